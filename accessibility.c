@@ -1,50 +1,151 @@
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include <Python.h>
 #include <structmember.h>
+#if PY_MAJOR_VERSION < 3
+#include <structseq.h>
+#define PyStructSequence_GET_ITEM(op, i) (((PyStructSequence *) (op))->ob_item[i])
+#endif
 #include <Accessibility.h>
+#include "backend.h"
+#include "core.h"
+#include "snapshot.h"
+
+/*
+ * On free-threaded builds these lock the object for the duration, and on
+ * others (where the GIL does the same job) they compile to nothing. Versions
+ * before 3.13 do not have them at all.
+ */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+/*
+ * From 3.9, the module is initialised in phases (PEP 489) and keeps its types,
+ * exceptions and caches in per-module state, so that every interpreter that
+ * imports it gets its own. Earlier versions share a single copy.
+ */
+#if PY_VERSION_HEX >= 0x03090000
+#define MULTI_PHASE_INIT 1
+#endif
+
+#ifndef Py_TPFLAGS_DISALLOW_INSTANTIATION
+#define Py_TPFLAGS_DISALLOW_INSTANTIATION 0 // see newType
+#endif
+
+#if PY_MAJOR_VERSION < 3
+/*
+ * Python 2 has no type specs, so types are described the same way for both
+ * and typeFromSpec builds them. Slots are numbered as in typeslots.h.
+ */
+typedef struct {
+    int slot;
+    void * pfunc;
+} PyType_Slot;
+
+typedef struct {
+    const char * name;
+    int basicsize;
+    int itemsize;
+    unsigned int flags;
+    PyType_Slot * slots;
+} PyType_Spec;
+
+#define Py_bf_getbuffer 1
+#define Py_mp_ass_subscript 3
+#define Py_mp_subscript 5
+#define Py_sq_contains 41
+#define Py_sq_length 45
+#define Py_tp_dealloc 52
+#define Py_tp_doc 56
+#define Py_tp_init 60
+#define Py_tp_iter 62
+#define Py_tp_iternext 63
+#define Py_tp_methods 64
+#define Py_tp_new 65
+#define Py_tp_richcompare 67
+#define Py_tp_members 72
+#define Py_tp_getset 73
+#endif
 
 /*
- * Intended to allow formatted error messages. Format strings work like
- * they do in printf(), etc.
+ * Like PySequence_Fast, but always makes a tuple, so that no other thread can
+ * change the items while the caller works through them.
  */
-char * formattedMessage(char * format, ...) {
-    char buf[1024];
-    va_list arglist;
-    va_start(arglist, format);
-    vsprintf(buf, format, arglist);
-    va_end(arglist);
-    size_t l = strlen(buf);
-    while(l && buf[l-1] =='\n') {
-        buf[l-1] = 0;
-        l--;
+static PyObject * sequenceCopy(PyObject * sequence, const char * message) {
+    if (PyTuple_CheckExact(sequence)) {
+        Py_INCREF(sequence);
+        return sequence;
     }
-    return strdup(buf);
+    PyObject * result = PySequence_Tuple(sequence);
+    if (result == NULL && PyErr_ExceptionMatches(PyExc_TypeError)) {
+        PyErr_SetString(PyExc_TypeError, message);
+    }
+    return result;
 }
 
+#if PY_MAJOR_VERSION < 3
+static pthread_key_t encoded_key; // each thread's copy of the last unicode string it encoded
+
+// Copies bytes into the calling thread's buffer, which lasts until its next call.
+static char * encodedCopy(const char * bytes, Py_ssize_t length) {
+    char * buffer = (char *) realloc(pthread_getspecific(encoded_key), length + 1);
+    if (buffer == NULL) return NULL;
+    pthread_setspecific(encoded_key, buffer);
+    memcpy(buffer, bytes, length + 1);
+    return buffer;
+}
+#endif
+
 /*
  * Converts a Python string to a CFStringRef that Cocoa/Carbon will understand.
  */
 CFStringRef CFStringFromPyString(PyObject * str, char ** c_string) {
-    if (PyUnicode_Check(str)) { // Handle Unicode strings
-        str = PyUnicode_AsUTF8String(str);
-    }
+    // Get a string representation of the attribute name
 #if PY_MAJOR_VERSION >= 3
-    if (!PyBytes_Check(str)) {
+    if (PyUnicode_Check(str)) {
+        // Cached by the string itself, so it lives as long as the caller's reference
+        *c_string = (char *) PyUnicode_AsUTF8(str);
+    } else if (PyBytes_Check(str)) {
+        *c_string = PyBytes_AsString(str);
+    } else {
 #else
-    if (!PyString_Check(str)) {
+    if (PyUnicode_Check(str)) { // Handle Unicode strings
+        // Names are ASCII, whose encoding the string caches itself as on
+        // Python 3; anything else is encoded into the thread's buffer
+        const char * encoding = PyUnicode_GetDefaultEncoding();
+        PyObject * cached = (strcmp(encoding, "ascii") == 0 || strcmp(encoding, "utf-8") == 0)
+            ? _PyUnicode_AsDefaultEncodedString(str, NULL) : NULL;
+        if (cached != NULL) {
+            *c_string = PyString_AS_STRING(cached);
+        } else {
+            PyErr_Clear();
+            PyObject * encoded = PyUnicode_AsUTF8String(str);
+            if (encoded == NULL) return NULL;
+            *c_string = encodedCopy(PyString_AS_STRING(encoded), PyString_GET_SIZE(encoded));
+            Py_DECREF(encoded);
+            if (*c_string == NULL) {
+                PyErr_NoMemory();
+                return NULL;
+            }
+        }
+    } else if (PyString_Check(str)) {
+        *c_string = PyString_AsString(str);
+    } else {
 #endif
         PyErr_SetString(PyExc_TypeError, "Non-string parameters are not permitted.");
         return NULL;
     }
-
-    // Get a string representation of the attribute name
-#if PY_MAJOR_VERSION >= 3
-    *c_string = PyBytes_AsString(str);
-#else
-    *c_string = PyString_AsString(str);
-#endif
-    if (!c_string) {
+    if (!*c_string) {
         PyErr_SetString(PyExc_TypeError, "An unknown error occured while converting string arguments to char *.");
         return NULL;
     }
@@ -113,9 +214,14 @@ cationServices/Reference/AXUIElement_header_reference/Reference/reference.html")
 typedef struct {
     PyObject_HEAD
     AXUIElementRef _ref;
-    AXObserverRef _obs;
+    AXSessionObserver * _observer;
     PyObject * pid;
     PyObject * callback;
+    pid_t _pid;
+    float _timeout;
+    float _applied_timeout;
+    PyObject * _schema; // its Schema, once looked up
+    PyInterpreterState * _interp; // to deliver notifications to, from watch() or set_callback()
 } AccessibleElement;
 
 static void AccessibleElement_dealloc(AccessibleElement *);
@@ -159,6 +265,13 @@ Returns a copy of the values for the specified attribute name(s), which may be \
 ``None``. If the element does not possess this/these attribute(s), this method \n\
 will raise a ``KeyError``.\n\
 \n\
+Strings, URLs and attributed strings (as plain text) come back as strings, \n\
+numbers as ``int`` or ``float``, elements as :py:class:`AccessibleElement`, \n\
+arrays as lists and dictionaries as dicts. Positions, sizes, frames and text \n\
+ranges come back as :py:class:`Point`, :py:class:`Size`, :py:class:`Rect` and \n\
+:py:class:`Range`, which are tuples with named fields. Empty strings and \n\
+arrays are ``None``.\n\
+\n\
 This is the underlying method called when using an AccessibleElement as a dict.\n\
 \n\
 :param names: Either a single name or a series of names, all strings.\n\
@@ -185,6 +298,23 @@ This is almost equivalent to using the element like a dictionary:\n\
 
 static PyObject * AccessibleElement_get(AccessibleElement *, PyObject *);
 
+PyDoc_STRVAR(get_parameterized_docstring, "get_parameterized(name, parameter)\n\n\
+Returns the value of the parameterized attribute with the given name for the \n\
+given parameter, such as the text of a range of characters. If the element \n\
+does not possess this attribute, this method will raise a KeyError.\n\
+\n\
+:param str name: The name of the parameterized attribute.\n\
+:param parameter: An element, a bool, a number, a string, a \n\
+    :py:class:`Point`, :py:class:`Size` or :py:class:`Rect`, or a \n\
+    ``(location, length)`` tuple (or :py:class:`Range`) for a range.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    print text_area.get_parameterized('AXStringForRange', (0, 80))\n\
+    print text_area.get_parameterized('AXBoundsForRange', (0, 1))");
+
+static PyObject * AccessibleElement_get_parameterized(AccessibleElement *, PyObject *);
+
 PyDoc_STRVAR(is_alive_docstring, "is_alive()\n\n\
 Returns ``True`` if the AXUIElementRef is still valid.");
 
@@ -238,7 +368,10 @@ element like so:\n\
     sr = create_systemwide_ref()\n\
     sr.set_timeout(5.0)  # i.e. five seconds to respond\n\
 \n\
-The default value can be restored by passing the ``DEFAULT_TIMEOUT`` value.");
+The default value can be restored by passing the ``DEFAULT_TIMEOUT`` value. With \n\
+adaptive timeouts enabled, an element using the default value has its timeout \n\
+derived from the observed latency of its application instead (see \n\
+:py:func:`configure_breaker`).");
 
 static PyObject * AccessibleElement_set_timeout(AccessibleElement *, PyObject *);
 
@@ -262,6 +395,15 @@ list of attributes that is returned by the :py:func:`keys` method.");
 
 static PyObject * AccessibleElement_actions(AccessibleElement *, PyObject *);
 
+PyDoc_STRVAR(schema_docstring, "schema()\n\n\
+Returns the element's :py:class:`Schema`: its role and subrole, and the \n\
+attributes and actions of elements with that role and subrole in its \n\
+application. Schemas are shared by all such elements, so only the first of \n\
+them asks for more than its role and subrole. The element keeps its schema \n\
+from then on.");
+
+static PyObject * AccessibleElement_schema(AccessibleElement *, PyObject *);
+
 PyDoc_STRVAR(action_desciption_docstring, "action_description(action_name)\n\n\
 Retrieves the description of an action available for the element. Note that \n\
 descriptions are implemented by the vendors, and so are often unhelpful.");
@@ -288,6 +430,19 @@ static PyObject * is_enabled(PyObject *, PyObject *, PyObject *);
 static PyObject * is_enabled(PyObject *);
 #endif
 
+PyDoc_STRVAR(create_application_ref_docstring, "create_application_ref(pid, force = False, cached = False)\n\n\
+Create an accessibile application with the given PID.\n\
+\n\
+:param int pid: The process ID of the application.\n\
+:param bool force: Skip the check that the application responds to requests.\n\
+:param bool cached: Return the element shared by all cached lookups of this PID.\n\
+\n\
+Cached elements are reused for as long as the process is running and the \n\
+element itself has not reported that it is invalid, which saves both the \n\
+element's creation and the validating request. Since the element is shared, so \n\
+are its callback and watched notifications. See \n\
+:py:func:`application_cache_info` for statistics on the cache.");
+
 static AccessibleElement * create_application_ref(PyObject *, PyObject *, PyObject *);
 static AccessibleElement * create_systemwide_ref(PyObject *, PyObject *);
 
@@ -303,6 +458,584 @@ element is used instead.\n\
 
 static AccessibleElement * element_at_position(PyObject *, PyObject *, PyObject *);
 
+PyDoc_STRVAR(list_windows_docstring, "list_windows(pids, attributes = [], timeout = 1.0)\n\n\
+Lists the windows of several applications at once. The applications are \n\
+queried concurrently on up to 32 native workers with the GIL released, so a \n\
+single hung application costs at most ``timeout`` seconds rather than stalling \n\
+the sweep. With more applications than workers, each worker takes the next \n\
+application once it is done with one, so in the worst case the call takes \n\
+``timeout`` seconds for every 32 applications. Unlike \n\
+:py:func:`create_application_ref`, no validating request is made for each PID.\n\
+\n\
+:param pids: A sequence of process IDs.\n\
+:param attributes: The names of the attributes to read from each window.\n\
+:param float timeout: The deadline, in seconds, for all requests to a single application.\n\
+:rval: A tuple of ``(records, timed_out, errors)``. Each record is a tuple of \n\
+    the PID, the window's :py:class:`AccessibleElement`, and one value per \n\
+    requested attribute (``None`` where it is unavailable). ``timed_out`` lists \n\
+    the PIDs that did not finish within the deadline, or that were skipped \n\
+    because they have been failing to respond (see \n\
+    :py:func:`configure_breaker`). ``errors`` maps the PIDs whose windows could \n\
+    not be listed for any other reason to their ``AXError`` codes. The records \n\
+    of both are omitted.\n\
+\n\
+For example, to print the title of every window of a few applications:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    records, timed_out, errors = list_windows(pids, ['AXTitle'], timeout = 0.5)\n\
+    for pid, window, title in records:\n\
+        print pid, title");
+
+static PyObject * list_windows(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(geometry_docstring, "geometry(elements)\n\n\
+Reads the ``AXPosition`` and ``AXSize`` of every element in one request per \n\
+element, and returns them as a :py:class:`Geometry` buffer rather than as \n\
+tuples. Elements that fail (because they are no longer valid, say) are \n\
+counted in its ``missing`` attribute instead of raising.\n\
+\n\
+:param elements: A sequence of :py:class:`AccessibleElement` objects.\n\
+:rval: A :py:class:`Geometry` in the order of elements.");
+
+static PyObject * geometry(PyObject *, PyObject *);
+
+PyDoc_STRVAR(perform_actions_docstring, "perform_actions(actions, ordered_per_pid = True)\n\n\
+Performs many actions at once. Different applications are sent their actions \n\
+concurrently, on native workers with the GIL released, so one that does not \n\
+respond only holds up its own actions; the actions of a single application, \n\
+when their order is kept, are performed on the calling thread. Failures are \n\
+returned rather than raised, so that one failed action does not stop the rest.\n\
+\n\
+:param actions: A sequence of ``(element, action_name)`` pairs.\n\
+:param bool ordered_per_pid: Whether the actions for each application are \n\
+    performed one after another, in the order given. Otherwise every action \n\
+    may be performed concurrently with every other.\n\
+:rval: A list with the ``AXError`` code of each action, in the order of \n\
+    actions: ``0`` where it succeeded.\n\
+\n\
+For example, to raise every window of an application:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    windows = app['AXWindows']\n\
+    errors = perform_actions([(w, 'AXRaise') for w in windows])\n\
+    print sum(1 for e in errors if e != 0), 'failed'");
+
+static PyObject * perform_actions(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(probe_docstring, "probe(elements, attributes, values = False, settable = False, strings = False)\n\n\
+Finds out which of the attributes each element has, without reading their \n\
+values and without raising for those that fail. Each element's attribute \n\
+names are read in one request, with the GIL released; asking for values or \n\
+settable adds a request for each attribute an element has.\n\
+\n\
+:param elements: A sequence of :py:class:`AccessibleElement` objects.\n\
+:param attributes: The names of the attributes to look for.\n\
+:param bool values: Whether to count the values of the attributes found, so \n\
+    that empty arrays and missing values are told apart. Only arrays can be \n\
+    counted, so other values are assumed to be there.\n\
+:param bool settable: Whether to ask if the attributes found can be set.\n\
+:param bool strings: With values, whether to read the values that cannot be \n\
+    counted as well, so that empty strings are told apart too, as \n\
+    :py:meth:`AccessibleElement.get` returns ``None`` for them. Each is copied \n\
+    in full to do so: the ``AXValue`` of an editor is its whole document.\n\
+:rval: A ``bytearray`` with one status per element and attribute, a row per \n\
+    element: ``status[i * len(attributes) + j]``. Each is ``PROBE_UNSUPPORTED`` \n\
+    (0) or a combination of the flags ``PROBE_PRESENT``, ``PROBE_SETTABLE``, \n\
+    ``PROBE_NO_VALUE``, ``PROBE_INVALID_ELEMENT`` (the element is no longer \n\
+    valid) and ``PROBE_FAILED`` (the application did not answer, or the \n\
+    Accessibility API is disabled), the last two set alongside whatever was \n\
+    found before the failure.\n\
+\n\
+For example, to find the children whose title can be changed:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    children = window['AXChildren']\n\
+    status = probe(children, ['AXTitle'], settable = True)\n\
+    editable = [c for c, s in zip(children, status) if s & PROBE_SETTABLE]");
+
+static PyObject * probe(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(snapshot_docstring, "snapshot(element, attributes = None, max_depth = -1)\n\n\
+Captures the tree below an element (to at most max_depth levels below it, or \n\
+all of it if max_depth is negative) in a compact binary format, which can be \n\
+stored or sent elsewhere and read with :py:class:`Snapshot`. Each element is \n\
+read in a single request, without the GIL, and elements that fail are kept \n\
+without values.\n\
+\n\
+:param element: The :py:class:`AccessibleElement` at the root of the tree.\n\
+:param attributes: The names of the attributes to capture; by default \n\
+    ``AXRole``, ``AXSubrole``, ``AXTitle``, ``AXDescription``, ``AXValue``, \n\
+    ``AXIdentifier``, ``AXPosition``, ``AXSize``, ``AXEnabled`` and ``AXFocused``.\n\
+:param int max_depth: How many levels of the tree to capture.\n\
+:rval: The snapshot as bytes.");
+
+static PyObject * snapshot(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(poll_watch_docstring, "poll_watch(elements, attributes, interval = 1.0, callback = None)\n\n\
+Watches attributes that change without posting any notification, by polling \n\
+them on a native thread. Each element is read in a single request every \n\
+interval, without the GIL, and compared with its last values there, so \n\
+Python only hears about the values that actually changed: either through \n\
+callback, which is called on the polling thread with the keyword arguments \n\
+``element``, ``attribute`` and ``value``, or, without one, from \n\
+:py:meth:`PollWatcher.changes`. A value that changes several times before it \n\
+is delivered is delivered once, as it was last seen. Values that cannot be \n\
+read are ``None``, and elements that are no longer valid are dropped.\n\
+\n\
+:param elements: A sequence of :py:class:`AccessibleElement` objects.\n\
+:param attributes: The names of the attributes to watch on every element.\n\
+:param float interval: The number of seconds between polls.\n\
+:param callback: The function to call for each change.\n\
+:rval: A :py:class:`PollWatcher`, which polls until it is stopped.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    def changed(element, attribute, value):\n\
+        print attribute, 'is now', value\n\
+\n\
+    accessibility.poll_watch(window['AXChildren'], ['AXTitle'], 0.5, changed)");
+
+static PyObject * poll_watch(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(track_focus_docstring, "track_focus(pids, callback = None)\n\n\
+Keeps track of the focused application, window and element, so that they \n\
+can be asked for without a request to any application. A native thread \n\
+observes the ``AXFocusedUIElementChanged``, ``AXFocusedWindowChanged``, \n\
+``AXApplicationActivated`` and ``AXApplicationDeactivated`` notifications \n\
+of each application, on a run loop of its own, and keeps the focus of each \n\
+from them; :py:meth:`FocusTracker.focused` only reads that. Changes of focus \n\
+are delivered either through callback, which is called on the tracking \n\
+thread with the keyword arguments ``application``, ``window`` and \n\
+``element``, or, without one, from :py:meth:`FocusTracker.changes`.\n\
+\n\
+The focus of each application is read once when tracking starts, and again \n\
+when it is activated, in case a notification was missed.\n\
+\n\
+:param pids: A sequence of the process IDs of the applications to track. \n\
+    Others can be added later with :py:meth:`FocusTracker.add`.\n\
+:param callback: The function to call for each change of focus.\n\
+:rval: A :py:class:`FocusTracker`, which tracks until it is stopped.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    tracker = accessibility.track_focus(pids)\n\
+    ...\n\
+    focus = tracker.focused()\n\
+    if focus is not None:\n\
+        application, window, element = focus");
+
+static PyObject * track_focus(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(application_cache_info_docstring, "application_cache_info()\n\n\
+Returns statistics for the cache used by ``create_application_ref(pid, cached = True)`` \n\
+as a dictionary with the keys ``size``, ``hits``, ``misses``, ``hit_rate`` and \n\
+``evictions``. Entries are evicted when their process has exited or when the \n\
+element responds with :py:class:`InvalidUIElementError`.");
+
+static PyObject * application_cache_info(PyObject *);
+
+PyDoc_STRVAR(clear_application_cache_docstring, "clear_application_cache()\n\n\
+Empties the application cache and resets its statistics.");
+
+static PyObject * clear_application_cache(PyObject *);
+
+PyDoc_STRVAR(enable_schema_cache_docstring, "enable_schema_cache(enabled = True)\n\n\
+Lets elements answer from their :py:class:`Schema` (see \n\
+:py:meth:`AccessibleElement.schema`) instead of asking their application. It \n\
+is off by default.\n\
+\n\
+When on, :py:meth:`~AccessibleElement.keys`, \n\
+:py:meth:`~AccessibleElement.actions` and :py:meth:`~AccessibleElement.can_set` \n\
+look up the schema of the element (which takes one request for elements that \n\
+have not looked it up before) and answer from it. Subscripts, \n\
+:py:meth:`~AccessibleElement.get` and ``in`` raise ``KeyError`` and return \n\
+``False`` for attributes an element's schema does not list, without a \n\
+request, once the element has its schema; they do not look it up themselves. \n\
+Attributes that an application can read but does not list are then treated as \n\
+missing, as are attributes added to an element after its schema was made.");
+
+static PyObject * enable_schema_cache(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(schema_cache_info_docstring, "schema_cache_info()\n\n\
+Returns statistics for the schemas shared between elements (see \n\
+:py:meth:`AccessibleElement.schema`) as a dictionary with the keys \n\
+``enabled``, ``size``, ``hits``, ``misses``, ``hit_rate`` and ``evictions``. \n\
+Schemas are kept per application, role and subrole; the cache is emptied when \n\
+it reaches 4096 of them.");
+
+static PyObject * schema_cache_info(PyObject *);
+
+PyDoc_STRVAR(clear_schema_cache_docstring, "clear_schema_cache()\n\n\
+Empties the schema cache and resets its statistics. Elements keep the schemas \n\
+they already have.");
+
+static PyObject * clear_schema_cache(PyObject *);
+
+PyDoc_STRVAR(configure_intern_cache_docstring, "configure_intern_cache(attributes = None, capacity = None)\n\n\
+Configures which attributes have their string values interned, and returns \n\
+the resulting configuration as a dictionary. Arguments that are not given \n\
+keep their current value.\n\
+\n\
+Values of these attributes (``AXRole``, ``AXSubrole`` and \n\
+``AXRoleDescription`` by default) come from a small vocabulary, so the \n\
+strings converted for them are remembered, and the same string object is \n\
+returned whenever a value repeats, by :py:meth:`AccessibleElement.get`, \n\
+:py:func:`list_windows` and :py:class:`PollWatcher`. Strings longer than 64 \n\
+characters are never interned. The cache holds at most ``capacity`` strings, \n\
+and a new string replaces any that shares its slot. Strings in a \n\
+:py:class:`Snapshot` are shared within the snapshot regardless.\n\
+\n\
+:param attributes: A list of attribute names.\n\
+:param int capacity: The number of strings kept, rounded up to a power of two, \n\
+    or 0 to turn interning off (the default is 1024).");
+
+static PyObject * configure_intern_cache(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(intern_cache_info_docstring, "intern_cache_info()\n\n\
+Returns statistics for the strings interned by \n\
+:py:func:`configure_intern_cache` as a dictionary with the keys ``size``, \n\
+``capacity``, ``hits``, ``misses``, ``hit_rate`` and ``evictions``.");
+
+static PyObject * intern_cache_info(PyObject *);
+
+PyDoc_STRVAR(clear_intern_cache_docstring, "clear_intern_cache()\n\n\
+Forgets the interned strings and resets their statistics.");
+
+static PyObject * clear_intern_cache(PyObject *);
+
+PyDoc_STRVAR(configure_breaker_docstring, "configure_breaker(threshold = None, cooldown = None, adaptive_timeout = None, multiplier = None, min_timeout = None, max_timeout = None)\n\n\
+Configures how requests to unresponsive applications are handled, and returns \n\
+the resulting configuration as a dictionary. Arguments that are not given keep \n\
+their current value.\n\
+\n\
+The latency and failures of every request are tracked per application. After \n\
+``threshold`` consecutive requests to an application could not be completed, \n\
+further requests to it fail immediately with :py:class:`CircuitOpenError` for \n\
+``cooldown`` seconds. The first request after the cool-down is let through; if \n\
+it fails too, the application is cut off again right away.\n\
+\n\
+With ``adaptive_timeout`` enabled (it is not by default), elements that have \n\
+not been given a timeout with :py:func:`AccessibleElement.set_timeout` wait \n\
+``multiplier`` times the application's observed 99th percentile latency, \n\
+clamped to the range given by ``min_timeout`` and ``max_timeout`` (in seconds), \n\
+and never less than a timeout set on the system-wide element. Only requests \n\
+that read count towards the percentile, and requests that timed out count as \n\
+taking at least as long as the timeout they were sent with.\n\
+\n\
+:param int threshold: Consecutive failures before an application is cut off, or 0 to disable.\n\
+:param float cooldown: Seconds to fail fast for once cut off.\n\
+:param bool adaptive_timeout: Whether to derive timeouts from observed latency.\n\
+:param float multiplier: Multiple of the 99th percentile latency to wait.\n\
+:param float min_timeout: The smallest adaptive timeout.\n\
+:param float max_timeout: The largest adaptive timeout.");
+
+static PyObject * configure_breaker(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(application_health_docstring, "application_health(pid = None)\n\n\
+Returns the tracked latency and failure history of one application, or of all \n\
+applications as a dictionary keyed by PID. Each entry is a dictionary with the \n\
+keys ``requests``, ``failures``, ``rejected``, ``consecutive_failures``, \n\
+``open`` (whether requests currently fail fast), ``p50`` and ``p99`` (latency in \n\
+seconds, or ``None`` before any responses), and ``timeout`` (the adaptive \n\
+timeout in effect, or ``None``).");
+
+static PyObject * application_health(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(reset_application_health_docstring, "reset_application_health()\n\n\
+Forgets the latency and failure history of all applications.");
+
+static PyObject * reset_application_health(PyObject *);
+
+PyDoc_STRVAR(configure_scheduler_docstring, "configure_scheduler(max_in_flight = None, background_in_flight = None)\n\n\
+Configures how requests to each application are scheduled, and returns the \n\
+resulting configuration as a dictionary. Arguments that are not given keep \n\
+their current value.\n\
+\n\
+With ``max_in_flight`` set, at most that many requests are made to any one \n\
+application at a time, and any more wait (without the GIL) for one of them to \n\
+finish. Waiting requests are let through by priority (see \n\
+:py:func:`set_priority`): interactive ones before any normal ones, and normal \n\
+ones before any background ones, and otherwise in the order they came. \n\
+Background requests can further be limited to ``background_in_flight`` at a \n\
+time, so that a crawl leaves room for interactive requests that have not \n\
+been made yet.\n\
+\n\
+:param int max_in_flight: Requests to an application at a time, or 0 for no limit (the default).\n\
+:param int background_in_flight: Background requests to an application at a time, or 0 for no \n\
+    limit but ``max_in_flight``.");
+
+static PyObject * configure_scheduler(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(set_priority_docstring, "set_priority(priority)\n\n\
+Sets the priority of the requests the calling thread makes from now on, \n\
+including those made for it by :py:func:`list_windows`, \n\
+:py:func:`perform_actions` and :py:func:`snapshot`, and by the watchers it \n\
+starts with :py:func:`poll_watch`. Priorities only matter once requests have \n\
+to wait for one another (see :py:func:`configure_scheduler`).\n\
+\n\
+:param str priority: One of ``'interactive'``, ``'normal'`` (the default) and ``'background'``.\n\
+:rval: The priority the thread had before, so that it can be restored.\n\
+\n\
+For example, to crawl applications without holding up a hotkey handler on \n\
+another thread:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    previous = set_priority('background')\n\
+    try:\n\
+        crawl(apps)\n\
+    finally:\n\
+        set_priority(previous)");
+
+static PyObject * set_priority(PyObject *, PyObject *);
+
+PyDoc_STRVAR(scheduler_info_docstring, "scheduler_info()\n\n\
+Returns the state of the request scheduler (see \n\
+:py:func:`configure_scheduler`) as a dictionary with the keys:\n\
+\n\
+* ``max_in_flight`` and ``background_in_flight``: the configured limits.\n\
+* ``priorities``: a dictionary with one dictionary per priority, with the \n\
+  keys ``requests`` (how many were scheduled), ``waited`` (how many of them \n\
+  had to wait), ``wait_total``, ``wait_mean`` and ``wait_max`` (the time \n\
+  they waited, in seconds), and ``queued`` (how many are waiting now).\n\
+* ``applications``: a dictionary keyed by the PID of every application with \n\
+  requests in flight or waiting, each a dictionary with the keys \n\
+  ``in_flight`` and ``queued`` (a dictionary of the requests waiting, by \n\
+  priority).\n\
+\n\
+Requests are only counted while a limit is set, and the counts are cleared \n\
+by :py:func:`reset_stats`.");
+
+static PyObject * scheduler_info(PyObject *);
+
+PyDoc_STRVAR(enable_stats_docstring, "enable_stats(enabled = True)\n\n\
+Turns the collection of call statistics (see :py:func:`stats`) on or off. It \n\
+is off by default, in which case the only cost is a check of this setting.");
+
+static PyObject * enable_stats(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(stats_docstring, "stats()\n\n\
+Returns the statistics collected for calls into the Accessibility API since \n\
+they were enabled or last reset, as a dictionary with the keys:\n\
+\n\
+* ``enabled``: whether statistics are currently being collected.\n\
+* ``elapsed``: the number of seconds covered, for computing rates.\n\
+* ``calls``: a list with one dictionary per distinct operation (the name of \n\
+  the API function), attribute (or action, or notification; ``None`` if not \n\
+  applicable) and PID (``None`` if unknown). Each has the keys ``operation``, \n\
+  ``attribute``, ``pid``, ``count``, ``errors``, ``total``, ``min``, ``max``, \n\
+  ``mean``, ``p50``, ``p90``, ``p99`` and ``p999`` (latencies in seconds), and \n\
+  ``histogram``, a list of ``(latency, count)`` pairs for the non-empty buckets.\n\
+  Notifications delivered to callbacks are listed under the operation \n\
+  ``'AXObserverCallback'``, timed until the callback returns from when the \n\
+  notification was posted (with the simulated backend) or from when the \n\
+  callback was called (otherwise).\n\
+* ``errors``: a dictionary mapping each ``AXError`` code encountered to the \n\
+  number of times it was returned.\n\
+\n\
+For example, to find the slowest attributes:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    enable_stats()\n\
+    # ... do some work ...\n\
+    calls = stats()['calls']\n\
+    for c in sorted(calls, key = lambda c: c['p99'], reverse = True)[:10]:\n\
+        print c['operation'], c['attribute'], c['pid'], c['p99']");
+
+static PyObject * stats(PyObject *);
+
+PyDoc_STRVAR(reset_stats_docstring, "reset_stats()\n\n\
+Discards all collected call statistics, and resets the counts returned by \n\
+:py:func:`run_loop_info` and :py:func:`scheduler_info`.");
+
+static PyObject * reset_stats(PyObject *);
+
+PyDoc_STRVAR(start_trace_docstring, "start_trace(buffer_size = 65536)\n\n\
+Starts recording a timeline of every request to the Accessibility API, every \n\
+conversion of a result to Python objects, and every notification callback, \n\
+discarding any previous recording. Each thread records into its own buffer of \n\
+``buffer_size`` events without locking; once a buffer is full, further events \n\
+of that thread are counted as dropped.\n\
+\n\
+Stop with :py:func:`stop_trace` and save with :py:func:`write_trace`:\n\
+\n\
+.. code-block:: python\n\
+\n\
+    start_trace()\n\
+    # ... reproduce the stall ...\n\
+    stop_trace()\n\
+    write_trace('stall.json')  # open in https://ui.perfetto.dev");
+
+static PyObject * start_trace(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(stop_trace_docstring, "stop_trace()\n\n\
+Stops recording. The recorded events are kept until the next call to \n\
+:py:func:`start_trace`.");
+
+static PyObject * stop_trace(PyObject *);
+
+PyDoc_STRVAR(write_trace_docstring, "write_trace(path)\n\n\
+Writes the events recorded since :py:func:`start_trace` to a file in the Chrome \n\
+trace event format, which can be opened in Perfetto or ``chrome://tracing``. \n\
+Requests carry the attribute (or action, or notification), the PID of the \n\
+target application and the resulting ``AXError`` code as arguments.\n\
+\n\
+:param str path: The file to write.\n\
+:rval: The number of events written.");
+
+static PyObject * write_trace(PyObject *, PyObject *);
+
+PyDoc_STRVAR(set_backend_docstring, "set_backend(name, config = None)\n\n\
+Chooses the implementation of the Accessibility API that the module talks to:\n\
+\n\
+* ``'hiservices'``: the real API. The default, and only available, on Mac OS X.\n\
+* ``'simulated'``: an in-process stand-in serving synthetic applications, for \n\
+  running benchmarks and tests without a window server. The default, and only \n\
+  available, on other platforms (e.g. Linux).\n\
+* ``'replay'``: serves a session recorded with :py:func:`start_recording`. \n\
+  Not available on Mac OS X.\n\
+\n\
+Switching (or reconfiguring) clears the application cache and health records, \n\
+stops any recording, and elements created beforehand become invalid.\n\
+\n\
+For the replay backend, ``config`` is a dictionary with the keys ``path`` \n\
+(required) and ``speed``, which scales the recorded timing of responses and \n\
+notifications (default 1; 0 serves everything as fast as possible, posting \n\
+each notification once as many requests have been made as had been before \n\
+it). Each request gets the next recorded response to the same request, or the \n\
+last one again once those run out; requests that were never recorded raise \n\
+:py:class:`NotRespondingError`. See :py:func:`replay_info`.\n\
+\n\
+For the simulated backend, ``config`` is a dictionary with the keys ``seed`` \n\
+(for everything random; default 0), ``trusted`` (what :py:func:`is_trusted` \n\
+reports; default True), ``queue_capacity`` (how many notifications each run \n\
+loop created afterwards holds before dropping them; default 4096) and \n\
+``applications``, a list of dictionaries with the keys:\n\
+\n\
+* ``pid`` (required) and ``name``.\n\
+* ``windows``, ``nodes`` and ``fanout``: the shape of the element tree, which \n\
+  has ``nodes`` elements in total (including the application itself) and gives \n\
+  each group up to ``fanout`` children. The defaults are 2, 64 and 4.\n\
+* ``text_length``: the length of text area values (default 256).\n\
+* ``text``: a string that text values repeat, instead of random words.\n\
+* ``latency``: seconds per request, either a number or one of \n\
+  ``('fixed', s)``, ``('uniform', low, high)``, ``('exponential', mean)`` or \n\
+  ``('lognormal', median, sigma)``. Default 0.\n\
+* ``hang``: ``(probability, seconds)`` for requests that take much longer, as \n\
+  they do when an application is busy. Requests give up with \n\
+  :py:class:`NotRespondingError` once they exceed the messaging timeout.\n\
+* ``errors``: a dictionary mapping ``'cannot_complete'``, \n\
+  ``'invalid_element'`` and ``'no_value'`` to the probability of a request \n\
+  failing that way.\n\
+* ``notification_rate``: notifications per second, posted at random to the \n\
+  observers registered with :py:func:`watch`, optionally limited to the names \n\
+  in ``notifications``. They are delivered by :py:func:`run_loop`.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    set_backend('simulated', {'seed': 1, 'applications': [\n\
+        {'pid': 100, 'nodes': 500, 'latency': ('lognormal', 0.002, 0.5)},\n\
+        {'pid': 101, 'hang': (0.05, 10.0)},\n\
+    ]})\n\
+    app = create_application_ref(100)");
+
+static PyObject * set_backend(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(current_backend_docstring, "current_backend()\n\n\
+Returns the name of the backend in use (the one being recorded, while \n\
+recording). See :py:func:`set_backend`.");
+
+static PyObject * current_backend(PyObject *);
+
+PyDoc_STRVAR(start_recording_docstring, "start_recording(path)\n\n\
+Starts recording every request made to the current backend, with its \n\
+response and how long it took, and every notification delivered, to a new \n\
+session log at ``path``. The log can be served later by the ``'replay'`` \n\
+backend (see :py:func:`set_backend`) to reproduce the session without the \n\
+applications it talked to.\n\
+\n\
+Records are appended as they happen, so a log cut short by a crash is still \n\
+readable up to the last complete one. Only one recording can be made at a time.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    start_recording('session.axlog')\n\
+    walk(create_application_ref(pid))\n\
+    stop_recording()\n\
+\n\
+    set_backend('replay', {'path': 'session.axlog', 'speed': 0})\n\
+    walk(create_application_ref(pid))");
+
+static PyObject * start_recording(PyObject *, PyObject *);
+
+PyDoc_STRVAR(stop_recording_docstring, "stop_recording()\n\n\
+Stops the recording started by :py:func:`start_recording` and closes the log.\n\
+\n\
+:rval: The number of requests recorded.");
+
+static PyObject * stop_recording(PyObject *);
+
+PyDoc_STRVAR(replay_info_docstring, "replay_info()\n\n\
+Returns what the ``'replay'`` backend has served from its log, as a \n\
+dictionary with the keys ``calls`` and ``notifications`` (recorded in the \n\
+log), ``duration`` (of the recording, in seconds), ``hits`` and ``misses`` \n\
+(requests answered from the log, or not), ``posted`` (notifications delivered \n\
+to observers) and ``unheard`` (notifications nobody was watching for). The \n\
+counts are all zero if no log is being served. Not available on Mac OS X.");
+
+static PyObject * replay_info(PyObject *);
+
+PyDoc_STRVAR(run_loop_docstring, "run_loop(timeout = None)\n\n\
+Runs the current thread's run loop, which is where the callbacks for \n\
+notifications watched on this thread are called, for up to ``timeout`` \n\
+seconds (or until interrupted, if ``None``). Returns early if there is \n\
+nothing left to watch.");
+
+static PyObject * run_loop(PyObject *, PyObject *, PyObject *);
+
+PyDoc_STRVAR(run_loop_info_docstring, "run_loop_info()\n\n\
+Returns counts of the notifications passed through run loops since the \n\
+module was loaded or :py:func:`reset_stats` was last called, as a dictionary \n\
+with the keys ``posted``, ``delivered`` (the callback has returned), \n\
+``dropped`` (the run loop's queue was full), ``max_depth`` (the most \n\
+notifications waiting in any one queue) and ``queue_capacity``. Only \n\
+available where the module provides its own run loops (i.e. not on Mac OS X).");
+
+static PyObject * run_loop_info(PyObject *);
+
+PyDoc_STRVAR(simulate_notification_docstring, "simulate_notification(element, notification, count = 1)\n\n\
+Posts a notification on behalf of an element of the simulated backend to every \n\
+observer watching it for that notification, ``count`` times. Notifications \n\
+are delivered by :py:func:`run_loop`.\n\
+\n\
+:rval: The number of notifications queued (less than requested if a queue \n\
+    was full).");
+
+static PyObject * simulate_notification(PyObject *, PyObject *, PyObject *);
+
+/* Benchmark hooks
+======== */
+
+// These time the module's internals without any requests in the way, for the
+// suite in the benchmarks directory. They are not part of the public API.
+
+PyDoc_STRVAR(benchmark_conversion_docstring, "_benchmark_conversion(kind, iterations)\n\n\
+Converts a value of the given kind (``'string'``, ``'text'``, ``'boolean'``, \n\
+``'point'``, ``'size'``, ``'element'``, ``'strings'`` or ``'elements'``) to \n\
+a Python object ``iterations`` times, returning the seconds taken.");
+
+static PyObject * benchmark_conversion(PyObject *, PyObject *);
+
+PyDoc_STRVAR(benchmark_dispatch_docstring, "_benchmark_dispatch(element, notification, iterations)\n\n\
+Hands a notification for the element straight to its callback ``iterations`` \n\
+times, bypassing the observer and run loop, returning the seconds taken.");
+
+static PyObject * benchmark_dispatch(PyObject *, PyObject *);
+
 /* Module exceptions
 ======== */
 
@@ -310,1011 +1043,8934 @@ PyDoc_STRVAR(InvalidUIElementError_docstring,
 "Raised when a reference to some AccessibleElement is no longer valid, usually \n\
 because the process is dead.");
 
-static PyObject * InvalidUIElementError;
 
 PyDoc_STRVAR(APIDisabledError_docstring, 
 "Raised when a the Accessibility API is disabled for some reference. Usually \n\
 this is because the user needs to enable Accessibility, although some Apple \n\
 applications are known to respond with this error regardless.");
 
-static PyObject * APIDisabledError;
 
-/* ========
-    Internal API
-======== */
+PyDoc_STRVAR(NotRespondingError_docstring,
+"Raised when a request could not be completed, usually because the application \n\
+did not respond before the timeout.");
 
-static PyObject * parseCFTypeRef(const CFTypeRef);
-static AccessibleElement * elementWithRef(AXUIElementRef *);
-static void handleAXErrors(const char *, AXError);
-static void NotifcationCallback(AXObserverRef, AXUIElementRef, CFStringRef, void *);
 
-/* ========
-    Module Implementation
-======== */
+PyDoc_STRVAR(CircuitOpenError_docstring,
+"Raised without making a request when an application has failed to respond \n\
+repeatedly and is still cooling down. See :py:func:`configure_breaker`.");
 
-/* AccessibleElement class
+
+// Not an error the Accessibility API produces; used to report that a request
+// was turned away before being sent.
+#define kAXErrorCircuitOpen ((AXError) -25290)
+
+/* Value types
 ======== */
 
-static void AccessibleElement_dealloc(AccessibleElement * self) {
-    // Use CFRelease to release for the AXUIElementRef, AXObserverRef
-    if (self->_ref != NULL) CFRelease(self->_ref);
-    if (self->_obs != NULL) CFRelease(self->_obs);
-    Py_XDECREF(self->pid);
-#if PY_MAJOR_VERSION >= 3
-    Py_TYPE(self)->tp_free((PyObject *) self);
-#else
-    self->ob_type->tp_free((PyObject *) self);
-#endif
-}
+// Geometry comes back as named tuples, which unpack just like the plain
+// tuples of earlier versions.
 
-static PyObject * AccessibleElement_richcompare(PyObject * self, PyObject * other, int op) {
-    PyObject * result = NULL;
+PyDoc_STRVAR(Point_docstring, "Point(x, y)\n\n\
+A position on screen, as returned for ``AXPosition``.");
 
-    if (self->ob_type != other->ob_type) {
-        // Need both to be the same type
-        result = Py_NotImplemented;
-    } else {
-        AccessibleElement * s = (AccessibleElement *) self;
-        AccessibleElement * o = (AccessibleElement *) other;
-        // Uses CFEqual on the underlying AXUIElementRefs for comparison
-        int i = CFEqual(s->_ref, o->_ref) ? 1 : 0;
-        switch (op) {
-            case Py_EQ:
-                result = (i > 0) ? Py_True : Py_False;
-                break;
-            case Py_NE:
-                result = (i > 0) ? Py_False : Py_True;
-                break;
-            default:
-                PyErr_SetString(PyExc_TypeError, "AccessibleElement objects can only be compared with == and != operators.");
-                break;
-        }
-    }
+static PyStructSequence_Field Point_fields[] = {
+    {"x", NULL},
+    {"y", NULL},
+    {NULL, NULL}
+};
 
-    Py_XINCREF(result);
-    return result;
-}
+static PyStructSequence_Desc Point_desc = {"accessibility.Point", Point_docstring, Point_fields, 2};
 
-/* Sequence Protocol
-======== */
+PyDoc_STRVAR(Size_docstring, "Size(width, height)\n\n\
+A size on screen, as returned for ``AXSize``.");
 
-static int AccessibleElement_contains(AccessibleElement * self, PyObject * arg) {
-    // The argument should be a string
-    char * name_string = NULL;
-    CFStringRef name_strref = CFStringFromPyString(arg, &name_string);
-    if (!name_strref) return 0;
+static PyStructSequence_Field Size_fields[] = {
+    {"width", NULL},
+    {"height", NULL},
+    {NULL, NULL}
+};
 
-    // Check if the attribute's value can be copied
-    CFTypeRef value = NULL;
-    AXError error = AXUIElementCopyAttributeValue(self->_ref, name_strref, &value);
-    if (name_strref != NULL) CFRelease(name_strref);
-    if (value != NULL) CFRelease(value);
-    
-    return (error == kAXErrorSuccess) ? 1 : 0;
-}
+static PyStructSequence_Desc Size_desc = {"accessibility.Size", Size_docstring, Size_fields, 2};
 
-static PySequenceMethods AccessibleElement_as_sequence = {
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    (objobjproc) AccessibleElement_contains,
+PyDoc_STRVAR(Rect_docstring, "Rect(x, y, width, height)\n\n\
+A rectangle on screen, as returned for ``AXFrame`` or the bounds of a range \n\
+of text.");
+
+static PyStructSequence_Field Rect_fields[] = {
+    {"x", NULL},
+    {"y", NULL},
+    {"width", NULL},
+    {"height", NULL},
+    {NULL, NULL}
 };
 
-/* Mapping Protocol
-======== */
+static PyStructSequence_Desc Rect_desc = {"accessibility.Rect", Rect_docstring, Rect_fields, 4};
 
-static PyObject * AccessibleElement_subscript(AccessibleElement * self, PyObject * key) {
-    return AccessibleElement_get(self, Py_BuildValue("(O)", key));
-}
+PyDoc_STRVAR(Range_docstring, "Range(location, length)\n\n\
+A range of characters, as returned for ``AXSelectedTextRange`` or \n\
+``AXVisibleCharacterRange``.");
 
-static int AccessibleElement_ass_subscript(AccessibleElement * self, PyObject * key, PyObject * value) {
-    return (AccessibleElement_set(self, Py_BuildValue("OO", key, value)) != NULL) ? 0 : -1;
-}
+static PyStructSequence_Field Range_fields[] = {
+    {"location", NULL},
+    {"length", NULL},
+    {NULL, NULL}
+};
 
-static PyMappingMethods AccessibleElement_as_mapping = {
-    0,
-    (binaryfunc) AccessibleElement_subscript,
-    (objobjargproc) AccessibleElement_ass_subscript,
+static PyStructSequence_Desc Range_desc = {"accessibility.Range", Range_docstring, Range_fields, 2};
+
+PyDoc_STRVAR(Schema_docstring, "Schema(role, subrole, attributes, actions, settable)\n\n\
+The attributes and actions shared by the elements of an application with the \n\
+same role and subrole, as returned by :py:meth:`AccessibleElement.schema`. \n\
+``role`` and ``subrole`` may be ``None``; ``attributes``, ``actions`` and \n\
+``settable`` (the attributes that can be set) are tuples of names.");
+
+static PyStructSequence_Field Schema_fields[] = {
+    {"role", NULL},
+    {"subrole", NULL},
+    {"attributes", NULL},
+    {"actions", NULL},
+    {"settable", NULL},
+    {NULL, NULL}
 };
 
-static PyObject * AccessibleElement_keys(AccessibleElement * self, PyObject * args) {
-    PyObject * result = NULL;
-    CFArrayRef names;
-    AXError error = AXUIElementCopyAttributeNames(self->_ref, &names);
-    if (error == kAXErrorSuccess) {
-        result = parseCFTypeRef(names);
-    } else {
-        handleAXErrors("attribute names", error);
-    }
+static PyStructSequence_Desc Schema_desc = {"accessibility.Schema", Schema_docstring, Schema_fields, 5};
 
-    if (names != NULL) CFRelease(names);
-    return result;
-}
+enum { SCHEMA_ROLE, SCHEMA_SUBROLE, SCHEMA_ATTRIBUTES, SCHEMA_ACTIONS, SCHEMA_SETTABLE };
 
-/* Members
+PyDoc_STRVAR(Geometry_docstring, "Geometry\n\n\
+The positions and sizes of many elements at once, as returned by \n\
+:py:func:`geometry`. It exports a read-only buffer of doubles with the shape \n\
+``(4, len(elements))``, whose rows are ``x``, ``y``, ``width`` and ``height``, \n\
+so that NumPy and :py:class:`memoryview` can use it without copying. Column \n\
+``i`` describes ``elements[i]``, and is ``nan`` where it could not be read.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    import numpy\n\
+    frames = accessibility.geometry(window['AXChildren'])\n\
+    x, y, width, height = numpy.asarray(frames)\n\
+    widest = frames.elements[numpy.nanargmax(width)]");
+
+typedef struct {
+    PyObject_HEAD
+    double * data; // the rows one after another, count values each
+    Py_ssize_t count;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    PyObject * elements;
+    Py_ssize_t missing;
+} Geometry;
+
+
+/* Snapshot class
 ======== */
 
-static PyObject * AccessibleElement_can_set(AccessibleElement * self, PyObject * args) {
-    PyObject * result = NULL;
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count > 1) {
-        PyErr_SetString(PyExc_ValueError, "Too many arguments.");
-        return NULL;
+PyDoc_STRVAR(Snapshot_docstring, "Snapshot(source)\n\n\
+A tree captured by :py:func:`snapshot`, read from a file (which is mapped into \n\
+memory) or from a bytes-like object. Nothing is converted until it is asked \n\
+for: nodes are numbered depth-first, starting from 0 for the root, and each \n\
+attribute is decoded the first time it is queried. Elements in values are \n\
+given as node numbers, or ``None`` if they were not captured.\n\
+\n\
+:param source: The path of a snapshot file, or the snapshot itself.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    data = accessibility.snapshot(app, attributes = ['AXRole', 'AXTitle'])\n\
+    tree = accessibility.Snapshot(data)\n\
+    for node in tree.find('AXRole', 'AXButton'):\n\
+        print tree.get(node, 'AXTitle'), tree.parent(node)");
+
+PyDoc_STRVAR(Snapshot_get_docstring, "get(node, attribute, default = None)\n\n\
+Returns the value of an attribute of a node, or default if the node had none. \n\
+Raises a KeyError if the attribute was not captured at all.");
+
+PyDoc_STRVAR(Snapshot_parent_docstring, "parent(node)\n\n\
+Returns the number of the node's parent, or ``None`` for the root.");
+
+PyDoc_STRVAR(Snapshot_children_docstring, "children(node)\n\n\
+Returns the numbers of the node's children, in order.");
+
+PyDoc_STRVAR(Snapshot_column_docstring, "column(attribute)\n\n\
+Returns the values of an attribute for every node as a list, with ``None`` \n\
+for nodes that had none.");
+
+PyDoc_STRVAR(Snapshot_find_docstring, "find(attribute, value)\n\n\
+Returns the numbers of the nodes whose value for an attribute equals value. \n\
+Strings are matched without being decoded.");
+
+PyDoc_STRVAR(Snapshot_close_docstring, "close()\n\n\
+Releases the snapshot, after which it can no longer be queried.");
+
+typedef struct {
+    PyObject_HEAD
+    SnapshotReader reader;
+    int open;
+    void * map;        // the file, when read from one
+    size_t map_size;
+    Py_buffer view;    // the object read from otherwise
+    int has_view;
+    PyObject * attributes;
+    PyObject ** strings; // short strings decoded so far, by index, shared between values
+    int pid;
+    double time;
+} Snapshot;
+
+
+/* Shared snapshot classes
+======== */
+
+PyDoc_STRVAR(SnapshotPublisher_docstring, "SnapshotPublisher(name, capacity = 16777216)\n\n\
+Publishes snapshots into a region of shared memory, from which any number of \n\
+processes can read them with a :py:class:`SnapshotSubscriber`, without \n\
+making any requests of their own. Publishing never waits for readers. There \n\
+can be one publisher for each region; a region left behind by one that has \n\
+exited is replaced.\n\
+\n\
+:param name: The name of the region, as for ``shm_open`` (e.g. ``'/ax-finder'``).\n\
+:param capacity: The largest snapshot that can be published, in bytes.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    publisher = accessibility.SnapshotPublisher('/ax-finder')\n\
+    while True:\n\
+        publisher.publish(accessibility.snapshot(finder))\n\
+        time.sleep(0.5)");
+
+PyDoc_STRVAR(SnapshotPublisher_publish_docstring, "publish(data)\n\n\
+Publishes a snapshot, as returned by :py:func:`snapshot`, and returns its \n\
+generation. Raises a ValueError if it is larger than the region's capacity.");
+
+PyDoc_STRVAR(SnapshotPublisher_close_docstring, "close(unlink = True)\n\n\
+Stops publishing, and removes the region's name unless unlink is false. \n\
+Subscribers that are already attached can still read the last snapshot.");
+
+PyDoc_STRVAR(SnapshotSubscriber_docstring, "SnapshotSubscriber(name)\n\n\
+Reads the snapshots published to a region of shared memory by a \n\
+:py:class:`SnapshotPublisher`, usually in another process. Every read is a \n\
+consistent copy of the latest snapshot, however often it is replaced, and \n\
+the generation can be checked cheaply to see whether there is a new one.\n\
+\n\
+:param name: The name of the region.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    subscriber = accessibility.SnapshotSubscriber('/ax-finder')\n\
+    generation, tree = subscriber.read()\n\
+    if tree is not None:\n\
+        print tree.find('AXRole', 'AXWindow')");
+
+PyDoc_STRVAR(SnapshotSubscriber_read_docstring, "read(raw = False)\n\n\
+Returns the generation of the latest snapshot and the snapshot itself, as a \n\
+:py:class:`Snapshot` (or as bytes, if raw is true), or ``(0, None)`` if \n\
+nothing has been published yet.");
+
+PyDoc_STRVAR(SnapshotSubscriber_close_docstring, "close()\n\n\
+Detaches from the region.");
+
+typedef struct {
+    PyObject_HEAD
+    SnapshotShare share;
+    pthread_mutex_t lock; // held while the region is written, or unmapped
+    int has_lock;
+    PyObject * name;
+    unsigned long long generation;
+} SnapshotPublisher;
+
+typedef struct {
+    PyObject_HEAD
+    SnapshotShare share;
+    pthread_mutex_t lock; // held while the region is read, or unmapped
+    int has_lock;
+    PyObject * name;
+} SnapshotSubscriber;
+
+
+/* Text reader class
+======== */
+
+PyDoc_STRVAR(TextReader_docstring, "TextReader(element, chunk_size = 4096, visible = False)\n\n\
+Reads the text of a long document a chunk at a time through \n\
+``AXStringForRange``, rather than copying all of ``AXValue`` at once. Chunks \n\
+are only read when they are reached, and are kept so that after a change \n\
+:py:meth:`refresh` can read again just the ones it touched.\n\
+\n\
+Iterating over a reader yields the text of each chunk in turn.\n\
+\n\
+:param element: An element with ``AXNumberOfCharacters``, such as a text area.\n\
+:param chunk_size: The number of characters to read with each request.\n\
+:param visible: Whether to read only the characters on screen, as given by \n\
+    ``AXVisibleCharacterRange``.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    reader = accessibility.TextReader(text_area)\n\
+    for chunk in reader:\n\
+        index.add(chunk)");
+
+PyDoc_STRVAR(TextReader_read_docstring, "read()\n\n\
+Returns all of the text in the reader's range, reading whichever chunks have \n\
+not been read yet.");
+
+PyDoc_STRVAR(TextReader_refresh_docstring, "refresh(changed = None)\n\n\
+Measures the text again and re-reads the chunks already read that may have \n\
+changed, and returns the :py:class:`Range` of each whose text did. Call it \n\
+when the element posts ``AXValueChanged``. Since the notification does not \n\
+say what changed, every chunk is re-read unless the range that changed is \n\
+given; if the length of the text changed too, everything after its start is.\n\
+\n\
+:param changed: A ``(location, length)`` tuple of the characters that changed.");
+
+typedef struct {
+    CFIndex location;
+    CFIndex length;
+    PyObject * text; // NULL until read
+} TextChunk;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject * element;
+    Py_ssize_t chunk_size;
+    char visible;
+    Py_ssize_t length; // of the whole text
+    CFRange range;     // of the text read, all of it unless visible
+    TextChunk * chunks; // one for each chunk_size characters of the whole text
+    Py_ssize_t chunk_count;
+    Py_ssize_t cursor;
+} TextReader;
+
+
+/* Request priorities
+======== */
+
+// The classes of requests the scheduler tells apart, most urgent first.
+typedef enum {
+    PRIORITY_INTERACTIVE,
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,
+    PRIORITY_COUNT
+} RequestPriority;
+
+static const char * priority_names[PRIORITY_COUNT] = { "interactive", "normal", "background" };
+
+/* Poll watcher class
+======== */
+
+PyDoc_STRVAR(PollWatcher_docstring, "PollWatcher\n\n\
+Polls attributes of several elements on a native thread, as started by \n\
+:py:func:`poll_watch`. It keeps polling until :py:meth:`stop` is called, \n\
+even if nothing else refers to it.");
+
+PyDoc_STRVAR(PollWatcher_changes_docstring, "changes(timeout = None)\n\n\
+Returns the changes seen since they were last asked for, as a list of \n\
+``(element, attribute, value)`` tuples, waiting for up to timeout seconds \n\
+(or until there are some, if ``None``) when there are none yet. Does not \n\
+wait once the watcher has stopped.");
+
+PyDoc_STRVAR(PollWatcher_stop_docstring, "stop()\n\n\
+Stops polling, waiting for a poll in progress to finish (unless called from \n\
+the callback).");
+
+typedef struct {
+    PyObject_HEAD
+    PyObject * elements;   // tuple
+    PyObject * attributes; // tuple
+    PyObject * callback;
+    double interval;
+    AXUIElementRef * refs;
+    pid_t * pids;
+    char * dead;           // elements found to be invalid, which are no longer polled
+    CFArrayRef names;
+    Py_ssize_t element_count;
+    Py_ssize_t attribute_count;
+    // Written only by the polling thread; read by others under lock
+    CFTypeRef * values;    // values[element * attribute_count + attribute], NULL if unreadable
+    char * pending;
+    Py_ssize_t * queue;    // the slots of pending changes, in the order seen
+    Py_ssize_t queue_count;
+    unsigned long long poll_count;
+    unsigned long long change_count;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;   // signalled to stop, or when changes are queued
+    int has_lock;
+    int running;
+    int stopping;
+    int orphaned;          // its interpreter is going away, so Python must not be touched
+    RequestPriority priority; // that of the thread that started it
+    PyInterpreterState * interp;
+    struct ModuleState * state;
+} PollWatcher;
+
+/* Focus tracker class
+======== */
+
+PyDoc_STRVAR(FocusTracker_docstring, "FocusTracker\n\n\
+Keeps track of the focused application, window and element from \n\
+notifications, on a native thread, as started by :py:func:`track_focus`. It \n\
+keeps tracking until :py:meth:`stop` is called, even if nothing else refers \n\
+to it.");
+
+PyDoc_STRVAR(FocusTracker_focused_docstring, "focused()\n\n\
+Returns the focus as it was last heard of, as an ``(application, window, \n\
+element)`` tuple, without making any request. The window and element are \n\
+``None`` where they are not known, and the whole is ``None`` if the \n\
+frontmost application is not one of those tracked.");
+
+PyDoc_STRVAR(FocusTracker_changes_docstring, "changes(timeout = None)\n\n\
+Returns the changes of focus since they were last asked for, oldest first, \n\
+each as :py:meth:`focused` would have returned it, waiting for up to timeout \n\
+seconds (or until there are some, if ``None``) when there are none yet. Only \n\
+the latest 64 are kept. Does not wait once the tracker has stopped.");
+
+PyDoc_STRVAR(FocusTracker_add_docstring, "add(pid)\n\n\
+Starts tracking another application, such as one launched since. Does \n\
+nothing if it is already tracked.\n\
+\n\
+:param int pid: The process ID of the application.");
+
+PyDoc_STRVAR(FocusTracker_stop_docstring, "stop()\n\n\
+Stops tracking, waiting for the tracking thread to let go of its observers \n\
+(unless called from the callback).");
+
+#define FOCUS_QUEUE_CAPACITY 64
+
+typedef struct FocusApplication {
+    struct FocusTracker * tracker;
+    pid_t pid;
+    AXUIElementRef ref;
+    AXObserverRef observer;   // created by the tracking thread, which alone uses it
+    // Under the tracker's lock
+    AXUIElementRef window;    // NULL if not known
+    AXUIElementRef element;
+} FocusApplication;
+
+// The focus at some point, with the index of its application (or -1).
+typedef struct {
+    Py_ssize_t application;
+    AXUIElementRef window;
+    AXUIElementRef element;
+} FocusState;
+
+typedef struct FocusTracker {
+    PyObject_HEAD
+    PyObject * applications; // list of elements, in the order of apps
+    PyObject * callback;
+    // Under lock; entries are never moved, as notifications point to them
+    FocusApplication ** apps;
+    Py_ssize_t app_count;
+    Py_ssize_t app_capacity;
+    Py_ssize_t frontmost;    // index into apps, or -1
+    FocusState queue[FOCUS_QUEUE_CAPACITY]; // a ring, oldest at queue_start
+    Py_ssize_t queue_start;
+    Py_ssize_t queue_count;
+    unsigned long long notification_count;
+    unsigned long long change_count;
+    CFArrayRef app_names;    // the attributes read from applications
+    CFArrayRef system_names; // and from the system-wide element
+    CFRunLoopRef loop;       // that of the tracking thread, once it has one
+    Py_ssize_t subscribed;   // apps the thread has subscribed to; only it uses this
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     // signalled to stop, when ready, or when changes are queued
+    int has_lock;
+    int running;
+    int ready;
+    int stopping;
+    int orphaned;
+    RequestPriority priority;
+    PyInterpreterState * interp;
+    struct ModuleState * state;
+} FocusTracker;
+
+
+/* Locator class
+======== */
+
+PyDoc_STRVAR(Locator_docstring, "Locator(element, path = None, ttl = 0.0)\n\n\
+Finds an element again after its application has rebuilt the interface around \n\
+it, which leaves elements found before invalid. A locator records the path to \n\
+the element from its application: at each level, the role, identifier and \n\
+title of the element there, and its index among its siblings with the same \n\
+role. It keeps the element it last found, and :py:meth:`resolve` checks with \n\
+one request that it is still there before returning it. If it is not, the \n\
+elements above it are checked in turn, and the path is followed again only \n\
+from the deepest of them that is.\n\
+\n\
+At each level, the child with the recorded role and identifier is taken, or, \n\
+if there is none, the child with the recorded role and title (preferring the \n\
+recorded index among several), or else the one at the recorded index.\n\
+\n\
+:param AccessibleElement element: The element to locate, or, with ``path``, \n\
+    the application to locate it in.\n\
+:param path: A path as given by :py:attr:`path`, to locate instead of element.\n\
+:param float ttl: For how many seconds an element that was found or checked is \n\
+    returned without checking it again.\n\
+\n\
+.. code-block:: python\n\
+\n\
+    save = accessibility.Locator(save_button)\n\
+    # ... later, when the window may have been rebuilt:\n\
+    button = save.resolve()\n\
+    if button is not None:\n\
+        button.perform_action('AXPress')");
+
+PyDoc_STRVAR(Locator_resolve_docstring, "resolve()\n\n\
+Returns the element the path leads to, as an :py:class:`AccessibleElement`, \n\
+or ``None`` if there is no longer one.");
+
+PyDoc_STRVAR(Locator_invalidate_docstring, "invalidate()\n\n\
+Forgets the elements found, so that the next :py:meth:`resolve` follows the \n\
+whole path from the application.");
+
+PyDoc_STRVAR(Locator_stats_docstring, "stats()\n\n\
+Returns what resolving has cost so far, as a dictionary with the keys:\n\
+\n\
+* ``lookups``: calls to :py:meth:`resolve`.\n\
+* ``hits``: lookups answered with the element kept, checked or not.\n\
+* ``checks``: requests made to check kept elements.\n\
+* ``resolutions``: times the path was followed again, from some level.\n\
+* ``levels``: the levels it was followed for, in all.\n\
+* ``requests``: requests made following it.\n\
+* ``failures``: lookups that found no element.\n\
+* ``seconds``: the time spent following it.");
+
+// Deeper paths than this are taken to have gone round in a loop.
+#define LOCATOR_MAX_DEPTH 256
+
+typedef struct {
+    CFStringRef role;       // each may be NULL
+    CFStringRef identifier;
+    CFStringRef title;
+    long index;             // among the siblings with the same role
+} LocatorStep;
+
+typedef struct {
+    PyObject_HEAD
+    int pid;
+    double ttl;
+    // Under lock
+    LocatorStep * steps;    // from the level below the application down
+    Py_ssize_t depth;
+    AXUIElementRef * chain; // chain[0] is the application and chain[i] the element found for
+                            // steps[i - 1], or NULL if not (or no longer) known
+    double checked_at;      // when chain[depth] was last found or checked
+    unsigned long long lookups;
+    unsigned long long hits;
+    unsigned long long checks;
+    unsigned long long resolutions;
+    unsigned long long levels;
+    unsigned long long requests;
+    unsigned long long failures;
+    double seconds;
+    pthread_mutex_t lock;
+    int has_lock;
+} Locator;
+
+/* Backends
+======== */
+
+#ifdef __APPLE__
+static const AXBackend * ax_backend = &hiservices_backend;
+#else
+static const AXBackend * ax_backend = &simulated_backend;
+
+#define SIMULATED_DEFAULT_PID 1000
+#endif
+
+// Elements are read, and observed, through the core (see core.h)
+static AXSession ax_session;
+
+static void useBackend(const AXBackend * backend) {
+    ax_backend = backend;
+    ax_session.backend = backend;
+}
+
+// The backend requests end up at, looking through a recording.
+static const AXBackend * activeBackend(void) {
+    if (ax_backend == &recording_backend) {
+        const AXBackend * recorded = recordingInner();
+        if (recorded != NULL) return recorded;
+    }
+    return ax_backend;
+}
+
+/* Module state
+======== */
+
+// The watchers and observing elements the module state keeps track of.
+typedef struct {
+    void ** items;
+    size_t count;
+    size_t capacity;
+} Registry;
+
+// The largest string values that are interned (see configure_intern_cache),
+// in characters.
+#define INTERN_MAX_LENGTH 64
+#define INTERN_DEFAULT_CAPACITY 1024
+#define INTERN_MAX_CAPACITY (1 << 20)
+
+typedef struct {
+    CFStringRef string; // retained
+    CFHashCode hash;
+    PyObject * value;
+} InternEntry;
+
+/*
+ * Everything that holds Python objects belongs to one interpreter, and so
+ * lives here rather than in statics. What is left at file scope (the
+ * backend, statistics, traces and application health) is native and shared
+ * by the whole process.
+ */
+typedef struct ModuleState {
+    PyObject * InvalidUIElementError;
+    PyObject * APIDisabledError;
+    PyObject * NotRespondingError;
+    PyObject * CircuitOpenError;
+    PyTypeObject * AccessibleElement_type;
+    PyTypeObject * Point_type;
+    PyTypeObject * Size_type;
+    PyTypeObject * Rect_type;
+    PyTypeObject * Range_type;
+    PyTypeObject * Schema_type;
+    PyTypeObject * Geometry_type;
+    PyTypeObject * Snapshot_type;
+    PyTypeObject * SnapshotPublisher_type;
+    PyTypeObject * SnapshotSubscriber_type;
+    PyTypeObject * TextReader_type;
+    PyTypeObject * PollWatcher_type;
+    PyTypeObject * FocusTracker_type;
+    PyTypeObject * Locator_type;
+    // Application elements by PID, for create_application_ref
+    PyObject * application_cache;
+    unsigned long application_cache_hits;
+    unsigned long application_cache_misses;
+    unsigned long application_cache_evictions;
+    // Schemas by (pid, role, subrole), for AccessibleElement.schema
+    PyObject * schema_cache;
+    unsigned long schema_cache_hits;
+    unsigned long schema_cache_misses;
+    unsigned long schema_cache_evictions;
+    int schema_cache_enabled;
+    // Strings converted for the values of a few attributes, in slots by the
+    // hash of the CFString (all under intern_lock)
+    pthread_mutex_t intern_lock;
+    InternEntry * intern_entries;
+    size_t intern_capacity; // a power of two, or 0 when off
+    CFStringRef * intern_attributes;
+    size_t intern_attribute_count;
+    unsigned long intern_hits;
+    unsigned long intern_misses;
+    unsigned long intern_evictions;
+    // Watchers still polling, focus trackers still tracking (both under
+    // watchers_lock), and elements with an observer on a run loop, which are
+    // stopped before the interpreter goes away
+    pthread_mutex_t watchers_lock;
+    Registry watchers;
+    Registry trackers;
+    pthread_mutex_t observers_lock;
+    Registry observers;
+} ModuleState;
+
+#ifdef MULTI_PHASE_INIT
+static ModuleState * moduleState(PyObject * module) {
+    return (ModuleState *) PyModule_GetState(module);
+}
+
+// Only for the module's own types, none of which can be subclassed.
+static ModuleState * typeState(PyTypeObject * type) {
+    return (ModuleState *) PyType_GetModuleState(type);
+}
+#else
+static ModuleState legacy_state;
+
+static ModuleState * moduleState(PyObject * module) {
+    return &legacy_state;
+}
+
+static ModuleState * typeState(PyTypeObject * type) {
+    return &legacy_state;
+}
+#endif
+
+// Frees an instance of one of the module's types, which as heap types are
+// kept alive by their instances.
+static void freeInstance(PyObject * self) {
+    PyTypeObject * type = Py_TYPE(self);
+    type->tp_free(self);
+    if (type->tp_flags & Py_TPFLAGS_HEAPTYPE) Py_DECREF(type);
+}
+
+static int registryAdd(Registry * registry, void * item) {
+    if (registry->count == registry->capacity) {
+        size_t capacity = registry->capacity ? 2 * registry->capacity : 8;
+        void ** items = (void **) realloc(registry->items, capacity * sizeof(void *));
+        if (items == NULL) return -1;
+        registry->items = items;
+        registry->capacity = capacity;
+    }
+    registry->items[registry->count++] = item;
+    return 0;
+}
+
+static void registryRemove(Registry * registry, void * item) {
+    for (size_t i = 0; i < registry->count; i++) {
+        if (registry->items[i] == item) {
+            registry->items[i] = registry->items[--registry->count];
+            return;
+        }
+    }
+}
+
+// Empties the registry, handing over what it held.
+static Registry registryTake(Registry * registry) {
+    Registry taken = *registry;
+    registry->items = NULL;
+    registry->count = registry->capacity = 0;
+    return taken;
+}
+
+/*
+ * Stops everything that would call into the interpreter once it has gone
+ * away. Watchers' threads could not attach to it, so they are left to leak
+ * rather than touch Python again; observers could be dispatched to by a run
+ * loop on another interpreter's thread. Needs the GIL, which it gives up to
+ * wait.
+ */
+static void stopCallbacks(ModuleState * state) {
+    Registry watchers;
+    Registry trackers;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&state->watchers_lock);
+    watchers = registryTake(&state->watchers);
+    for (size_t i = 0; i < watchers.count; i++) ((PollWatcher *) watchers.items[i])->orphaned = 1;
+    trackers = registryTake(&state->trackers);
+    for (size_t i = 0; i < trackers.count; i++) ((FocusTracker *) trackers.items[i])->orphaned = 1;
+    pthread_mutex_unlock(&state->watchers_lock);
+
+    for (size_t i = 0; i < watchers.count; i++) {
+        PollWatcher * watcher = (PollWatcher *) watchers.items[i];
+        pthread_mutex_lock(&watcher->lock);
+        watcher->stopping = 1;
+        pthread_cond_broadcast(&watcher->wake);
+        while (watcher->running) pthread_cond_wait(&watcher->wake, &watcher->lock);
+        pthread_mutex_unlock(&watcher->lock);
+    }
+    for (size_t i = 0; i < trackers.count; i++) {
+        FocusTracker * tracker = (FocusTracker *) trackers.items[i];
+        pthread_mutex_lock(&tracker->lock);
+        tracker->stopping = 1;
+        pthread_cond_broadcast(&tracker->wake);
+        if (tracker->loop != NULL) CFRunLoopStop(tracker->loop);
+        while (tracker->running) pthread_cond_wait(&tracker->wake, &tracker->lock);
+        pthread_mutex_unlock(&tracker->lock);
+    }
+    Py_END_ALLOW_THREADS
+    free(watchers.items);
+    free(trackers.items);
+
+    pthread_mutex_lock(&state->observers_lock);
+    Registry observers = registryTake(&state->observers);
+    pthread_mutex_unlock(&state->observers_lock);
+    for (size_t i = 0; i < observers.count; i++) {
+        AccessibleElement * element = (AccessibleElement *) observers.items[i];
+        axSessionObserverStop(element->_observer);
+    }
+    free(observers.items);
+}
+
+/* Application health
+======== */
+
+#define HEALTH_SAMPLES 64
+#define HEALTH_MIN_SAMPLES 16
+
+/*
+ * The requests to an application that hold one of its slots, and those
+ * waiting for one. Each priority hands out tickets, and serves them in order,
+ * so waiting requests are the difference of the two.
+ */
+typedef struct {
+    int in_flight;
+    int in_flight_background;
+    unsigned long next_ticket[PRIORITY_COUNT];
+    unsigned long serving[PRIORITY_COUNT];
+} RequestQueue;
+
+typedef struct {
+    pid_t pid;
+    int in_use;
+    RequestQueue queue;
+    unsigned long requests;
+    unsigned long failures;
+    unsigned long rejected;
+    int consecutive_failures;
+    double open_until;
+    // Latency of the most recent responses, in seconds
+    float samples[HEALTH_SAMPLES];
+    int sample_count;
+    int sample_head;
+    int samples_since_sort;
+    float p50;
+    float p99;
+} ApplicationHealth;
+
+typedef struct {
+    int threshold;
+    double cooldown;
+    int adaptive_timeout;
+    double multiplier;
+    double min_timeout;
+    double max_timeout;
+} BreakerConfig;
+
+/*
+ * Applications are spread over several tables with a lock each, so that
+ * threads talking to different applications do not queue up behind one
+ * another. The breaker configuration is read under any one of the locks and
+ * written under all of them.
+ */
+#define HEALTH_STRIPES 16
+
+typedef struct {
+    unsigned long long requests;
+    unsigned long long waited;
+    double wait_total;
+    double wait_max;
+} SchedulerCounters;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t available; // signalled when a slot of one of its applications frees up
+    ApplicationHealth * table;
+    size_t capacity;
+    size_t count;
+    SchedulerCounters counters[PRIORITY_COUNT];
+} HealthStripe;
+
+typedef struct {
+    int max_in_flight;
+    int background_in_flight;
+} SchedulerConfig;
+
+// A request's claim on one of its application's slots.
+typedef struct {
+    pid_t pid;
+    RequestPriority priority;
+    unsigned long ticket;
+    int holding;
+} RequestSlot;
+
+static BreakerConfig breaker_config = { 5, 10.0, 0, 4.0, 0.25, 6.0 };
+// The timeout set on the system-wide element, or 0 for the system's own.
+// Adaptive timeouts never go below it; written under all the health locks.
+static float system_timeout = 0;
+// Like the breaker's, but max_in_flight is also read without a lock to skip
+// scheduling altogether while it is 0
+static SchedulerConfig scheduler_config = { 0, 0 };
+static pthread_key_t priority_key;
+static HealthStripe health_stripes[HEALTH_STRIPES];
+static pthread_once_t health_once = PTHREAD_ONCE_INIT;
+
+/* Call statistics
+======== */
+
+typedef enum {
+    OP_COPY_ATTRIBUTE_VALUE,
+    OP_COPY_MULTIPLE_ATTRIBUTE_VALUES,
+    OP_COPY_PARAMETERIZED_ATTRIBUTE_VALUE,
+    OP_COPY_ATTRIBUTE_NAMES,
+    OP_GET_ATTRIBUTE_VALUE_COUNT,
+    OP_IS_ATTRIBUTE_SETTABLE,
+    OP_SET_ATTRIBUTE_VALUE,
+    OP_COPY_ACTION_NAMES,
+    OP_COPY_ACTION_DESCRIPTION,
+    OP_PERFORM_ACTION,
+    OP_COPY_ELEMENT_AT_POSITION,
+    OP_GET_PID,
+    OP_SET_MESSAGING_TIMEOUT,
+    OP_CREATE_APPLICATION,
+    OP_CREATE_SYSTEMWIDE,
+    OP_OBSERVER_CREATE,
+    OP_OBSERVER_ADD_NOTIFICATION,
+    OP_OBSERVER_GET_RUN_LOOP_SOURCE,
+    OP_OBSERVER_CALLBACK,
+    OP_COUNT
+} AXOperation;
+
+static const char * operation_names[OP_COUNT] = {
+    "AXUIElementCopyAttributeValue",
+    "AXUIElementCopyMultipleAttributeValues",
+    "AXUIElementCopyParameterizedAttributeValue",
+    "AXUIElementCopyAttributeNames",
+    "AXUIElementGetAttributeValueCount",
+    "AXUIElementIsAttributeSettable",
+    "AXUIElementSetAttributeValue",
+    "AXUIElementCopyActionNames",
+    "AXUIElementCopyActionDescription",
+    "AXUIElementPerformAction",
+    "AXUIElementCopyElementAtPosition",
+    "AXUIElementGetPid",
+    "AXUIElementSetMessagingTimeout",
+    "AXUIElementCreateApplication",
+    "AXUIElementCreateSystemWide",
+    "AXObserverCreate",
+    "AXObserverAddNotification",
+    "AXObserverGetRunLoopSource",
+    "AXObserverCallback"
+};
+
+// Latencies are bucketed like an HDR histogram: exact below 2^STATS_SUB_BITS
+// nanoseconds, then STATS_SUB_BUCKETS linear buckets per power of two, which
+// keeps the relative error under about 6% up to roughly 18 minutes.
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXPONENT 40
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) * STATS_SUB_BUCKETS)
+#define STATS_MAX_KEYS 4096
+
+typedef struct {
+    int in_use;
+    AXOperation operation;
+    CFStringRef attribute; // retained, or NULL
+    pid_t pid;
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[STATS_BUCKETS];
+} CallStats;
+
+// The AXError codes run from -25200 to -25214; anything else is "other".
+#define STATS_ERROR_CODES 16
+
+static volatile int stats_enabled;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static CallStats * stats_table;
+static size_t stats_capacity;
+static size_t stats_count;
+static uint64_t stats_overflow;
+static uint64_t stats_error_counts[STATS_ERROR_CODES];
+static uint64_t stats_circuit_open;
+static uint64_t stats_other_errors;
+static uint64_t stats_reset_at;
+
+// A request to an application, from requestBegin to requestEnd.
+typedef struct {
+    AXOperation operation;
+    CFStringRef attribute;
+    AXUIElementRef ref;
+    pid_t pid;
+    PyObject * owner; // the element's object, if it has one, whose lock guards its timeout
+    double started;
+    uint64_t call_started;
+    float timeout;    // what it was sent with, or 0 for the default
+    int restore;      // whether the element goes back to the default timeout after
+    RequestSlot slot;
+} Request;
+
+/* Tracing
+======== */
+
+typedef enum {
+    TRACE_IPC,
+    TRACE_CONVERSION,
+    TRACE_CALLBACK
+} TraceCategory;
+
+static const char * trace_category_names[] = { "ipc", "conversion", "callback" };
+
+typedef struct {
+    uint64_t begin;
+    uint64_t end;
+    const char * name; // static
+    CFStringRef detail; // retained, or NULL
+    pid_t pid;
+    AXError error;
+    TraceCategory category;
+} TraceEvent;
+
+/*
+ * Each thread records into its own buffer without taking any locks; the count
+ * is only advanced once an event is complete, so a concurrent flush reads just
+ * the finished ones. A buffer belongs to the trace (generation) it was last
+ * reset for, and its owning thread resets it lazily when a new trace starts.
+ */
+typedef struct TraceBuffer {
+    struct TraceBuffer * next;
+    unsigned long generation;
+    int thread_id;
+    int orphaned;
+    size_t capacity;
+    size_t count;
+    uint64_t dropped;
+    TraceEvent * events;
+} TraceBuffer;
+
+#define TRACE_DEFAULT_CAPACITY 65536
+
+static volatile int trace_enabled;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static TraceBuffer * trace_buffers;
+static unsigned long trace_generation;
+static size_t trace_capacity = TRACE_DEFAULT_CAPACITY;
+static uint64_t trace_origin;
+static int trace_threads;
+
+/* ========
+    Internal API
+======== */
+
+static PyObject * parseCFTypeRef(ModuleState *, const CFTypeRef);
+static PyObject * stringFromUTF8(const char *, Py_ssize_t);
+static PyObject * newValue(PyTypeObject *, Py_ssize_t);
+static PyObject * newGeometry(PyTypeObject *, const double *, int);
+static PyObject * newRange(ModuleState *, CFIndex, CFIndex);
+static CFTypeRef CFParameterFromPyObject(ModuleState *, PyObject *);
+static void registerConverters(void);
+static PyObject * tracedParseCFTypeRef(ModuleState *, const CFTypeRef, pid_t);
+static PyObject * convertAttributeValue(ModuleState *, CFStringRef, CFTypeRef, pid_t);
+static AccessibleElement * elementWithRef(ModuleState *, AXUIElementRef *);
+static void handleAXErrors(ModuleState *, const char *, AXError);
+static void handleElementAXErrors(AccessibleElement *, const char *, AXError);
+static void evictCachedApplication(AccessibleElement *);
+static PyObject * elementSchema(AccessibleElement *);
+static PyObject * elementKnownSchema(AccessibleElement *);
+static int schemaLists(PyObject *, int, const char *);
+static PyObject * schemaNameList(PyObject *, int);
+static void NotifcationCallback(AXUIElementRef, CFStringRef, void *);
+static double monotonicTime(void);
+static void healthSortSamples(ApplicationHealth *);
+static double healthTimeout(ApplicationHealth *, BreakerConfig *, float);
+static void healthLockAll(void);
+static void healthUnlockAll(void);
+static AXError healthAdmit(pid_t, float *);
+static void healthSetSystemTimeout(float);
+static void healthRecord(pid_t, AXOperation, double, float, AXError);
+static RequestPriority currentPriority(void);
+static int scheduleWaiting(RequestQueue *);
+static void scheduleEnter(RequestSlot *, pid_t, RequestPriority, int);
+static void scheduleLeave(RequestSlot *);
+static AXError requestBegin(Request *, RequestPriority, int, float, float *);
+static void requestEnd(Request *, AXError);
+static AXError beginRequest(AccessibleElement *, Request *);
+static uint64_t nanoTime(void);
+static uint64_t callBegin(void);
+static uint64_t statsBucketValue(int);
+static AXError setMessagingTimeout(AXUIElementRef, pid_t, float);
+static void callEnd(AXOperation, CFStringRef, pid_t, uint64_t, AXError);
+static void traceRecord(TraceCategory, const char *, CFStringRef, pid_t, uint64_t, uint64_t, AXError);
+static void traceBufferClear(TraceBuffer *);
+static void traceThreadExit(void *);
+static unsigned long traceWrite(FILE *);
+static AXError copyAttributeValue(AccessibleElement *, CFStringRef, CFTypeRef *);
+static AXError copyMultipleAttributeValues(AccessibleElement *, CFArrayRef, CFArrayRef *);
+static AXError copyParameterizedAttributeValue(AccessibleElement *, CFStringRef, CFTypeRef, CFTypeRef *);
+static AXError copyAttributeNames(AccessibleElement *, CFArrayRef *);
+static AXError getAttributeValueCount(AccessibleElement *, CFStringRef, CFIndex *);
+static AXError isAttributeSettable(AccessibleElement *, CFStringRef, Boolean *);
+static AXError setAttributeValue(AccessibleElement *, CFStringRef, CFTypeRef);
+static AXError copyActionNames(AccessibleElement *, CFArrayRef *);
+static AXError copyActionDescription(AccessibleElement *, CFStringRef, CFStringRef *);
+static AXError performAction(AccessibleElement *, CFStringRef);
+#ifndef __APPLE__
+static int parseSimulatedConfig(PyObject *, SimConfig *);
+static int parseReplayConfig(PyObject *, char **, double *);
+#endif
+
+/* ========
+    Module Implementation
+======== */
+
+/* AccessibleElement class
+======== */
+
+static void AccessibleElement_dealloc(AccessibleElement * self) {
+    // Use CFRelease to release for the AXUIElementRef
+    if (self->_ref != NULL) CFRelease(self->_ref);
+    if (self->_observer != NULL) {
+        ModuleState * state = typeState(Py_TYPE(self));
+        pthread_mutex_lock(&state->observers_lock);
+        registryRemove(&state->observers, self);
+        pthread_mutex_unlock(&state->observers_lock);
+        // Queued notifications do not reach the callback after this
+        axSessionObserverClose(self->_observer);
+    }
+    Py_XDECREF(self->pid);
+    Py_XDECREF(self->callback);
+    Py_XDECREF(self->_schema);
+    freeInstance((PyObject *) self);
+}
+
+static PyObject * AccessibleElement_richcompare(PyObject * self, PyObject * other, int op) {
+    PyObject * result = NULL;
+
+    if (self->ob_type != other->ob_type) {
+        // Need both to be the same type
+        result = Py_NotImplemented;
+    } else {
+        AccessibleElement * s = (AccessibleElement *) self;
+        AccessibleElement * o = (AccessibleElement *) other;
+        // Uses CFEqual on the underlying AXUIElementRefs for comparison
+        int i = CFEqual(s->_ref, o->_ref) ? 1 : 0;
+        switch (op) {
+            case Py_EQ:
+                result = (i > 0) ? Py_True : Py_False;
+                break;
+            case Py_NE:
+                result = (i > 0) ? Py_False : Py_True;
+                break;
+            default:
+                PyErr_SetString(PyExc_TypeError, "AccessibleElement objects can only be compared with == and != operators.");
+                break;
+        }
+    }
+
+    Py_XINCREF(result);
+    return result;
+}
+
+/* Sequence Protocol
+======== */
+
+static int AccessibleElement_contains(AccessibleElement * self, PyObject * arg) {
+    // The argument should be a string
+    char * name_string = NULL;
+    CFStringRef name_strref = CFStringFromPyString(arg, &name_string);
+    if (!name_strref) return 0;
+
+    // Once the element has its schema, attributes it does not list are missing
+    if (typeState(Py_TYPE(self))->schema_cache_enabled) {
+        PyObject * schema = elementKnownSchema(self);
+        int listed = schema == NULL || schemaLists(schema, SCHEMA_ATTRIBUTES, name_string);
+        Py_XDECREF(schema);
+        if (!listed) {
+            CFRelease(name_strref);
+            return 0;
+        }
+    }
+
+    // Check if the attribute's value can be copied
+    CFTypeRef value = NULL;
+    AXError error = copyAttributeValue(self, name_strref, &value);
+    if (name_strref != NULL) CFRelease(name_strref);
+    if (value != NULL) CFRelease(value);
+    
+    return (error == kAXErrorSuccess) ? 1 : 0;
+}
+
+
+/* Mapping Protocol
+======== */
+
+static PyObject * AccessibleElement_subscript(AccessibleElement * self, PyObject * key) {
+    PyObject * args = PyTuple_Pack(1, key);
+    if (args == NULL) return NULL;
+    PyObject * result = AccessibleElement_get(self, args);
+    Py_DECREF(args);
+    return result;
+}
+
+static int AccessibleElement_ass_subscript(AccessibleElement * self, PyObject * key, PyObject * value) {
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Attributes cannot be deleted.");
+        return -1;
+    }
+    PyObject * args = PyTuple_Pack(2, key, value);
+    if (args == NULL) return -1;
+    PyObject * result = AccessibleElement_set(self, args);
+    Py_DECREF(args);
+    Py_XDECREF(result);
+    return (result != NULL) ? 0 : -1;
+}
+
+
+static PyObject * AccessibleElement_keys(AccessibleElement * self, PyObject * args) {
+    if (typeState(Py_TYPE(self))->schema_cache_enabled) {
+        PyObject * schema = elementSchema(self);
+        if (schema == NULL) return NULL;
+        PyObject * result = schemaNameList(schema, SCHEMA_ATTRIBUTES);
+        Py_DECREF(schema);
+        return result;
+    }
+
+    PyObject * result = NULL;
+    CFArrayRef names;
+    AXError error = copyAttributeNames(self, &names);
+    if (error == kAXErrorSuccess) {
+        result = tracedParseCFTypeRef(typeState(Py_TYPE(self)), names, self->_pid);
+    } else {
+        handleElementAXErrors(self, "attribute names", error);
+    }
+
+    if (names != NULL) CFRelease(names);
+    return result;
+}
+
+/* Members
+======== */
+
+static PyObject * AccessibleElement_can_set(AccessibleElement * self, PyObject * args) {
+    PyObject * result = NULL;
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count > 1) {
+        PyErr_SetString(PyExc_ValueError, "Too many arguments.");
+        return NULL;
+    }
+    
+    // The first argument should be a string
+    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
+    if (!name) return NULL; // PyTuple_GetItem will set an Index error.
+    char * name_string = NULL;
+    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+
+    // Check to see if the attribute can be set at all
+    Boolean can_set;
+    AXError error;
+    if (typeState(Py_TYPE(self))->schema_cache_enabled) {
+        PyObject * schema = elementSchema(self);
+        if (schema == NULL) {
+            CFRelease(name_strref);
+            return NULL;
+        }
+        can_set = schemaLists(schema, SCHEMA_SETTABLE, name_string);
+        error = (can_set || schemaLists(schema, SCHEMA_ATTRIBUTES, name_string)) ? kAXErrorSuccess : kAXErrorAttributeUnsupported;
+        Py_DECREF(schema);
+    } else {
+        error = isAttributeSettable(self, name_strref, &can_set);
+    }
+
+    if (error == kAXErrorSuccess) {
+        result = can_set ? Py_True : Py_False;
+    } else {
+        handleElementAXErrors(self, name_string, error);
+    }
+
+    if (name_strref != NULL) CFRelease(name_strref);
+    Py_XINCREF(result);
+    return result;
+}
+
+static PyObject * AccessibleElement_count(AccessibleElement * self, PyObject * args) {
+    PyObject * result = Py_None;
+    // This allows for retrieving multiple objects, so find how many were
+    // requested and loop over them.
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count > 1) {
+        result = PyTuple_New(attribute_count);
+    }
+
+    for (int i = 0; i < attribute_count; i++) {
+        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
+        if (!name) {
+            if (attribute_count > 1) Py_DECREF(result);
+            return NULL; // PyTuple_GetItem will set an Index error.
+        }
+        char * name_string = NULL;
+        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+        if (!name_strref) {
+            if (attribute_count > 1) Py_DECREF(result);
+            return NULL; // CFStringFromPyString will set an error.
+        }
+        
+        // Get the count itself
+        CFIndex count;
+        AXError error = getAttributeValueCount(self, name_strref, &count);
+        
+        if (error == kAXErrorSuccess) {
+            if (attribute_count > 1) {
+                PyTuple_SetItem(result, i, Py_BuildValue("i", count));
+            } else {
+                result = Py_BuildValue("i", count);
+            }
+        } else {
+            // If any of the requests fail, release memory and raise an exception
+            if (attribute_count > 1) Py_DECREF(result);
+            if (name_strref != NULL) CFRelease(name_strref);
+            handleElementAXErrors(self, name_string, error);
+            return NULL;
+        }
+        if (name_strref != NULL) CFRelease(name_strref);
+    }
+    return result;
+}
+
+static PyObject * AccessibleElement_get(AccessibleElement * self, PyObject * args) {
+    PyObject * result = NULL;
+    // This allows for retrieving multiple objects, so find how many were
+    // requested and loop over them.
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count > 1) {
+        result = PyTuple_New(attribute_count);
+    }
+
+    for (int i = 0; i < attribute_count; i++) {
+        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
+        if (!name) {
+            if (attribute_count > 1) Py_DECREF(result);
+            return NULL; // PyTuple_GetItem will set an Index error.
+        }
+        char * name_string = NULL;
+        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+        if (!name_strref) {
+            if (attribute_count > 1) Py_DECREF(result);
+            return NULL; // CFStringFromPyString will set an error.
+        }
+        
+        // Copy the value, unless the element's schema says it has none
+        CFTypeRef value = NULL;
+        AXError error = kAXErrorAttributeUnsupported;
+        PyObject * schema = typeState(Py_TYPE(self))->schema_cache_enabled ? elementKnownSchema(self) : NULL;
+        if (schema == NULL || schemaLists(schema, SCHEMA_ATTRIBUTES, name_string))
+            error = copyAttributeValue(self, name_strref, &value);
+        Py_XDECREF(schema);
+        
+        if (error == kAXErrorSuccess) {
+            PyObject * item = convertAttributeValue(typeState(Py_TYPE(self)), name_strref, value, self->_pid);
+            CFRelease(value);
+            if (item == NULL) {
+                if (attribute_count > 1) Py_DECREF(result);
+                CFRelease(name_strref);
+                return NULL;
+            }
+            if (attribute_count > 1) {
+                PyTuple_SET_ITEM(result, i, item);
+            } else {
+                result = item;
+            }
+        } else {
+            // If any of the requests fail, release memory and raise an exception
+            if (attribute_count > 1) Py_DECREF(result);
+            if (name_strref != NULL) CFRelease(name_strref);
+            if (value != NULL) CFRelease(value);
+            handleElementAXErrors(self, name_string, error);
+            return NULL;
+        }
+        if (name_strref != NULL) CFRelease(name_strref);
+    }
+    return result;
+}
+
+static PyObject * AccessibleElement_is_alive(AccessibleElement * self, PyObject * args) {
+    // Just check to see if the element responds to a basic attribute request
+    CFTypeRef value = NULL;
+    AXError error = copyAttributeValue(self, kAXRoleAttribute, &value);
+    if (value != NULL) CFRelease(value);
+    
+    if (error == kAXErrorInvalidUIElement) {
+        evictCachedApplication(self);
+        Py_RETURN_FALSE;
+    } else {
+        Py_RETURN_TRUE;
+    }
+}
+
+static PyObject * AccessibleElement_get_parameterized(AccessibleElement * self, PyObject * args) {
+    PyObject * name = NULL;
+    PyObject * parameter = NULL;
+
+    if (!PyArg_ParseTuple(args, "OO", &name, &parameter))
+        return NULL;
+
+    char * name_string = NULL;
+    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+    if (!name_strref) return NULL;
+    CFTypeRef parameter_ref = CFParameterFromPyObject(typeState(Py_TYPE(self)), parameter);
+    if (!parameter_ref) {
+        CFRelease(name_strref);
+        return NULL;
+    }
+
+    CFTypeRef value = NULL;
+    AXError error = copyParameterizedAttributeValue(self, name_strref, parameter_ref, &value);
+    CFRelease(parameter_ref);
+
+    PyObject * result = NULL;
+    if (error == kAXErrorSuccess) {
+        result = tracedParseCFTypeRef(typeState(Py_TYPE(self)), value, self->_pid);
+        CFRelease(value);
+    } else {
+        if (value != NULL) CFRelease(value);
+        handleElementAXErrors(self, name_string, error);
+    }
+    CFRelease(name_strref);
+    return result;
+}
+
+static PyObject * AccessibleElement_set(AccessibleElement * self, PyObject * args) {
+    PyObject * result = NULL;
+    // There should be at least two arguments
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count <= 1) {
+        PyErr_SetString(PyExc_ValueError, "Not enough arguments.");
+        return NULL;
+    }
+    // The first argument should be a string
+    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
+    if (!name) {
+        return NULL; // PyTuple_GetItem will set an Index error.
+    }
+    char * name_string = NULL;
+    CF_SCOPED CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+    if (!name_strref) {
+        return NULL; // CFStringFromPyString will set an error.
+    }
+
+    // Check to see if the attribute can be set at all
+    Boolean can_set;
+    AXError error = isAttributeSettable(self, name_strref, &can_set);
+
+    if (error == kAXErrorSuccess && !can_set) {
+        PyErr_Format(PyExc_ValueError, "The %s attribute cannot be modified.", name_string);
+        return NULL;
+    } else if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, name_string, error);
+        return result;
+    }
+
+    // Try to figure out what to set
+    if (CFStringCompare(name_strref, kAXPositionAttribute, 0) == kCFCompareEqualTo) {
+        
+        // For position, need a tuple of floats
+        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
+        float pair[2];
+        if (!PyTuple_Check(value)) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
+            return NULL;
+        } else if (PyTuple_Size(value) != 2) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
+            return NULL;
+        } else if (!PyArg_ParseTuple(value, "ff", &pair[0], &pair[1])) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
+            return NULL;
+        }
+        CGPoint pos = CGPointMake((CGFloat) pair[0], (CGFloat) pair[1]);
+        CF_SCOPED CFTypeRef position = (CFTypeRef) AXValueCreate(kAXValueCGPointType, (const void *) &pos);
+        AXError error = setAttributeValue(self, kAXPositionAttribute, position);
+
+        result = Py_BuildValue("i", error);
+        return result;
+    } else if (CFStringCompare(name_strref, kAXSizeAttribute, 0) == kCFCompareEqualTo) {
+        
+        // For size, need a tuple of floats
+        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
+        float pair[2];
+        if (!PyTuple_Check(value)) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
+            return NULL;
+        } else if (PyTuple_Size(value) != 2) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
+            return NULL;
+        } else if (!PyArg_ParseTuple(value, "ff", &pair[0], &pair[1])) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
+            return NULL;
+        }
+        CGSize s = CGSizeMake((CGFloat) pair[0], (CGFloat) pair[1]);
+        CF_SCOPED CFTypeRef size = (CFTypeRef) AXValueCreate(kAXValueCGSizeType, (const void *) &s);
+        AXError error = setAttributeValue(self, kAXSizeAttribute, size);
+
+        result = Py_BuildValue("i", error);
+        return result;
+    } else if (CFStringCompare(name_strref, kAXHiddenAttribute, 0) == kCFCompareEqualTo) {
+
+        // For hidden, need a bool
+        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
+        if (PyObject_IsTrue(value) == -1) {
+            PyErr_SetString(PyExc_ValueError, "Setting AXHidden requires a bool.");
+            return NULL;
+        }
+        
+        AXError error;
+        if (PyObject_IsTrue(value)) {
+            error = setAttributeValue(self, kAXHiddenAttribute, kCFBooleanTrue);
+        } else {
+            error = setAttributeValue(self, kAXHiddenAttribute, kCFBooleanFalse);
+        }
+        result = Py_BuildValue("i", error);
+        return result;
+    }
+
+    PyErr_SetString(PyExc_NotImplementedError, "Not all attributes can yet be modified.");
+    return result;
+}
+
+static PyObject * AccessibleElement_set_callback(AccessibleElement * self, PyObject * args) {
+    PyObject * callable = NULL;
+    
+    if (!PyArg_ParseTuple(args, "O", &callable))
+        return NULL;
+
+    // The argument should be a callable
+    if (!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "The callback must be callable.");
+        return NULL;
+    }
+    // Notifications may be delivered on another thread while this runs
+    PyObject * previous;
+    Py_INCREF(callable);
+    Py_BEGIN_CRITICAL_SECTION(self);
+    previous = self->callback;
+    self->callback = callable;
+#ifdef MULTI_PHASE_INIT
+    self->_interp = PyInterpreterState_Get();
+#else
+    self->_interp = PyThreadState_Get()->interp;
+#endif
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(previous);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * AccessibleElement_set_timeout(AccessibleElement * self, PyObject * args) {
+    float timeout;
+
+    if (!PyArg_ParseTuple(args, "f", &timeout))
+        return NULL;
+
+    AXError error = setMessagingTimeout(self->_ref, self->_pid, timeout);
+    
+    if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, "timeout", error);
+        return NULL;
+    } else {
+        // An explicit timeout takes precedence over the adaptive one, and
+        // one for every element is the least an adaptive one may be
+        if (self->_pid <= 0) healthSetSystemTimeout(timeout);
+        Py_BEGIN_CRITICAL_SECTION(self);
+        self->_timeout = timeout;
+        self->_applied_timeout = timeout;
+        Py_END_CRITICAL_SECTION();
+        Py_RETURN_NONE;
+    }
+}
+
+// Creates the element's observer, once. Returns 0 with an exception set on failure.
+static int AccessibleElement_observe(AccessibleElement * self) {
+    int result = 1;
+    // Two threads watching the same element must not both create one
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->_observer == NULL) {
+        // Nothing is watched until watch() adds it
+        AXSessionObserver * observer = NULL;
+        uint64_t call_started = callBegin();
+        AXError error = axSessionObserve(&ax_session, self->_ref, NULL, NotifcationCallback, self, &observer);
+        callEnd(OP_OBSERVER_CREATE, NULL, self->_pid, call_started, error);
+        if (error != kAXErrorSuccess) {
+            handleElementAXErrors(self, "observer", error);
+            result = 0;
+        }
+
+        if (result) {
+            ModuleState * state = typeState(Py_TYPE(self));
+            pthread_mutex_lock(&state->observers_lock);
+            result = registryAdd(&state->observers, self) == 0;
+            pthread_mutex_unlock(&state->observers_lock);
+            if (!result) {
+                axSessionObserverClose(observer);
+                PyErr_NoMemory();
+            }
+        }
+        if (result) self->_observer = observer;
+    }
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * AccessibleElement_watch(AccessibleElement * self, PyObject * args) {
+    if (self->pid == Py_None) {
+        PyErr_SetString(PyExc_TypeError, "Must have a PID to watch for notifications.");
+        return NULL;
+    }
+
+    // The observer needs to be initialized before notifications can be watched
+    if (!AccessibleElement_observe(self)) return NULL;
+#ifdef MULTI_PHASE_INIT
+    self->_interp = PyInterpreterState_Get();
+#else
+    self->_interp = PyThreadState_Get()->interp;
+#endif
+    
+    // Since the method accepts an arbitrary number of strings...
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    
+    for (int i = 0; i < attribute_count; i++) {
+        // The arguments should be strings
+        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
+        if (!name) {
+            return NULL; // PyTuple_GetItem will set an Index error.
+        }
+        char * name_string = NULL;
+        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+        if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+
+        // Add the notification
+        uint64_t call_started = callBegin();
+        AXError error = axSessionObserverAdd(&ax_session, self->_observer, name_string);
+        callEnd(OP_OBSERVER_ADD_NOTIFICATION, name_strref, self->_pid, call_started, error);
+        CFRelease(name_strref);
+        
+        if (error != kAXErrorSuccess) {
+            handleElementAXErrors(self, name_string, error);
+            return NULL;
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * AccessibleElement_actions(AccessibleElement * self, PyObject * args) {
+    if (typeState(Py_TYPE(self))->schema_cache_enabled) {
+        PyObject * schema = elementSchema(self);
+        if (schema == NULL) return NULL;
+        PyObject * result = schemaNameList(schema, SCHEMA_ACTIONS);
+        Py_DECREF(schema);
+        return result;
+    }
+
+    PyObject * result = NULL;
+    CFArrayRef names;
+    AXError error = copyActionNames(self, &names);
+    if (error == kAXErrorSuccess) {
+        result = tracedParseCFTypeRef(typeState(Py_TYPE(self)), names, self->_pid);
+    } else {
+        handleElementAXErrors(self, "action names", error);
+    }
+
+    if (names != NULL) CFRelease(names);
+    return result;
+}
+
+static PyObject * AccessibleElement_schema(AccessibleElement * self, PyObject * args) {
+    return elementSchema(self);
+}
+
+static PyObject * AccessibleElement_action_description(AccessibleElement * self, PyObject * args) {
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count != 1) {
+        PyErr_SetString(PyExc_ValueError, "An action name must be specified to retrieve its description.");
+        return NULL;
+    }
+    // The first argument should be a string
+    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
+    if (!name) {
+        return NULL; // PyTuple_GetItem will set an Index error.
+    }
+    char * name_string = NULL;
+    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+
+    // Check for the action's description
+    CFStringRef descr;
+    AXError error = copyActionDescription(self, name_strref, &descr);
+    if (name_strref != NULL) CFRelease(name_strref);
+
+    if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, name_string, error);
+        return NULL;
+    }
+    return tracedParseCFTypeRef(typeState(Py_TYPE(self)), descr, self->_pid);
+}
+
+static PyObject * AccessibleElement_perform_action(AccessibleElement * self, PyObject * args) {
+    Py_ssize_t attribute_count = PyTuple_Size(args);
+    if (attribute_count != 1) {
+        PyErr_SetString(PyExc_ValueError, "An action name must be specified.");
+        return NULL;
+    }
+    // The first argument should be a string
+    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
+    if (!name) {
+        return NULL; // PyTuple_GetItem will set an Index error.
+    }
+    char * name_string = NULL;
+    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
+    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+
+    // Check for the action's description
+    AXError error = performAction(self, name_strref);
+    if (name_strref != NULL) CFRelease(name_strref);
+
+    if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, name_string, error);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef AccessibleElement_methods[] = {
+    // Attributes
+    {"keys", (PyCFunction) AccessibleElement_keys, METH_NOARGS, keys_docstring},
+    {"count", (PyCFunction) AccessibleElement_count, METH_VARARGS, count_docstring},
+    {"get", (PyCFunction) AccessibleElement_get, METH_VARARGS, get_docstring},
+    {"get_parameterized", (PyCFunction) AccessibleElement_get_parameterized, METH_VARARGS, get_parameterized_docstring},
+    {"set", (PyCFunction) AccessibleElement_set, METH_VARARGS, set_docstring},
+    {"can_set", (PyCFunction) AccessibleElement_can_set, METH_VARARGS, can_set_docstring},
+    {"schema", (PyCFunction) AccessibleElement_schema, METH_NOARGS, schema_docstring},
+    // Notification API
+    {"watch", (PyCFunction) AccessibleElement_watch, METH_VARARGS, watch_docstring},
+    {"set_callback", (PyCFunction) AccessibleElement_set_callback, METH_VARARGS, set_callback_docstring},
+    // Action API
+    {"actions", (PyCFunction) AccessibleElement_actions, METH_NOARGS, actions_docstring},
+    {"action_description", (PyCFunction) AccessibleElement_action_description, METH_VARARGS, action_desciption_docstring},
+    {"perform_action", (PyCFunction) AccessibleElement_perform_action, METH_VARARGS, perform_action_docstring},
+    // Misc
+    {"set_timeout", (PyCFunction) AccessibleElement_set_timeout, METH_VARARGS, set_timeout_docstring},
+    {"is_alive", (PyCFunction) AccessibleElement_is_alive, METH_NOARGS, is_alive_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef AccessibleElement_members[] = {
+    {"pid", T_OBJECT_EX, offsetof(AccessibleElement, pid), READONLY, "The process ID associated with this element, if it has one."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyType_Slot AccessibleElement_slots[] = {
+    {Py_tp_dealloc, (void *) AccessibleElement_dealloc},
+    {Py_tp_doc, (void *) AccessibleElement_docstring},
+    {Py_tp_richcompare, (void *) AccessibleElement_richcompare},
+    {Py_tp_methods, (void *) AccessibleElement_methods},
+    {Py_tp_members, (void *) AccessibleElement_members},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {Py_sq_contains, (void *) AccessibleElement_contains},
+    {Py_mp_subscript, (void *) AccessibleElement_subscript},
+    {Py_mp_ass_subscript, (void *) AccessibleElement_ass_subscript},
+    {0, NULL}
+};
+
+static PyType_Spec AccessibleElement_spec = {
+    "accessibility.AccessibleElement",
+    sizeof(AccessibleElement),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    AccessibleElement_slots
+};
+
+/* Geometry class
+======== */
+
+static void Geometry_dealloc(Geometry * self) {
+    PyMem_Free(self->data);
+    Py_XDECREF(self->elements);
+    freeInstance((PyObject *) self);
+}
+
+static Py_ssize_t Geometry_length(Geometry * self) {
+    return self->count;
+}
+
+static int Geometry_getbuffer(Geometry * self, Py_buffer * view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Geometry is read-only.");
+        view->obj = NULL;
+        return -1;
+    }
+    // The data never changes while the object lives, so views need no tracking
+    view->buf = self->data;
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->len = 4 * self->count * (Py_ssize_t) sizeof(double);
+    view->readonly = 1;
+    view->itemsize = sizeof(double);
+    view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+
+
+static PyMemberDef Geometry_members[] = {
+    {"elements", T_OBJECT_EX, offsetof(Geometry, elements), READONLY, "The elements described, as a tuple in the order of the columns."},
+    {"missing", T_PYSSIZET, offsetof(Geometry, missing), READONLY, "How many of the elements could not be read."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyType_Slot Geometry_slots[] = {
+    {Py_tp_dealloc, (void *) Geometry_dealloc},
+    {Py_tp_doc, (void *) Geometry_docstring},
+    {Py_tp_members, (void *) Geometry_members},
+    {Py_sq_length, (void *) Geometry_length},
+#if PY_MAJOR_VERSION < 3 || defined(MULTI_PHASE_INIT)
+    // Before 3.9, specs cannot set buffer slots; see newType
+    {Py_bf_getbuffer, (void *) Geometry_getbuffer},
+#endif
+    {0, NULL}
+};
+
+static PyType_Spec Geometry_spec = {
+    "accessibility.Geometry",
+    sizeof(Geometry),
+    0,
+#if PY_MAJOR_VERSION >= 3
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+    Geometry_slots
+};
+
+/* Snapshot class
+======== */
+
+static void Snapshot_release(Snapshot * self) {
+    if (self->strings != NULL) {
+        for (uint32_t i = 0; i < self->reader.string_count; i++) Py_XDECREF(self->strings[i]);
+        free(self->strings);
+        self->strings = NULL;
+    }
+    if (self->open) snapshotClose(&self->reader);
+    self->open = 0;
+    if (self->map != NULL) munmap(self->map, self->map_size);
+    self->map = NULL;
+    if (self->has_view) PyBuffer_Release(&self->view);
+    self->has_view = 0;
+    Py_CLEAR(self->attributes);
+}
+
+static void Snapshot_dealloc(Snapshot * self) {
+    Snapshot_release(self);
+    freeInstance((PyObject *) self);
+}
+
+static int Snapshot_init(Snapshot * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"source", NULL};
+    PyObject * source;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &source)) return -1;
+    Snapshot_release(self);
+
+    const uint8_t * bytes;
+    size_t size;
+#if PY_MAJOR_VERSION >= 3
+    if (PyUnicode_Check(source)) {
+#else
+    // snapshot() returns a str too, which no path could start like
+    if (PyUnicode_Check(source) || (PyString_Check(source) && (PyString_GET_SIZE(source) < LOG_MAGIC_LENGTH
+            || memcmp(PyString_AS_STRING(source), SNAPSHOT_MAGIC, LOG_MAGIC_LENGTH) != 0))) {
+#endif
+        const char * path;
+        if (!PyArg_Parse(source, "s", &path)) return -1;
+        int fd = open(path, O_RDONLY);
+        struct stat info;
+        if (fd == -1 || fstat(fd, &info) == -1) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        if (info.st_size > 0) {
+            void * map = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+                close(fd);
+                return -1;
+            }
+            self->map = map;
+            self->map_size = (size_t) info.st_size;
+        }
+        close(fd);
+        bytes = self->map;
+        size = self->map_size;
+    } else {
+        if (PyObject_GetBuffer(source, &self->view, PyBUF_SIMPLE) == -1) {
+            PyErr_SetString(PyExc_TypeError, "The source must be a path or a bytes-like object.");
+            return -1;
+        }
+        self->has_view = 1;
+        bytes = self->view.buf;
+        size = (size_t) self->view.len;
+    }
+
+    char message[128];
+    if (snapshotOpen(&self->reader, bytes, size, message, sizeof(message)) == -1) {
+        Snapshot_release(self);
+        PyErr_SetString(PyExc_ValueError, message);
+        return -1;
+    }
+    self->open = 1;
+    self->pid = self->reader.pid;
+    self->time = self->reader.time / 1e6;
+
+    self->attributes = PyTuple_New(self->reader.column_count);
+    for (uint32_t i = 0; self->attributes != NULL && i < self->reader.column_count; i++) {
+        size_t length;
+        const uint8_t * name = snapshotString(&self->reader, self->reader.columns[i].name, &length);
+        PyObject * item = stringFromUTF8((const char *) name, (Py_ssize_t) length);
+        if (item == NULL) {
+            Snapshot_release(self);
+            return -1;
+        }
+        PyTuple_SET_ITEM(self->attributes, i, item);
+    }
+    if (self->attributes == NULL) {
+        Snapshot_release(self);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * Snapshot_node(uint32_t node) {
+#if PY_MAJOR_VERSION >= 3
+    return PyLong_FromUnsignedLong(node);
+#else
+    return PyInt_FromSize_t(node);
+#endif
+}
+
+static int Snapshot_check(Snapshot * self, Py_ssize_t node) {
+    if (!self->open) {
+        PyErr_SetString(PyExc_ValueError, "The snapshot is closed.");
+        return -1;
+    }
+    if (node < 0 || node >= (Py_ssize_t) self->reader.node_count) {
+        PyErr_SetString(PyExc_IndexError, "There is no node with that number.");
+        return -1;
+    }
+    return 0;
+}
+
+// Finds the column of an attribute, decoding it if need be.
+static SnapshotColumn * Snapshot_column_named(Snapshot * self, PyObject * name) {
+    if (!self->open) {
+        PyErr_SetString(PyExc_ValueError, "The snapshot is closed.");
+        return NULL;
+    }
+    char * bytes;
+    Py_ssize_t length;
+#if PY_MAJOR_VERSION >= 3
+    if (!PyUnicode_Check(name) || (bytes = (char *) PyUnicode_AsUTF8AndSize(name, &length)) == NULL) {
+#else
+    if (!PyString_Check(name) || PyString_AsStringAndSize(name, &bytes, &length) == -1) {
+#endif
+        if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "Attribute names must be strings.");
+        return NULL;
+    }
+    int64_t index = snapshotFindString(&self->reader, bytes, (size_t) length);
+    for (uint32_t i = 0; index >= 0 && i < self->reader.column_count; i++) {
+        SnapshotColumn * column = &self->reader.columns[i];
+        if (column->name != (uint32_t) index) continue;
+        if (snapshotLoadColumn(&self->reader, column) == -1) {
+            PyErr_SetString(PyExc_ValueError, "The snapshot is damaged.");
+            return NULL;
+        }
+        return column;
+    }
+    PyErr_SetObject(PyExc_KeyError, name);
+    return NULL;
+}
+
+static PyObject * Snapshot_decode(Snapshot * self, LogReader * value, int depth) {
+    if (depth > LOG_MAX_DEPTH) value->failed = 1;
+    int tag = value->failed ? -1 : logReadByte(value);
+    switch (tag) {
+        case SNAPSHOT_VALUE_NONE:
+            Py_RETURN_NONE;
+        case SNAPSHOT_VALUE_STRING: {
+            size_t length;
+            uint32_t index = (uint32_t) logReadVarint(value);
+            const uint8_t * bytes = snapshotString(&self->reader, index, &length);
+            if (bytes == NULL) break;
+            if (length > INTERN_MAX_LENGTH) return stringFromUTF8((const char *) bytes, (Py_ssize_t) length);
+
+            // Roles and the like repeat throughout, so each is decoded once
+            if (self->strings == NULL) {
+                self->strings = (PyObject **) calloc(self->reader.string_count, sizeof(PyObject *));
+                if (self->strings == NULL) return PyErr_NoMemory();
+            }
+            if (self->strings[index] == NULL) {
+                self->strings[index] = stringFromUTF8((const char *) bytes, (Py_ssize_t) length);
+                if (self->strings[index] == NULL) return NULL;
+            }
+            Py_INCREF(self->strings[index]);
+            return self->strings[index];
+        }
+        case SNAPSHOT_VALUE_FALSE:
+            Py_RETURN_FALSE;
+        case SNAPSHOT_VALUE_TRUE:
+            Py_RETURN_TRUE;
+        case SNAPSHOT_VALUE_INTEGER:
+            return PyLong_FromLongLong(logReadSigned(value));
+        case SNAPSHOT_VALUE_REAL:
+            return PyFloat_FromDouble(logReadReal(value));
+        case SNAPSHOT_VALUE_ELEMENT: {
+            uint64_t node = logReadVarint(value);
+            if (node == 0) Py_RETURN_NONE;
+            if (node > self->reader.node_count) break;
+            return Snapshot_node((uint32_t) node - 1);
+        }
+        case SNAPSHOT_VALUE_ARRAY: {
+            uint64_t count = logReadVarint(value);
+            // Every value takes at least a byte, which bounds the count
+            if (count > (uint64_t) (value->end - value->position)) break;
+            PyObject * list = PyList_New((Py_ssize_t) count);
+            for (uint64_t i = 0; list != NULL && i < count; i++) {
+                PyObject * item = Snapshot_decode(self, value, depth + 1);
+                if (item == NULL) Py_CLEAR(list);
+                else PyList_SET_ITEM(list, (Py_ssize_t) i, item);
+            }
+            return list;
+        }
+        case SNAPSHOT_VALUE_POINT:
+        case SNAPSHOT_VALUE_SIZE: {
+            PyTypeObject * type = (tag == SNAPSHOT_VALUE_POINT) ? typeState(Py_TYPE(self))->Point_type : typeState(Py_TYPE(self))->Size_type;
+            double fields[2];
+            fields[0] = snapshotReadCoordinate(value);
+            fields[1] = snapshotReadCoordinate(value);
+            return newGeometry(type, fields, 2);
+        }
+        case SNAPSHOT_VALUE_RECT: {
+            double fields[4];
+            for (int i = 0; i < 4; i++) fields[i] = snapshotReadCoordinate(value);
+            return newGeometry(typeState(Py_TYPE(self))->Rect_type, fields, 4);
+        }
+        case SNAPSHOT_VALUE_RANGE: {
+            PyObject * result = newValue(typeState(Py_TYPE(self))->Range_type, 2);
+            if (result == NULL) return NULL;
+            for (int i = 0; i < 2; i++) {
+                PyObject * field = PyLong_FromLongLong(logReadSigned(value));
+                if (field == NULL) {
+                    Py_DECREF(result);
+                    return NULL;
+                }
+                PyStructSequence_SET_ITEM(result, i, field);
+            }
+            return result;
+        }
+    }
+    if (!PyErr_Occurred()) PyErr_SetString(PyExc_ValueError, "The snapshot is damaged.");
+    return NULL;
+}
+
+// Decodes the value of a node in a column, or returns NULL without an error if it has none.
+static PyObject * Snapshot_value(Snapshot * self, SnapshotColumn * column, uint32_t node) {
+    uint32_t slot = column->slots[node];
+    if (slot == 0) return NULL;
+    LogReader value = { column->values[slot - 1], column->end, 0 };
+    PyObject * result = Snapshot_decode(self, &value, 0);
+    if (result != NULL && value.failed) {
+        Py_DECREF(result);
+        PyErr_SetString(PyExc_ValueError, "The snapshot is damaged.");
+        return NULL;
+    }
+    return result;
+}
+
+static Py_ssize_t Snapshot_length_impl(Snapshot * self) {
+    return self->open ? (Py_ssize_t) self->reader.node_count : 0;
+}
+
+static PyObject * Snapshot_get_impl(Snapshot * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"node", "attribute", "default", NULL};
+    Py_ssize_t node;
+    PyObject * name;
+    PyObject * fallback = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nO|O", kwlist, &node, &name, &fallback)) return NULL;
+    if (Snapshot_check(self, node) == -1) return NULL;
+    SnapshotColumn * column = Snapshot_column_named(self, name);
+    if (column == NULL) return NULL;
+
+    PyObject * value = Snapshot_value(self, column, (uint32_t) node);
+    if (value == NULL && !PyErr_Occurred()) {
+        Py_INCREF(fallback);
+        return fallback;
+    }
+    return value;
+}
+
+static PyObject * Snapshot_parent_impl(Snapshot * self, PyObject * args) {
+    Py_ssize_t node;
+    if (!PyArg_ParseTuple(args, "n", &node) || Snapshot_check(self, node) == -1) return NULL;
+    uint32_t parent = self->reader.parents[node];
+    if (parent == SNAPSHOT_NO_PARENT) Py_RETURN_NONE;
+    return Snapshot_node(parent);
+}
+
+static PyObject * Snapshot_children_impl(Snapshot * self, PyObject * args) {
+    Py_ssize_t node;
+    if (!PyArg_ParseTuple(args, "n", &node) || Snapshot_check(self, node) == -1) return NULL;
+    PyObject * children = PyList_New(0);
+    uint32_t end = (uint32_t) node + self->reader.sizes[node];
+    for (uint32_t child = (uint32_t) node + 1; children != NULL && child < end; child += self->reader.sizes[child]) {
+        PyObject * item = Snapshot_node(child);
+        if (item == NULL || PyList_Append(children, item) == -1) Py_CLEAR(children);
+        Py_XDECREF(item);
+    }
+    return children;
+}
+
+static PyObject * Snapshot_column_impl(Snapshot * self, PyObject * args) {
+    PyObject * name;
+    if (!PyArg_ParseTuple(args, "O", &name)) return NULL;
+    SnapshotColumn * column = Snapshot_column_named(self, name);
+    if (column == NULL) return NULL;
+
+    PyObject * values = PyList_New(self->reader.node_count);
+    for (uint32_t node = 0; values != NULL && node < self->reader.node_count; node++) {
+        PyObject * value = Snapshot_value(self, column, node);
+        if (value == NULL && PyErr_Occurred()) {
+            Py_CLEAR(values);
+            break;
+        }
+        if (value == NULL) {
+            value = Py_None;
+            Py_INCREF(value);
+        }
+        PyList_SET_ITEM(values, node, value);
+    }
+    return values;
+}
+
+static PyObject * Snapshot_find_impl(Snapshot * self, PyObject * args) {
+    PyObject * name;
+    PyObject * wanted;
+    if (!PyArg_ParseTuple(args, "OO", &name, &wanted)) return NULL;
+    SnapshotColumn * column = Snapshot_column_named(self, name);
+    if (column == NULL) return NULL;
+
+    // Strings are compared by their index in the string table
+    int64_t string = -2;
+#if PY_MAJOR_VERSION >= 3
+    if (PyUnicode_Check(wanted)) {
+        Py_ssize_t length;
+        const char * bytes = PyUnicode_AsUTF8AndSize(wanted, &length);
+#else
+    if (PyString_Check(wanted)) {
+        Py_ssize_t length = PyString_GET_SIZE(wanted);
+        const char * bytes = PyString_AS_STRING(wanted);
+#endif
+        if (bytes == NULL) return NULL;
+        string = snapshotFindString(&self->reader, bytes, (size_t) length);
+    }
+
+    PyObject * found = PyList_New(0);
+    for (uint32_t node = 0; found != NULL && string != -1 && node < self->reader.node_count; node++) {
+        if (column->slots[node] == 0) continue;
+        int matches;
+        if (string >= 0) {
+            LogReader value = { column->values[column->slots[node] - 1], column->end, 0 };
+            matches = logReadByte(&value) == SNAPSHOT_VALUE_STRING && logReadVarint(&value) == (uint64_t) string;
+        } else {
+            PyObject * value = Snapshot_value(self, column, node);
+            matches = (value != NULL) ? PyObject_RichCompareBool(value, wanted, Py_EQ) : -1;
+            Py_XDECREF(value);
+        }
+        if (matches == -1) {
+            Py_CLEAR(found);
+        } else if (matches) {
+            PyObject * item = Snapshot_node(node);
+            if (item == NULL || PyList_Append(found, item) == -1) Py_CLEAR(found);
+            Py_XDECREF(item);
+        }
+    }
+    return found;
+}
+
+static PyObject * Snapshot_close_impl(Snapshot * self) {
+    Snapshot_release(self);
+    Py_RETURN_NONE;
+}
+
+/*
+ * Columns are decoded on first use and the snapshot can be closed at any
+ * time, so on free-threaded builds each method holds the snapshot's lock.
+ */
+
+static Py_ssize_t Snapshot_length(Snapshot * self) {
+    Py_ssize_t result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_length_impl(self);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_get(Snapshot * self, PyObject * args, PyObject * kwargs) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_get_impl(self, args, kwargs);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_parent(Snapshot * self, PyObject * args) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_parent_impl(self, args);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_children(Snapshot * self, PyObject * args) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_children_impl(self, args);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_column(Snapshot * self, PyObject * args) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_column_impl(self, args);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_find(Snapshot * self, PyObject * args) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_find_impl(self, args);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * Snapshot_close(Snapshot * self) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Snapshot_close_impl(self);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+
+static PyMethodDef Snapshot_methods[] = {
+    {"get", (PyCFunction) Snapshot_get, METH_VARARGS|METH_KEYWORDS, Snapshot_get_docstring},
+    {"parent", (PyCFunction) Snapshot_parent, METH_VARARGS, Snapshot_parent_docstring},
+    {"children", (PyCFunction) Snapshot_children, METH_VARARGS, Snapshot_children_docstring},
+    {"column", (PyCFunction) Snapshot_column, METH_VARARGS, Snapshot_column_docstring},
+    {"find", (PyCFunction) Snapshot_find, METH_VARARGS, Snapshot_find_docstring},
+    {"close", (PyCFunction) Snapshot_close, METH_NOARGS, Snapshot_close_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef Snapshot_members[] = {
+    {"attributes", T_OBJECT, offsetof(Snapshot, attributes), READONLY, "The names of the attributes captured, as a tuple."},
+    {"pid", T_INT, offsetof(Snapshot, pid), READONLY, "The process ID of the application captured."},
+    {"time", T_DOUBLE, offsetof(Snapshot, time), READONLY, "When the snapshot was taken, in seconds since the epoch."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyType_Slot Snapshot_slots[] = {
+    {Py_tp_dealloc, (void *) Snapshot_dealloc},
+    {Py_tp_doc, (void *) Snapshot_docstring},
+    {Py_tp_methods, (void *) Snapshot_methods},
+    {Py_tp_members, (void *) Snapshot_members},
+    {Py_tp_init, (void *) Snapshot_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {Py_sq_length, (void *) Snapshot_length},
+    {0, NULL}
+};
+
+static PyType_Spec Snapshot_spec = {
+    "accessibility.Snapshot",
+    sizeof(Snapshot),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    Snapshot_slots
+};
+
+/* Shared snapshot classes
+======== */
+
+// Both classes keep a region and a lock for it, in the same place.
+static void sharedClose(SnapshotShare * share, pthread_mutex_t * lock, int has_lock) {
+    if (!has_lock) return;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(lock);
+    Py_END_ALLOW_THREADS
+    snapshotShareClose(share);
+    pthread_mutex_unlock(lock);
+}
+
+static int sharedInit(const char * name, SnapshotShare * share, pthread_mutex_t * lock, int * has_lock, int error) {
+    if (error != 0) {
+        if (error == EBUSY) {
+            PyErr_Format(PyExc_OSError, "Another process is publishing to '%s'.", name);
+        } else if (error == EINVAL) {
+            PyErr_Format(PyExc_ValueError, "'%s' is not a snapshot region.", name);
+        } else {
+            errno = error;
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+        }
+        return -1;
+    }
+    if (!*has_lock) {
+        pthread_mutex_init(lock, NULL);
+        *has_lock = 1;
+    }
+    return 0;
+}
+
+static int sharedCheck(const SnapshotShare * share) {
+    if (share->region != NULL) return 0;
+    PyErr_SetString(PyExc_ValueError, "The region is closed.");
+    return -1;
+}
+
+static void SnapshotPublisher_dealloc(SnapshotPublisher * self) {
+    sharedClose(&self->share, &self->lock, self->has_lock);
+    if (self->has_lock) pthread_mutex_destroy(&self->lock);
+    Py_CLEAR(self->name);
+    freeInstance((PyObject *) self);
+}
+
+static int SnapshotPublisher_init(SnapshotPublisher * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"name", "capacity", NULL};
+    PyObject * name_object;
+    const char * name;
+    Py_ssize_t capacity = 16 << 20;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n", kwlist, &name_object, &capacity)) return -1;
+    if (!PyArg_Parse(name_object, "s", &name)) return -1;
+    if (capacity <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The capacity must be positive.");
+        return -1;
+    }
+    sharedClose(&self->share, &self->lock, self->has_lock);
+    Py_INCREF(name_object);
+    Py_XDECREF(self->name);
+    self->name = name_object;
+
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = snapshotShareCreate(&self->share, name, (size_t) capacity);
+    Py_END_ALLOW_THREADS
+    self->generation = 0;
+    return sharedInit(name, &self->share, &self->lock, &self->has_lock, error);
+}
+
+static PyObject * SnapshotPublisher_publish(SnapshotPublisher * self, PyObject * args) {
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "s*", &data)) return NULL;
+
+    uint64_t generation = 0;
+    int closed = 0;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    if (self->share.region == NULL) closed = 1;
+    else generation = snapshotSharePublish(&self->share, data.buf, (size_t) data.len);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+
+    if (closed) {
+        sharedCheck(&self->share);
+        return NULL;
+    }
+    if (generation == 0) {
+        PyErr_Format(PyExc_ValueError, "The snapshot is larger than the region's capacity of %zu bytes.",
+                     snapshotShareCapacity(&self->share));
+        return NULL;
+    }
+    self->generation = generation;
+    return PyLong_FromUnsignedLongLong(generation);
+}
+
+static PyObject * SnapshotPublisher_close(SnapshotPublisher * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"unlink", NULL};
+    PyObject * unlink = Py_True;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &unlink)) return NULL;
+    if (self->share.region == NULL) Py_RETURN_NONE;
+    sharedClose(&self->share, &self->lock, self->has_lock);
+
+    const char * name;
+    int remove = PyObject_IsTrue(unlink);
+    if (remove == -1 || !PyArg_Parse(self->name, "s", &name)) return NULL;
+    if (remove) shm_unlink(name);
+    Py_RETURN_NONE;
+}
+
+static PyObject * SnapshotPublisher_capacity(SnapshotPublisher * self, void * closure) {
+    if (sharedCheck(&self->share) == -1) return NULL;
+    return PyLong_FromSize_t(snapshotShareCapacity(&self->share));
+}
+
+static PyMethodDef SnapshotPublisher_methods[] = {
+    {"publish", (PyCFunction) SnapshotPublisher_publish, METH_VARARGS, SnapshotPublisher_publish_docstring},
+    {"close", (PyCFunction) SnapshotPublisher_close, METH_VARARGS|METH_KEYWORDS, SnapshotPublisher_close_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef SnapshotPublisher_members[] = {
+    {"name", T_OBJECT, offsetof(SnapshotPublisher, name), READONLY, "The name of the region."},
+    {"generation", T_ULONGLONG, offsetof(SnapshotPublisher, generation), READONLY, "The generation last published, or 0."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef SnapshotPublisher_getset[] = {
+    {"capacity", (getter) SnapshotPublisher_capacity, NULL, "The largest snapshot that can be published, in bytes.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot SnapshotPublisher_slots[] = {
+    {Py_tp_dealloc, (void *) SnapshotPublisher_dealloc},
+    {Py_tp_doc, (void *) SnapshotPublisher_docstring},
+    {Py_tp_methods, (void *) SnapshotPublisher_methods},
+    {Py_tp_members, (void *) SnapshotPublisher_members},
+    {Py_tp_getset, (void *) SnapshotPublisher_getset},
+    {Py_tp_init, (void *) SnapshotPublisher_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec SnapshotPublisher_spec = {
+    "accessibility.SnapshotPublisher",
+    sizeof(SnapshotPublisher),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    SnapshotPublisher_slots
+};
+
+static void SnapshotSubscriber_dealloc(SnapshotSubscriber * self) {
+    sharedClose(&self->share, &self->lock, self->has_lock);
+    if (self->has_lock) pthread_mutex_destroy(&self->lock);
+    Py_CLEAR(self->name);
+    freeInstance((PyObject *) self);
+}
+
+static int SnapshotSubscriber_init(SnapshotSubscriber * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"name", NULL};
+    PyObject * name_object;
+    const char * name;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &name_object)) return -1;
+    if (!PyArg_Parse(name_object, "s", &name)) return -1;
+    sharedClose(&self->share, &self->lock, self->has_lock);
+    Py_INCREF(name_object);
+    Py_XDECREF(self->name);
+    self->name = name_object;
+
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = snapshotShareAttach(&self->share, name);
+    Py_END_ALLOW_THREADS
+    return sharedInit(name, &self->share, &self->lock, &self->has_lock, error);
+}
+
+static PyObject * SnapshotSubscriber_read(SnapshotSubscriber * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"raw", NULL};
+    PyObject * raw = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &raw)) return NULL;
+    int want_raw = PyObject_IsTrue(raw);
+    if (want_raw == -1 || sharedCheck(&self->share) == -1) return NULL;
+
+    // The bytes are allocated at the size last seen, and again if it grows
+    PyObject * bytes = NULL;
+    size_t length = 0;
+    uint64_t generation = 0;
+    int result;
+    for (;;) {
+        uint8_t * out = (bytes != NULL) ? (uint8_t *) PyBytes_AS_STRING(bytes) : NULL;
+        size_t size = (bytes != NULL) ? (size_t) PyBytes_GET_SIZE(bytes) : 0;
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->lock);
+        result = (self->share.region != NULL) ? snapshotShareRead(&self->share, out, size, &length, &generation) : -2;
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+        if (result != 1) break;
+        Py_XDECREF(bytes);
+        bytes = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) length);
+        if (bytes == NULL) return NULL;
+    }
+
+    if (result == -2) {
+        Py_XDECREF(bytes);
+        sharedCheck(&self->share);
+        return NULL;
+    }
+    if (result == -1) {
+        Py_XDECREF(bytes);
+        return Py_BuildValue("(iO)", 0, Py_None);
+    }
+    if (bytes == NULL) bytes = PyBytes_FromStringAndSize(NULL, 0);
+    else if ((size_t) PyBytes_GET_SIZE(bytes) != length) _PyBytes_Resize(&bytes, (Py_ssize_t) length);
+    if (bytes == NULL) return NULL;
+
+    PyObject * value = bytes;
+    if (!want_raw) {
+        value = PyObject_CallFunctionObjArgs((PyObject *) typeState(Py_TYPE(self))->Snapshot_type, bytes, NULL);
+        Py_DECREF(bytes);
+        if (value == NULL) return NULL;
+    }
+    PyObject * pair = Py_BuildValue("(KO)", (unsigned long long) generation, value);
+    Py_DECREF(value);
+    return pair;
+}
+
+static PyObject * SnapshotSubscriber_close(SnapshotSubscriber * self) {
+    sharedClose(&self->share, &self->lock, self->has_lock);
+    Py_RETURN_NONE;
+}
+
+static PyObject * SnapshotSubscriber_generation(SnapshotSubscriber * self, void * closure) {
+    if (sharedCheck(&self->share) == -1) return NULL;
+    return PyLong_FromUnsignedLongLong(snapshotShareGeneration(&self->share));
+}
+
+static PyObject * SnapshotSubscriber_publisher(SnapshotSubscriber * self, void * closure) {
+    if (sharedCheck(&self->share) == -1) return NULL;
+    pid_t pid = snapshotSharePublisher(&self->share);
+    if (pid == 0) Py_RETURN_NONE;
+    return PyLong_FromLong((long) pid);
+}
+
+static PyObject * SnapshotSubscriber_time(SnapshotSubscriber * self, void * closure) {
+    if (sharedCheck(&self->share) == -1) return NULL;
+    uint64_t time = snapshotShareTime(&self->share);
+    if (time == 0) Py_RETURN_NONE;
+    return PyFloat_FromDouble(time / 1e6);
+}
+
+static PyMethodDef SnapshotSubscriber_methods[] = {
+    {"read", (PyCFunction) SnapshotSubscriber_read, METH_VARARGS|METH_KEYWORDS, SnapshotSubscriber_read_docstring},
+    {"close", (PyCFunction) SnapshotSubscriber_close, METH_NOARGS, SnapshotSubscriber_close_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef SnapshotSubscriber_members[] = {
+    {"name", T_OBJECT, offsetof(SnapshotSubscriber, name), READONLY, "The name of the region."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef SnapshotSubscriber_getset[] = {
+    {"generation", (getter) SnapshotSubscriber_generation, NULL, "The generation of the latest snapshot, or 0 if there is none yet.", NULL},
+    {"publisher", (getter) SnapshotSubscriber_publisher, NULL, "The process ID of the publisher, or None once it has closed the region.", NULL},
+    {"time", (getter) SnapshotSubscriber_time, NULL, "When the latest snapshot was published, in seconds since the epoch.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot SnapshotSubscriber_slots[] = {
+    {Py_tp_dealloc, (void *) SnapshotSubscriber_dealloc},
+    {Py_tp_doc, (void *) SnapshotSubscriber_docstring},
+    {Py_tp_methods, (void *) SnapshotSubscriber_methods},
+    {Py_tp_members, (void *) SnapshotSubscriber_members},
+    {Py_tp_getset, (void *) SnapshotSubscriber_getset},
+    {Py_tp_init, (void *) SnapshotSubscriber_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec SnapshotSubscriber_spec = {
+    "accessibility.SnapshotSubscriber",
+    sizeof(SnapshotSubscriber),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    SnapshotSubscriber_slots
+};
+
+static void textReaderClear(TextReader * self) {
+    for (Py_ssize_t i = 0; i < self->chunk_count; i++) Py_CLEAR(self->chunks[i].text);
+    free(self->chunks);
+    self->chunks = NULL;
+    self->chunk_count = 0;
+}
+
+static void TextReader_dealloc(TextReader * self) {
+    textReaderClear(self);
+    Py_CLEAR(self->element);
+    freeInstance((PyObject *) self);
+}
+
+// Reads the length of the text (and the visible range), and makes room for its chunks.
+static int textReaderMeasure(TextReader * self) {
+    AccessibleElement * element = (AccessibleElement *) self->element;
+    CFTypeRef value = NULL;
+    AXError error = copyAttributeValue(element, kAXNumberOfCharactersAttribute, &value);
+    CFIndex length = 0;
+    if (error == kAXErrorSuccess) {
+        if (CFGetTypeID(value) != CFNumberGetTypeID() || !CFNumberGetValue(value, kCFNumberCFIndexType, &length) || length < 0)
+            error = kAXErrorNoValue;
+        CFRelease(value);
+    }
+    if (error != kAXErrorSuccess) {
+        handleElementAXErrors(element, "AXNumberOfCharacters", error);
+        return -1;
+    }
+
+    CFRange range = CFRangeMake(0, length);
+    if (self->visible) {
+        value = NULL;
+        error = copyAttributeValue(element, kAXVisibleCharacterRangeAttribute, &value);
+        if (error == kAXErrorSuccess) {
+            if (CFGetTypeID(value) != AXValueGetTypeID() || !AXValueGetValue(value, kAXValueCFRangeType, (void *) &range))
+                error = kAXErrorNoValue;
+            CFRelease(value);
+        }
+        if (error != kAXErrorSuccess) {
+            handleElementAXErrors(element, "AXVisibleCharacterRange", error);
+            return -1;
+        }
+        // Applications have been known to report ranges past the end of the text
+        if (range.location < 0) range.location = 0;
+        if (range.location > length) range.location = length;
+        if (range.length < 0 || range.length > length - range.location) range.length = length - range.location;
+    }
+
+    Py_ssize_t count = (length + self->chunk_size - 1) / self->chunk_size;
+    if (count != self->chunk_count) {
+        for (Py_ssize_t i = count; i < self->chunk_count; i++) Py_CLEAR(self->chunks[i].text);
+        TextChunk * chunks = realloc(self->chunks, (count > 0 ? count : 1) * sizeof(TextChunk));
+        if (chunks == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        for (Py_ssize_t i = self->chunk_count; i < count; i++) chunks[i].text = NULL;
+        self->chunks = chunks;
+        self->chunk_count = count;
+    }
+    self->length = length;
+    self->range = range;
+    return 0;
+}
+
+// The first and one past the last chunk in the range.
+static Py_ssize_t textReaderFirst(TextReader * self) {
+    return self->range.location / self->chunk_size;
+}
+
+static Py_ssize_t textReaderEnd(TextReader * self) {
+    if (self->range.length == 0) return textReaderFirst(self);
+    return (self->range.location + self->range.length - 1) / self->chunk_size + 1;
+}
+
+// The part of a chunk that lies in the range.
+static CFRange textReaderPiece(TextReader * self, Py_ssize_t i) {
+    CFIndex start = (CFIndex) i * self->chunk_size;
+    CFIndex end = start + self->chunk_size;
+    if (start < self->range.location) start = self->range.location;
+    if (end > self->range.location + self->range.length) end = self->range.location + self->range.length;
+    return CFRangeMake(start, end - start);
+}
+
+// Whether the units at index and index + 1 are the two halves of one character.
+static int textReaderPair(CFStringRef string, CFIndex length, CFIndex index) {
+    return index >= 0 && index + 1 < length
+        && CFStringIsSurrogateHighCharacter(CFStringGetCharacterAtIndex(string, index))
+        && CFStringIsSurrogateLowCharacter(CFStringGetCharacterAtIndex(string, index + 1));
+}
+
+// Chunks are cut at fixed offsets, which can fall inside a surrogate pair. A
+// unit is read either side of the piece, and a pair across its end is kept
+// whole in it and left out of the next, so that every chunk converts.
+static CFTypeRef textReaderTrim(CFStringRef string, CFIndex before, CFIndex after) {
+    CFIndex length = CFStringGetLength(string);
+    CFIndex start = before < length ? before : length;
+    CFIndex end = length - after > start ? length - after : start;
+    if (before > 0 && textReaderPair(string, length, start - 1)) start++;
+    if (after > 0 && textReaderPair(string, length, end - 1)) end++;
+    if (end < start) end = start;
+    return CFStringCreateWithSubstring(kCFAllocatorDefault, string, CFRangeMake(start, end - start));
+}
+
+// Reads a chunk's text, replacing whatever was read before. Returns it (borrowed), or NULL.
+static PyObject * textReaderFetch(TextReader * self, Py_ssize_t i) {
+    AccessibleElement * element = (AccessibleElement *) self->element;
+    CFRange piece = textReaderPiece(self, i);
+    CFIndex before = piece.location > self->range.location ? 1 : 0;
+    CFIndex after = piece.location + piece.length < self->range.location + self->range.length ? 1 : 0;
+    CFRange wide = CFRangeMake(piece.location - before, piece.length + before + after);
+    CFTypeRef parameter = AXValueCreate(kAXValueCFRangeType, (const void *) &wide);
+    if (parameter == NULL) return PyErr_NoMemory();
+
+    CFTypeRef value = NULL;
+    AXError error = copyParameterizedAttributeValue(element, kAXStringForRangeParameterizedAttribute, parameter, &value);
+    CFRelease(parameter);
+    if (error != kAXErrorSuccess) {
+        if (value != NULL) CFRelease(value);
+        handleElementAXErrors(element, "AXStringForRange", error);
+        return NULL;
+    }
+    if ((before > 0 || after > 0) && CFGetTypeID(value) == CFStringGetTypeID()) {
+        CFTypeRef trimmed = textReaderTrim((CFStringRef) value, before, after);
+        CFRelease(value);
+        if (trimmed == NULL) return PyErr_NoMemory();
+        value = trimmed;
+    }
+    PyObject * text = tracedParseCFTypeRef(typeState(Py_TYPE(self)), value, element->_pid);
+    CFRelease(value);
+    if (text == Py_None) { // empty strings are converted to None
+        Py_DECREF(text);
+        text = stringFromUTF8("", 0);
+    }
+    if (text == NULL) return NULL;
+
+    Py_XDECREF(self->chunks[i].text);
+    self->chunks[i].location = piece.location;
+    self->chunks[i].length = piece.length;
+    self->chunks[i].text = text;
+    return text;
+}
+
+// A chunk's text, read if it has not been (or if the range has moved across it since).
+static PyObject * textReaderChunk(TextReader * self, Py_ssize_t i) {
+    TextChunk * chunk = &self->chunks[i];
+    CFRange piece = textReaderPiece(self, i);
+    if (chunk->text != NULL && chunk->location == piece.location && chunk->length == piece.length) return chunk->text;
+    return textReaderFetch(self, i);
+}
+
+static int TextReader_init_impl(TextReader * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"element", "chunk_size", "visible", NULL};
+    PyObject * element = NULL;
+    Py_ssize_t chunk_size = 4096;
+    PyObject * visible = Py_False;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|nO", kwlist, typeState(Py_TYPE(self))->AccessibleElement_type, &element, &chunk_size, &visible))
+        return -1;
+    if (chunk_size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The chunk size must be positive.");
+        return -1;
+    }
+    int is_visible = PyObject_IsTrue(visible);
+    if (is_visible == -1) return -1;
+
+    textReaderClear(self);
+    Py_INCREF(element);
+    Py_XDECREF(self->element);
+    self->element = element;
+    self->chunk_size = chunk_size;
+    self->visible = (char) is_visible;
+    self->cursor = 0;
+    return textReaderMeasure(self);
+}
+
+static int textReaderCheck(TextReader * self) {
+    if (self->element == NULL) {
+        PyErr_SetString(PyExc_ValueError, "The reader has not been initialised.");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * TextReader_iter_impl(TextReader * self) {
+    if (textReaderCheck(self) == -1) return NULL;
+    self->cursor = textReaderFirst(self);
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject * TextReader_iternext_impl(TextReader * self) {
+    if (self->element == NULL) return NULL;
+    if (self->cursor < textReaderFirst(self)) self->cursor = textReaderFirst(self);
+    if (self->cursor >= textReaderEnd(self)) return NULL;
+    PyObject * text = textReaderChunk(self, self->cursor);
+    if (text == NULL) return NULL;
+    self->cursor++;
+    Py_INCREF(text);
+    return text;
+}
+
+static PyObject * TextReader_read_impl(TextReader * self) {
+    if (textReaderCheck(self) == -1) return NULL;
+    Py_ssize_t first = textReaderFirst(self);
+    Py_ssize_t end = textReaderEnd(self);
+    PyObject * pieces = PyList_New(end - first);
+    if (pieces == NULL) return NULL;
+    for (Py_ssize_t i = first; i < end; i++) {
+        PyObject * text = textReaderChunk(self, i);
+        if (text == NULL) {
+            Py_DECREF(pieces);
+            return NULL;
+        }
+        Py_INCREF(text);
+        PyList_SET_ITEM(pieces, i - first, text);
+    }
+#if PY_MAJOR_VERSION >= 3
+    PyObject * empty = PyUnicode_FromString("");
+    PyObject * result = (empty != NULL) ? PyUnicode_Join(empty, pieces) : NULL;
+#else
+    PyObject * empty = PyString_FromString("");
+    PyObject * result = (empty != NULL) ? _PyString_Join(empty, pieces) : NULL;
+#endif
+    Py_XDECREF(empty);
+    Py_DECREF(pieces);
+    return result;
+}
+
+static PyObject * TextReader_refresh_impl(TextReader * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"changed", NULL};
+    PyObject * changed = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &changed)) return NULL;
+    if (textReaderCheck(self) == -1) return NULL;
+
+    long long dirty_start = 0;
+    long long dirty_length = -1; // to the end
+    if (changed != Py_None) {
+        if (!PyTuple_Check(changed) || PyTuple_Size(changed) != 2 || !PyArg_ParseTuple(changed, "LL", &dirty_start, &dirty_length)) {
+            PyErr_SetString(PyExc_TypeError, "The changed range must be a tuple of exactly two integers.");
+            return NULL;
+        }
+    }
+
+    Py_ssize_t old_length = self->length;
+    if (textReaderMeasure(self) == -1) return NULL;
+    // Text inserted or deleted shifts everything after it
+    if (self->length != old_length) dirty_length = -1;
+
+    PyObject * result = PyList_New(0);
+    if (result == NULL) return NULL;
+    Py_ssize_t first = textReaderFirst(self);
+    Py_ssize_t end = textReaderEnd(self);
+    for (Py_ssize_t i = 0; i < self->chunk_count; i++) {
+        TextChunk * chunk = &self->chunks[i];
+        if (chunk->text == NULL) continue;
+        if (i < first || i >= end) {
+            Py_CLEAR(chunk->text);
+            continue;
+        }
+        CFRange piece = textReaderPiece(self, i);
+        int moved = chunk->location != piece.location || chunk->length != piece.length;
+        // Chunks also read a unit either side, for surrogate pairs
+        int dirty = piece.location + piece.length + 1 > dirty_start
+            && (dirty_length < 0 || piece.location - 1 < dirty_start + dirty_length);
+        if (!moved && !dirty) continue;
+
+        PyObject * old = chunk->text;
+        Py_INCREF(old);
+        PyObject * text = textReaderFetch(self, i);
+        int same = (text != NULL) ? PyObject_RichCompareBool(old, text, Py_EQ) : -1;
+        Py_DECREF(old);
+        if (same == -1) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        if (same) continue;
+        PyObject * range = newRange(typeState(Py_TYPE(self)), piece.location, piece.length);
+        if (range == NULL || PyList_Append(result, range) == -1) {
+            Py_XDECREF(range);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(range);
+    }
+    return result;
+}
+
+static PyObject * TextReader_range_impl(TextReader * self, void * closure) {
+    if (textReaderCheck(self) == -1) return NULL;
+    return newRange(typeState(Py_TYPE(self)), self->range.location, self->range.length);
+}
+
+/*
+ * Chunks are fetched and replaced as the reader goes, so on free-threaded
+ * builds each method holds the reader's lock.
+ */
+
+static int TextReader_init(TextReader * self, PyObject * args, PyObject * kwargs) {
+    int result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_init_impl(self, args, kwargs);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * TextReader_iter(TextReader * self) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_iter_impl(self);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * TextReader_iternext(TextReader * self) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_iternext_impl(self);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * TextReader_read(TextReader * self) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_read_impl(self);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * TextReader_refresh(TextReader * self, PyObject * args, PyObject * kwargs) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_refresh_impl(self, args, kwargs);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyObject * TextReader_range(TextReader * self, void * closure) {
+    PyObject * result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = TextReader_range_impl(self, closure);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static PyMethodDef TextReader_methods[] = {
+    {"read", (PyCFunction) TextReader_read, METH_NOARGS, TextReader_read_docstring},
+    {"refresh", (PyCFunction) TextReader_refresh, METH_VARARGS|METH_KEYWORDS, TextReader_refresh_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef TextReader_members[] = {
+    {"element", T_OBJECT, offsetof(TextReader, element), READONLY, "The element whose text is read."},
+    {"chunk_size", T_PYSSIZET, offsetof(TextReader, chunk_size), READONLY, "The number of characters read with each request."},
+    {"visible", T_BOOL, offsetof(TextReader, visible), READONLY, "Whether only the characters on screen are read."},
+    {"length", T_PYSSIZET, offsetof(TextReader, length), READONLY, "The length of the whole text, when last measured."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef TextReader_getset[] = {
+    {"range", (getter) TextReader_range, NULL, "The :py:class:`Range` of the characters read, when last measured.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot TextReader_slots[] = {
+    {Py_tp_dealloc, (void *) TextReader_dealloc},
+    {Py_tp_doc, (void *) TextReader_docstring},
+    {Py_tp_iter, (void *) TextReader_iter},
+    {Py_tp_iternext, (void *) TextReader_iternext},
+    {Py_tp_methods, (void *) TextReader_methods},
+    {Py_tp_members, (void *) TextReader_members},
+    {Py_tp_getset, (void *) TextReader_getset},
+    {Py_tp_init, (void *) TextReader_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec TextReader_spec = {
+    "accessibility.TextReader",
+    sizeof(TextReader),
+    0,
+#if PY_MAJOR_VERSION >= 3
+    Py_TPFLAGS_DEFAULT,
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER,
+#endif
+    TextReader_slots
+};
+
+static void PollWatcher_dealloc(PollWatcher * self) {
+    // A running watcher is kept alive by its thread, so it has stopped by now
+    for (Py_ssize_t i = 0; self->refs != NULL && i < self->element_count; i++) CFRelease(self->refs[i]);
+    for (Py_ssize_t i = 0; self->values != NULL && i < self->element_count * self->attribute_count; i++) {
+        if (self->values[i] != NULL) CFRelease(self->values[i]);
+    }
+    if (self->names != NULL) CFRelease(self->names);
+    free(self->refs);
+    free(self->pids);
+    free(self->dead);
+    free(self->values);
+    free(self->pending);
+    free(self->queue);
+    if (self->has_lock) {
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->wake);
+    }
+    Py_CLEAR(self->elements);
+    Py_CLEAR(self->attributes);
+    Py_CLEAR(self->callback);
+    freeInstance((PyObject *) self);
+}
+
+// Values that could not be read are kept as NULL, so that errors compare equal.
+static CFTypeRef pollValue(CFArrayRef values, CFIndex index) {
+    if (values == NULL || index >= CFArrayGetCount(values)) return NULL;
+    CFTypeRef value = CFArrayGetValueAtIndex(values, index);
+    if (value == NULL) return NULL;
+    if (CFGetTypeID(value) == AXValueGetTypeID() && AXValueGetType((AXValueRef) value) == kAXValueAXErrorType) return NULL;
+    return value;
+}
+
+static void pollStore(PollWatcher * self, Py_ssize_t slot, CFTypeRef value, int report) {
+    CFTypeRef old = self->values[slot];
+    if (old == value || (old != NULL && value != NULL && CFEqual(old, value))) return;
+    if (value != NULL) CFRetain(value);
+
+    pthread_mutex_lock(&self->lock);
+    self->values[slot] = value;
+    if (report) {
+        self->change_count++;
+        if (!self->pending[slot]) {
+            self->pending[slot] = 1;
+            self->queue[self->queue_count++] = slot;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (old != NULL) CFRelease(old);
+}
+
+/*
+ * Reads every element once, and queues whatever changed (unless this is the
+ * first poll, which only fills in the values). Does not need the GIL, and
+ * only the polling thread calls it once that has started.
+ */
+static void pollOnce(PollWatcher * self, int report) {
+    for (Py_ssize_t i = 0; i < self->element_count; i++) {
+        if (self->dead[i]) continue;
+        CFArrayRef values = NULL;
+        Request request = { .operation = OP_COPY_MULTIPLE_ATTRIBUTE_VALUES, .ref = self->refs[i], .pid = self->pids[i] };
+        if (requestBegin(&request, self->priority, 0, 0, NULL) != kAXErrorSuccess) continue;
+        AXError error = axSessionCopyMultiple(&ax_session, self->refs[i], self->names, 0, &values);
+        requestEnd(&request, error);
+
+        if (error == kAXErrorInvalidUIElement) {
+            self->dead[i] = 1;
+        } else if (error != kAXErrorSuccess) {
+            // e.g. a timeout, which says nothing about the values
+            if (values != NULL) CFRelease(values);
+            continue;
+        }
+        for (Py_ssize_t a = 0; a < self->attribute_count; a++) {
+            pollStore(self, i * self->attribute_count + a, pollValue(values, (CFIndex) a), report);
+        }
+        if (values != NULL) CFRelease(values);
+    }
+    pthread_mutex_lock(&self->lock);
+    self->poll_count++;
+    if (self->queue_count > 0) pthread_cond_broadcast(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+}
+
+typedef struct {
+    Py_ssize_t slot;
+    CFTypeRef value;
+} PollChange;
+
+// Takes the queued changes, with the values they have now. Returns how many.
+static Py_ssize_t pollTake(PollWatcher * self, PollChange ** changes) {
+    *changes = NULL;
+    pthread_mutex_lock(&self->lock);
+    Py_ssize_t count = self->queue_count;
+    if (count > 0) *changes = (PollChange *) malloc(count * sizeof(PollChange));
+    if (*changes == NULL) count = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        Py_ssize_t slot = self->queue[i];
+        (*changes)[i].slot = slot;
+        (*changes)[i].value = self->values[slot];
+        if (self->values[slot] != NULL) CFRetain(self->values[slot]);
+        self->pending[slot] = 0;
+    }
+    if (count > 0) self->queue_count = 0;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+// Converts a change to a new (element, attribute, value) tuple. Needs the GIL.
+static PyObject * pollChangeTuple(PollWatcher * self, PollChange * change) {
+    Py_ssize_t element = change->slot / self->attribute_count;
+    Py_ssize_t attribute = change->slot % self->attribute_count;
+    PyObject * value;
+    if (change->value != NULL) {
+        CFStringRef name = CFArrayGetValueAtIndex(self->names, (CFIndex) attribute);
+        value = convertAttributeValue(typeState(Py_TYPE(self)), name, change->value, self->pids[element]);
+    } else {
+        Py_INCREF(Py_None);
+        value = Py_None;
+    }
+    if (value == NULL) return NULL;
+    return Py_BuildValue("(OON)", PyTuple_GET_ITEM(self->elements, element), PyTuple_GET_ITEM(self->attributes, attribute), value);
+}
+
+static void pollRelease(PollChange * changes, Py_ssize_t count) {
+    for (Py_ssize_t i = 0; i < count; i++) {
+        if (changes[i].value != NULL) CFRelease(changes[i].value);
+    }
+    free(changes);
+}
+
+// Calls the callback for every queued change. Needs the GIL.
+static void pollDeliver(PollWatcher * self) {
+    PollChange * changes;
+    Py_ssize_t count = pollTake(self, &changes);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * change = pollChangeTuple(self, &changes[i]);
+        PyObject * result = NULL;
+        if (change != NULL) {
+            PyObject * args = PyTuple_New(0);
+            PyObject * kwargs = Py_BuildValue("{s:O,s:O,s:O}", "element", PyTuple_GET_ITEM(change, 0),
+                                              "attribute", PyTuple_GET_ITEM(change, 1), "value", PyTuple_GET_ITEM(change, 2));
+            if (args != NULL && kwargs != NULL) result = PyObject_Call(self->callback, args, kwargs);
+            Py_XDECREF(args);
+            Py_XDECREF(kwargs);
+            Py_DECREF(change);
+        }
+        if (result == NULL) PyErr_Print();
+        Py_XDECREF(result);
+    }
+    pollRelease(changes, count);
+}
+
+static void * PollWatcher_thread(void * arg) {
+    PollWatcher * self = (PollWatcher *) arg;
+    double next = monotonicTime() + self->interval;
+
+    pthread_mutex_lock(&self->lock);
+    while (!self->stopping) {
+        double remaining = next - monotonicTime();
+        if (remaining > 0) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            double until = now.tv_sec + now.tv_usec / 1e6 + remaining;
+            struct timespec abstime;
+            abstime.tv_sec = (time_t) until;
+            abstime.tv_nsec = (long) ((until - (double) abstime.tv_sec) * 1e9);
+            pthread_cond_timedwait(&self->wake, &self->lock, &abstime);
+            continue;
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        pollOnce(self, 1);
+        // Polls that overrun the interval are not made up for
+        next += self->interval;
+        if (next < monotonicTime()) next = monotonicTime();
+
+        pthread_mutex_lock(&self->lock);
+        int deliver = self->callback != Py_None && self->queue_count > 0 && !self->stopping;
+        pthread_mutex_unlock(&self->lock);
+        if (deliver) {
+            // A thread state of the watcher's own interpreter, which
+            // PyGILState_Ensure would not give once there are several
+            PyEval_RestoreThread(PyThreadState_New(self->interp));
+            pollDeliver(self);
+            PyThreadState_Clear(PyThreadState_Get());
+            PyThreadState_DeleteCurrent();
+        }
+        pthread_mutex_lock(&self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    // The interpreter is attached before the watcher leaves the registry, so
+    // that stopCallbacks either finds it or waits for it to let go
+    ModuleState * state = self->state;
+    pthread_mutex_lock(&state->watchers_lock);
+    int orphaned = self->orphaned;
+    if (!orphaned) {
+        PyEval_RestoreThread(PyThreadState_New(self->interp));
+        registryRemove(&state->watchers, self);
+    }
+    pthread_mutex_unlock(&state->watchers_lock);
+
+    pthread_mutex_lock(&self->lock);
+    self->running = 0;
+    pthread_cond_broadcast(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    if (orphaned) return NULL;
+
+    // Drop the thread's reference, which may be the last
+    Py_DECREF(self);
+    PyThreadState_Clear(PyThreadState_Get());
+    PyThreadState_DeleteCurrent();
+    return NULL;
+}
+
+static PyObject * PollWatcher_stop(PollWatcher * self) {
+    pthread_mutex_lock(&self->lock);
+    self->stopping = 1;
+    pthread_cond_broadcast(&self->wake);
+    int wait = self->running && !pthread_equal(self->thread, pthread_self());
+    pthread_mutex_unlock(&self->lock);
+
+    if (wait) {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->lock);
+        while (self->running) pthread_cond_wait(&self->wake, &self->lock);
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * PollWatcher_changes(PollWatcher * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"timeout", NULL};
+    PyObject * timeout_object = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout_object)) return NULL;
+
+    double timeout = -1;
+    if (timeout_object != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_object);
+        if (timeout == -1 && PyErr_Occurred()) return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError, "The timeout must not be negative.");
+            return NULL;
+        }
+    }
+
+    // Wait in short slices so that KeyboardInterrupt still gets through
+    double deadline = monotonicTime() + timeout;
+    for (;;) {
+        pthread_mutex_lock(&self->lock);
+        int ready = self->queue_count > 0 || !self->running;
+        pthread_mutex_unlock(&self->lock);
+        if (ready) break;
+
+        double slice = 0.1;
+        if (timeout >= 0) {
+            double remaining = deadline - monotonicTime();
+            if (remaining <= 0) break;
+            if (remaining < slice) slice = remaining;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double until = now.tv_sec + now.tv_usec / 1e6 + slice;
+        struct timespec abstime;
+        abstime.tv_sec = (time_t) until;
+        abstime.tv_nsec = (long) ((until - (double) abstime.tv_sec) * 1e9);
+        pthread_mutex_lock(&self->lock);
+        if (self->queue_count == 0 && self->running) pthread_cond_timedwait(&self->wake, &self->lock, &abstime);
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+        if (PyErr_CheckSignals() == -1) return NULL;
+    }
+
+    PollChange * changes;
+    Py_ssize_t count = pollTake(self, &changes);
+    PyObject * result = PyList_New(count);
+    for (Py_ssize_t i = 0; result != NULL && i < count; i++) {
+        PyObject * change = pollChangeTuple(self, &changes[i]);
+        if (change == NULL) Py_CLEAR(result);
+        else PyList_SET_ITEM(result, i, change);
+    }
+    pollRelease(changes, count);
+    return result;
+}
+
+static PyObject * PollWatcher_running(PollWatcher * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    int running = self->running && !self->stopping;
+    pthread_mutex_unlock(&self->lock);
+    return PyBool_FromLong(running);
+}
+
+static PyObject * PollWatcher_poll_count(PollWatcher * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    unsigned long long count = self->poll_count;
+    pthread_mutex_unlock(&self->lock);
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+static PyObject * PollWatcher_change_count(PollWatcher * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    unsigned long long count = self->change_count;
+    pthread_mutex_unlock(&self->lock);
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+static PyMethodDef PollWatcher_methods[] = {
+    {"changes", (PyCFunction) PollWatcher_changes, METH_VARARGS|METH_KEYWORDS, PollWatcher_changes_docstring},
+    {"stop", (PyCFunction) PollWatcher_stop, METH_NOARGS, PollWatcher_stop_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef PollWatcher_members[] = {
+    {"elements", T_OBJECT, offsetof(PollWatcher, elements), READONLY, "The elements polled."},
+    {"attributes", T_OBJECT, offsetof(PollWatcher, attributes), READONLY, "The names of the attributes polled."},
+    {"interval", T_DOUBLE, offsetof(PollWatcher, interval), READONLY, "The number of seconds between polls."},
+    {"callback", T_OBJECT, offsetof(PollWatcher, callback), READONLY, "The function called for each change, or None."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef PollWatcher_getset[] = {
+    {"running", (getter) PollWatcher_running, NULL, "Whether the watcher is still polling.", NULL},
+    {"poll_count", (getter) PollWatcher_poll_count, NULL, "The number of polls made, the first included.", NULL},
+    {"change_count", (getter) PollWatcher_change_count, NULL, "The number of changes seen, before any were merged.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot PollWatcher_slots[] = {
+    {Py_tp_dealloc, (void *) PollWatcher_dealloc},
+    {Py_tp_doc, (void *) PollWatcher_docstring},
+    {Py_tp_methods, (void *) PollWatcher_methods},
+    {Py_tp_members, (void *) PollWatcher_members},
+    {Py_tp_getset, (void *) PollWatcher_getset},
+    {0, NULL}
+};
+
+static PyType_Spec PollWatcher_spec = {
+    "accessibility.PollWatcher",
+    sizeof(PollWatcher),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    PollWatcher_slots
+};
+
+static void focusStateClear(FocusState * state) {
+    if (state->window != NULL) CFRelease(state->window);
+    if (state->element != NULL) CFRelease(state->element);
+    state->window = state->element = NULL;
+}
+
+static void FocusTracker_dealloc(FocusTracker * self) {
+    // A running tracker is kept alive by its thread, which has released the
+    // observers by now
+    for (Py_ssize_t i = 0; self->apps != NULL && i < self->app_count; i++) {
+        FocusApplication * app = self->apps[i];
+        CFRelease(app->ref);
+        if (app->window != NULL) CFRelease(app->window);
+        if (app->element != NULL) CFRelease(app->element);
+        free(app);
+    }
+    free(self->apps);
+    for (Py_ssize_t i = 0; i < self->queue_count; i++) {
+        focusStateClear(&self->queue[(self->queue_start + i) % FOCUS_QUEUE_CAPACITY]);
+    }
+    if (self->app_names != NULL) CFRelease(self->app_names);
+    if (self->system_names != NULL) CFRelease(self->system_names);
+    if (self->loop != NULL) CFRelease(self->loop);
+    if (self->has_lock) {
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->wake);
+    }
+    Py_CLEAR(self->applications);
+    Py_CLEAR(self->callback);
+    freeInstance((PyObject *) self);
+}
+
+// Replaces what a slot holds, returning whether that changed. Expects the lock to be held.
+static int focusReplace(AXUIElementRef * slot, AXUIElementRef value) {
+    if (*slot == value || (*slot != NULL && value != NULL && CFEqual(*slot, value))) return 0;
+    if (value != NULL) CFRetain(value);
+    if (*slot != NULL) CFRelease(*slot);
+    *slot = value;
+    return 1;
+}
+
+// Queues the focus as it is now, dropping the oldest change if the queue is
+// full. Expects the lock to be held.
+static void focusQueue(FocusTracker * self) {
+    if (self->queue_count == FOCUS_QUEUE_CAPACITY) {
+        focusStateClear(&self->queue[self->queue_start]);
+        self->queue_start = (self->queue_start + 1) % FOCUS_QUEUE_CAPACITY;
+        self->queue_count--;
+    }
+    FocusState * state = &self->queue[(self->queue_start + self->queue_count) % FOCUS_QUEUE_CAPACITY];
+    state->application = self->frontmost;
+    state->window = state->element = NULL;
+    if (self->frontmost >= 0) {
+        FocusApplication * app = self->apps[self->frontmost];
+        if (app->window != NULL) state->window = (AXUIElementRef) CFRetain(app->window);
+        if (app->element != NULL) state->element = (AXUIElementRef) CFRetain(app->element);
+    }
+    self->queue_count++;
+    self->change_count++;
+    pthread_cond_broadcast(&self->wake);
+}
+
+// An element among values, or NULL if that could not be read.
+static AXUIElementRef focusElement(CFArrayRef values, CFIndex index) {
+    CFTypeRef value = pollValue(values, index);
+    if (value == NULL || CFGetTypeID(value) != AXUIElementGetTypeID()) return NULL;
+    return (AXUIElementRef) value;
+}
+
+/*
+ * Reads attributes of an element in one request. Does not need the GIL: the focus tracker calls it from its own thread,
+ * and locators with the GIL released.
+ */
+static AXError readAttributes(AXUIElementRef ref, pid_t pid, CFArrayRef names, RequestPriority priority, CFArrayRef * values) {
+    *values = NULL;
+    Request request = { .operation = OP_COPY_MULTIPLE_ATTRIBUTE_VALUES, .ref = ref, .pid = pid };
+    AXError error = requestBegin(&request, priority, 0, 0, NULL);
+    if (error != kAXErrorSuccess) return error;
+    error = axSessionCopyMultiple(&ax_session, ref, names, 0, values);
+    requestEnd(&request, error);
+    if (error != kAXErrorSuccess && *values != NULL) {
+        CFRelease(*values);
+        *values = NULL;
+    }
+    return error;
+}
+
+// Reads the focused window and element of an application, queueing the
+// focus if report is set and they changed while it is frontmost.
+static void focusRefresh(FocusTracker * self, FocusApplication * app, int report) {
+    CFArrayRef values;
+    if (readAttributes(app->ref, app->pid, self->app_names, self->priority, &values) != kAXErrorSuccess) return;
+
+    pthread_mutex_lock(&self->lock);
+    int changed = focusReplace(&app->window, focusElement(values, 0));
+    changed |= focusReplace(&app->element, focusElement(values, 1));
+    if (changed && report && self->frontmost >= 0 && self->apps[self->frontmost] == app) focusQueue(self);
+    pthread_mutex_unlock(&self->lock);
+    CFRelease(values);
+}
+
+// Asks the system which application is frontmost, as at the start.
+static void focusReadFrontmost(FocusTracker * self, int report) {
+    uint64_t call_started = callBegin();
+    AXUIElementRef system = ax_backend->createSystemWide();
+    callEnd(OP_CREATE_SYSTEMWIDE, NULL, -1, call_started, kAXErrorSuccess);
+
+    CFArrayRef values;
+    AXError error = readAttributes(system, -1, self->system_names, self->priority, &values);
+    CFRelease(system);
+    if (error != kAXErrorSuccess) return;
+
+    pid_t pid = -1;
+    AXUIElementRef application = focusElement(values, 0);
+    if (application != NULL) {
+        call_started = callBegin();
+        error = ax_backend->getPid(application, &pid);
+        callEnd(OP_GET_PID, NULL, -1, call_started, error);
+        if (error != kAXErrorSuccess) pid = -1;
+    }
+    CFRelease(values);
+
+    pthread_mutex_lock(&self->lock);
+    Py_ssize_t frontmost = -1;
+    for (Py_ssize_t i = 0; pid > 0 && i < self->app_count; i++) {
+        if (self->apps[i]->pid == pid) frontmost = i;
+    }
+    if (frontmost != self->frontmost) {
+        self->frontmost = frontmost;
+        if (report) focusQueue(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Called on the tracking thread's run loop, without the GIL.
+static void focusNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    FocusApplication * app = (FocusApplication *) refcon;
+    FocusTracker * self = app->tracker;
+    int refresh = 0;
+
+    pthread_mutex_lock(&self->lock);
+    self->notification_count++;
+    int frontmost = self->frontmost >= 0 && self->apps[self->frontmost] == app;
+    int changed = 0;
+    if (CFEqual(notification, kAXFocusedUIElementChangedNotification)) {
+        changed = focusReplace(&app->element, element) && frontmost;
+    } else if (CFEqual(notification, kAXFocusedWindowChangedNotification)) {
+        changed = focusReplace(&app->window, element) && frontmost;
+    } else if (CFEqual(notification, kAXApplicationActivatedNotification)) {
+        for (Py_ssize_t i = 0; !frontmost && i < self->app_count; i++) {
+            if (self->apps[i] == app) self->frontmost = i;
+        }
+        changed = !frontmost;
+        // Whatever changed while it was in the background was heard of too,
+        // but a notification may have been missed
+        refresh = 1;
+    } else if (CFEqual(notification, kAXApplicationDeactivatedNotification)) {
+        // Another application's activation may have been heard of first
+        if (frontmost) self->frontmost = -1;
+        changed = frontmost;
+    }
+    if (changed) focusQueue(self);
+    pthread_mutex_unlock(&self->lock);
+
+    if (refresh) focusRefresh(self, app, 1);
+}
+
+/*
+ * Observes the applications not yet subscribed to on the tracking thread's
+ * run loop, and only then reads their focus (and which application is
+ * frontmost), so that no change in between goes unheard.
+ */
+static void focusSubscribe(FocusTracker * self, int report) {
+    CFStringRef notifications[] = {
+        kAXFocusedUIElementChangedNotification, kAXFocusedWindowChangedNotification,
+        kAXApplicationActivatedNotification, kAXApplicationDeactivatedNotification
+    };
+    for (;;) {
+        pthread_mutex_lock(&self->lock);
+        FocusApplication * app = self->subscribed < self->app_count ? self->apps[self->subscribed] : NULL;
+        pthread_mutex_unlock(&self->lock);
+        if (app == NULL) break;
+        self->subscribed++;
+
+        AXObserverRef observer = NULL;
+        uint64_t call_started = callBegin();
+        AXError error = ax_backend->observerCreate(app->pid, focusNotification, &observer);
+        callEnd(OP_OBSERVER_CREATE, NULL, app->pid, call_started, error);
+        if (error == kAXErrorSuccess) {
+            app->observer = observer;
+            for (size_t i = 0; i < sizeof(notifications) / sizeof(notifications[0]); i++) {
+                call_started = callBegin();
+                error = ax_backend->observerAddNotification(observer, app->ref, notifications[i], app);
+                callEnd(OP_OBSERVER_ADD_NOTIFICATION, notifications[i], app->pid, call_started, error);
+            }
+            call_started = callBegin();
+            CFRunLoopSourceRef source = ax_backend->observerGetRunLoopSource(observer);
+            callEnd(OP_OBSERVER_GET_RUN_LOOP_SOURCE, NULL, app->pid, call_started, kAXErrorSuccess);
+            CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopDefaultMode);
+        }
+        focusRefresh(self, app, report);
+    }
+    focusReadFrontmost(self, report);
+}
+
+// Takes the queued changes. Returns how many.
+static Py_ssize_t focusTake(FocusTracker * self, FocusState * states) {
+    pthread_mutex_lock(&self->lock);
+    Py_ssize_t count = self->queue_count;
+    for (Py_ssize_t i = 0; i < count; i++) states[i] = self->queue[(self->queue_start + i) % FOCUS_QUEUE_CAPACITY];
+    self->queue_start = self->queue_count = 0;
+    pthread_mutex_unlock(&self->lock);
+    return count;
+}
+
+// A new reference to an element for ref, which may be NULL (giving None). Needs the GIL.
+static PyObject * focusElementObject(FocusTracker * self, AXUIElementRef ref) {
+    if (ref == NULL) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    CFRetain(ref);
+    return (PyObject *) elementWithRef(typeState(Py_TYPE(self)), &ref);
+}
+
+// Converts a state to a new (application, window, element) tuple, or None. Needs the GIL.
+static PyObject * focusTuple(FocusTracker * self, FocusState * state) {
+    if (state->application < 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    PyObject * application = PySequence_GetItem(self->applications, state->application);
+    PyObject * window = application ? focusElementObject(self, state->window) : NULL;
+    PyObject * element = window ? focusElementObject(self, state->element) : NULL;
+    if (element == NULL) {
+        Py_XDECREF(application);
+        Py_XDECREF(window);
+        return NULL;
+    }
+    return Py_BuildValue("(NNN)", application, window, element);
+}
+
+// Calls the callback for every queued change. Needs the GIL.
+static void focusDeliver(FocusTracker * self) {
+    FocusState states[FOCUS_QUEUE_CAPACITY];
+    Py_ssize_t count = focusTake(self, states);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * focus = focusTuple(self, &states[i]);
+        PyObject * result = NULL;
+        if (focus != NULL) {
+            PyObject * args = PyTuple_New(0);
+            PyObject * kwargs;
+            if (focus == Py_None) {
+                kwargs = Py_BuildValue("{s:O,s:O,s:O}", "application", Py_None, "window", Py_None, "element", Py_None);
+            } else {
+                kwargs = Py_BuildValue("{s:O,s:O,s:O}", "application", PyTuple_GET_ITEM(focus, 0),
+                                       "window", PyTuple_GET_ITEM(focus, 1), "element", PyTuple_GET_ITEM(focus, 2));
+            }
+            if (args != NULL && kwargs != NULL) result = PyObject_Call(self->callback, args, kwargs);
+            Py_XDECREF(args);
+            Py_XDECREF(kwargs);
+            Py_DECREF(focus);
+        }
+        if (result == NULL) PyErr_Print();
+        Py_XDECREF(result);
+        focusStateClear(&states[i]);
+    }
+}
+
+static void * FocusTracker_thread(void * arg) {
+    FocusTracker * self = (FocusTracker *) arg;
+    pthread_mutex_lock(&self->lock);
+    self->loop = (CFRunLoopRef) CFRetain(CFRunLoopGetCurrent());
+    pthread_mutex_unlock(&self->lock);
+
+    // The focus as it is at the start is not a change
+    focusSubscribe(self, 0);
+
+    pthread_mutex_lock(&self->lock);
+    self->ready = 1;
+    pthread_cond_broadcast(&self->wake);
+    while (!self->stopping) {
+        int added = self->app_count > self->subscribed;
+        pthread_mutex_unlock(&self->lock);
+        if (added) focusSubscribe(self, 1);
+
+        // Returns after each notification, so that the callback hears of it
+        // straight away
+        CFRunLoopRunResult result = CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, 1);
+
+        pthread_mutex_lock(&self->lock);
+        int deliver = self->callback != Py_None && self->queue_count > 0 && !self->stopping;
+        if (result == kCFRunLoopRunFinished && !deliver && !self->stopping && self->app_count == self->subscribed) {
+            // No application could be observed, so there is nothing to run
+            // until one is added
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            double until = now.tv_sec + now.tv_usec / 1e6 + 0.1;
+            struct timespec abstime;
+            abstime.tv_sec = (time_t) until;
+            abstime.tv_nsec = (long) ((until - (double) abstime.tv_sec) * 1e9);
+            pthread_cond_timedwait(&self->wake, &self->lock, &abstime);
+        }
+        pthread_mutex_unlock(&self->lock);
+        if (deliver) {
+            PyEval_RestoreThread(PyThreadState_New(self->interp));
+            focusDeliver(self);
+            PyThreadState_Clear(PyThreadState_Get());
+            PyThreadState_DeleteCurrent();
+        }
+        pthread_mutex_lock(&self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    // Queued notifications must not reach the applications once they are freed
+    for (Py_ssize_t i = 0; i < self->subscribed; i++) {
+        pthread_mutex_lock(&self->lock);
+        FocusApplication * app = self->apps[i];
+        pthread_mutex_unlock(&self->lock);
+        if (app->observer == NULL) continue;
+        CFRunLoopSourceInvalidate(ax_backend->observerGetRunLoopSource(app->observer));
+        CFRelease(app->observer);
+        app->observer = NULL;
+    }
+
+    // As for poll watchers, the interpreter is attached before the tracker
+    // leaves the registry
+    ModuleState * state = self->state;
+    pthread_mutex_lock(&state->watchers_lock);
+    int orphaned = self->orphaned;
+    if (!orphaned) {
+        PyEval_RestoreThread(PyThreadState_New(self->interp));
+        registryRemove(&state->trackers, self);
+    }
+    pthread_mutex_unlock(&state->watchers_lock);
+
+    pthread_mutex_lock(&self->lock);
+    self->running = 0;
+    self->ready = 1;
+    pthread_cond_broadcast(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+    if (orphaned) return NULL;
+
+    // Drop the thread's reference, which may be the last
+    Py_DECREF(self);
+    PyThreadState_Clear(PyThreadState_Get());
+    PyThreadState_DeleteCurrent();
+    return NULL;
+}
+
+/*
+ * Starts tracking an application, for the tracking thread to subscribe to.
+ * Needs the GIL. Returns 0, or -1 with an exception set.
+ */
+static int focusAdd(FocusTracker * self, pid_t pid) {
+    pthread_mutex_lock(&self->lock);
+    int present = 0;
+    for (Py_ssize_t i = 0; i < self->app_count; i++) {
+        if (self->apps[i]->pid == pid) present = 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (present) return 0;
+
+    FocusApplication * app = (FocusApplication *) calloc(1, sizeof(FocusApplication));
+    if (app == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    uint64_t call_started = callBegin();
+    AXUIElementRef ref = ax_backend->createApplication(pid);
+    callEnd(OP_CREATE_APPLICATION, NULL, pid, call_started, kAXErrorSuccess);
+    app->tracker = self;
+    app->pid = pid;
+    app->ref = (AXUIElementRef) CFRetain(ref);
+    PyObject * element = (PyObject *) elementWithRef(typeState(Py_TYPE(self)), &ref);
+    if (element == NULL || PyList_Append(self->applications, element) < 0) {
+        Py_XDECREF(element);
+        CFRelease(app->ref);
+        free(app);
+        return -1;
+    }
+    Py_DECREF(element);
+
+    pthread_mutex_lock(&self->lock);
+    if (self->app_count == self->app_capacity) {
+        Py_ssize_t capacity = self->app_capacity ? 2 * self->app_capacity : 8;
+        FocusApplication ** apps = (FocusApplication **) realloc(self->apps, capacity * sizeof(FocusApplication *));
+        if (apps != NULL) {
+            self->apps = apps;
+            self->app_capacity = capacity;
+        }
+    }
+    int added = self->app_count < self->app_capacity;
+    if (added) {
+        self->apps[self->app_count++] = app;
+        pthread_cond_broadcast(&self->wake);
+        if (self->loop != NULL) CFRunLoopStop(self->loop);
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (!added) {
+        PySequence_DelItem(self->applications, -1);
+        CFRelease(app->ref);
+        free(app);
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * FocusTracker_add(FocusTracker * self, PyObject * args) {
+    int pid;
+    if (!PyArg_ParseTuple(args, "i", &pid)) return NULL;
+    if (pid <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The pid must be positive.");
+        return NULL;
+    }
+    int result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = focusAdd(self, (pid_t) pid);
+    Py_END_CRITICAL_SECTION();
+    if (result < 0) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject * FocusTracker_focused(FocusTracker * self) {
+    FocusState state;
+    pthread_mutex_lock(&self->lock);
+    state.application = self->frontmost;
+    state.window = state.element = NULL;
+    if (self->frontmost >= 0) {
+        FocusApplication * app = self->apps[self->frontmost];
+        if (app->window != NULL) state.window = (AXUIElementRef) CFRetain(app->window);
+        if (app->element != NULL) state.element = (AXUIElementRef) CFRetain(app->element);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    PyObject * result = focusTuple(self, &state);
+    focusStateClear(&state);
+    return result;
+}
+
+static PyObject * FocusTracker_stop(FocusTracker * self) {
+    pthread_mutex_lock(&self->lock);
+    self->stopping = 1;
+    pthread_cond_broadcast(&self->wake);
+    if (self->loop != NULL) CFRunLoopStop(self->loop);
+    int wait = self->running && !pthread_equal(self->thread, pthread_self());
+    pthread_mutex_unlock(&self->lock);
+
+    if (wait) {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->lock);
+        while (self->running) pthread_cond_wait(&self->wake, &self->lock);
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * FocusTracker_changes(FocusTracker * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"timeout", NULL};
+    PyObject * timeout_object = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout_object)) return NULL;
+
+    double timeout = -1;
+    if (timeout_object != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_object);
+        if (timeout == -1 && PyErr_Occurred()) return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError, "The timeout must not be negative.");
+            return NULL;
+        }
+    }
+
+    // Wait in short slices so that KeyboardInterrupt still gets through
+    double deadline = monotonicTime() + timeout;
+    for (;;) {
+        pthread_mutex_lock(&self->lock);
+        int ready = self->queue_count > 0 || !self->running;
+        pthread_mutex_unlock(&self->lock);
+        if (ready) break;
+
+        double slice = 0.1;
+        if (timeout >= 0) {
+            double remaining = deadline - monotonicTime();
+            if (remaining <= 0) break;
+            if (remaining < slice) slice = remaining;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double until = now.tv_sec + now.tv_usec / 1e6 + slice;
+        struct timespec abstime;
+        abstime.tv_sec = (time_t) until;
+        abstime.tv_nsec = (long) ((until - (double) abstime.tv_sec) * 1e9);
+        pthread_mutex_lock(&self->lock);
+        if (self->queue_count == 0 && self->running) pthread_cond_timedwait(&self->wake, &self->lock, &abstime);
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS
+        if (PyErr_CheckSignals() == -1) return NULL;
+    }
+
+    FocusState states[FOCUS_QUEUE_CAPACITY];
+    Py_ssize_t count = focusTake(self, states);
+    PyObject * result = PyList_New(count);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * focus = result ? focusTuple(self, &states[i]) : NULL;
+        if (focus == NULL) Py_CLEAR(result);
+        else PyList_SET_ITEM(result, i, focus);
+        focusStateClear(&states[i]);
+    }
+    return result;
+}
+
+static PyObject * FocusTracker_running(FocusTracker * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    int running = self->running && !self->stopping;
+    pthread_mutex_unlock(&self->lock);
+    return PyBool_FromLong(running);
+}
+
+static PyObject * FocusTracker_applications(FocusTracker * self, void * closure) {
+    return PySequence_Tuple(self->applications);
+}
+
+static PyObject * FocusTracker_notification_count(FocusTracker * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    unsigned long long count = self->notification_count;
+    pthread_mutex_unlock(&self->lock);
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+static PyObject * FocusTracker_change_count(FocusTracker * self, void * closure) {
+    pthread_mutex_lock(&self->lock);
+    unsigned long long count = self->change_count;
+    pthread_mutex_unlock(&self->lock);
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+static PyMethodDef FocusTracker_methods[] = {
+    {"focused", (PyCFunction) FocusTracker_focused, METH_NOARGS, FocusTracker_focused_docstring},
+    {"changes", (PyCFunction) FocusTracker_changes, METH_VARARGS|METH_KEYWORDS, FocusTracker_changes_docstring},
+    {"add", (PyCFunction) FocusTracker_add, METH_VARARGS, FocusTracker_add_docstring},
+    {"stop", (PyCFunction) FocusTracker_stop, METH_NOARGS, FocusTracker_stop_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef FocusTracker_members[] = {
+    {"callback", T_OBJECT, offsetof(FocusTracker, callback), READONLY, "The function called for each change, or None."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef FocusTracker_getset[] = {
+    {"running", (getter) FocusTracker_running, NULL, "Whether the tracker is still tracking.", NULL},
+    {"applications", (getter) FocusTracker_applications, NULL, "The elements of the applications tracked.", NULL},
+    {"notification_count", (getter) FocusTracker_notification_count, NULL, "The number of notifications heard.", NULL},
+    {"change_count", (getter) FocusTracker_change_count, NULL, "The number of changes of focus, dropped ones included.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot FocusTracker_slots[] = {
+    {Py_tp_dealloc, (void *) FocusTracker_dealloc},
+    {Py_tp_doc, (void *) FocusTracker_docstring},
+    {Py_tp_methods, (void *) FocusTracker_methods},
+    {Py_tp_members, (void *) FocusTracker_members},
+    {Py_tp_getset, (void *) FocusTracker_getset},
+    {0, NULL}
+};
+
+static PyType_Spec FocusTracker_spec = {
+    "accessibility.FocusTracker",
+    sizeof(FocusTracker),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    FocusTracker_slots
+};
+
+/*
+ * A locator's requests are all made with the GIL released and its lock held,
+ * so the lock is only ever taken without the GIL.
+ */
+
+// The attributes a locator matches elements by, made once for all threads.
+static CFArrayRef locator_names;
+static CFArrayRef locator_up_names; // and the parent too, to record a path
+static CFArrayRef locator_children_names;
+static pthread_once_t locator_once = PTHREAD_ONCE_INIT;
+
+enum { LOCATOR_ROLE, LOCATOR_IDENTIFIER, LOCATOR_TITLE, LOCATOR_PARENT };
+
+static void locatorInitNames(void) {
+    const void * attributes[] = { kAXRoleAttribute, kAXIdentifierAttribute, kAXTitleAttribute, kAXParentAttribute };
+    locator_names = CFArrayCreate(kCFAllocatorDefault, attributes, 3, &kCFTypeArrayCallBacks);
+    locator_up_names = CFArrayCreate(kCFAllocatorDefault, attributes, 4, &kCFTypeArrayCallBacks);
+    const void * children[] = { kAXChildrenAttribute };
+    locator_children_names = CFArrayCreate(kCFAllocatorDefault, children, 1, &kCFTypeArrayCallBacks);
+}
+
+static int locatorSame(CFStringRef a, CFStringRef b) {
+    return a == b || (a != NULL && b != NULL && CFEqual(a, b));
+}
+
+// A string among values, retained, or NULL if it could not be read or is empty.
+static CFStringRef locatorString(CFArrayRef values, CFIndex index) {
+    CFTypeRef value = pollValue(values, index);
+    if (value == NULL || CFGetTypeID(value) != CFStringGetTypeID() || CFStringGetLength((CFStringRef) value) == 0) return NULL;
+    return (CFStringRef) CFRetain(value);
+}
+
+static void locatorStepClear(LocatorStep * step) {
+    if (step->role != NULL) CFRelease(step->role);
+    if (step->identifier != NULL) CFRelease(step->identifier);
+    if (step->title != NULL) CFRelease(step->title);
+    step->role = step->identifier = step->title = NULL;
+}
+
+static void locatorFree(LocatorStep * steps, AXUIElementRef * chain, Py_ssize_t depth) {
+    for (Py_ssize_t i = 0; steps != NULL && i < depth; i++) locatorStepClear(&steps[i]);
+    for (Py_ssize_t i = 0; chain != NULL && i <= depth; i++) {
+        if (chain[i] != NULL) CFRelease(chain[i]);
+    }
+    free(steps);
+    free(chain);
+}
+
+/*
+ * Reads what an element is matched by into step, and its parent into *parent
+ * (retained, or NULL if it has none) unless parent is NULL.
+ */
+static AXError locatorRead(AXUIElementRef ref, pid_t pid, RequestPriority priority, LocatorStep * step, AXUIElementRef * parent) {
+    CFArrayRef values;
+    AXError error = readAttributes(ref, pid, parent != NULL ? locator_up_names : locator_names, priority, &values);
+    if (error != kAXErrorSuccess) return error;
+    step->role = locatorString(values, LOCATOR_ROLE);
+    step->identifier = locatorString(values, LOCATOR_IDENTIFIER);
+    step->title = locatorString(values, LOCATOR_TITLE);
+    if (parent != NULL) {
+        CFTypeRef value = pollValue(values, LOCATOR_PARENT);
+        *parent = (value != NULL && CFGetTypeID(value) == AXUIElementGetTypeID()) ? (AXUIElementRef) CFRetain(value) : NULL;
+    }
+    CFRelease(values);
+    return kAXErrorSuccess;
+}
+
+// The children of an element, retained, or NULL if they could not be read.
+static CFArrayRef locatorChildren(AXUIElementRef ref, pid_t pid, RequestPriority priority) {
+    CFArrayRef values;
+    if (readAttributes(ref, pid, locator_children_names, priority, &values) != kAXErrorSuccess) return NULL;
+    CFTypeRef value = pollValue(values, 0);
+    CFArrayRef children = (value != NULL && CFGetTypeID(value) == CFArrayGetTypeID()) ? (CFArrayRef) CFRetain(value) : NULL;
+    CFRelease(values);
+    return children;
+}
+
+// The index of child among the children of parent with the same role, or 0 if it is not among them.
+static long locatorIndex(AXUIElementRef parent, AXUIElementRef child, CFStringRef role, pid_t pid, RequestPriority priority) {
+    CFArrayRef children = locatorChildren(parent, pid, priority);
+    if (children == NULL) return 0;
+    CFIndex position = 0;
+    CFIndex count = CFArrayGetCount(children);
+    while (position < count && !CFEqual(CFArrayGetValueAtIndex(children, position), child)) position++;
+    long index = 0;
+    for (CFIndex i = 0; position < count && i < position; i++) {
+        LocatorStep seen = {NULL, NULL, NULL, 0};
+        AXUIElementRef sibling = (AXUIElementRef) CFArrayGetValueAtIndex(children, i);
+        if (locatorRead(sibling, pid, priority, &seen, NULL) == kAXErrorSuccess && locatorSame(seen.role, role)) index++;
+        locatorStepClear(&seen);
+    }
+    CFRelease(children);
+    return index;
+}
+
+/*
+ * Records the path to an element from its application, with the chain of
+ * elements along it, by following its parents up. Does not need the GIL.
+ * Returns 0, -1 with *error set if a request failed, -2 if the parents do not
+ * end at an application (or go on past LOCATOR_MAX_DEPTH), or -3 if memory ran
+ * out.
+ */
+static int locatorRecord(AXUIElementRef ref, pid_t pid, RequestPriority priority, LocatorStep ** steps_out,
+                         AXUIElementRef ** chain_out, Py_ssize_t * depth_out, AXError * error) {
+    // Collected from the element up, then turned around
+    LocatorStep * steps = calloc(LOCATOR_MAX_DEPTH + 1, sizeof(LocatorStep));
+    AXUIElementRef * chain = calloc(LOCATOR_MAX_DEPTH + 1, sizeof(AXUIElementRef));
+    if (steps == NULL || chain == NULL) {
+        free(steps);
+        free(chain);
+        return -3;
+    }
+
+    Py_ssize_t count = 0;
+    AXUIElementRef current = (AXUIElementRef) CFRetain(ref);
+    int status = -2;
+    while (current != NULL) {
+        AXUIElementRef parent = NULL;
+        chain[count] = current;
+        *error = locatorRead(current, pid, priority, &steps[count], &parent);
+        count++;
+        if (*error != kAXErrorSuccess) {
+            status = -1;
+            break;
+        }
+        if (locatorSame(steps[count - 1].role, CFSTR("AXApplication"))) {
+            if (parent != NULL) CFRelease(parent);
+            status = 0;
+            break;
+        }
+        if (count > LOCATOR_MAX_DEPTH) {
+            if (parent != NULL) CFRelease(parent);
+            break;
+        }
+        current = parent;
+    }
+    Py_ssize_t depth = count - 1;
+    if (status != 0) {
+        // locatorFree only clears the steps below depth
+        locatorStepClear(&steps[depth]);
+        locatorFree(steps, chain, depth);
+        return status;
+    }
+
+    // The application's own step is not part of the path
+    locatorStepClear(&steps[depth]);
+    for (Py_ssize_t i = 0, j = depth; i < j; i++, j--) {
+        AXUIElementRef element = chain[i];
+        chain[i] = chain[j];
+        chain[j] = element;
+    }
+    for (Py_ssize_t i = 0, j = depth - 1; i < j; i++, j--) {
+        LocatorStep step = steps[i];
+        steps[i] = steps[j];
+        steps[j] = step;
+    }
+    for (Py_ssize_t i = 0; i < depth; i++) {
+        steps[i].index = locatorIndex(chain[i], chain[i + 1], steps[i].role, pid, priority);
+    }
+    *steps_out = steps;
+    *chain_out = chain;
+    *depth_out = depth;
+    return 0;
+}
+
+// Whether the element kept for a level still matches its step. Expects the lock to be held.
+static int locatorCheck(Locator * self, Py_ssize_t level, RequestPriority priority) {
+    LocatorStep seen = {NULL, NULL, NULL, 0};
+    self->checks++;
+    int valid = 0;
+    if (locatorRead(self->chain[level], self->pid, priority, &seen, NULL) == kAXErrorSuccess) {
+        if (level == 0) {
+            valid = locatorSame(seen.role, CFSTR("AXApplication"));
+        } else {
+            LocatorStep * step = &self->steps[level - 1];
+            valid = locatorSame(seen.role, step->role)
+                && (step->identifier == NULL || locatorSame(seen.identifier, step->identifier));
+        }
+    }
+    locatorStepClear(&seen);
+    return valid;
+}
+
+/*
+ * Finds the child of the element for a level that matches the next step,
+ * retained, or NULL if none does. Expects the lock to be held.
+ */
+static AXUIElementRef locatorFind(Locator * self, Py_ssize_t level, RequestPriority priority) {
+    LocatorStep * step = &self->steps[level];
+    CFArrayRef children = locatorChildren(self->chain[level], self->pid, priority);
+    self->requests++;
+    if (children == NULL) return NULL;
+
+    // An identifier decides it; otherwise the title counts for more than the index
+    AXUIElementRef best = NULL;
+    int best_score = 0;
+    int perfect = (step->title != NULL ? 2 : 0) + 1;
+    long index = 0;
+    for (CFIndex i = 0; i < CFArrayGetCount(children); i++) {
+        AXUIElementRef child = (AXUIElementRef) CFArrayGetValueAtIndex(children, i);
+        if (CFGetTypeID(child) != AXUIElementGetTypeID()) continue;
+        LocatorStep seen = {NULL, NULL, NULL, 0};
+        AXError error = locatorRead(child, self->pid, priority, &seen, NULL);
+        self->requests++;
+        if (error != kAXErrorSuccess || !locatorSame(seen.role, step->role)) {
+            locatorStepClear(&seen);
+            continue;
+        }
+
+        int score = 0;
+        if (step->identifier != NULL && seen.identifier != NULL) {
+            score = locatorSame(seen.identifier, step->identifier) ? perfect + 1 : -1;
+        } else {
+            score = (step->title != NULL && locatorSame(seen.title, step->title)) * 2 + (index == step->index);
+        }
+        index++;
+        locatorStepClear(&seen);
+        if (score > best_score) {
+            best = child;
+            best_score = score;
+        }
+        if (score > perfect || (score == perfect && step->identifier == NULL)) break;
+    }
+    if (best != NULL) CFRetain(best);
+    CFRelease(children);
+    return best;
+}
+
+/*
+ * Returns the element the path leads to, retained, or NULL. Checks what is
+ * kept from the leaf up, and follows the path down again from the deepest
+ * level still valid. Expects the lock to be held.
+ */
+static AXUIElementRef locatorResolve(Locator * self, RequestPriority priority) {
+    self->lookups++;
+    double now = monotonicTime();
+    Py_ssize_t level = self->depth;
+    if (self->chain[level] != NULL && self->ttl > 0 && now - self->checked_at < self->ttl) {
+        self->hits++;
+        return (AXUIElementRef) CFRetain(self->chain[level]);
+    }
+
+    while (level > 0 && self->chain[level] == NULL) level--;
+    if (self->chain[level] == NULL) level = -1; // a lookup before found no application
+    while (level >= 0 && !locatorCheck(self, level, priority)) {
+        if (self->chain[level] != NULL) CFRelease(self->chain[level]);
+        self->chain[level] = NULL;
+        level--;
+    }
+    if (level < 0) {
+        // Even the application's element is gone, as when the backend changes
+        self->chain[0] = ax_backend->createApplication(self->pid);
+        if (self->chain[0] == NULL || !locatorCheck(self, 0, priority)) {
+            if (self->chain[0] != NULL) CFRelease(self->chain[0]);
+            self->chain[0] = NULL;
+            self->failures++;
+            return NULL;
+        }
+        level = 0;
+    }
+
+    if (level < self->depth) {
+        double started = monotonicTime();
+        self->resolutions++;
+        for (; level < self->depth; level++) {
+            self->levels++;
+            self->chain[level + 1] = locatorFind(self, level, priority);
+            if (self->chain[level + 1] == NULL) break;
+        }
+        now = monotonicTime();
+        self->seconds += now - started;
+        if (self->chain[self->depth] == NULL) {
+            self->failures++;
+            return NULL;
+        }
+    } else {
+        self->hits++;
+    }
+    self->checked_at = now;
+    return (AXUIElementRef) CFRetain(self->chain[self->depth]);
+}
+
+// The steps of a path given as a sequence of tuples, or NULL with an exception set.
+static LocatorStep * locatorParsePath(PyObject * path, Py_ssize_t * depth) {
+    PyObject * items = sequenceCopy(path, "The path must be a sequence of (role, identifier, title, index) tuples.");
+    if (items == NULL) return NULL;
+    *depth = PyTuple_GET_SIZE(items);
+    if (*depth > LOCATOR_MAX_DEPTH) {
+        PyErr_Format(PyExc_ValueError, "The path must be at most %d levels deep.", LOCATOR_MAX_DEPTH);
+        Py_DECREF(items);
+        return NULL;
+    }
+    LocatorStep * steps = calloc(*depth > 0 ? *depth : 1, sizeof(LocatorStep));
+    if (steps == NULL) {
+        Py_DECREF(items);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < *depth; i++) {
+        PyObject * item = sequenceCopy(PyTuple_GET_ITEM(items, i), "Each level of the path must be a (role, identifier, title, index) tuple.");
+        PyObject * strings[3];
+        long index;
+        int ok = item != NULL && PyArg_ParseTuple(item, "OOOl;Each level of the path must be a (role, identifier, title, index) tuple.",
+                                                  &strings[0], &strings[1], &strings[2], &index);
+        if (ok && index < 0) {
+            PyErr_SetString(PyExc_ValueError, "The indices of the path must not be negative.");
+            ok = 0;
+        }
+        CFStringRef * fields[3] = { &steps[i].role, &steps[i].identifier, &steps[i].title };
+        for (int j = 0; ok && j < 3; j++) {
+            if (strings[j] == Py_None) continue;
+            char * c_string;
+            *fields[j] = CFStringFromPyString(strings[j], &c_string);
+            if (*fields[j] == NULL) ok = 0;
+            else if (CFStringGetLength(*fields[j]) == 0) {
+                CFRelease(*fields[j]);
+                *fields[j] = NULL;
+            }
+        }
+        Py_XDECREF(item);
+        if (!ok) {
+            locatorFree(steps, NULL, i + 1);
+            Py_DECREF(items);
+            return NULL;
+        }
+        steps[i].index = index;
+    }
+    Py_DECREF(items);
+    return steps;
+}
+
+static int Locator_init_impl(Locator * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"element", "path", "ttl", NULL};
+    AccessibleElement * element = NULL;
+    PyObject * path = Py_None;
+    double ttl = 0.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|Od", kwlist, typeState(Py_TYPE(self))->AccessibleElement_type, &element, &path, &ttl))
+        return -1;
+    if (ttl < 0) {
+        PyErr_SetString(PyExc_ValueError, "The time to live must not be negative.");
+        return -1;
+    }
+    if (element->_pid <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The element does not belong to an application.");
+        return -1;
+    }
+    pthread_once(&locator_once, locatorInitNames);
+    if (!self->has_lock) {
+        if (pthread_mutex_init(&self->lock, NULL) != 0) {
+            PyErr_SetString(PyExc_RuntimeError, "Could not create the locator's lock.");
+            return -1;
+        }
+        self->has_lock = 1;
+    }
+
+    LocatorStep * steps = NULL;
+    AXUIElementRef * chain = NULL;
+    Py_ssize_t depth = 0;
+    double checked_at = 0;
+    if (path == Py_None) {
+        RequestPriority priority = currentPriority();
+        AXError error = kAXErrorSuccess;
+        int status;
+        Py_BEGIN_ALLOW_THREADS
+        status = locatorRecord(element->_ref, element->_pid, priority, &steps, &chain, &depth, &error);
+        Py_END_ALLOW_THREADS
+        if (status == -1) {
+            handleElementAXErrors(element, "AXParent", error);
+            return -1;
+        } else if (status == -2) {
+            PyErr_SetString(PyExc_ValueError, "The element is not within an application.");
+            return -1;
+        } else if (status == -3) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        checked_at = monotonicTime();
+    } else {
+        steps = locatorParsePath(path, &depth);
+        if (steps == NULL) return -1;
+        chain = calloc(depth + 1, sizeof(AXUIElementRef));
+        if (chain == NULL) {
+            locatorFree(steps, NULL, depth);
+            PyErr_NoMemory();
+            return -1;
+        }
+        chain[0] = (AXUIElementRef) CFRetain(element->_ref);
+    }
+
+    // Swapped in whole, so that a resolve in another thread sees one path or the other
+    LocatorStep * old_steps;
+    AXUIElementRef * old_chain;
+    Py_ssize_t old_depth;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    old_steps = self->steps;
+    old_chain = self->chain;
+    old_depth = self->depth;
+    self->pid = element->_pid;
+    self->ttl = ttl;
+    self->steps = steps;
+    self->chain = chain;
+    self->depth = depth;
+    self->checked_at = checked_at;
+    self->lookups = self->hits = self->checks = self->resolutions = 0;
+    self->levels = self->requests = self->failures = 0;
+    self->seconds = 0;
+    pthread_mutex_unlock(&self->lock);
+    locatorFree(old_steps, old_chain, old_depth);
+    Py_END_ALLOW_THREADS
+    return 0;
+}
+
+static int Locator_init(Locator * self, PyObject * args, PyObject * kwargs) {
+    int result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = Locator_init_impl(self, args, kwargs);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+static void Locator_dealloc(Locator * self) {
+    locatorFree(self->steps, self->chain, self->depth);
+    if (self->has_lock) pthread_mutex_destroy(&self->lock);
+    freeInstance((PyObject *) self);
+}
+
+static int locatorCheckReady(Locator * self) {
+    if (!self->has_lock || self->chain == NULL) {
+        PyErr_SetString(PyExc_ValueError, "The locator has not been initialised.");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject * Locator_resolve(Locator * self) {
+    if (locatorCheckReady(self) == -1) return NULL;
+    RequestPriority priority = currentPriority();
+    AXUIElementRef ref;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    ref = locatorResolve(self, priority);
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    if (ref == NULL) Py_RETURN_NONE;
+    return (PyObject *) elementWithRef(typeState(Py_TYPE(self)), &ref);
+}
+
+static PyObject * Locator_invalidate(Locator * self) {
+    if (locatorCheckReady(self) == -1) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    for (Py_ssize_t i = 1; i <= self->depth; i++) {
+        if (self->chain[i] != NULL) CFRelease(self->chain[i]);
+        self->chain[i] = NULL;
+    }
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject * Locator_stats(Locator * self) {
+    if (locatorCheckReady(self) == -1) return NULL;
+    unsigned long long counts[7];
+    double seconds;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    counts[0] = self->lookups;
+    counts[1] = self->hits;
+    counts[2] = self->checks;
+    counts[3] = self->resolutions;
+    counts[4] = self->levels;
+    counts[5] = self->requests;
+    counts[6] = self->failures;
+    seconds = self->seconds;
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:d}", "lookups", counts[0], "hits", counts[1],
+                         "checks", counts[2], "resolutions", counts[3], "levels", counts[4],
+                         "requests", counts[5], "failures", counts[6], "seconds", seconds);
+}
+
+static PyObject * Locator_path(Locator * self, void * closure) {
+    if (locatorCheckReady(self) == -1) return NULL;
+    // Copied under the lock, as another init could replace the path
+    LocatorStep * steps = NULL;
+    Py_ssize_t depth = 0;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->lock);
+    depth = self->depth;
+    steps = calloc(depth > 0 ? depth : 1, sizeof(LocatorStep));
+    for (Py_ssize_t i = 0; steps != NULL && i < depth; i++) {
+        steps[i] = self->steps[i];
+        if (steps[i].role != NULL) CFRetain(steps[i].role);
+        if (steps[i].identifier != NULL) CFRetain(steps[i].identifier);
+        if (steps[i].title != NULL) CFRetain(steps[i].title);
+    }
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    if (steps == NULL) return PyErr_NoMemory();
+
+    ModuleState * state = typeState(Py_TYPE(self));
+    PyObject * result = PyTuple_New(depth);
+    for (Py_ssize_t i = 0; result != NULL && i < depth; i++) {
+        CFStringRef strings[3] = { steps[i].role, steps[i].identifier, steps[i].title };
+        PyObject * level = PyTuple_New(4);
+        for (int j = 0; level != NULL && j < 4; j++) {
+            PyObject * item;
+            if (j == 3) {
+                item = PyLong_FromLong(steps[i].index);
+            } else if (strings[j] == NULL) {
+                item = Py_None;
+                Py_INCREF(item);
+            } else {
+                item = parseCFTypeRef(state, strings[j]);
+            }
+            if (item == NULL) Py_CLEAR(level);
+            else PyTuple_SET_ITEM(level, j, item);
+        }
+        if (level == NULL) Py_CLEAR(result);
+        else PyTuple_SET_ITEM(result, i, level);
+    }
+    locatorFree(steps, NULL, depth);
+    return result;
+}
+
+static PyMethodDef Locator_methods[] = {
+    {"resolve", (PyCFunction) Locator_resolve, METH_NOARGS, Locator_resolve_docstring},
+    {"invalidate", (PyCFunction) Locator_invalidate, METH_NOARGS, Locator_invalidate_docstring},
+    {"stats", (PyCFunction) Locator_stats, METH_NOARGS, Locator_stats_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef Locator_members[] = {
+    {"pid", T_INT, offsetof(Locator, pid), READONLY, "The process identifier of the application."},
+    {"ttl", T_DOUBLE, offsetof(Locator, ttl), READONLY, "For how many seconds an element found is returned without checking it."},
+    {"depth", T_PYSSIZET, offsetof(Locator, depth), READONLY, "The number of levels of the path below the application."},
+    {NULL, 0, 0, 0, NULL}
+};
+
+static PyGetSetDef Locator_getset[] = {
+    {"path", (getter) Locator_path, NULL, "The path from the application, as a tuple of (role, identifier, title, index) tuples, one for each level below it.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot Locator_slots[] = {
+    {Py_tp_dealloc, (void *) Locator_dealloc},
+    {Py_tp_doc, (void *) Locator_docstring},
+    {Py_tp_methods, (void *) Locator_methods},
+    {Py_tp_members, (void *) Locator_members},
+    {Py_tp_getset, (void *) Locator_getset},
+    {Py_tp_init, (void *) Locator_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec Locator_spec = {
+    "accessibility.Locator",
+    sizeof(Locator),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    Locator_slots
+};
+
+/* Module functions implementation
+======== */
+
+#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_9
+
+// Use the prompt system for Mavericks & later
+static PyObject * is_enabled(PyObject * self, PyObject * args, PyObject * kwargs) {  
+    static char *kwlist [] = {"prompt", NULL};
+    int prompt = 1;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &prompt))
+        return NULL;
+
+    if (prompt == 1) {
+        const void * keys[] = { kAXTrustedCheckOptionPrompt };
+        const void * values[] = { kCFBooleanTrue };
+        CF_SCOPED CFDictionaryRef options = CFDictionaryCreate(NULL, keys, values, 1, NULL, NULL);
+        if (ax_backend->isProcessTrusted(options)) {
+            Py_RETURN_TRUE;
+        } else {
+            Py_RETURN_FALSE;
+        }
+    } else {
+        if (ax_backend->isProcessTrusted(NULL)) {
+            Py_RETURN_TRUE;
+        } else {
+            Py_RETURN_FALSE;
+        }
+    }
+#else
+
+// Use the old system otherwise
+static PyObject * is_enabled(PyObject * self) {
+    if (AXAPIEnabled()) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+#endif
+}
+
+static PyObject * is_trusted(PyObject * self) {
+    if (ax_backend->isProcessTrusted(NULL)) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static AccessibleElement * create_application_ref(PyObject * self, PyObject * args, PyObject * kwargs) {
+    ModuleState * state = moduleState(self);
+    static char *kwlist [] = {"pid", "force", "cached", NULL};
+    pid_t pid;
+    int force = 0;
+    int cached = 0;
+ 
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|ii", kwlist, &pid, &force, &cached))
+        return NULL;
+
+    PyObject * key = NULL;
+    if (cached) {
+        key = Py_BuildValue("i", pid);
+        if (!key) return NULL;
+        // The cache and its counters are shared by every thread
+        AccessibleElement * hit;
+        Py_BEGIN_CRITICAL_SECTION(state->application_cache);
+        hit = (AccessibleElement *) PyDict_GetItem(state->application_cache, key);
+        Py_XINCREF(hit);
+        Py_END_CRITICAL_SECTION();
+        int exists = hit != NULL && ax_backend->processExists(pid);
+        Py_BEGIN_CRITICAL_SECTION(state->application_cache);
+        if (exists) {
+            state->application_cache_hits++;
+        } else {
+            if (hit != NULL && PyDict_GetItem(state->application_cache, key) == (PyObject *) hit) {
+                PyDict_DelItem(state->application_cache, key);
+                state->application_cache_evictions++;
+            }
+            state->application_cache_misses++;
+        }
+        Py_END_CRITICAL_SECTION();
+        if (exists) {
+            Py_DECREF(key);
+            return hit;
+        }
+        Py_XDECREF(hit);
+    }
+
+    uint64_t call_started = callBegin();
+    AXUIElementRef ref = ax_backend->createApplication(pid);
+    callEnd(OP_CREATE_APPLICATION, NULL, pid, call_started, kAXErrorSuccess);
+    
+    // Just check to see if the element responds to a basic attribute request
+    // This might cause problems in some extreme cases, but it also alleviates
+    // the common mistake of passing in a PID with a typo, only to have a call
+    // fail later.
+    CFTypeRef value = NULL;
+    Request request = { .operation = OP_COPY_ATTRIBUTE_VALUE, .attribute = kAXRoleAttribute, .ref = ref, .pid = pid };
+    AXError error = requestBegin(&request, currentPriority(), 1, 0, NULL);
+    if (error == kAXErrorSuccess) {
+        error = axSessionCopy(&ax_session, ref, kAXRoleAttribute, &value);
+        requestEnd(&request, error);
+    }
+    if (value != NULL) CFRelease(value);
+    
+    if (error == kAXErrorCircuitOpen && force == 0) {
+        handleAXErrors(state, "AXRole", error);
+        CFRelease(ref);
+        Py_XDECREF(key);
+        return NULL;
+    } else if (error == kAXErrorAPIDisabled) {
+        PyErr_SetString(state->APIDisabledError, "The element created with this PID does not respond to Accessibility requests -- perhaps Accessibility is not enabled on the system?");
+        CFRelease(ref);
+        Py_XDECREF(key);
+        return NULL;
+    } else if (error != kAXErrorSuccess && force == 0) {
+        PyErr_SetString(PyExc_ValueError,
+           "The element does not respond to a request for its AXRole, which is \n\
+supposedly required of all Accessibility API-enabled objects. For this reason, \n\
+it is inadvisable to try and create an AccessibleElement for this PID. You may \n\
+override this failure case by passing ``force = True`` to this function.");
+        CFRelease(ref);
+        Py_XDECREF(key);
+        return NULL;
+    }
+
+    AccessibleElement * result = elementWithRef(state, &ref);
+    if (result != NULL && key != NULL) {
+        // Another thread may have cached one while this one was created, in
+        // which case everyone gets that one
+        Py_BEGIN_CRITICAL_SECTION(state->application_cache);
+        AccessibleElement * other = (AccessibleElement *) PyDict_GetItem(state->application_cache, key);
+        if (other != NULL) {
+            Py_INCREF(other);
+            Py_DECREF(result);
+            result = other;
+        } else if (PyDict_SetItem(state->application_cache, key, (PyObject *) result) == -1) {
+            Py_DECREF(result);
+            result = NULL;
+        }
+        Py_END_CRITICAL_SECTION();
+    }
+    Py_XDECREF(key);
+    return result;
+}
+
+static AccessibleElement * create_systemwide_ref(PyObject * self, PyObject * args) {
+    ModuleState * state = moduleState(self);
+    uint64_t call_started = callBegin();
+    AXUIElementRef ref = ax_backend->createSystemWide();
+    callEnd(OP_CREATE_SYSTEMWIDE, NULL, -1, call_started, kAXErrorSuccess);
+    return elementWithRef(state, &ref);
+}
+
+static AccessibleElement * element_at_position(PyObject * self, PyObject * args, PyObject * kwargs) {
+    ModuleState * state = moduleState(self);
+    AccessibleElement * result = NULL;
+    AccessibleElement * parent = NULL;
+    float x, y;
+
+    static char *kwlist [] = {"x", "y", "element", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ff|O", kwlist, &x, &y, &parent))
+        return NULL;
+    
+    AXUIElementRef ref = (parent != NULL) ? parent->_ref : ax_backend->createSystemWide();
+    AXUIElementRef element;
+    uint64_t call_started = callBegin();
+    AXError error = ax_backend->copyElementAtPosition(ref, x, y, &element);
+    callEnd(OP_COPY_ELEMENT_AT_POSITION, NULL, (parent != NULL) ? parent->_pid : -1, call_started, error);
+
+    if (error == kAXErrorSuccess) {
+        result = elementWithRef(state, &element);
+    } else {
+        handleAXErrors(state, "(element at position)", error);
+    }
+
+    if (ref != NULL && parent == NULL) CFRelease(ref);
+    return result;
+}
+
+static PyObject * application_cache_info(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    Py_ssize_t size;
+    unsigned long hits, misses, evictions;
+    Py_BEGIN_CRITICAL_SECTION(state->application_cache);
+    size = PyDict_Size(state->application_cache);
+    hits = state->application_cache_hits;
+    misses = state->application_cache_misses;
+    evictions = state->application_cache_evictions;
+    Py_END_CRITICAL_SECTION();
+
+    unsigned long lookups = hits + misses;
+    double hit_rate = lookups ? (double) hits / (double) lookups : 0.0;
+    return Py_BuildValue("{s:n,s:k,s:k,s:d,s:k}",
+        "size", size,
+        "hits", hits,
+        "misses", misses,
+        "hit_rate", hit_rate,
+        "evictions", evictions);
+}
+
+static PyObject * clear_application_cache(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    Py_BEGIN_CRITICAL_SECTION(state->application_cache);
+    PyDict_Clear(state->application_cache);
+    state->application_cache_hits = 0;
+    state->application_cache_misses = 0;
+    state->application_cache_evictions = 0;
+    Py_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+static PyObject * enable_schema_cache(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"enabled", NULL};
+    int enabled = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &enabled))
+        return NULL;
+
+    moduleState(self)->schema_cache_enabled = enabled ? 1 : 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject * schema_cache_info(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    Py_ssize_t size;
+    unsigned long hits, misses, evictions;
+    Py_BEGIN_CRITICAL_SECTION(state->schema_cache);
+    size = PyDict_Size(state->schema_cache);
+    hits = state->schema_cache_hits;
+    misses = state->schema_cache_misses;
+    evictions = state->schema_cache_evictions;
+    Py_END_CRITICAL_SECTION();
+
+    unsigned long lookups = hits + misses;
+    double hit_rate = lookups ? (double) hits / (double) lookups : 0.0;
+    return Py_BuildValue("{s:O,s:n,s:k,s:k,s:d,s:k}",
+        "enabled", state->schema_cache_enabled ? Py_True : Py_False,
+        "size", size,
+        "hits", hits,
+        "misses", misses,
+        "hit_rate", hit_rate,
+        "evictions", evictions);
+}
+
+static PyObject * clear_schema_cache(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    Py_BEGIN_CRITICAL_SECTION(state->schema_cache);
+    PyDict_Clear(state->schema_cache);
+    state->schema_cache_hits = 0;
+    state->schema_cache_misses = 0;
+    state->schema_cache_evictions = 0;
+    Py_END_CRITICAL_SECTION();
+    Py_RETURN_NONE;
+}
+
+// Empties the interned strings' slots, which needs the GIL.
+static void internReleaseEntries(InternEntry * entries, size_t capacity) {
+    for (size_t i = 0; entries != NULL && i < capacity; i++) {
+        if (entries[i].string != NULL) CFRelease(entries[i].string);
+        Py_XDECREF(entries[i].value);
+    }
+    free(entries);
+}
+
+static void internReleaseAttributes(CFStringRef * attributes, size_t count) {
+    for (size_t i = 0; attributes != NULL && i < count; i++) CFRelease(attributes[i]);
+    free(attributes);
+}
+
+/*
+ * Replaces the interned attributes, if attributes is not NULL, and the slots
+ * (emptying them), if capacity is not negative. Takes ownership of
+ * attributes. Returns -1 with an exception set if memory ran out.
+ */
+static int internConfigure(ModuleState * state, CFStringRef * attributes, size_t attribute_count, long capacity) {
+    InternEntry * entries = NULL;
+    size_t size = 0;
+    if (capacity > 0) {
+        size = 1;
+        while (size < (size_t) capacity) size <<= 1;
+        entries = (InternEntry *) calloc(size, sizeof(InternEntry));
+        if (entries == NULL) {
+            internReleaseAttributes(attributes, attribute_count);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&state->intern_lock);
+    if (attributes != NULL) {
+        CFStringRef * swapped = state->intern_attributes;
+        size_t swapped_count = state->intern_attribute_count;
+        state->intern_attributes = attributes;
+        state->intern_attribute_count = attribute_count;
+        attributes = swapped;
+        attribute_count = swapped_count;
+    }
+    size_t old_size = 0;
+    if (capacity >= 0) {
+        InternEntry * swapped = state->intern_entries;
+        old_size = state->intern_capacity;
+        state->intern_entries = entries;
+        state->intern_capacity = size;
+        entries = swapped;
+    }
+    pthread_mutex_unlock(&state->intern_lock);
+
+    internReleaseAttributes(attributes, attribute_count);
+    internReleaseEntries(capacity >= 0 ? entries : NULL, old_size);
+    return 0;
+}
+
+static PyObject * configure_intern_cache(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"attributes", "capacity", NULL};
+    ModuleState * state = moduleState(self);
+    PyObject * names = NULL;
+
+    pthread_mutex_lock(&state->intern_lock);
+    long current = (long) state->intern_capacity;
+    pthread_mutex_unlock(&state->intern_lock);
+    long capacity = current;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Ol", kwlist, &names, &capacity))
+        return NULL;
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "The capacity cannot be negative.");
+        return NULL;
+    } else if (capacity > INTERN_MAX_CAPACITY) {
+        PyErr_Format(PyExc_ValueError, "The capacity cannot be more than %d.", INTERN_MAX_CAPACITY);
+        return NULL;
+    }
+
+    CFStringRef * attributes = NULL;
+    size_t attribute_count = 0;
+    if (names != NULL && names != Py_None) {
+        PyObject * sequence = sequenceCopy(names, "The attributes must be a sequence of strings.");
+        if (sequence == NULL) return NULL;
+        attribute_count = (size_t) PyTuple_GET_SIZE(sequence);
+        attributes = (CFStringRef *) calloc(attribute_count ? attribute_count : 1, sizeof(CFStringRef));
+        if (attributes == NULL) {
+            Py_DECREF(sequence);
+            return PyErr_NoMemory();
+        }
+        for (size_t i = 0; i < attribute_count; i++) {
+            char * name_string = NULL;
+            attributes[i] = CFStringFromPyString(PyTuple_GET_ITEM(sequence, (Py_ssize_t) i), &name_string);
+            if (attributes[i] == NULL) {
+                Py_DECREF(sequence);
+                internReleaseAttributes(attributes, i);
+                return NULL;
+            }
+        }
+        Py_DECREF(sequence);
+    }
+    // The strings are only forgotten if the capacity changes
+    if (internConfigure(state, attributes, attribute_count, capacity != current ? capacity : -1) == -1) return NULL;
+
+    PyObject * result = PyList_New(0);
+    pthread_mutex_lock(&state->intern_lock);
+    for (size_t i = 0; result != NULL && i < state->intern_attribute_count; i++) {
+        PyObject * item = parseCFTypeRef(state, state->intern_attributes[i]);
+        if (item == NULL || PyList_Append(result, item) == -1) Py_CLEAR(result);
+        Py_XDECREF(item);
+    }
+    size_t size = state->intern_capacity;
+    pthread_mutex_unlock(&state->intern_lock);
+    if (result == NULL) return NULL;
+
+    return Py_BuildValue("{s:N,s:n}",
+        "attributes", result,
+        "capacity", (Py_ssize_t) size);
+}
+
+static PyObject * intern_cache_info(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    Py_ssize_t size = 0;
+    pthread_mutex_lock(&state->intern_lock);
+    for (size_t i = 0; i < state->intern_capacity; i++) {
+        if (state->intern_entries[i].string != NULL) size++;
+    }
+    size_t capacity = state->intern_capacity;
+    unsigned long hits = state->intern_hits;
+    unsigned long misses = state->intern_misses;
+    unsigned long evictions = state->intern_evictions;
+    pthread_mutex_unlock(&state->intern_lock);
+
+    unsigned long lookups = hits + misses;
+    double hit_rate = lookups ? (double) hits / (double) lookups : 0.0;
+    return Py_BuildValue("{s:n,s:n,s:k,s:k,s:d,s:k}",
+        "size", size,
+        "capacity", (Py_ssize_t) capacity,
+        "hits", hits,
+        "misses", misses,
+        "hit_rate", hit_rate,
+        "evictions", evictions);
+}
+
+static PyObject * clear_intern_cache(PyObject * self) {
+    ModuleState * state = moduleState(self);
+    pthread_mutex_lock(&state->intern_lock);
+    long capacity = (long) state->intern_capacity;
+    state->intern_hits = 0;
+    state->intern_misses = 0;
+    state->intern_evictions = 0;
+    pthread_mutex_unlock(&state->intern_lock);
+    if (internConfigure(state, NULL, 0, capacity) == -1) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject * configure_breaker(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"threshold", "cooldown", "adaptive_timeout", "multiplier", "min_timeout", "max_timeout", NULL};
+
+    healthLockAll();
+    BreakerConfig config = breaker_config;
+    healthUnlockAll();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ididdd", kwlist, &config.threshold, &config.cooldown,
+            &config.adaptive_timeout, &config.multiplier, &config.min_timeout, &config.max_timeout))
+        return NULL;
+
+    if (config.threshold < 0 || config.cooldown < 0) {
+        PyErr_SetString(PyExc_ValueError, "The threshold and cooldown cannot be negative.");
+        return NULL;
+    } else if (config.multiplier <= 0 || config.min_timeout <= 0 || config.min_timeout > config.max_timeout) {
+        PyErr_SetString(PyExc_ValueError, "The multiplier must be positive, and the timeouts a positive range.");
+        return NULL;
+    }
+    config.adaptive_timeout = config.adaptive_timeout ? 1 : 0;
+
+    healthLockAll();
+    breaker_config = config;
+    healthUnlockAll();
+
+    return Py_BuildValue("{s:i,s:d,s:N,s:d,s:d,s:d}",
+        "threshold", config.threshold,
+        "cooldown", config.cooldown,
+        "adaptive_timeout", PyBool_FromLong(config.adaptive_timeout),
+        "multiplier", config.multiplier,
+        "min_timeout", config.min_timeout,
+        "max_timeout", config.max_timeout);
+}
+
+static PyObject * healthAsDict(ApplicationHealth * health, BreakerConfig * config, float least, double now) {
+    int open = config->threshold > 0 && health->consecutive_failures >= config->threshold && now < health->open_until;
+    PyObject * p50 = Py_None;
+    PyObject * p99 = Py_None;
+    PyObject * timeout = Py_None;
+    if (health->sample_count > 0) {
+        p50 = PyFloat_FromDouble(health->p50);
+        p99 = PyFloat_FromDouble(health->p99);
+    } else {
+        Py_INCREF(p50);
+        Py_INCREF(p99);
+    }
+    if (config->adaptive_timeout && health->sample_count >= HEALTH_MIN_SAMPLES) {
+        timeout = PyFloat_FromDouble(healthTimeout(health, config, least));
+    } else {
+        Py_INCREF(timeout);
+    }
+    return Py_BuildValue("{s:k,s:k,s:k,s:i,s:N,s:N,s:N,s:N}",
+        "requests", health->requests,
+        "failures", health->failures,
+        "rejected", health->rejected,
+        "consecutive_failures", health->consecutive_failures,
+        "open", PyBool_FromLong(open),
+        "p50", p50,
+        "p99", p99,
+        "timeout", timeout);
+}
+
+static PyObject * application_health(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"pid", NULL};
+    PyObject * pid_arg = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &pid_arg))
+        return NULL;
+
+    long pid = -1;
+    if (pid_arg != Py_None) {
+        pid = PyLong_AsLong(pid_arg);
+        if (pid == -1 && PyErr_Occurred()) return NULL;
+    }
+
+    // Copy the entries so that no Python objects are built under the lock
+    healthLockAll();
+    BreakerConfig config = breaker_config;
+    float least = system_timeout;
+    size_t total = 0;
+    for (int s = 0; s < HEALTH_STRIPES; s++) total += health_stripes[s].count;
+    size_t count = 0;
+    ApplicationHealth * copies = (ApplicationHealth *) malloc((total ? total : 1) * sizeof(ApplicationHealth));
+    for (int s = 0; copies != NULL && s < HEALTH_STRIPES; s++) {
+        HealthStripe * stripe = &health_stripes[s];
+        for (size_t i = 0; i < stripe->capacity; i++) {
+            if (!stripe->table[i].in_use) continue;
+            if (pid != -1 && stripe->table[i].pid != (pid_t) pid) continue;
+            if (stripe->table[i].samples_since_sort > 0) healthSortSamples(&stripe->table[i]);
+            copies[count++] = stripe->table[i];
+        }
+    }
+    healthUnlockAll();
+    if (copies == NULL) return PyErr_NoMemory();
+
+    double now = monotonicTime();
+    PyObject * result = NULL;
+    if (pid != -1) {
+        if (count > 0) {
+            result = healthAsDict(&copies[0], &config, least, now);
+        } else {
+            PyErr_Format(PyExc_KeyError, "No requests have been made to PID %ld.", pid);
+        }
+    } else {
+        result = PyDict_New();
+        for (size_t i = 0; result != NULL && i < count; i++) {
+            PyObject * key = Py_BuildValue("i", copies[i].pid);
+            PyObject * value = healthAsDict(&copies[i], &config, least, now);
+            if (!key || !value || PyDict_SetItem(result, key, value) == -1) {
+                Py_CLEAR(result);
+            }
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+        }
+    }
+    free(copies);
+    return result;
+}
+
+static PyObject * reset_application_health(PyObject * self) {
+    healthLockAll();
+    for (int s = 0; s < HEALTH_STRIPES; s++) {
+        HealthStripe * stripe = &health_stripes[s];
+        int busy = 0;
+        for (size_t i = 0; i < stripe->capacity && !busy; i++) {
+            RequestQueue * queue = &stripe->table[i].queue;
+            busy = stripe->table[i].in_use && (queue->in_flight > 0 || scheduleWaiting(queue));
+        }
+        if (busy) {
+            // Requests hold on to the entries of their applications, so only
+            // the history is forgotten
+            for (size_t i = 0; i < stripe->capacity; i++) {
+                ApplicationHealth * health = &stripe->table[i];
+                if (!health->in_use) continue;
+                ApplicationHealth kept = { .pid = health->pid, .in_use = 1, .queue = health->queue };
+                *health = kept;
+            }
+            continue;
+        }
+        free(stripe->table);
+        stripe->table = NULL;
+        stripe->capacity = 0;
+        stripe->count = 0;
+    }
+    healthUnlockAll();
+    Py_RETURN_NONE;
+}
+
+static PyObject * configure_scheduler(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"max_in_flight", "background_in_flight", NULL};
+
+    healthLockAll();
+    SchedulerConfig config = scheduler_config;
+    healthUnlockAll();
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &config.max_in_flight, &config.background_in_flight))
+        return NULL;
+
+    if (config.max_in_flight < 0 || config.background_in_flight < 0) {
+        PyErr_SetString(PyExc_ValueError, "The limits cannot be negative.");
+        return NULL;
+    }
+
+    healthLockAll();
+    __atomic_store_n(&scheduler_config.max_in_flight, config.max_in_flight, __ATOMIC_RELAXED);
+    scheduler_config.background_in_flight = config.background_in_flight;
+    // Waiting requests may be free to go under the new limits
+    for (int s = 0; s < HEALTH_STRIPES; s++) pthread_cond_broadcast(&health_stripes[s].available);
+    healthUnlockAll();
+
+    return Py_BuildValue("{s:i,s:i}",
+        "max_in_flight", config.max_in_flight,
+        "background_in_flight", config.background_in_flight);
+}
+
+static PyObject * set_priority(PyObject * self, PyObject * args) {
+    const char * name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+
+    int priority = -1;
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        if (strcmp(name, priority_names[p]) == 0) priority = p;
+    }
+    if (priority == -1) {
+        PyErr_SetString(PyExc_ValueError, "The priority must be 'interactive', 'normal' or 'background'.");
+        return NULL;
+    }
+
+    RequestPriority previous = currentPriority();
+    pthread_setspecific(priority_key, (void *) (intptr_t) (priority + 1));
+#if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString(priority_names[previous]);
+#else
+    return PyString_FromString(priority_names[previous]);
+#endif
+}
+
+static PyObject * scheduler_info(PyObject * self) {
+    // Copy what is needed so that no Python objects are built under the lock
+    healthLockAll();
+    SchedulerConfig config = scheduler_config;
+    SchedulerCounters counters[PRIORITY_COUNT];
+    unsigned long queued[PRIORITY_COUNT];
+    memset(counters, 0, sizeof(counters));
+    memset(queued, 0, sizeof(queued));
+    size_t total = 0;
+    for (int s = 0; s < HEALTH_STRIPES; s++) total += health_stripes[s].count;
+    size_t count = 0;
+    ApplicationHealth * busy = (ApplicationHealth *) malloc((total ? total : 1) * sizeof(ApplicationHealth));
+    for (int s = 0; busy != NULL && s < HEALTH_STRIPES; s++) {
+        HealthStripe * stripe = &health_stripes[s];
+        for (int p = 0; p < PRIORITY_COUNT; p++) {
+            counters[p].requests += stripe->counters[p].requests;
+            counters[p].waited += stripe->counters[p].waited;
+            counters[p].wait_total += stripe->counters[p].wait_total;
+            if (stripe->counters[p].wait_max > counters[p].wait_max) counters[p].wait_max = stripe->counters[p].wait_max;
+        }
+        for (size_t i = 0; i < stripe->capacity; i++) {
+            RequestQueue * queue = &stripe->table[i].queue;
+            if (!stripe->table[i].in_use || (queue->in_flight == 0 && !scheduleWaiting(queue))) continue;
+            for (int p = 0; p < PRIORITY_COUNT; p++) queued[p] += queue->next_ticket[p] - queue->serving[p];
+            busy[count++] = stripe->table[i];
+        }
+    }
+    healthUnlockAll();
+    if (busy == NULL) return PyErr_NoMemory();
+
+    PyObject * priorities = PyDict_New();
+    for (int p = 0; priorities != NULL && p < PRIORITY_COUNT; p++) {
+        double mean = counters[p].waited ? counters[p].wait_total / counters[p].waited : 0.0;
+        PyObject * value = Py_BuildValue("{s:K,s:K,s:d,s:d,s:d,s:k}",
+            "requests", counters[p].requests,
+            "waited", counters[p].waited,
+            "wait_total", counters[p].wait_total,
+            "wait_mean", mean,
+            "wait_max", counters[p].wait_max,
+            "queued", queued[p]);
+        if (!value || PyDict_SetItemString(priorities, priority_names[p], value) == -1) Py_CLEAR(priorities);
+        Py_XDECREF(value);
+    }
+    PyObject * applications = PyDict_New();
+    for (size_t i = 0; applications != NULL && i < count; i++) {
+        RequestQueue * queue = &busy[i].queue;
+        PyObject * key = Py_BuildValue("i", busy[i].pid);
+        PyObject * value = Py_BuildValue("{s:i,s:{s:k,s:k,s:k}}",
+            "in_flight", queue->in_flight,
+            "queued",
+                priority_names[PRIORITY_INTERACTIVE], queue->next_ticket[PRIORITY_INTERACTIVE] - queue->serving[PRIORITY_INTERACTIVE],
+                priority_names[PRIORITY_NORMAL], queue->next_ticket[PRIORITY_NORMAL] - queue->serving[PRIORITY_NORMAL],
+                priority_names[PRIORITY_BACKGROUND], queue->next_ticket[PRIORITY_BACKGROUND] - queue->serving[PRIORITY_BACKGROUND]);
+        if (!key || !value || PyDict_SetItem(applications, key, value) == -1) Py_CLEAR(applications);
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+    }
+    free(busy);
+    if (!priorities || !applications) {
+        Py_XDECREF(priorities);
+        Py_XDECREF(applications);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:i,s:i,s:N,s:N}",
+        "max_in_flight", config.max_in_flight,
+        "background_in_flight", config.background_in_flight,
+        "priorities", priorities,
+        "applications", applications);
+}
+
+static PyObject * enable_stats(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"enabled", NULL};
+    int enabled = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &enabled))
+        return NULL;
+
+    pthread_mutex_lock(&stats_lock);
+    if (enabled && !stats_enabled && stats_count == 0) stats_reset_at = nanoTime();
+    stats_enabled = enabled ? 1 : 0;
+    pthread_mutex_unlock(&stats_lock);
+    Py_RETURN_NONE;
+}
+
+static PyObject * statsAsDict(ModuleState * state, CallStats * entry) {
+    PyObject * attribute = Py_None;
+    if (entry->attribute != NULL) {
+        attribute = parseCFTypeRef(state, entry->attribute);
+        if (!attribute) return NULL;
+    } else {
+        Py_INCREF(attribute);
+    }
+    PyObject * pid = (entry->pid > 0) ? Py_BuildValue("i", entry->pid) : (Py_INCREF(Py_None), Py_None);
+
+    // Walk the buckets once for all the percentiles, and keep the non-empty
+    // ones as the histogram.
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    double values[4] = { 0, 0, 0, 0 };
+    int q = 0;
+    uint64_t seen = 0;
+    PyObject * histogram = PyList_New(0);
+    for (int i = 0; histogram != NULL && i < STATS_BUCKETS; i++) {
+        if (entry->buckets[i] == 0) continue;
+        seen += entry->buckets[i];
+        uint64_t value = statsBucketValue(i);
+        if (value > entry->max) value = entry->max;
+        while (q < 4 && (double) seen >= quantiles[q] * (double) entry->count) {
+            values[q++] = value / 1e9;
+        }
+        PyObject * pair = Py_BuildValue("(dI)", value / 1e9, entry->buckets[i]);
+        if (!pair || PyList_Append(histogram, pair) == -1) Py_CLEAR(histogram);
+        Py_XDECREF(pair);
+    }
+    if (!histogram || !pid) {
+        Py_DECREF(attribute);
+        Py_XDECREF(pid);
+        Py_XDECREF(histogram);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:s,s:N,s:N,s:K,s:K,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:N}",
+        "operation", operation_names[entry->operation],
+        "attribute", attribute,
+        "pid", pid,
+        "count", (unsigned long long) entry->count,
+        "errors", (unsigned long long) entry->errors,
+        "total", entry->total / 1e9,
+        "min", entry->count ? entry->min / 1e9 : 0.0,
+        "max", entry->max / 1e9,
+        "mean", entry->count ? (double) entry->total / (double) entry->count / 1e9 : 0.0,
+        "p50", values[0],
+        "p90", values[1],
+        "p99", values[2],
+        "p999", values[3],
+        "histogram", histogram);
+}
+
+static PyObject * stats(PyObject * self) {
+    // Copy everything out first; building Python objects under the lock could
+    // run arbitrary code (e.g. a garbage collection) that records calls itself.
+    pthread_mutex_lock(&stats_lock);
+    int enabled = stats_enabled;
+    double elapsed = stats_reset_at ? (nanoTime() - stats_reset_at) / 1e9 : 0.0;
+    uint64_t error_counts[STATS_ERROR_CODES];
+    memcpy(error_counts, stats_error_counts, sizeof(error_counts));
+    uint64_t circuit_open = stats_circuit_open;
+    uint64_t other_errors = stats_other_errors;
+    uint64_t overflow = stats_overflow;
+    size_t count = 0;
+    CallStats * copies = (CallStats *) malloc((stats_count ? stats_count : 1) * sizeof(CallStats));
+    for (size_t i = 0; copies != NULL && i < stats_capacity; i++) {
+        if (!stats_table[i].in_use) continue;
+        copies[count] = stats_table[i];
+        if (copies[count].attribute != NULL) CFRetain(copies[count].attribute);
+        count++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+    if (copies == NULL) return PyErr_NoMemory();
+
+    PyObject * calls = PyList_New(0);
+    for (size_t i = 0; calls != NULL && i < count; i++) {
+        PyObject * entry = statsAsDict(moduleState(self), &copies[i]);
+        if (!entry || PyList_Append(calls, entry) == -1) Py_CLEAR(calls);
+        Py_XDECREF(entry);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (copies[i].attribute != NULL) CFRelease(copies[i].attribute);
+    }
+    free(copies);
+
+    PyObject * errors = PyDict_New();
+    for (int i = 0; errors != NULL && i < STATS_ERROR_CODES + 1; i++) {
+        uint64_t n = (i < STATS_ERROR_CODES) ? error_counts[i] : circuit_open;
+        if (n == 0) continue;
+        PyObject * key = Py_BuildValue("i", (i < STATS_ERROR_CODES) ? kAXErrorFailure - i : kAXErrorCircuitOpen);
+        PyObject * value = PyLong_FromUnsignedLongLong(n);
+        if (!key || !value || PyDict_SetItem(errors, key, value) == -1) Py_CLEAR(errors);
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+    }
+    if (!calls || !errors) {
+        Py_XDECREF(calls);
+        Py_XDECREF(errors);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:N,s:d,s:N,s:N,s:K,s:K}",
+        "enabled", PyBool_FromLong(enabled),
+        "elapsed", elapsed,
+        "calls", calls,
+        "errors", errors,
+        "other_errors", (unsigned long long) other_errors,
+        "dropped", (unsigned long long) overflow);
+}
+
+static PyObject * start_trace(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"buffer_size", NULL};
+    Py_ssize_t buffer_size = TRACE_DEFAULT_CAPACITY;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", kwlist, &buffer_size))
+        return NULL;
+
+    if (buffer_size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The buffer size must be positive.");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    // Buffers of threads that have exited will never be reset by their owner
+    TraceBuffer ** link = &trace_buffers;
+    while (*link != NULL) {
+        TraceBuffer * buffer = *link;
+        if (buffer->orphaned) {
+            *link = buffer->next;
+            traceBufferClear(buffer);
+            free(buffer->events);
+            free(buffer);
+        } else {
+            link = &buffer->next;
+        }
+    }
+    trace_capacity = (size_t) buffer_size;
+    trace_origin = nanoTime();
+    __atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+    trace_enabled = 1;
+    pthread_mutex_unlock(&trace_lock);
+    Py_RETURN_NONE;
+}
+
+static PyObject * stop_trace(PyObject * self) {
+    trace_enabled = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject * write_trace(PyObject * self, PyObject * args) {
+    char * path = NULL;
+
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+
+    FILE * file = fopen(path, "w");
+    if (file == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return NULL;
+    }
+
+    unsigned long written = 0;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&trace_lock);
+    written = traceWrite(file);
+    pthread_mutex_unlock(&trace_lock);
+    fclose(file);
+    Py_END_ALLOW_THREADS
+
+    return Py_BuildValue("k", written);
+}
+
+static PyObject * set_backend(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"name", "config", NULL};
+    char * name = NULL;
+    PyObject * config = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|O", kwlist, &name, &config))
+        return NULL;
+
+    const AXBackend * previous = activeBackend();
+#ifdef __APPLE__
+    if (strcmp(name, hiservices_backend.name) == 0) {
+        if (config != Py_None) {
+            PyErr_SetString(PyExc_ValueError, "The hiservices backend takes no configuration.");
+            return NULL;
+        }
+        recordingStop();
+        useBackend(&hiservices_backend);
+    }
+#else
+    if (strcmp(name, simulated_backend.name) == 0) {
+        SimConfig simulation;
+        if (parseSimulatedConfig(config, &simulation) == -1)
+            return NULL;
+
+        // Waits for requests in flight on other threads to finish
+        int failed;
+        Py_BEGIN_ALLOW_THREADS
+        failed = simulatedConfigure(&simulation);
+        Py_END_ALLOW_THREADS
+        free(simulation.applications);
+        if (failed) return PyErr_NoMemory();
+        recordingStop();
+        useBackend(&simulated_backend);
+    } else if (strcmp(name, replay_backend.name) == 0) {
+        char * path = NULL;
+        double speed = 1.0;
+        if (parseReplayConfig(config, &path, &speed) == -1)
+            return NULL;
+
+        char message[512];
+        int failed;
+        Py_BEGIN_ALLOW_THREADS
+        failed = replayOpen(path, speed, message, sizeof(message));
+        Py_END_ALLOW_THREADS
+        if (failed) {
+            PyErr_SetString(PyExc_ValueError, message);
+            return NULL;
+        }
+        recordingStop();
+        useBackend(&replay_backend);
+    }
+#endif
+    else {
+        PyErr_Format(PyExc_ValueError, "The %s backend is not available on this platform.", name);
+        return NULL;
+    }
+
+#ifndef __APPLE__
+    if (previous == &replay_backend && ax_backend != &replay_backend) {
+        Py_BEGIN_ALLOW_THREADS
+        replayClose();
+        Py_END_ALLOW_THREADS
+    }
+#endif
+
+    // Neither PIDs nor elements carry over between backends
+    PyObject * application_cache = moduleState(self)->application_cache;
+    Py_BEGIN_CRITICAL_SECTION(application_cache);
+    PyDict_Clear(application_cache);
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(reset_application_health(self));
+    Py_RETURN_NONE;
+}
+
+static PyObject * current_backend(PyObject * self) {
+    return Py_BuildValue("s", activeBackend()->name);
+}
+
+static PyObject * start_recording(PyObject * self, PyObject * args) {
+    char * path = NULL;
+
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+
+    if (ax_backend == &recording_backend) {
+        PyErr_SetString(PyExc_RuntimeError, "A recording is already in progress.");
+        return NULL;
+    }
+
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = recordingStart(ax_backend, path);
+    Py_END_ALLOW_THREADS
+    if (error != 0) {
+        errno = error;
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return NULL;
+    }
+
+    useBackend(&recording_backend);
+    Py_RETURN_NONE;
+}
+
+static PyObject * stop_recording(PyObject * self) {
+    if (ax_backend != &recording_backend) {
+        PyErr_SetString(PyExc_RuntimeError, "Nothing is being recorded.");
+        return NULL;
+    }
+
+    useBackend(recordingInner());
+    long calls;
+    Py_BEGIN_ALLOW_THREADS
+    calls = recordingStop();
+    Py_END_ALLOW_THREADS
+    if (calls < 0) {
+        PyErr_SetString(PyExc_IOError, "The session log could not be written in full.");
+        return NULL;
+    }
+    return Py_BuildValue("l", calls);
+}
+
+static PyObject * replay_info(PyObject * self) {
+#ifndef __APPLE__
+    ReplayInfo info;
+    replayGetInfo(&info);
+    return Py_BuildValue("{s:K,s:K,s:d,s:K,s:K,s:K,s:K}",
+        "calls", (unsigned long long) info.calls,
+        "notifications", (unsigned long long) info.notifications,
+        "duration", info.duration,
+        "hits", (unsigned long long) info.hits,
+        "misses", (unsigned long long) info.misses,
+        "posted", (unsigned long long) info.posted,
+        "unheard", (unsigned long long) info.unheard);
+#else
+    PyErr_SetString(PyExc_NotImplementedError, "Sessions can only be replayed where the module provides its own run loops.");
+    return NULL;
+#endif
+}
+
+/*
+ * The thread state each thread's run_loop() gives up while it waits, so that
+ * notifications it dispatches are delivered to the interpreter that runs it
+ * (which PyGILState_Ensure cannot tell apart once there are several).
+ */
+static pthread_key_t loop_key;
+
+static PyObject * run_loop(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"timeout", NULL};
+    PyObject * timeout_object = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout_object))
+        return NULL;
+
+    double timeout = -1;
+    if (timeout_object != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_object);
+        if (timeout == -1 && PyErr_Occurred()) return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError, "The timeout must not be negative.");
+            return NULL;
+        }
+    }
+
+    // Run in short slices so that KeyboardInterrupt still gets through
+    double deadline = monotonicTime() + timeout;
+    while (1) {
+        double slice = 0.1;
+        if (timeout >= 0) {
+            double remaining = deadline - monotonicTime();
+            if (remaining <= 0) break;
+            if (remaining < slice) slice = remaining;
+        }
+
+        CFRunLoopRunResult result;
+        void * outer = pthread_getspecific(loop_key);
+        Py_BEGIN_ALLOW_THREADS
+        pthread_setspecific(loop_key, _save);
+        result = CFRunLoopRunInMode(kCFRunLoopDefaultMode, slice, 0);
+        pthread_setspecific(loop_key, outer);
+        Py_END_ALLOW_THREADS
+        if (result == kCFRunLoopRunFinished || result == kCFRunLoopRunStopped) break;
+        if (PyErr_CheckSignals() == -1) return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * run_loop_info(PyObject * self) {
+#ifndef __APPLE__
+    AXCompatRunLoopStats stats;
+    AXCompatRunLoopGetStats(&stats);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+        "posted", (unsigned long long) stats.posted,
+        "delivered", (unsigned long long) stats.delivered,
+        "dropped", (unsigned long long) stats.dropped,
+        "max_depth", (unsigned long long) stats.max_depth,
+        "queue_capacity", (unsigned long long) stats.queue_capacity);
+#else
+    PyErr_SetString(PyExc_NotImplementedError, "Run loop counts are only kept by the module's own run loops.");
+    return NULL;
+#endif
+}
+
+static PyObject * simulate_notification(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"element", "notification", "count", NULL};
+    AccessibleElement * element = NULL;
+    PyObject * name = NULL;
+    long count = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O|l", kwlist, moduleState(self)->AccessibleElement_type, &element, &name, &count))
+        return NULL;
+
+#ifndef __APPLE__
+    if (activeBackend() == &simulated_backend) {
+        char * name_string = NULL;
+        CFStringRef notification = CFStringFromPyString(name, &name_string);
+        if (!notification) return NULL;
+
+        long posted = simulatedPostNotification(element->_ref, notification, count);
+        CFRelease(notification);
+        if (posted < 0) {
+            handleElementAXErrors(element, name_string, kAXErrorInvalidUIElement);
+            return NULL;
+        }
+        return Py_BuildValue("l", posted);
+    }
+#endif
+
+    PyErr_SetString(PyExc_NotImplementedError, "Notifications can only be simulated with the simulated backend.");
+    return NULL;
+}
+
+/*
+ * Builds the value that benchmark_conversion converts, or returns NULL for an
+ * unknown kind. Arrays hold BENCHMARK_ARRAY_LENGTH items.
+ */
+#define BENCHMARK_ARRAY_LENGTH 16
+
+static CFTypeRef benchmarkValue(const char * kind) {
+    if (strcmp(kind, "string") == 0) {
+        return CFStringCreateWithCString(kCFAllocatorDefault, "AXButton", kCFStringEncodingUTF8);
+    } else if (strcmp(kind, "text") == 0) {
+        char text[1025];
+        for (int i = 0; i < 1024; i++) text[i] = (i % 8 == 7) ? ' ' : 'a' + (i % 26);
+        text[1024] = '\0';
+        return CFStringCreateWithCString(kCFAllocatorDefault, text, kCFStringEncodingUTF8);
+    } else if (strcmp(kind, "boolean") == 0) {
+        return CFRetain(kCFBooleanTrue);
+    } else if (strcmp(kind, "point") == 0) {
+        CGPoint point = { 120.0, 48.0 };
+        return AXValueCreate(kAXValueCGPointType, (const void *) &point);
+    } else if (strcmp(kind, "size") == 0) {
+        CGSize size = { 800.0, 600.0 };
+        return AXValueCreate(kAXValueCGSizeType, (const void *) &size);
+    } else if (strcmp(kind, "element") == 0) {
+        return ax_backend->createApplication(getpid());
+    } else if (strcmp(kind, "strings") == 0 || strcmp(kind, "elements") == 0) {
+        const char * item_kind = (kind[0] == 's') ? "string" : "element";
+        const void * items[BENCHMARK_ARRAY_LENGTH];
+        for (int i = 0; i < BENCHMARK_ARRAY_LENGTH; i++) items[i] = benchmarkValue(item_kind);
+        CFArrayRef array = CFArrayCreate(kCFAllocatorDefault, items, BENCHMARK_ARRAY_LENGTH, &kCFTypeArrayCallBacks);
+        for (int i = 0; i < BENCHMARK_ARRAY_LENGTH; i++) CFRelease(items[i]);
+        return array;
+    }
+    return NULL;
+}
+
+static PyObject * benchmark_conversion(PyObject * self, PyObject * args) {
+    char * kind = NULL;
+    long iterations = 0;
+
+    if (!PyArg_ParseTuple(args, "sl", &kind, &iterations))
+        return NULL;
+
+    CFTypeRef value = benchmarkValue(kind);
+    if (value == NULL) {
+        PyErr_Format(PyExc_ValueError, "Unknown value kind '%s'.", kind);
+        return NULL;
+    }
+
+    ModuleState * state = moduleState(self);
+    uint64_t started = nanoTime();
+    for (long i = 0; i < iterations; i++) {
+        PyObject * result = parseCFTypeRef(state, value);
+        if (result == NULL) {
+            CFRelease(value);
+            return NULL;
+        }
+        Py_DECREF(result);
+    }
+    uint64_t elapsed = nanoTime() - started;
+
+    CFRelease(value);
+    return PyFloat_FromDouble(elapsed / 1e9);
+}
+
+static PyObject * benchmark_dispatch(PyObject * self, PyObject * args) {
+    AccessibleElement * element = NULL;
+    PyObject * name = NULL;
+    long iterations = 0;
+
+    if (!PyArg_ParseTuple(args, "O!Ol", moduleState(self)->AccessibleElement_type, &element, &name, &iterations))
+        return NULL;
+
+    if (element->callback == Py_None) {
+        PyErr_SetString(PyExc_ValueError, "The element has no callback to dispatch to.");
+        return NULL;
+    }
+
+    char * name_string = NULL;
+    CFStringRef notification = CFStringFromPyString(name, &name_string);
+    if (!notification) return NULL;
+
+    // Dispatched as run_loop() does, giving up the thread state meanwhile
+    uint64_t started = nanoTime();
+    void * outer = pthread_getspecific(loop_key);
+    Py_BEGIN_ALLOW_THREADS
+    pthread_setspecific(loop_key, _save);
+    for (long i = 0; i < iterations; i++) {
+        NotifcationCallback(element->_ref, notification, (void *) element);
+    }
+    pthread_setspecific(loop_key, outer);
+    Py_END_ALLOW_THREADS
+    uint64_t elapsed = nanoTime() - started;
+
+    CFRelease(notification);
+    return PyFloat_FromDouble(elapsed / 1e9);
+}
+
+static PyObject * reset_stats(PyObject * self) {
+    pthread_mutex_lock(&stats_lock);
+    for (size_t i = 0; i < stats_capacity; i++) {
+        if (stats_table[i].in_use && stats_table[i].attribute != NULL) CFRelease(stats_table[i].attribute);
+    }
+    free(stats_table);
+    stats_table = NULL;
+    stats_capacity = 0;
+    stats_count = 0;
+    stats_overflow = 0;
+    memset(stats_error_counts, 0, sizeof(stats_error_counts));
+    stats_circuit_open = 0;
+    stats_other_errors = 0;
+    stats_reset_at = nanoTime();
+    pthread_mutex_unlock(&stats_lock);
+    healthLockAll();
+    for (int s = 0; s < HEALTH_STRIPES; s++) {
+        memset(health_stripes[s].counters, 0, sizeof(health_stripes[s].counters));
+    }
+    healthUnlockAll();
+#ifndef __APPLE__
+    AXCompatRunLoopResetStats();
+#endif
+    Py_RETURN_NONE;
+}
+
+/* Window inventory
+======== */
+
+// The results for a single application. Values are stored window-major, i.e.
+// values[window * attribute_count + attribute], and are NULL when missing.
+typedef struct {
+    pid_t pid;
+    AXError error;
+    CFArrayRef windows;
+    CFTypeRef * values;
+    int done;
+} WindowSweepEntry;
+
+// Shared between list_windows and its workers. Whoever drops the last
+// reference frees it, because workers for hung applications may outlive the
+// call that started them.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int references;
+    int closed;
+    Py_ssize_t next;
+    Py_ssize_t remaining;
+    float timeout;
+    RequestPriority priority;
+    CFStringRef * attributes;
+    Py_ssize_t attribute_count;
+    WindowSweepEntry * entries;
+    Py_ssize_t entry_count;
+} WindowSweep;
+
+// Past this many applications, workers take another once done with one,
+// and the call may wait for the timeout once for each round.
+#define WINDOW_SWEEP_MAX_WORKERS 32
+
+static void WindowSweepEntry_clear(WindowSweep * sweep, WindowSweepEntry * entry) {
+    if (entry->values != NULL) {
+        CFIndex window_count = CFArrayGetCount(entry->windows);
+        for (CFIndex i = 0; i < window_count * sweep->attribute_count; i++) {
+            if (entry->values[i] != NULL) CFRelease(entry->values[i]);
+        }
+        free(entry->values);
+        entry->values = NULL;
+    }
+    if (entry->windows != NULL) CFRelease(entry->windows);
+    entry->windows = NULL;
+}
+
+static void WindowSweep_release(WindowSweep * sweep) {
+    pthread_mutex_lock(&sweep->lock);
+    int references = --sweep->references;
+    pthread_mutex_unlock(&sweep->lock);
+    if (references > 0) return;
+
+    for (Py_ssize_t i = 0; i < sweep->entry_count; i++) {
+        WindowSweepEntry_clear(sweep, &sweep->entries[i]);
+    }
+    for (Py_ssize_t i = 0; i < sweep->attribute_count; i++) {
+        CFRelease(sweep->attributes[i]);
+    }
+    pthread_cond_destroy(&sweep->finished);
+    pthread_mutex_destroy(&sweep->lock);
+    free(sweep->attributes);
+    free(sweep->entries);
+    free(sweep);
+}
+
+static void WindowSweep_query(WindowSweep * sweep, WindowSweepEntry * entry) {
+    double deadline = monotonicTime() + sweep->timeout;
+    uint64_t call_started = callBegin();
+    AXUIElementRef app = ax_backend->createApplication(entry->pid);
+    callEnd(OP_CREATE_APPLICATION, NULL, entry->pid, call_started, kAXErrorSuccess);
+
+    // An application that is already known to hang is not even asked
+    CFTypeRef windows = NULL;
+    float applied = 0;
+    Request request = { .operation = OP_COPY_ATTRIBUTE_VALUE, .attribute = kAXWindowsAttribute, .ref = app, .pid = entry->pid };
+    entry->error = requestBegin(&request, sweep->priority, 0, sweep->timeout, &applied);
+    if (entry->error == kAXErrorSuccess) {
+        entry->error = axSessionCopy(&ax_session, app, kAXWindowsAttribute, &windows);
+        requestEnd(&request, entry->error);
+    }
+    CFRelease(app);
+    if (entry->error != kAXErrorSuccess) {
+        if (windows != NULL) CFRelease(windows);
+        return;
+    } else if (windows == NULL || CFGetTypeID(windows) != CFArrayGetTypeID()) {
+        if (windows != NULL) CFRelease(windows);
+        entry->error = kAXErrorNoValue;
+        return;
+    }
+    entry->windows = (CFArrayRef) windows;
+
+    CFIndex window_count = CFArrayGetCount(entry->windows);
+    if (window_count == 0 || sweep->attribute_count == 0) return;
+    entry->values = (CFTypeRef *) calloc(window_count * sweep->attribute_count, sizeof(CFTypeRef));
+    if (entry->values == NULL) {
+        entry->error = kAXErrorFailure;
+        return;
+    }
+
+    for (CFIndex w = 0; w < window_count; w++) {
+        AXUIElementRef window = (AXUIElementRef) CFArrayGetValueAtIndex(entry->windows, w);
+        applied = 0;
+        for (Py_ssize_t a = 0; a < sweep->attribute_count; a++) {
+            // Each request only gets whatever is left of the application's
+            // deadline, so many slow replies cannot add up past it.
+            float remaining = (float) (deadline - monotonicTime());
+            if (remaining <= 0) {
+                entry->error = kAXErrorCannotComplete;
+                return;
+            }
+
+            CFTypeRef value = NULL;
+            request = (Request) { .operation = OP_COPY_ATTRIBUTE_VALUE, .attribute = sweep->attributes[a], .ref = window, .pid = entry->pid };
+            AXError error = requestBegin(&request, sweep->priority, 0, remaining, &applied);
+            if (error == kAXErrorSuccess) {
+                error = axSessionCopy(&ax_session, window, sweep->attributes[a], &value);
+                requestEnd(&request, error);
+            }
+            if (error == kAXErrorSuccess) {
+                entry->values[w * sweep->attribute_count + a] = value;
+            } else {
+                if (value != NULL) CFRelease(value);
+                if (error == kAXErrorCannotComplete || error == kAXErrorCircuitOpen) {
+                    entry->error = error;
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static void * WindowSweep_worker(void * arg) {
+    WindowSweep * sweep = (WindowSweep *) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&sweep->lock);
+        Py_ssize_t index = sweep->next++;
+        int closed = sweep->closed;
+        pthread_mutex_unlock(&sweep->lock);
+        if (index >= sweep->entry_count || closed) break;
+
+        WindowSweepEntry * entry = &sweep->entries[index];
+        WindowSweep_query(sweep, entry);
+
+        pthread_mutex_lock(&sweep->lock);
+        entry->done = 1;
+        if (--sweep->remaining == 0) pthread_cond_signal(&sweep->finished);
+        pthread_mutex_unlock(&sweep->lock);
+    }
+
+    WindowSweep_release(sweep);
+    return NULL;
+}
+
+static PyObject * list_windows(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"pids", "attributes", "timeout", NULL};
+    ModuleState * state = moduleState(self);
+    PyObject * pids = NULL;
+    PyObject * attributes = NULL;
+    float timeout = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Of", kwlist, &pids, &attributes, &timeout))
+        return NULL;
+
+    if (timeout <= 0) {
+        PyErr_SetString(PyExc_ValueError, "The timeout must be positive.");
+        return NULL;
+    }
+
+    PyObject * pid_seq = sequenceCopy(pids, "The pids must be a sequence of integers.");
+    if (!pid_seq) return NULL;
+    PyObject * attribute_seq = (attributes != NULL) ?
+        sequenceCopy(attributes, "The attributes must be a sequence of strings.") : PyTuple_New(0);
+    if (!attribute_seq) {
+        Py_DECREF(pid_seq);
+        return NULL;
+    }
+
+    WindowSweep * sweep = (WindowSweep *) calloc(1, sizeof(WindowSweep));
+    Py_ssize_t pid_count = PySequence_Fast_GET_SIZE(pid_seq);
+    Py_ssize_t attribute_count = PySequence_Fast_GET_SIZE(attribute_seq);
+    if (sweep != NULL) {
+        sweep->entries = (WindowSweepEntry *) calloc(pid_count ? pid_count : 1, sizeof(WindowSweepEntry));
+        sweep->attributes = (CFStringRef *) calloc(attribute_count ? attribute_count : 1, sizeof(CFStringRef));
+    }
+    if (sweep == NULL || sweep->entries == NULL || sweep->attributes == NULL) {
+        if (sweep != NULL) {
+            free(sweep->entries);
+            free(sweep->attributes);
+            free(sweep);
+        }
+        Py_DECREF(pid_seq);
+        Py_DECREF(attribute_seq);
+        return PyErr_NoMemory();
+    }
+    pthread_mutex_init(&sweep->lock, NULL);
+    pthread_cond_init(&sweep->finished, NULL);
+    sweep->references = 1;
+    sweep->timeout = timeout;
+    sweep->priority = currentPriority();
+
+    for (Py_ssize_t i = 0; i < pid_count; i++) {
+        long pid = PyLong_AsLong(PySequence_Fast_GET_ITEM(pid_seq, i));
+        if (pid == -1 && PyErr_Occurred()) break;
+        sweep->entries[i].pid = (pid_t) pid;
+        sweep->entry_count++;
+    }
+    for (Py_ssize_t i = 0; i < attribute_count && !PyErr_Occurred(); i++) {
+        char * name_string = NULL;
+        CFStringRef name_strref = CFStringFromPyString(PySequence_Fast_GET_ITEM(attribute_seq, i), &name_string);
+        if (!name_strref) break; // CFStringFromPyString will set an error.
+        sweep->attributes[i] = name_strref;
+        sweep->attribute_count++;
+    }
+    Py_DECREF(pid_seq);
+    Py_DECREF(attribute_seq);
+    if (PyErr_Occurred()) {
+        WindowSweep_release(sweep);
+        return NULL;
+    }
+    sweep->remaining = sweep->entry_count;
+
+    // Start the workers; each holds a reference to the sweep
+    Py_ssize_t worker_count = sweep->entry_count < WINDOW_SWEEP_MAX_WORKERS ? sweep->entry_count : WINDOW_SWEEP_MAX_WORKERS;
+    Py_ssize_t started = 0;
+    for (Py_ssize_t i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        pthread_mutex_lock(&sweep->lock);
+        sweep->references++;
+        pthread_mutex_unlock(&sweep->lock);
+        if (pthread_create(&thread, NULL, WindowSweep_worker, sweep) != 0) {
+            WindowSweep_release(sweep);
+            break;
+        }
+        pthread_detach(thread);
+        started++;
+    }
+    if (started == 0 && sweep->entry_count > 0) {
+        WindowSweep_release(sweep);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start any workers to list windows.");
+        return NULL;
+    }
+
+    // Applications are handed out to the workers in turn, so the last ones
+    // may start only after earlier ones used up their full deadline.
+    Py_ssize_t rounds = (sweep->entry_count + started - 1) / (started ? started : 1);
+    double wait = timeout * (double) rounds + 0.25;
+    int * finished = (int *) calloc(sweep->entry_count ? sweep->entry_count : 1, sizeof(int));
+
+    Py_BEGIN_ALLOW_THREADS
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double until = now.tv_sec + now.tv_usec / 1e6 + wait;
+    struct timespec abstime;
+    abstime.tv_sec = (time_t) until;
+    abstime.tv_nsec = (long) ((until - (double) abstime.tv_sec) * 1e9);
+
+    pthread_mutex_lock(&sweep->lock);
+    while (sweep->remaining > 0) {
+        if (pthread_cond_timedwait(&sweep->finished, &sweep->lock, &abstime) == ETIMEDOUT) break;
+    }
+    // Whatever is still running from here on is abandoned to its worker
+    sweep->closed = 1;
+    for (Py_ssize_t i = 0; finished != NULL && i < sweep->entry_count; i++) {
+        finished[i] = sweep->entries[i].done;
+    }
+    pthread_mutex_unlock(&sweep->lock);
+    Py_END_ALLOW_THREADS
+
+    if (finished == NULL) {
+        WindowSweep_release(sweep);
+        return PyErr_NoMemory();
+    }
+
+    PyObject * records = PyList_New(0);
+    PyObject * timed_out = PyList_New(0);
+    PyObject * errors = PyDict_New();
+    for (Py_ssize_t i = 0; records && timed_out && errors && i < sweep->entry_count; i++) {
+        WindowSweepEntry * entry = &sweep->entries[i];
+        if (!finished[i] || entry->error == kAXErrorCannotComplete || entry->error == kAXErrorCircuitOpen) {
+            PyObject * pid = Py_BuildValue("i", entry->pid);
+            PyList_Append(timed_out, pid);
+            Py_XDECREF(pid);
+            continue;
+        } else if (entry->error != kAXErrorSuccess && entry->error != kAXErrorNoValue) {
+            // An application without a list of windows simply has none
+            PyObject * pid = Py_BuildValue("i", entry->pid);
+            PyObject * code = Py_BuildValue("i", entry->error);
+            if (pid && code) PyDict_SetItem(errors, pid, code);
+            Py_XDECREF(pid);
+            Py_XDECREF(code);
+            continue;
+        } else if (entry->windows == NULL) {
+            continue;
+        }
+
+        CFIndex window_count = CFArrayGetCount(entry->windows);
+        for (CFIndex w = 0; w < window_count; w++) {
+            PyObject * record = PyTuple_New(2 + sweep->attribute_count);
+            if (!record) break;
+            PyTuple_SET_ITEM(record, 0, Py_BuildValue("i", entry->pid));
+
+            AXUIElementRef window = (AXUIElementRef) CFRetain(CFArrayGetValueAtIndex(entry->windows, w));
+            PyTuple_SET_ITEM(record, 1, (PyObject *) elementWithRef(state, &window));
+
+            for (Py_ssize_t a = 0; a < sweep->attribute_count; a++) {
+                CFTypeRef value = entry->values[w * sweep->attribute_count + a];
+                PyObject * item = NULL;
+                if (value != NULL) {
+                    item = convertAttributeValue(state, sweep->attributes[a], value, entry->pid);
+                    if (!item) PyErr_Clear();
+                }
+                if (!item) {
+                    item = Py_None;
+                    Py_INCREF(Py_None);
+                }
+                PyTuple_SET_ITEM(record, 2 + a, item);
+            }
+            PyList_Append(records, record);
+            Py_DECREF(record);
+        }
+    }
+    free(finished);
+    WindowSweep_release(sweep);
+
+    if (!records || !timed_out || !errors) {
+        Py_XDECREF(records);
+        Py_XDECREF(timed_out);
+        Py_XDECREF(errors);
+        return NULL;
+    }
+    return Py_BuildValue("(NNN)", records, timed_out, errors);
+}
+
+/* Bulk geometry
+======== */
+
+static int geometryValue(CFArrayRef values, CFIndex index, AXValueType type, void * out) {
+    if (values == NULL || CFArrayGetCount(values) <= index) return 0;
+    CFTypeRef value = CFArrayGetValueAtIndex(values, index);
+    return CFGetTypeID(value) == AXValueGetTypeID() && AXValueGetType(value) == type
+        && AXValueGetValue(value, type, out);
+}
+
+// The attributes geometry() reads, made once for all threads.
+static CFArrayRef geometry_names;
+static pthread_once_t geometry_once = PTHREAD_ONCE_INIT;
+
+static void geometryInitNames(void) {
+    const void * attributes[] = { kAXPositionAttribute, kAXSizeAttribute };
+    geometry_names = CFArrayCreate(kCFAllocatorDefault, attributes, 2, &kCFTypeArrayCallBacks);
+}
+
+static PyObject * geometry(PyObject * self, PyObject * args) {
+    ModuleState * state = moduleState(self);
+    PyObject * elements;
+    if (!PyArg_ParseTuple(args, "O", &elements)) return NULL;
+
+    // A tuple of our own, so the index cannot change under the buffer
+    PyObject * index = PySequence_Tuple(elements);
+    if (!index) return NULL;
+    Py_ssize_t count = PyTuple_GET_SIZE(index);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        if (!PyObject_TypeCheck(PyTuple_GET_ITEM(index, i), state->AccessibleElement_type)) {
+            PyErr_SetString(PyExc_TypeError, "The elements must be AccessibleElement objects.");
+            Py_DECREF(index);
+            return NULL;
+        }
+    }
+
+    Geometry * result = (Geometry *) state->Geometry_type->tp_alloc(state->Geometry_type, 0);
+    if (!result) {
+        Py_DECREF(index);
+        return NULL;
+    }
+    result->data = PyMem_Malloc(4 * (count ? count : 1) * sizeof(double));
+    result->count = count;
+    result->shape[0] = 4;
+    result->shape[1] = count;
+    result->strides[0] = count * (Py_ssize_t) sizeof(double);
+    result->strides[1] = sizeof(double);
+    result->elements = index;
+    result->missing = 0;
+    if (!result->data) {
+        Py_DECREF(result);
+        return PyErr_NoMemory();
+    }
+
+    pthread_once(&geometry_once, geometryInitNames);
+    CFArrayRef names = geometry_names;
+
+    double * x = result->data;
+    double * y = x + count;
+    double * width = y + count;
+    double * height = width + count;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        CFArrayRef values = NULL;
+        AXError error = copyMultipleAttributeValues((AccessibleElement *) PyTuple_GET_ITEM(index, i), names, &values);
+        if (error == kAXErrorAPIDisabled) {
+            handleAXErrors(state, "AXPosition", error);
+            Py_DECREF(result);
+            return NULL;
+        }
+
+        CGPoint point;
+        CGSize size;
+        int found = (error == kAXErrorSuccess);
+        if (!geometryValue(values, 0, kAXValueCGPointType, &point)) found = 0;
+        if (!geometryValue(values, 1, kAXValueCGSizeType, &size)) found = 0;
+        if (values != NULL) CFRelease(values);
+
+        if (found) {
+            x[i] = point.x;
+            y[i] = point.y;
+            width[i] = size.width;
+            height[i] = size.height;
+        } else {
+            x[i] = y[i] = width[i] = height[i] = Py_NAN;
+            result->missing++;
+        }
+    }
+    return (PyObject *) result;
+}
+
+/* Bulk actions
+======== */
+
+// One action of perform_actions, with what its worker needs copied out of
+// the element beforehand, as workers cannot touch Python objects.
+typedef struct {
+    AccessibleElement * element;
+    AXUIElementRef ref;
+    pid_t pid;
+    float timeout;         // the element's own, or 0 for the adaptive one
+    float applied_timeout; // the adaptive timeout last set on it
+    CFStringRef action;
+    AXError error;
+} ActionItem;
+
+// Actions are handed out to the workers in runs, each performed in order by
+// a single worker: all the actions for one application when their order is
+// kept, or else one action per run.
+typedef struct ActionBatch {
+    struct ActionBatch * next_batch;
+    pthread_cond_t finished;
+    Py_ssize_t next;       // the next run to hand out
+    Py_ssize_t done;       // the runs performed
+    ActionItem * items;
+    Py_ssize_t * order;    // the items, run after run
+    Py_ssize_t * runs;     // where each run starts in order, and where the last ends
+    Py_ssize_t run_count;
+    RequestPriority priority;
+} ActionBatch;
+
+/*
+ * The workers are shared by every call, and kept once started (they cost
+ * nothing while idle), since starting threads for each call would cost more
+ * than the actions themselves with a responsive application. Batches with
+ * runs left to hand out are queued in action_batches. The workers are
+ * stopped and joined when the last module using them is freed.
+ */
+#define ACTION_MAX_WORKERS 32
+
+static pthread_mutex_t action_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t action_queued = PTHREAD_COND_INITIALIZER;
+static ActionBatch * action_batches;
+static pthread_t action_threads[ACTION_MAX_WORKERS];
+static int action_workers;
+static int action_idle;
+static int action_stopping;
+static int action_modules; // the modules that may use the workers
+
+typedef struct {
+    pid_t pid;
+    Py_ssize_t index;
+} ActionKey;
+
+// By PID and then by position, so that sorting by it is stable.
+static int compareActionKeys(const void * a, const void * b) {
+    const ActionKey * x = (const ActionKey *) a, * y = (const ActionKey *) b;
+    if (x->pid != y->pid) return (x->pid > y->pid) - (x->pid < y->pid);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void performActionItem(ActionItem * item, RequestPriority priority) {
+    // The element's timeout is copied back to it after the batch
+    Request request = { .operation = OP_PERFORM_ACTION, .attribute = item->action, .ref = item->ref, .pid = item->pid };
+    item->error = requestBegin(&request, priority, 0, item->timeout, &item->applied_timeout);
+    if (item->error != kAXErrorSuccess) return;
+    item->error = ax_backend->performAction(item->ref, item->action);
+    requestEnd(&request, item->error);
+}
+
+// Hands out the next run of the first batch that has any. Must be called
+// with action_lock held.
+static ActionBatch * actionTake(Py_ssize_t * run) {
+    ActionBatch * batch = action_batches;
+    if (batch == NULL) return NULL;
+    *run = batch->next++;
+    if (batch->next >= batch->run_count) action_batches = batch->next_batch;
+    if (action_batches != NULL && action_idle > 0) pthread_cond_signal(&action_queued);
+    return batch;
+}
+
+// Performs a run, and then tells the batch. Must be called with action_lock
+// held, which is released meanwhile.
+static void actionPerform(ActionBatch * batch, Py_ssize_t run) {
+    pthread_mutex_unlock(&action_lock);
+    for (Py_ssize_t i = batch->runs[run]; i < batch->runs[run + 1]; i++) {
+        performActionItem(&batch->items[batch->order[i]], batch->priority);
+    }
+    pthread_mutex_lock(&action_lock);
+    if (++batch->done == batch->run_count) pthread_cond_signal(&batch->finished);
+}
+
+static void * actionWorker(void * arg) {
+    (void) arg;
+    pthread_mutex_lock(&action_lock);
+    for (;;) {
+        Py_ssize_t run;
+        ActionBatch * batch = actionTake(&run);
+        if (batch == NULL && action_stopping) break;
+        if (batch == NULL) {
+            action_idle++;
+            pthread_cond_wait(&action_queued, &action_lock);
+            action_idle--;
+            continue;
+        }
+        actionPerform(batch, run);
+    }
+    pthread_mutex_unlock(&action_lock);
+    return NULL;
+}
+
+// Counts a module that may use the workers.
+static void actionAttach(void) {
+    pthread_mutex_lock(&action_lock);
+    action_modules++;
+    pthread_mutex_unlock(&action_lock);
+}
+
+#ifdef MULTI_PHASE_INIT
+// Stops and joins the workers once no module is left to use them.
+static void actionDetach(void) {
+    pthread_mutex_lock(&action_lock);
+    if (--action_modules > 0) {
+        pthread_mutex_unlock(&action_lock);
+        return;
+    }
+    action_stopping = 1;
+    pthread_cond_broadcast(&action_queued);
+    int workers = action_workers;
+    pthread_mutex_unlock(&action_lock);
+
+    for (int i = 0; i < workers; i++) pthread_join(action_threads[i], NULL);
+    pthread_mutex_lock(&action_lock);
+    action_workers = 0;
+    action_stopping = 0;
+    pthread_mutex_unlock(&action_lock);
+}
+#endif
+
+// Queues the batch and performs runs of it until all have been handed out,
+// and then waits for the workers to finish theirs. Call without the GIL.
+static void actionRun(ActionBatch * batch) {
+    if (batch->run_count == 0) return;
+    pthread_cond_init(&batch->finished, NULL);
+    pthread_mutex_lock(&action_lock);
+    if (batch->run_count > 1) {
+        ActionBatch ** tail = &action_batches;
+        while (*tail != NULL) tail = &(*tail)->next_batch;
+        *tail = batch;
+
+        // The calling thread is one of the workers, so it needs one fewer
+        int wanted = (batch->run_count - 1 < ACTION_MAX_WORKERS) ? (int) batch->run_count - 1 : ACTION_MAX_WORKERS;
+        for (int i = action_idle; i < wanted && action_workers < ACTION_MAX_WORKERS; i++) {
+            if (pthread_create(&action_threads[action_workers], NULL, actionWorker, NULL) != 0) break;
+            action_workers++;
+        }
+        // One idle worker is woken, and each wakes the next as it takes a
+        // run, so that runs performed quickly wake no more than they need
+        if (action_idle > 0) pthread_cond_signal(&action_queued);
+    }
+
+    while (batch->next < batch->run_count) {
+        Py_ssize_t run = batch->next++;
+        if (batch->next >= batch->run_count && batch->run_count > 1) {
+            // Unqueue it, wherever it is now
+            ActionBatch ** link = &action_batches;
+            while (*link != NULL && *link != batch) link = &(*link)->next_batch;
+            if (*link == batch) *link = batch->next_batch;
+        }
+        actionPerform(batch, run);
+    }
+    while (batch->done < batch->run_count) pthread_cond_wait(&batch->finished, &action_lock);
+    pthread_mutex_unlock(&action_lock);
+    pthread_cond_destroy(&batch->finished);
+}
+
+static PyObject * perform_actions(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"actions", "ordered_per_pid", NULL};
+    ModuleState * state = moduleState(self);
+    PyObject * actions = NULL;
+    PyObject * ordered = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &actions, &ordered))
+        return NULL;
+    int ordered_per_pid = (ordered != NULL) ? PyObject_IsTrue(ordered) : 1;
+    if (ordered_per_pid == -1) return NULL;
+
+    PyObject * action_seq = sequenceCopy(actions, "The actions must be a sequence of (element, action_name) pairs.");
+    if (!action_seq) return NULL;
+    Py_ssize_t count = PyTuple_GET_SIZE(action_seq);
+
+    ActionBatch batch;
+    memset(&batch, 0, sizeof(ActionBatch));
+    batch.priority = currentPriority();
+    batch.items = (ActionItem *) calloc(count ? count : 1, sizeof(ActionItem));
+    batch.order = (Py_ssize_t *) calloc(count ? count : 1, sizeof(Py_ssize_t));
+    batch.runs = (Py_ssize_t *) calloc(count + 1, sizeof(Py_ssize_t));
+    if (batch.items == NULL || batch.order == NULL || batch.runs == NULL) {
+        free(batch.items);
+        free(batch.order);
+        free(batch.runs);
+        Py_DECREF(action_seq);
+        return PyErr_NoMemory();
+    }
+
+    // Everything the workers need is copied (and retained) here, so that
+    // nothing can change under them once the GIL is released
+    Py_ssize_t item_count = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * pair = PySequence_Fast(PyTuple_GET_ITEM(action_seq, i), "Each action must be an (element, action_name) pair.");
+        if (!pair) break;
+        if (PySequence_Fast_GET_SIZE(pair) != 2 ||
+            !PyObject_TypeCheck(PySequence_Fast_GET_ITEM(pair, 0), state->AccessibleElement_type)) {
+            PyErr_SetString(PyExc_TypeError, "Each action must be an (element, action_name) pair.");
+            Py_DECREF(pair);
+            break;
+        }
+        char * name_string = NULL;
+        CFStringRef name_strref = CFStringFromPyString(PySequence_Fast_GET_ITEM(pair, 1), &name_string);
+        if (!name_strref) { // CFStringFromPyString will set an error.
+            Py_DECREF(pair);
+            break;
+        }
+
+        AccessibleElement * element = (AccessibleElement *) PySequence_Fast_GET_ITEM(pair, 0);
+        ActionItem * item = &batch.items[i];
+        Py_INCREF(element);
+        item->element = element;
+        item->ref = (AXUIElementRef) CFRetain(element->_ref);
+        item->pid = element->_pid;
+        item->action = name_strref;
+        Py_BEGIN_CRITICAL_SECTION(element);
+        item->timeout = element->_timeout;
+        item->applied_timeout = element->_applied_timeout;
+        Py_END_CRITICAL_SECTION();
+        item_count++;
+        Py_DECREF(pair);
+    }
+    Py_DECREF(action_seq);
+
+    if (!PyErr_Occurred()) {
+        ActionKey * keys = ordered_per_pid ? (ActionKey *) calloc(count ? count : 1, sizeof(ActionKey)) : NULL;
+        if (keys != NULL) {
+            for (Py_ssize_t i = 0; i < count; i++) {
+                keys[i].pid = batch.items[i].pid;
+                keys[i].index = i;
+            }
+            qsort(keys, count, sizeof(ActionKey), compareActionKeys);
+            for (Py_ssize_t i = 0; i < count; i++) {
+                batch.order[i] = keys[i].index;
+                if (i == 0 || keys[i].pid != keys[i - 1].pid) batch.runs[batch.run_count++] = i;
+            }
+            free(keys);
+        } else if (ordered_per_pid) {
+            PyErr_NoMemory();
+        } else {
+            for (Py_ssize_t i = 0; i < count; i++) batch.order[i] = i;
+            for (Py_ssize_t i = 0; i < count; i++) batch.runs[batch.run_count++] = i;
+        }
+        batch.runs[batch.run_count] = count;
+    }
+
+    if (!PyErr_Occurred()) {
+        Py_BEGIN_ALLOW_THREADS
+        actionRun(&batch);
+        Py_END_ALLOW_THREADS
+    }
+
+    PyObject * result = PyErr_Occurred() ? NULL : PyList_New(count);
+    int disabled = 0;
+    for (Py_ssize_t i = 0; i < item_count; i++) {
+        ActionItem * item = &batch.items[i];
+        if (result != NULL) {
+#if PY_MAJOR_VERSION >= 3
+            PyObject * code = PyLong_FromLong(item->error);
+#else
+            PyObject * code = PyInt_FromLong(item->error);
+#endif
+            if (code != NULL) {
+                PyList_SET_ITEM(result, i, code);
+            } else {
+                Py_CLEAR(result);
+            }
+        }
+        if (item->error == kAXErrorAPIDisabled) disabled = 1;
+        if (item->timeout <= 0) {
+            Py_BEGIN_CRITICAL_SECTION(item->element);
+            item->element->_applied_timeout = item->applied_timeout;
+            Py_END_CRITICAL_SECTION();
+        }
+        CFRelease(item->action);
+        CFRelease(item->ref);
+        Py_DECREF(item->element);
+    }
+    free(batch.items);
+    free(batch.order);
+    free(batch.runs);
+
+    // A disabled API is not the failure of any one action
+    if (result != NULL && disabled) {
+        Py_DECREF(result);
+        handleAXErrors(state, NULL, kAXErrorAPIDisabled);
+        return NULL;
+    }
+    return result;
+}
+
+/* Attribute schemas
+======== */
+
+// Past this many schemas, the cache starts over.
+#define SCHEMA_CACHE_CAPACITY 4096
+
+// The attributes a schema is keyed by, made once for all threads.
+static CFArrayRef schema_key_names;
+static pthread_once_t schema_once = PTHREAD_ONCE_INIT;
+
+static void schemaInitNames(void) {
+    const void * attributes[] = { kAXRoleAttribute, kAXSubroleAttribute };
+    schema_key_names = CFArrayCreate(kCFAllocatorDefault, attributes, 2, &kCFTypeArrayCallBacks);
+}
+
+// Whether the field of a schema (a tuple of names) lists name.
+static int schemaLists(PyObject * schema, int field, const char * name) {
+    PyObject * names = PyStructSequence_GET_ITEM(schema, field);
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(names); i++) {
+        PyObject * item = PyTuple_GET_ITEM(names, i);
+#if PY_MAJOR_VERSION >= 3
+        const char * item_name = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : NULL;
+#else
+        const char * item_name = PyString_Check(item) ? PyString_AS_STRING(item) : NULL;
+#endif
+        if (item_name != NULL && strcmp(item_name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// The names of a schema's field as a list, or None if there are none, as keys() returns them.
+static PyObject * schemaNameList(PyObject * schema, int field) {
+    PyObject * names = PyStructSequence_GET_ITEM(schema, field);
+    if (PyTuple_GET_SIZE(names) == 0) Py_RETURN_NONE;
+    return PySequence_List(names);
+}
+
+// The strings of an array of names (which may be NULL) as a tuple.
+static PyObject * schemaNames(ModuleState * state, CFArrayRef names) {
+    CFIndex count = (names != NULL) ? CFArrayGetCount(names) : 0;
+    PyObject * tuple = PyTuple_New((Py_ssize_t) count);
+    for (CFIndex i = 0; tuple != NULL && i < count; i++) {
+        PyObject * item = parseCFTypeRef(state, CFArrayGetValueAtIndex(names, i));
+        if (item == NULL) {
+            Py_CLEAR(tuple);
+            break;
+        }
+        PyTuple_SET_ITEM(tuple, (Py_ssize_t) i, item);
+    }
+    return tuple;
+}
+
+static PyObject * schemaString(ModuleState * state, CFTypeRef value) {
+    if (value == NULL || CFGetTypeID(value) != CFStringGetTypeID()) Py_RETURN_NONE;
+    return parseCFTypeRef(state, value);
+}
+
+/*
+ * Asks an element for the names of its attributes and actions, and which of
+ * its attributes can be set, as a new schema for the given role and subrole.
+ * Returns NULL with an exception set if any request fails.
+ */
+static PyObject * schemaCreate(AccessibleElement * self, PyObject * role, PyObject * subrole) {
+    ModuleState * state = typeState(Py_TYPE(self));
+    PyObject * schema = NULL, * attributes = NULL, * actions = NULL, * settable = NULL;
+    CFArrayRef attribute_names = NULL, action_names = NULL;
+    CFMutableArrayRef settable_names = NULL;
+
+    AXError error = copyAttributeNames(self, &attribute_names);
+    if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, "attribute names", error);
+        goto done;
+    }
+    error = copyActionNames(self, &action_names);
+    if (error == kAXErrorActionUnsupported || error == kAXErrorAttributeUnsupported || error == kAXErrorNoValue) {
+        // Elements with no actions at all
+        action_names = NULL;
+    } else if (error != kAXErrorSuccess) {
+        handleElementAXErrors(self, "action names", error);
+        goto done;
+    }
+
+    CFIndex count = CFArrayGetCount(attribute_names);
+    settable_names = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+    for (CFIndex i = 0; i < count; i++) {
+        CFStringRef name = CFArrayGetValueAtIndex(attribute_names, i);
+        Boolean can_set = 0;
+        error = isAttributeSettable(self, name, &can_set);
+        if (error == kAXErrorSuccess) {
+            if (can_set) CFArrayAppendValue(settable_names, name);
+        } else if (error != kAXErrorAttributeUnsupported && error != kAXErrorNoValue) {
+            handleElementAXErrors(self, "attribute names", error);
+            goto done;
+        }
+    }
+
+    attributes = schemaNames(state, attribute_names);
+    actions = attributes ? schemaNames(state, action_names) : NULL;
+    settable = actions ? schemaNames(state, settable_names) : NULL;
+    schema = settable ? newValue(state->Schema_type, 5) : NULL;
+    if (schema != NULL) {
+        Py_INCREF(role);
+        Py_INCREF(subrole);
+        PyStructSequence_SET_ITEM(schema, SCHEMA_ROLE, role);
+        PyStructSequence_SET_ITEM(schema, SCHEMA_SUBROLE, subrole);
+        PyStructSequence_SET_ITEM(schema, SCHEMA_ATTRIBUTES, attributes);
+        PyStructSequence_SET_ITEM(schema, SCHEMA_ACTIONS, actions);
+        PyStructSequence_SET_ITEM(schema, SCHEMA_SETTABLE, settable);
+        attributes = actions = settable = NULL;
+    }
+
+done:
+    Py_XDECREF(attributes);
+    Py_XDECREF(actions);
+    Py_XDECREF(settable);
+    if (attribute_names != NULL) CFRelease(attribute_names);
+    if (action_names != NULL) CFRelease(action_names);
+    if (settable_names != NULL) CFRelease(settable_names);
+    return schema;
+}
+
+// The element's schema, if it has looked it up already (a new reference), or NULL.
+static PyObject * elementKnownSchema(AccessibleElement * self) {
+    PyObject * schema;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    schema = self->_schema;
+    Py_XINCREF(schema);
+    Py_END_CRITICAL_SECTION();
+    return schema;
+}
+
+/*
+ * The element's schema (a new reference), looking it up by its role and
+ * subrole, read with one request, and making it if no element of the same
+ * application, role and subrole has before. Returns NULL with an exception
+ * set on failure.
+ */
+static PyObject * elementSchema(AccessibleElement * self) {
+    PyObject * schema = elementKnownSchema(self);
+    if (schema != NULL) return schema;
+
+    ModuleState * state = typeState(Py_TYPE(self));
+    pthread_once(&schema_once, schemaInitNames);
+    CFArrayRef values = NULL;
+    AXError error = copyMultipleAttributeValues(self, schema_key_names, &values);
+    if (error != kAXErrorSuccess) {
+        if (values != NULL) CFRelease(values);
+        handleElementAXErrors(self, "AXRole", error);
+        return NULL;
+    }
+    PyObject * role = schemaString(state, pollValue(values, 0));
+    PyObject * subrole = schemaString(state, pollValue(values, 1));
+    CFRelease(values);
+    PyObject * key = (role && subrole) ? PyTuple_Pack(3, self->pid, role, subrole) : NULL;
+    if (key == NULL) goto done;
+
+    Py_BEGIN_CRITICAL_SECTION(state->schema_cache);
+    schema = PyDict_GetItem(state->schema_cache, key);
+    Py_XINCREF(schema);
+    if (schema != NULL) {
+        state->schema_cache_hits++;
+    } else {
+        state->schema_cache_misses++;
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (schema == NULL) {
+        schema = schemaCreate(self, role, subrole);
+        if (schema == NULL) goto done;
+
+        // Another thread may have made the same schema meanwhile
+        Py_BEGIN_CRITICAL_SECTION(state->schema_cache);
+        PyObject * other = PyDict_GetItem(state->schema_cache, key);
+        if (other != NULL) {
+            Py_INCREF(other);
+            Py_DECREF(schema);
+            schema = other;
+        } else {
+            Py_ssize_t size = PyDict_Size(state->schema_cache);
+            if (size >= SCHEMA_CACHE_CAPACITY) {
+                PyDict_Clear(state->schema_cache);
+                state->schema_cache_evictions += (unsigned long) size;
+            }
+            // The schema is still good for this element if it cannot be shared
+            if (PyDict_SetItem(state->schema_cache, key, schema) == -1) PyErr_Clear();
+        }
+        Py_END_CRITICAL_SECTION();
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (self->_schema == NULL) {
+        Py_INCREF(schema);
+        self->_schema = schema;
+    }
+    Py_END_CRITICAL_SECTION();
+
+done:
+    Py_XDECREF(key);
+    Py_XDECREF(role);
+    Py_XDECREF(subrole);
+    return schema;
+}
+
+/* Probing
+======== */
+
+// What probe finds of each attribute, as flags.
+enum {
+    PROBE_UNSUPPORTED = 0,
+    PROBE_PRESENT = 1,
+    PROBE_SETTABLE = 2,
+    PROBE_NO_VALUE = 4,
+    PROBE_INVALID_ELEMENT = 8,
+    PROBE_FAILED = 16
+};
+
+typedef struct {
+    AXUIElementRef ref;
+    pid_t pid;
+} ProbeElement;
+
+// The flags for a request that failed for reasons other than the attribute.
+static unsigned char probeFailure(AXError error) {
+    return (error == kAXErrorInvalidUIElement) ? PROBE_INVALID_ELEMENT : PROBE_FAILED;
+}
+
+// Whether the value is one that converts to None.
+static int probeEmpty(CFTypeRef value) {
+    if (value == NULL) return 1;
+    CFTypeID type = CFGetTypeID(value);
+    if (type == CFStringGetTypeID()) return CFStringGetLength(value) == 0;
+    if (type == CFAttributedStringGetTypeID()) return CFStringGetLength(CFAttributedStringGetString(value)) == 0;
+    if (type == CFArrayGetTypeID()) return CFArrayGetCount(value) == 0;
+    return 0;
+}
+
+/*
+ * Probes one element: its attribute names in one request, and then, for the
+ * attributes it has, their value counts and settability if asked for.
+ * Fills in a row of statuses. Call without the GIL.
+ */
+static void probeElement(ProbeElement * element, CFStringRef * attributes, Py_ssize_t attribute_count,
+                         int values, int settable, int strings, RequestPriority priority, unsigned char * row) {
+    CFArrayRef names = NULL;
+    Request request = { .operation = OP_COPY_ATTRIBUTE_NAMES, .ref = element->ref, .pid = element->pid };
+    AXError error = requestBegin(&request, priority, 0, 0, NULL);
+    if (error == kAXErrorSuccess) {
+        error = ax_backend->copyAttributeNames(element->ref, &names);
+        requestEnd(&request, error);
+    }
+    if (error != kAXErrorSuccess || names == NULL) {
+        memset(row, (error != kAXErrorSuccess) ? probeFailure(error) : PROBE_FAILED, attribute_count);
+        if (names != NULL) CFRelease(names);
+        return;
+    }
+
+    CFIndex name_count = CFArrayGetCount(names);
+    for (Py_ssize_t a = 0; a < attribute_count; a++) {
+        row[a] = PROBE_UNSUPPORTED;
+        for (CFIndex n = 0; n < name_count; n++) {
+            if (CFEqual(CFArrayGetValueAtIndex(names, n), attributes[a])) {
+                row[a] = PROBE_PRESENT;
+                break;
+            }
+        }
+    }
+    CFRelease(names);
+
+    for (Py_ssize_t a = 0; a < attribute_count; a++) {
+        if (row[a] != PROBE_PRESENT) continue;
+        if (values) {
+            // Only arrays have a count; anything else is only read to see
+            // whether it is empty if asked to, as that copies all of it
+            CFIndex count = -1;
+            request = (Request) { .operation = OP_GET_ATTRIBUTE_VALUE_COUNT, .attribute = attributes[a], .ref = element->ref, .pid = element->pid };
+            error = requestBegin(&request, priority, 0, 0, NULL);
+            if (error == kAXErrorSuccess) {
+                error = ax_backend->getAttributeValueCount(element->ref, attributes[a], &count);
+                requestEnd(&request, error);
+            }
+            if (error == kAXErrorIllegalArgument && strings) {
+                CFTypeRef value = NULL;
+                request = (Request) { .operation = OP_COPY_ATTRIBUTE_VALUE, .attribute = attributes[a], .ref = element->ref, .pid = element->pid };
+                error = requestBegin(&request, priority, 0, 0, NULL);
+                if (error == kAXErrorSuccess) {
+                    error = axSessionCopy(&ax_session, element->ref, attributes[a], &value);
+                    requestEnd(&request, error);
+                }
+                if (error == kAXErrorSuccess) count = probeEmpty(value) ? 0 : 1;
+                if (value != NULL) CFRelease(value);
+            }
+            if ((error == kAXErrorSuccess && count == 0) || error == kAXErrorNoValue) {
+                row[a] |= PROBE_NO_VALUE;
+            } else if (error == kAXErrorAttributeUnsupported) {
+                row[a] = PROBE_UNSUPPORTED;
+                continue;
+            } else if (error != kAXErrorSuccess && error != kAXErrorIllegalArgument) {
+                row[a] |= probeFailure(error);
+            }
+        }
+        if (settable) {
+            Boolean can_set = 0;
+            request = (Request) { .operation = OP_IS_ATTRIBUTE_SETTABLE, .attribute = attributes[a], .ref = element->ref, .pid = element->pid };
+            error = requestBegin(&request, priority, 0, 0, NULL);
+            if (error == kAXErrorSuccess) {
+                error = ax_backend->isAttributeSettable(element->ref, attributes[a], &can_set);
+                requestEnd(&request, error);
+            }
+            if (error == kAXErrorSuccess && can_set) {
+                row[a] |= PROBE_SETTABLE;
+            } else if (error == kAXErrorAttributeUnsupported) {
+                row[a] = PROBE_UNSUPPORTED;
+            } else if (error != kAXErrorSuccess) {
+                row[a] |= probeFailure(error);
+            }
+        }
+    }
+}
+
+static PyObject * probe(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"elements", "attributes", "values", "settable", "strings", NULL};
+    ModuleState * state = moduleState(self);
+    PyObject * elements;
+    PyObject * attributes;
+    PyObject * values_object = NULL;
+    PyObject * settable_object = NULL;
+    PyObject * strings_object = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOO", kwlist, &elements, &attributes, &values_object, &settable_object, &strings_object))
+        return NULL;
+    int values = (values_object != NULL) ? PyObject_IsTrue(values_object) : 0;
+    int settable = (settable_object != NULL) ? PyObject_IsTrue(settable_object) : 0;
+    int strings = (strings_object != NULL) ? PyObject_IsTrue(strings_object) : 0;
+    if (values == -1 || settable == -1 || strings == -1) return NULL;
+
+    PyObject * element_seq = sequenceCopy(elements, "The elements must be a sequence of AccessibleElement objects.");
+    if (!element_seq) return NULL;
+    PyObject * attribute_seq = sequenceCopy(attributes, "The attributes must be a sequence of strings.");
+    if (!attribute_seq) {
+        Py_DECREF(element_seq);
+        return NULL;
+    }
+    Py_ssize_t element_count = PyTuple_GET_SIZE(element_seq);
+    Py_ssize_t attribute_count = PyTuple_GET_SIZE(attribute_seq);
+    if (attribute_count > 0 && element_count > PY_SSIZE_T_MAX / attribute_count) {
+        Py_DECREF(element_seq);
+        Py_DECREF(attribute_seq);
+        PyErr_SetString(PyExc_OverflowError, "Too many elements and attributes to probe at once.");
+        return NULL;
+    }
+
+    ProbeElement * items = (ProbeElement *) calloc(element_count ? element_count : 1, sizeof(ProbeElement));
+    CFStringRef * names = (CFStringRef *) calloc(attribute_count ? attribute_count : 1, sizeof(CFStringRef));
+    PyObject * result = PyByteArray_FromStringAndSize(NULL, element_count * attribute_count);
+    if (items == NULL || names == NULL) PyErr_NoMemory();
+
+    // Everything is retained here, so that nothing can change once the GIL
+    // is released
+    Py_ssize_t item_count = 0;
+    Py_ssize_t name_count = 0;
+    for (Py_ssize_t i = 0; result != NULL && !PyErr_Occurred() && i < element_count; i++) {
+        AccessibleElement * element = (AccessibleElement *) PyTuple_GET_ITEM(element_seq, i);
+        if (!PyObject_TypeCheck((PyObject *) element, state->AccessibleElement_type)) {
+            PyErr_SetString(PyExc_TypeError, "The elements must be AccessibleElement objects.");
+            break;
+        }
+        items[i].ref = (AXUIElementRef) CFRetain(element->_ref);
+        items[i].pid = element->_pid;
+        item_count++;
+    }
+    for (Py_ssize_t a = 0; result != NULL && !PyErr_Occurred() && a < attribute_count; a++) {
+        char * name_string = NULL;
+        names[a] = CFStringFromPyString(PyTuple_GET_ITEM(attribute_seq, a), &name_string);
+        if (!names[a]) break; // CFStringFromPyString will set an error.
+        name_count++;
+    }
+    Py_DECREF(element_seq);
+    Py_DECREF(attribute_seq);
+
+    if (result != NULL && !PyErr_Occurred()) {
+        unsigned char * matrix = (unsigned char *) PyByteArray_AS_STRING(result);
+        RequestPriority priority = currentPriority();
+        Py_BEGIN_ALLOW_THREADS
+        for (Py_ssize_t i = 0; i < element_count; i++) {
+            probeElement(&items[i], names, attribute_count, values, settable, strings, priority, matrix + i * attribute_count);
+        }
+        Py_END_ALLOW_THREADS
+    }
+
+    for (Py_ssize_t i = 0; i < item_count; i++) CFRelease(items[i].ref);
+    for (Py_ssize_t a = 0; a < name_count; a++) CFRelease(names[a]);
+    free(items);
+    free(names);
+    if (PyErr_Occurred()) Py_CLEAR(result);
+    return result;
+}
+
+/* Snapshots
+======== */
+
+static const char * snapshot_attributes[] = {
+    "AXRole", "AXSubrole", "AXTitle", "AXDescription", "AXValue",
+    "AXIdentifier", "AXPosition", "AXSize", "AXEnabled", "AXFocused"
+};
+
+typedef struct {
+    Request request; // the one in progress
+    RequestPriority priority;
+    float timeout;   // the element's own
+} SnapshotRequest;
+
+static AXError snapshotCallBegin(void * context, AXUIElementRef ref, pid_t pid) {
+    SnapshotRequest * snapshot = (SnapshotRequest *) context;
+    snapshot->request = (Request) { .operation = OP_COPY_MULTIPLE_ATTRIBUTE_VALUES, .ref = ref, .pid = pid };
+    return requestBegin(&snapshot->request, snapshot->priority, 0, snapshot->timeout, NULL);
+}
+
+static void snapshotCallEnd(void * context, AXError error) {
+    requestEnd(&((SnapshotRequest *) context)->request, error);
+}
+
+static PyObject * snapshot(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"element", "attributes", "max_depth", NULL};
+    AccessibleElement * element;
+    PyObject * attributes = NULL;
+    int max_depth = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|Oi", kwlist, moduleState(self)->AccessibleElement_type, &element, &attributes, &max_depth))
+        return NULL;
+
+    CFMutableArrayRef names = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    if (attributes == NULL || attributes == Py_None) {
+        for (size_t i = 0; i < sizeof(snapshot_attributes) / sizeof(snapshot_attributes[0]); i++) {
+            CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, snapshot_attributes[i], kCFStringEncodingUTF8);
+            CFArrayAppendValue(names, name);
+            CFRelease(name);
+        }
+    } else {
+        PyObject * attribute_seq = sequenceCopy(attributes, "The attributes must be a sequence of strings.");
+        if (!attribute_seq) {
+            CFRelease(names);
+            return NULL;
+        }
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(attribute_seq); i++) {
+            char * c_string;
+            CFStringRef name = CFStringFromPyString(PySequence_Fast_GET_ITEM(attribute_seq, i), &c_string);
+            if (!name) {
+                Py_DECREF(attribute_seq);
+                CFRelease(names);
+                return NULL;
+            }
+            CFArrayAppendValue(names, name);
+            CFRelease(name);
+        }
+        Py_DECREF(attribute_seq);
+    }
+
+    SnapshotRequest request = { .priority = currentPriority(), .timeout = element->_timeout };
+    SnapshotCalls calls = { ax_backend, snapshotCallBegin, snapshotCallEnd, &request };
+    LogBuffer out = { NULL, 0, 0, 0 };
+    AXError error;
+    uint32_t captured;
+    Py_BEGIN_ALLOW_THREADS
+    captured = snapshotCapture(element->_ref, element->_pid, names, max_depth, &calls, &out, &error);
+    Py_END_ALLOW_THREADS
+    CFRelease(names);
+
+    PyObject * result = NULL;
+    if (out.failed) {
+        PyErr_NoMemory();
+    } else if (captured == 0) {
+        handleElementAXErrors(element, "the snapshot", error);
+    } else {
+        result = PyBytes_FromStringAndSize((const char *) out.bytes, (Py_ssize_t) out.length);
+    }
+    free(out.bytes);
+    return result;
+}
+
+/* Poll watchers
+======== */
+
+static PyObject * poll_watch(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"elements", "attributes", "interval", "callback", NULL};
+    PyObject * elements;
+    PyObject * attributes;
+    double interval = 1.0;
+    PyObject * callback = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dO", kwlist, &elements, &attributes, &interval, &callback))
+        return NULL;
+    if (!(interval > 0)) {
+        PyErr_SetString(PyExc_ValueError, "The interval must be positive.");
+        return NULL;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "The callback must be callable.");
+        return NULL;
+    }
+
+    ModuleState * state = moduleState(self);
+    PollWatcher * watcher = (PollWatcher *) state->PollWatcher_type->tp_alloc(state->PollWatcher_type, 0);
+    if (watcher == NULL) return NULL;
+    Py_INCREF(callback);
+    watcher->callback = callback;
+    watcher->interval = interval;
+    watcher->priority = currentPriority();
+    watcher->elements = PySequence_Tuple(elements);
+    watcher->attributes = watcher->elements ? PySequence_Tuple(attributes) : NULL;
+    if (watcher->attributes == NULL) {
+        Py_DECREF(watcher);
+        return NULL;
+    }
+    Py_ssize_t element_count = PyTuple_GET_SIZE(watcher->elements);
+    Py_ssize_t attribute_count = PyTuple_GET_SIZE(watcher->attributes);
+    for (Py_ssize_t i = 0; i < element_count; i++) {
+        if (!PyObject_TypeCheck(PyTuple_GET_ITEM(watcher->elements, i), state->AccessibleElement_type)) {
+            PyErr_SetString(PyExc_TypeError, "The elements must be AccessibleElement objects.");
+            Py_DECREF(watcher);
+            return NULL;
+        }
+    }
+
+    CFMutableArrayRef names = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    watcher->names = names;
+    for (Py_ssize_t a = 0; a < attribute_count; a++) {
+        char * c_string;
+        CFStringRef name = CFStringFromPyString(PyTuple_GET_ITEM(watcher->attributes, a), &c_string);
+        if (!name) {
+            Py_DECREF(watcher);
+            return NULL;
+        }
+        CFArrayAppendValue(names, name);
+        CFRelease(name);
+    }
+
+    Py_ssize_t slots = element_count * attribute_count;
+    watcher->refs = (AXUIElementRef *) calloc(element_count ? element_count : 1, sizeof(AXUIElementRef));
+    watcher->pids = (pid_t *) calloc(element_count ? element_count : 1, sizeof(pid_t));
+    watcher->dead = (char *) calloc(element_count ? element_count : 1, 1);
+    watcher->values = (CFTypeRef *) calloc(slots ? slots : 1, sizeof(CFTypeRef));
+    watcher->pending = (char *) calloc(slots ? slots : 1, 1);
+    watcher->queue = (Py_ssize_t *) calloc(slots ? slots : 1, sizeof(Py_ssize_t));
+    if (!watcher->refs || !watcher->pids || !watcher->dead || !watcher->values || !watcher->pending || !watcher->queue) {
+        Py_DECREF(watcher);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < element_count; i++) {
+        AccessibleElement * element = (AccessibleElement *) PyTuple_GET_ITEM(watcher->elements, i);
+        watcher->refs[i] = (AXUIElementRef) CFRetain(element->_ref);
+        watcher->pids[i] = element->_pid;
+    }
+    watcher->element_count = element_count;
+    watcher->attribute_count = attribute_count;
+
+    if (pthread_mutex_init(&watcher->lock, NULL) != 0) {
+        Py_DECREF(watcher);
+        PyErr_SetString(PyExc_RuntimeError, "Could not create a lock for the watcher.");
+        return NULL;
+    }
+    pthread_cond_init(&watcher->wake, NULL);
+    watcher->has_lock = 1;
+
+    // The first values are read here, so changes are measured from the call
+    Py_BEGIN_ALLOW_THREADS
+    pollOnce(watcher, 0);
+    Py_END_ALLOW_THREADS
+
+    // The thread holds a reference until it exits
+    Py_INCREF(watcher);
+    watcher->running = 1;
+#ifdef MULTI_PHASE_INIT
+    watcher->interp = PyInterpreterState_Get();
+#else
+    watcher->interp = PyThreadState_Get()->interp;
+#endif
+    watcher->state = state;
+    int started;
+    // The thread holds watchers_lock while it waits for the GIL, so it is
+    // only taken without it
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&state->watchers_lock);
+    started = registryAdd(&state->watchers, watcher) == 0;
+    if (started && pthread_create(&watcher->thread, NULL, PollWatcher_thread, watcher) != 0) {
+        registryRemove(&state->watchers, watcher);
+        started = 0;
+    }
+    pthread_mutex_unlock(&state->watchers_lock);
+    Py_END_ALLOW_THREADS
+    if (!started) {
+        watcher->running = 0;
+        Py_DECREF(watcher);
+        Py_DECREF(watcher);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start the polling thread.");
+        return NULL;
+    }
+    pthread_detach(watcher->thread);
+    return (PyObject *) watcher;
+}
+
+/* Focus tracking
+======== */
+
+static PyObject * track_focus(PyObject * self, PyObject * args, PyObject * kwargs) {
+    static char *kwlist [] = {"pids", "callback", NULL};
+    PyObject * pids;
+    PyObject * callback = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &pids, &callback))
+        return NULL;
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "The callback must be callable.");
+        return NULL;
+    }
+    PyObject * pid_seq = sequenceCopy(pids, "The pids must be a sequence of integers.");
+    if (!pid_seq) return NULL;
+
+    ModuleState * state = moduleState(self);
+    FocusTracker * tracker = (FocusTracker *) state->FocusTracker_type->tp_alloc(state->FocusTracker_type, 0);
+    if (tracker == NULL) {
+        Py_DECREF(pid_seq);
+        return NULL;
+    }
+    Py_INCREF(callback);
+    tracker->callback = callback;
+    tracker->frontmost = -1;
+    tracker->priority = currentPriority();
+    tracker->applications = PyList_New(0);
+    if (tracker->applications == NULL || pthread_mutex_init(&tracker->lock, NULL) != 0) {
+        Py_DECREF(pid_seq);
+        Py_DECREF(tracker);
+        if (!PyErr_Occurred()) PyErr_SetString(PyExc_RuntimeError, "Could not create a lock for the tracker.");
+        return NULL;
+    }
+    pthread_cond_init(&tracker->wake, NULL);
+    tracker->has_lock = 1;
+
+    CFStringRef app_names[] = {kAXFocusedWindowAttribute, kAXFocusedUIElementAttribute};
+    CFStringRef system_names[] = {kAXFocusedApplicationAttribute};
+    tracker->app_names = CFArrayCreate(kCFAllocatorDefault, (const void **) app_names, 2, &kCFTypeArrayCallBacks);
+    tracker->system_names = CFArrayCreate(kCFAllocatorDefault, (const void **) system_names, 1, &kCFTypeArrayCallBacks);
+
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(pid_seq); i++) {
+        long pid = PyLong_AsLong(PySequence_Fast_GET_ITEM(pid_seq, i));
+        if (pid == -1 && PyErr_Occurred()) break;
+        if (pid <= 0) {
+            PyErr_SetString(PyExc_ValueError, "The pids must be positive.");
+            break;
+        }
+        if (focusAdd(tracker, (pid_t) pid) < 0) break;
+    }
+    Py_DECREF(pid_seq);
+    if (PyErr_Occurred()) {
+        Py_DECREF(tracker);
+        return NULL;
+    }
+
+    // The thread holds a reference until it exits
+    Py_INCREF(tracker);
+    tracker->running = 1;
+#ifdef MULTI_PHASE_INIT
+    tracker->interp = PyInterpreterState_Get();
+#else
+    tracker->interp = PyThreadState_Get()->interp;
+#endif
+    tracker->state = state;
+    int started;
+    // As for poll_watch, watchers_lock is only taken without the GIL. The
+    // focus is read by the thread once it has subscribed, and waited for
+    // here, so that it is there to be asked for as soon as this returns.
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&state->watchers_lock);
+    started = registryAdd(&state->trackers, tracker) == 0;
+    if (started && pthread_create(&tracker->thread, NULL, FocusTracker_thread, tracker) != 0) {
+        registryRemove(&state->trackers, tracker);
+        started = 0;
+    }
+    pthread_mutex_unlock(&state->watchers_lock);
+    if (started) {
+        pthread_detach(tracker->thread);
+        pthread_mutex_lock(&tracker->lock);
+        while (!tracker->ready) pthread_cond_wait(&tracker->wake, &tracker->lock);
+        pthread_mutex_unlock(&tracker->lock);
+    }
+    Py_END_ALLOW_THREADS
+    if (!started) {
+        tracker->running = 0;
+        Py_DECREF(tracker);
+        Py_DECREF(tracker);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start the tracking thread.");
+        return NULL;
+    }
+    return (PyObject *) tracker;
+}
+
+/* Module definition
+======== */
+ 
+static PyMethodDef methods[] = {
+#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_9
+    {"is_enabled", (PyCFunction) is_enabled, METH_VARARGS|METH_KEYWORDS, is_enabled_docstring},
+#else
+    {"is_enabled", (PyCFunction) is_enabled, METH_NOARGS, "is_enabled()\n\nCheck if accessibility has been enabled on the system."},
+#endif
+    {"is_trusted", (PyCFunction) is_trusted, METH_NOARGS, "is_trusted()\n\nCheck if this application is a trusted process."},
+    {"create_application_ref", (PyCFunction) create_application_ref, METH_VARARGS|METH_KEYWORDS, create_application_ref_docstring},
+    {"create_systemwide_ref", (PyCFunction) create_systemwide_ref, METH_NOARGS, "create_systemwide_ref()\n\nGet a system-wide accessible element reference."},
+    {"element_at_position", (PyCFunction) element_at_position, METH_VARARGS|METH_KEYWORDS, element_at_position_docstring},
+    {"list_windows", (PyCFunction) list_windows, METH_VARARGS|METH_KEYWORDS, list_windows_docstring},
+    {"geometry", (PyCFunction) geometry, METH_VARARGS, geometry_docstring},
+    {"perform_actions", (PyCFunction) perform_actions, METH_VARARGS|METH_KEYWORDS, perform_actions_docstring},
+    {"probe", (PyCFunction) probe, METH_VARARGS|METH_KEYWORDS, probe_docstring},
+    {"snapshot", (PyCFunction) snapshot, METH_VARARGS|METH_KEYWORDS, snapshot_docstring},
+    {"poll_watch", (PyCFunction) poll_watch, METH_VARARGS|METH_KEYWORDS, poll_watch_docstring},
+    {"track_focus", (PyCFunction) track_focus, METH_VARARGS|METH_KEYWORDS, track_focus_docstring},
+    {"application_cache_info", (PyCFunction) application_cache_info, METH_NOARGS, application_cache_info_docstring},
+    {"clear_application_cache", (PyCFunction) clear_application_cache, METH_NOARGS, clear_application_cache_docstring},
+    {"enable_schema_cache", (PyCFunction) enable_schema_cache, METH_VARARGS|METH_KEYWORDS, enable_schema_cache_docstring},
+    {"schema_cache_info", (PyCFunction) schema_cache_info, METH_NOARGS, schema_cache_info_docstring},
+    {"clear_schema_cache", (PyCFunction) clear_schema_cache, METH_NOARGS, clear_schema_cache_docstring},
+    {"configure_intern_cache", (PyCFunction) configure_intern_cache, METH_VARARGS|METH_KEYWORDS, configure_intern_cache_docstring},
+    {"intern_cache_info", (PyCFunction) intern_cache_info, METH_NOARGS, intern_cache_info_docstring},
+    {"clear_intern_cache", (PyCFunction) clear_intern_cache, METH_NOARGS, clear_intern_cache_docstring},
+    {"configure_breaker", (PyCFunction) configure_breaker, METH_VARARGS|METH_KEYWORDS, configure_breaker_docstring},
+    {"application_health", (PyCFunction) application_health, METH_VARARGS|METH_KEYWORDS, application_health_docstring},
+    {"reset_application_health", (PyCFunction) reset_application_health, METH_NOARGS, reset_application_health_docstring},
+    {"configure_scheduler", (PyCFunction) configure_scheduler, METH_VARARGS|METH_KEYWORDS, configure_scheduler_docstring},
+    {"set_priority", (PyCFunction) set_priority, METH_VARARGS, set_priority_docstring},
+    {"scheduler_info", (PyCFunction) scheduler_info, METH_NOARGS, scheduler_info_docstring},
+    {"enable_stats", (PyCFunction) enable_stats, METH_VARARGS|METH_KEYWORDS, enable_stats_docstring},
+    {"stats", (PyCFunction) stats, METH_NOARGS, stats_docstring},
+    {"reset_stats", (PyCFunction) reset_stats, METH_NOARGS, reset_stats_docstring},
+    {"start_trace", (PyCFunction) start_trace, METH_VARARGS|METH_KEYWORDS, start_trace_docstring},
+    {"stop_trace", (PyCFunction) stop_trace, METH_NOARGS, stop_trace_docstring},
+    {"write_trace", (PyCFunction) write_trace, METH_VARARGS, write_trace_docstring},
+    {"set_backend", (PyCFunction) set_backend, METH_VARARGS|METH_KEYWORDS, set_backend_docstring},
+    {"current_backend", (PyCFunction) current_backend, METH_NOARGS, current_backend_docstring},
+    {"start_recording", (PyCFunction) start_recording, METH_VARARGS, start_recording_docstring},
+    {"stop_recording", (PyCFunction) stop_recording, METH_NOARGS, stop_recording_docstring},
+    {"replay_info", (PyCFunction) replay_info, METH_NOARGS, replay_info_docstring},
+    {"run_loop", (PyCFunction) run_loop, METH_VARARGS|METH_KEYWORDS, run_loop_docstring},
+    {"run_loop_info", (PyCFunction) run_loop_info, METH_NOARGS, run_loop_info_docstring},
+    {"simulate_notification", (PyCFunction) simulate_notification, METH_VARARGS|METH_KEYWORDS, simulate_notification_docstring},
+    {"_benchmark_conversion", (PyCFunction) benchmark_conversion, METH_VARARGS, benchmark_conversion_docstring},
+    {"_benchmark_dispatch", (PyCFunction) benchmark_dispatch, METH_VARARGS, benchmark_dispatch_docstring},
+    {NULL, NULL, 0, NULL}
+};
+
+/*
+ * Python 2 has no PyType_FromSpec, so types are built here from the same
+ * specs, in memory that lives as long as the process.
+ */
+#if PY_MAJOR_VERSION < 3
+typedef struct {
+    PyTypeObject type;
+    PySequenceMethods as_sequence;
+    PyMappingMethods as_mapping;
+    PyBufferProcs as_buffer;
+} LegacyType;
+
+static PyTypeObject * typeFromSpec(PyType_Spec * spec) {
+    LegacyType * legacy = (LegacyType *) calloc(1, sizeof(LegacyType));
+    if (legacy == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    PyTypeObject * type = &legacy->type;
+    PyObject_INIT((PyObject *) type, &PyType_Type);
+    type->tp_name = spec->name;
+    type->tp_basicsize = spec->basicsize;
+    type->tp_itemsize = spec->itemsize;
+    type->tp_flags = spec->flags;
+    type->tp_as_sequence = &legacy->as_sequence;
+    type->tp_as_mapping = &legacy->as_mapping;
+    type->tp_as_buffer = &legacy->as_buffer;
+    for (PyType_Slot * slot = spec->slots; slot->slot != 0; slot++) {
+        switch (slot->slot) {
+            case Py_bf_getbuffer: legacy->as_buffer.bf_getbuffer = (getbufferproc) slot->pfunc; break;
+            case Py_mp_ass_subscript: legacy->as_mapping.mp_ass_subscript = (objobjargproc) slot->pfunc; break;
+            case Py_mp_subscript: legacy->as_mapping.mp_subscript = (binaryfunc) slot->pfunc; break;
+            case Py_sq_contains: legacy->as_sequence.sq_contains = (objobjproc) slot->pfunc; break;
+            case Py_sq_length: legacy->as_sequence.sq_length = (lenfunc) slot->pfunc; break;
+            case Py_tp_dealloc: type->tp_dealloc = (destructor) slot->pfunc; break;
+            case Py_tp_doc: type->tp_doc = (const char *) slot->pfunc; break;
+            case Py_tp_init: type->tp_init = (initproc) slot->pfunc; break;
+            case Py_tp_iter: type->tp_iter = (getiterfunc) slot->pfunc; break;
+            case Py_tp_iternext: type->tp_iternext = (iternextfunc) slot->pfunc; break;
+            case Py_tp_methods: type->tp_methods = (PyMethodDef *) slot->pfunc; break;
+            case Py_tp_new: type->tp_new = (newfunc) slot->pfunc; break;
+            case Py_tp_richcompare: type->tp_richcompare = (richcmpfunc) slot->pfunc; break;
+            case Py_tp_members: type->tp_members = (PyMemberDef *) slot->pfunc; break;
+            case Py_tp_getset: type->tp_getset = (PyGetSetDef *) slot->pfunc; break;
+        }
+    }
+    if (PyType_Ready(type) < 0) return NULL;
+    return type;
+}
+#endif
+
+static PyTypeObject * newType(PyObject * module, PyType_Spec * spec) {
+#if defined(MULTI_PHASE_INIT)
+    PyTypeObject * type = (PyTypeObject *) PyType_FromModuleAndSpec(module, spec, NULL);
+#elif PY_MAJOR_VERSION >= 3
+    PyTypeObject * type = (PyTypeObject *) PyType_FromSpec(spec);
+#else
+    PyTypeObject * type = typeFromSpec(spec);
+#endif
+    if (type == NULL) return NULL;
+#if PY_VERSION_HEX < 0x030A0000
+    // Without Py_TPFLAGS_DISALLOW_INSTANTIATION, types that are not meant to
+    // be created from Python would inherit object's tp_new
+    int has_new = 0;
+    for (PyType_Slot * slot = spec->slots; slot->slot != 0; slot++) {
+        if (slot->slot == Py_tp_new) has_new = 1;
+    }
+    if (!has_new) type->tp_new = NULL;
+#endif
+#if PY_MAJOR_VERSION >= 3 && !defined(MULTI_PHASE_INIT)
+    // Specs cannot set buffer slots before 3.9
+    if (spec == &Geometry_spec) type->tp_as_buffer->bf_getbuffer = (getbufferproc) Geometry_getbuffer;
+#endif
+    return type;
+}
+
+// Adds a reference to value to the module, taking the one it was given.
+static int addObject(PyObject * module, const char * name, PyObject * value) {
+    if (value == NULL) return -1;
+    Py_INCREF(value);
+    if (PyModule_AddObject(module, name, value) < 0) {
+        Py_DECREF(value);
+        Py_DECREF(value);
+        return -1;
+    }
+    return 0;
+}
+
+static pthread_once_t process_once = PTHREAD_ONCE_INIT;
+
+// What is shared by every interpreter, set up by the first to import the module.
+static void processInit(void) {
+    pthread_key_create(&trace_key, traceThreadExit);
+    pthread_key_create(&loop_key, NULL);
+    pthread_key_create(&priority_key, NULL);
+#if PY_MAJOR_VERSION < 3
+    pthread_key_create(&encoded_key, free);
+#endif
+    registerConverters();
+    axSessionInit(&ax_session, ax_backend);
+
+#ifndef __APPLE__
+    // Give the simulated backend something to talk to out of the box
+    SimConfig simulation;
+    if (parseSimulatedConfig(Py_None, &simulation) == 0) {
+        simulatedConfigure(&simulation);
+        free(simulation.applications);
+    }
+#endif
+}
+
+static PyObject * stop_callbacks(PyObject * self) {
+    stopCallbacks(moduleState(self));
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef stop_callbacks_def = {"_stop_callbacks", (PyCFunction) stop_callbacks, METH_NOARGS, NULL};
+
+static int moduleExec(PyObject * m) {
+    ModuleState * state = moduleState(m);
+    pthread_once(&process_once, processInit);
+    pthread_mutex_init(&state->watchers_lock, NULL);
+    pthread_mutex_init(&state->observers_lock, NULL);
+    pthread_mutex_init(&state->intern_lock, NULL);
+    actionAttach();
+
+    struct {
+        const char * name;
+        PyType_Spec * spec;
+        PyTypeObject ** type;
+    } types[] = {
+        {"AccessibleElement", &AccessibleElement_spec, &state->AccessibleElement_type},
+        {"FocusTracker", &FocusTracker_spec, &state->FocusTracker_type},
+        {"Geometry", &Geometry_spec, &state->Geometry_type},
+        {"Locator", &Locator_spec, &state->Locator_type},
+        {"PollWatcher", &PollWatcher_spec, &state->PollWatcher_type},
+        {"Snapshot", &Snapshot_spec, &state->Snapshot_type},
+        {"SnapshotPublisher", &SnapshotPublisher_spec, &state->SnapshotPublisher_type},
+        {"SnapshotSubscriber", &SnapshotSubscriber_spec, &state->SnapshotSubscriber_type},
+        {"TextReader", &TextReader_spec, &state->TextReader_type}
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        *types[i].type = newType(m, types[i].spec);
+        if (addObject(m, types[i].name, (PyObject *) *types[i].type) < 0) return -1;
+    }
+
+    PyTypeObject ** value_types[] = {&state->Point_type, &state->Size_type, &state->Rect_type, &state->Range_type, &state->Schema_type};
+    PyStructSequence_Desc * value_descs[] = {&Point_desc, &Size_desc, &Rect_desc, &Range_desc, &Schema_desc};
+#ifndef MULTI_PHASE_INIT
+    static PyTypeObject value_storage[5];
+#endif
+    for (int i = 0; i < 5; i++) {
+#if defined(MULTI_PHASE_INIT)
+        *value_types[i] = PyStructSequence_NewType(value_descs[i]);
+#elif PY_MAJOR_VERSION >= 3
+        if (value_storage[i].tp_name == NULL && PyStructSequence_InitType2(&value_storage[i], value_descs[i]) < 0) return -1;
+        *value_types[i] = &value_storage[i];
+#else
+        if (value_storage[i].tp_name == NULL) PyStructSequence_InitType(&value_storage[i], value_descs[i]);
+        *value_types[i] = &value_storage[i];
+#endif
+        // The name without the module prefix
+        if (addObject(m, strchr(value_descs[i]->name, '.') + 1, (PyObject *) *value_types[i]) < 0) return -1;
+    }
+
+    PyModule_AddObject(m, "DEFAULT_TIMEOUT", PyFloat_FromDouble(0.0));
+    PyModule_AddIntConstant(m, "PROBE_UNSUPPORTED", PROBE_UNSUPPORTED);
+    PyModule_AddIntConstant(m, "PROBE_PRESENT", PROBE_PRESENT);
+    PyModule_AddIntConstant(m, "PROBE_SETTABLE", PROBE_SETTABLE);
+    PyModule_AddIntConstant(m, "PROBE_NO_VALUE", PROBE_NO_VALUE);
+    PyModule_AddIntConstant(m, "PROBE_INVALID_ELEMENT", PROBE_INVALID_ELEMENT);
+    PyModule_AddIntConstant(m, "PROBE_FAILED", PROBE_FAILED);
+#if PY_MAJOR_VERSION >= 3
+    PyModule_AddObject(m, "__author__", PyBytes_FromString("Aaron Jacobs <atheriel@gmail.com>"));
+    PyModule_AddObject(m, "__version__", PyBytes_FromString("0.4.0"));
+#else
+    PyModule_AddObject(m, "__author__", PyString_FromString("Aaron Jacobs <atheriel@gmail.com>"));
+    PyModule_AddObject(m, "__version__", PyString_FromString("0.4.0"));
+#endif
+
+    state->InvalidUIElementError = PyErr_NewExceptionWithDoc("accessibility.InvalidUIElementError", InvalidUIElementError_docstring, PyExc_ValueError, NULL);
+    if (addObject(m, "InvalidUIElementError", state->InvalidUIElementError) < 0) return -1;
+
+    state->APIDisabledError = PyErr_NewExceptionWithDoc("accessibility.APIDisabledError", APIDisabledError_docstring, PyExc_Exception, NULL);
+    if (addObject(m, "APIDisabledError", state->APIDisabledError) < 0) return -1;
+
+    state->NotRespondingError = PyErr_NewExceptionWithDoc("accessibility.NotRespondingError", NotRespondingError_docstring, PyExc_Exception, NULL);
+    if (addObject(m, "NotRespondingError", state->NotRespondingError) < 0) return -1;
+
+    state->CircuitOpenError = PyErr_NewExceptionWithDoc("accessibility.CircuitOpenError", CircuitOpenError_docstring, state->NotRespondingError, NULL);
+    if (addObject(m, "CircuitOpenError", state->CircuitOpenError) < 0) return -1;
+
+    state->application_cache = PyDict_New();
+    if (state->application_cache == NULL) return -1;
+    state->schema_cache = PyDict_New();
+    if (state->schema_cache == NULL) return -1;
+
+    // Roles and the like are interned from the start
+    const CFStringRef interned[] = { kAXRoleAttribute, kAXSubroleAttribute, kAXRoleDescriptionAttribute };
+    CFStringRef * intern_attributes = (CFStringRef *) calloc(3, sizeof(CFStringRef));
+    if (intern_attributes == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (int i = 0; i < 3; i++) intern_attributes[i] = (CFStringRef) CFRetain(interned[i]);
+    if (internConfigure(state, intern_attributes, 3, INTERN_DEFAULT_CAPACITY) == -1) return -1;
+
+    // Callbacks are stopped while the interpreter can still finish them
+    PyObject * atexit = PyImport_ImportModule("atexit");
+    PyObject * hook = PyCFunction_NewEx(&stop_callbacks_def, m, NULL);
+    PyObject * result = (atexit && hook) ? PyObject_CallMethod(atexit, "register", "O", hook) : NULL;
+    Py_XDECREF(atexit);
+    Py_XDECREF(hook);
+    if (result == NULL) return -1;
+    Py_DECREF(result);
+
+#if PY_VERSION_HEX < 0x03090000
+    if (!PyEval_ThreadsInitialized()) {
+        PyEval_InitThreads();
+    }
+#endif
+    return 0;
+}
+
+#ifdef MULTI_PHASE_INIT
+static int moduleTraverse(PyObject * m, visitproc visit, void * arg) {
+    ModuleState * state = moduleState(m);
+    Py_VISIT(state->InvalidUIElementError);
+    Py_VISIT(state->APIDisabledError);
+    Py_VISIT(state->NotRespondingError);
+    Py_VISIT(state->CircuitOpenError);
+    Py_VISIT(state->AccessibleElement_type);
+    Py_VISIT(state->Point_type);
+    Py_VISIT(state->Size_type);
+    Py_VISIT(state->Rect_type);
+    Py_VISIT(state->Range_type);
+    Py_VISIT(state->Schema_type);
+    Py_VISIT(state->Geometry_type);
+    Py_VISIT(state->Snapshot_type);
+    Py_VISIT(state->SnapshotPublisher_type);
+    Py_VISIT(state->SnapshotSubscriber_type);
+    Py_VISIT(state->TextReader_type);
+    Py_VISIT(state->PollWatcher_type);
+    Py_VISIT(state->FocusTracker_type);
+    Py_VISIT(state->Locator_type);
+    Py_VISIT(state->application_cache);
+    Py_VISIT(state->schema_cache);
+    return 0;
+}
+
+static int moduleClear(PyObject * m) {
+    ModuleState * state = moduleState(m);
+    stopCallbacks(state);
+    Py_CLEAR(state->InvalidUIElementError);
+    Py_CLEAR(state->APIDisabledError);
+    Py_CLEAR(state->NotRespondingError);
+    Py_CLEAR(state->CircuitOpenError);
+    Py_CLEAR(state->AccessibleElement_type);
+    Py_CLEAR(state->Point_type);
+    Py_CLEAR(state->Size_type);
+    Py_CLEAR(state->Rect_type);
+    Py_CLEAR(state->Range_type);
+    Py_CLEAR(state->Schema_type);
+    Py_CLEAR(state->Geometry_type);
+    Py_CLEAR(state->Snapshot_type);
+    Py_CLEAR(state->SnapshotPublisher_type);
+    Py_CLEAR(state->SnapshotSubscriber_type);
+    Py_CLEAR(state->TextReader_type);
+    Py_CLEAR(state->PollWatcher_type);
+    Py_CLEAR(state->FocusTracker_type);
+    Py_CLEAR(state->Locator_type);
+    Py_CLEAR(state->application_cache);
+    Py_CLEAR(state->schema_cache);
+    internConfigure(state, NULL, 0, 0);
+    return 0;
+}
+
+static void moduleFree(void * m) {
+    moduleClear((PyObject *) m);
+    actionDetach();
+    pthread_mutex_destroy(&moduleState((PyObject *) m)->watchers_lock);
+    pthread_mutex_destroy(&moduleState((PyObject *) m)->observers_lock);
+    internReleaseAttributes(moduleState((PyObject *) m)->intern_attributes, moduleState((PyObject *) m)->intern_attribute_count);
+    pthread_mutex_destroy(&moduleState((PyObject *) m)->intern_lock);
+}
+
+static PyModuleDef_Slot module_slots[] = {
+    {Py_mod_exec, (void *) moduleExec},
+#if PY_VERSION_HEX >= 0x030C0000
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_GIL_DISABLED
+    // Everything shared between threads has its own lock, so free-threaded
+    // builds can leave the GIL off
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    "accessibility",
+    module_docstring,
+    sizeof(ModuleState),
+    methods,
+    module_slots,
+    moduleTraverse,
+    moduleClear,
+    moduleFree
+};
+
+PyMODINIT_FUNC PyInit_accessibility(void) {
+    return PyModuleDef_Init(&module);
+}
+#elif PY_MAJOR_VERSION >= 3
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    "accessibility",
+    module_docstring,
+    (Py_ssize_t) -1,
+    methods,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+PyMODINIT_FUNC PyInit_accessibility(void) {
+    PyObject * m = PyModule_Create(&module);
+    if (m == NULL) return NULL;
+    if (moduleExec(m) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
+#else
+PyMODINIT_FUNC initaccessibility(void) {
+    PyObject * m = Py_InitModule3("accessibility", methods, module_docstring);
+    if (m == NULL) {
+        return;
     }
-    
-    // The first argument should be a string
-    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
-    if (!name) return NULL; // PyTuple_GetItem will set an Index error.
-    char * name_string = NULL;
-    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+    moduleExec(m);
+}
+#endif
 
-    // Check to see if the attribute can be set at all
-    Boolean can_set;
-    AXError error = AXUIElementIsAttributeSettable(self->_ref, name_strref, &can_set);
+/* ========
+    Private Member Implementations
+======== */
+
+static AccessibleElement * elementWithRef(ModuleState * state, AXUIElementRef * ref) {
+    PyTypeObject * type = state->AccessibleElement_type;
+    AccessibleElement * self = (AccessibleElement *) type->tp_alloc(type, 0);
+    if (self == NULL) {
+        CFRelease(*ref);
+        return NULL;
+    }
+    self->_ref = *ref;
+    self->_observer = NULL;
 
+    self->_timeout = 0;
+    self->_applied_timeout = 0;
+    self->_schema = NULL;
+    self->_interp = NULL;
+
+    // Sets the pid, which should never change
+    pid_t pid;
+    uint64_t call_started = callBegin();
+    AXError error = ax_backend->getPid(*ref, &pid);
+    callEnd(OP_GET_PID, NULL, (error == kAXErrorSuccess) ? pid : -1, call_started, error);
+    self->_pid = (error == kAXErrorSuccess) ? pid : -1;
     if (error == kAXErrorSuccess) {
-        result = can_set ? Py_True : Py_False;
+#if PY_MAJOR_VERSION >= 3
+        self->pid = PyLong_FromLong(pid);
+#else
+        self->pid = PyInt_FromLong(pid);
+#endif
     } else {
-        handleAXErrors(name_string, error);
+        self->pid = Py_None;
+        Py_INCREF(Py_None);
     }
 
-    if (name_strref != NULL) CFRelease(name_strref);
-    Py_XINCREF(result);
+    // Set the callback to None for now
+    self->callback = Py_None;
+    Py_INCREF(Py_None);
+    
+    return self;
+}
+
+static PyObject * stringFromUTF8(const char * bytes, Py_ssize_t length) {
+#if PY_MAJOR_VERSION >= 3
+    return PyUnicode_DecodeUTF8(bytes, length, NULL);
+#else
+    return PyString_FromStringAndSize(bytes, length);
+#endif
+}
+
+static PyObject * convertString(ModuleState * state, CFTypeRef value) {
+    CFIndex length = CFStringGetLength(value);
+    if (length == 0) Py_RETURN_NONE; // Empty strings have always been None
+
+    // Short strings (nearly all of them) are copied out on the stack
+    char stack[256];
+    char * allocated;
+    size_t size;
+    const char * bytes = cfStringUTF8(value, stack, sizeof(stack), &size, &allocated);
+    if (bytes == NULL) {
+        if (errno == ENOMEM) return PyErr_NoMemory();
+        PyErr_SetString(PyExc_TypeError, "The referenced string representation could not be parsed.");
+        return NULL;
+    }
+    PyObject * result = stringFromUTF8(bytes, (Py_ssize_t) size);
+    if (allocated != NULL) free(allocated);
     return result;
 }
 
-static PyObject * AccessibleElement_count(AccessibleElement * self, PyObject * args) {
-    PyObject * result = Py_None;
-    // This allows for retrieving multiple objects, so find how many were
-    // requested and loop over them.
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count > 1) {
-        result = PyTuple_New(attribute_count);
+static PyObject * convertBoolean(ModuleState * state, CFTypeRef value) {
+    if (CFBooleanGetValue(value)) Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject * convertNumber(ModuleState * state, CFTypeRef value) {
+    if (CFNumberIsFloatType(value)) {
+        double real = 0;
+        CFNumberGetValue(value, kCFNumberDoubleType, &real);
+        return PyFloat_FromDouble(real);
     }
+    long long integer = 0;
+    CFNumberGetValue(value, kCFNumberLongLongType, &integer);
+#if PY_MAJOR_VERSION >= 3
+    return PyLong_FromLongLong(integer);
+#else
+    if (integer >= LONG_MIN && integer <= LONG_MAX) return PyInt_FromLong((long) integer);
+    return PyLong_FromLongLong(integer);
+#endif
+}
 
-    for (int i = 0; i < attribute_count; i++) {
-        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
-        if (!name) {
-            if (attribute_count > 1) Py_DECREF(result);
-            return NULL; // PyTuple_GetItem will set an Index error.
-        }
-        char * name_string = NULL;
-        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-        if (!name_strref) {
-            if (attribute_count > 1) Py_DECREF(result);
-            return NULL; // CFStringFromPyString will set an error.
-        }
-        
-        // Get the count itself
-        CFIndex count;
-        AXError error = AXUIElementGetAttributeValueCount(self->_ref, name_strref, &count);
-        
-        if (error == kAXErrorSuccess) {
-            if (attribute_count > 1) {
-                PyTuple_SetItem(result, i, Py_BuildValue("i", count));
-            } else {
-                result = Py_BuildValue("i", count);
-            }
-        } else {
-            // If any of the requests fail, release memory and raise an exception
-            if (attribute_count > 1) Py_DECREF(result);
-            if (name_strref != NULL) CFRelease(name_strref);
-            handleAXErrors(name_string, error);
+static PyObject * convertElement(ModuleState * state, CFTypeRef value) {
+    // Elements take over a reference of their own
+    AXUIElementRef ref = (AXUIElementRef) CFRetain(value);
+    return (PyObject *) elementWithRef(state, &ref);
+}
+
+static PyObject * convertURL(ModuleState * state, CFTypeRef value) {
+    return convertString(state, CFURLGetString(value));
+}
+
+static PyObject * convertAttributedString(ModuleState * state, CFTypeRef value) {
+    return convertString(state, CFAttributedStringGetString(value));
+}
+
+/*
+ * The value types have no hidden fields, so they can be allocated directly,
+ * skipping the lookups of their field counts in PyStructSequence_New.
+ */
+static PyObject * newValue(PyTypeObject * type, Py_ssize_t count) {
+#if PY_MAJOR_VERSION >= 3
+    return type->tp_alloc(type, count);
+#else
+    // Python 2 keeps the length in ob_size, which only this sets
+    return PyStructSequence_New(type);
+#endif
+}
+
+static PyObject * newGeometry(PyTypeObject * type, const double * fields, int count) {
+    PyObject * result = newValue(type, count);
+    if (result == NULL) return NULL;
+    for (int i = 0; i < count; i++) {
+        PyObject * field = PyFloat_FromDouble(fields[i]);
+        if (field == NULL) {
+            Py_DECREF(result);
             return NULL;
         }
-        if (name_strref != NULL) CFRelease(name_strref);
+        PyStructSequence_SET_ITEM(result, i, field);
     }
     return result;
 }
 
-static PyObject * AccessibleElement_get(AccessibleElement * self, PyObject * args) {
-    PyObject * result = NULL;
-    // This allows for retrieving multiple objects, so find how many were
-    // requested and loop over them.
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count > 1) {
-        result = PyTuple_New(attribute_count);
+static PyObject * newRange(ModuleState * state, CFIndex location, CFIndex length) {
+    PyObject * result = newValue(state->Range_type, 2);
+    if (result == NULL) return NULL;
+    PyStructSequence_SET_ITEM(result, 0, PyLong_FromLong((long) location));
+    PyStructSequence_SET_ITEM(result, 1, PyLong_FromLong((long) length));
+    if (PyStructSequence_GET_ITEM(result, 0) == NULL || PyStructSequence_GET_ITEM(result, 1) == NULL) {
+        Py_DECREF(result);
+        return NULL;
     }
+    return result;
+}
 
-    for (int i = 0; i < attribute_count; i++) {
-        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
-        if (!name) {
-            if (attribute_count > 1) Py_DECREF(result);
-            return NULL; // PyTuple_GetItem will set an Index error.
-        }
-        char * name_string = NULL;
-        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-        if (!name_strref) {
-            if (attribute_count > 1) Py_DECREF(result);
-            return NULL; // CFStringFromPyString will set an error.
+static PyObject * convertAXValue(ModuleState * state, CFTypeRef value) {
+    AXVariant variant;
+    if (axVariantFromAXValue((AXValueRef) value, &variant) == -1) {
+        switch (AXValueGetType(value)) {
+            case kAXValueCGPointType:
+            case kAXValueCGSizeType:
+            case kAXValueCGRectType:
+            case kAXValueCFRangeType:
+            case kAXValueAXErrorType:
+                PyErr_SetString(PyExc_ValueError, "The value cannot be retrieved.");
+                break;
+            default:
+                PyErr_SetString(PyExc_NotImplementedError, "Not all AXValue can yet be parsed.");
         }
-        
-        // Copy the value
-        CFTypeRef value = NULL;
-        AXError error = AXUIElementCopyAttributeValue(self->_ref, name_strref, &value);
-        
-        if (error == kAXErrorSuccess) {
-            if (attribute_count > 1) {
-                PyTuple_SetItem(result, i, parseCFTypeRef(value));
-            } else {
-                result = parseCFTypeRef(value);
-            }
-        } else {
-            // If any of the requests fail, release memory and raise an exception
-            if (attribute_count > 1) Py_DECREF(result);
-            if (name_strref != NULL) CFRelease(name_strref);
-            if (value != NULL) CFRelease(value);
-            handleAXErrors(name_string, error);
+        return NULL;
+    }
+    switch (variant.type) {
+        case AX_VARIANT_POINT:
+            return newGeometry(state->Point_type, variant.value.geometry, 2);
+        case AX_VARIANT_SIZE:
+            return newGeometry(state->Size_type, variant.value.geometry, 2);
+        case AX_VARIANT_RECT:
+            return newGeometry(state->Rect_type, variant.value.geometry, 4);
+        case AX_VARIANT_RANGE:
+            return newRange(state, (CFIndex) variant.value.range.location, (CFIndex) variant.value.range.length);
+        default:
+            return Py_BuildValue("i", (int) variant.value.integer);
+    }
+}
+
+static PyObject * convertArray(ModuleState * state, CFTypeRef value) {
+    CFIndex count = CFArrayGetCount(value);
+    if (count <= 0) Py_RETURN_NONE; // Empty arrays have always been None
+
+    PyObject * list = PyList_New((Py_ssize_t) count);
+    if (list == NULL) return NULL;
+    for (CFIndex i = 0; i < count; i++) {
+        PyObject * item = parseCFTypeRef(state, CFArrayGetValueAtIndex(value, i));
+        if (item == NULL) {
+            Py_DECREF(list);
             return NULL;
         }
-        if (name_strref != NULL) CFRelease(name_strref);
+        PyList_SET_ITEM(list, (Py_ssize_t) i, item);
     }
-    return result;
+    return list;
 }
 
-static PyObject * AccessibleElement_is_alive(AccessibleElement * self, PyObject * args) {
-    // Just check to see if the element responds to a basic attribute request
-    CFTypeRef value = NULL;
-    AXError error = AXUIElementCopyAttributeValue(self->_ref, kAXRoleAttribute, &value);
-    if (value != NULL) CFRelease(value);
-    
-    if (error == kAXErrorInvalidUIElement) Py_RETURN_FALSE;
-    else Py_RETURN_TRUE;
-}
+static PyObject * convertDictionary(ModuleState * state, CFTypeRef value) {
+    CFIndex count = CFDictionaryGetCount(value);
+    PyObject * dict = PyDict_New();
+    if (dict == NULL || count <= 0) return dict;
 
-static PyObject * AccessibleElement_set(AccessibleElement * self, PyObject * args) {
-    PyObject * result = NULL;
-    // There should be at least two arguments
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count <= 1) {
-        PyErr_SetString(PyExc_ValueError, "Not enough arguments.");
-        return NULL;
+    const void * stack[32];
+    const void ** keys = (count <= 16) ? stack : malloc(sizeof(void *) * 2 * (size_t) count);
+    if (keys == NULL) {
+        Py_DECREF(dict);
+        return PyErr_NoMemory();
     }
-    // The first argument should be a string
-    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
-    if (!name) {
-        return NULL; // PyTuple_GetItem will set an Index error.
-    }
-    char * name_string = NULL;
-    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-    if (!name_strref) {
-        if (attribute_count > 1) Py_DECREF(result);
-        return NULL; // CFStringFromPyString will set an error.
+    const void ** values = keys + count;
+    CFDictionaryGetKeysAndValues(value, keys, values);
+
+    for (CFIndex i = 0; i < count && dict != NULL; i++) {
+        PyObject * key = parseCFTypeRef(state, keys[i]);
+        PyObject * item = (key != NULL) ? parseCFTypeRef(state, values[i]) : NULL;
+        if (item == NULL || PyDict_SetItem(dict, key, item) == -1) Py_CLEAR(dict);
+        Py_XDECREF(key);
+        Py_XDECREF(item);
     }
+    if (keys != stack) free(keys);
+    return dict;
+}
 
-    // Check to see if the attribute can be set at all
-    Boolean can_set;
-    AXError error = AXUIElementIsAttributeSettable(self->_ref, name_strref, &can_set);
+/*
+ * Converters by CF type ID, in a small open-addressed table filled in at
+ * import, since type IDs are only known at runtime.
+ */
+typedef PyObject * (*ValueConverter)(ModuleState *, CFTypeRef);
 
-    if (error == kAXErrorSuccess && !can_set) {
-        PyErr_SetString(PyExc_ValueError, formattedMessage("The %s attribute cannot be modified.", name_string));
-        return NULL;
-    } else if (error != kAXErrorSuccess) {
-        handleAXErrors(name_string, error);
-        return result;
+#define CONVERTER_TABLE_SIZE 32 // a power of two, well over the number of types
+
+static struct {
+    CFTypeID type;
+    ValueConverter convert;
+} converters[CONVERTER_TABLE_SIZE];
+
+static void registerConverter(CFTypeID type, ValueConverter convert) {
+    size_t index = (size_t) type & (CONVERTER_TABLE_SIZE - 1);
+    while (converters[index].convert != NULL && converters[index].type != type)
+        index = (index + 1) & (CONVERTER_TABLE_SIZE - 1);
+    converters[index].type = type;
+    converters[index].convert = convert;
+}
+
+static void registerConverters(void) {
+    registerConverter(CFStringGetTypeID(), convertString);
+    registerConverter(AXUIElementGetTypeID(), convertElement);
+    registerConverter(CFArrayGetTypeID(), convertArray);
+    registerConverter(AXValueGetTypeID(), convertAXValue);
+    registerConverter(CFBooleanGetTypeID(), convertBoolean);
+    registerConverter(CFNumberGetTypeID(), convertNumber);
+    registerConverter(CFDictionaryGetTypeID(), convertDictionary);
+    registerConverter(CFURLGetTypeID(), convertURL);
+    registerConverter(CFAttributedStringGetTypeID(), convertAttributedString);
+}
+
+/*
+ * Converts a value returned by the API to a Python object. The value is only
+ * borrowed: elements retain what they keep, and the caller still releases it.
+ */
+static PyObject * parseCFTypeRef(ModuleState * state, const CFTypeRef value) {
+    CFTypeID type = CFGetTypeID(value);
+    size_t index = (size_t) type & (CONVERTER_TABLE_SIZE - 1);
+    while (converters[index].convert != NULL) {
+        if (converters[index].type == type) return converters[index].convert(state, value);
+        index = (index + 1) & (CONVERTER_TABLE_SIZE - 1);
     }
+    PyErr_SetString(PyExc_TypeError, "Unknown CFTypeRef type.");
+    return NULL;
+}
 
-    // Try to figure out what to set
-    if (CFStringCompare(name_strref, kAXPositionAttribute, 0) == kCFCompareEqualTo) {
-        
-        // For position, need a tuple of floats
-        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
-        float pair[2];
-        if (!PyTuple_Check(value)) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
-            return NULL;
-        } else if (PyTuple_Size(value) != 2) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
-            return NULL;
-        } else if (!PyArg_ParseTuple(value, "ff", &pair[0], &pair[1])) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXPosition requires a tuple of exactly two floats.");
-            return NULL;
+/*
+ * parseCFTypeRef, recorded as a conversion when tracing. Used for the values
+ * of requests, so that conversion time shows up next to the request itself.
+ */
+static PyObject * tracedParseCFTypeRef(ModuleState * state, const CFTypeRef value, pid_t pid) {
+    if (!trace_enabled) return parseCFTypeRef(state, value);
+    uint64_t begin = nanoTime();
+    PyObject * result = parseCFTypeRef(state, value);
+    traceRecord(TRACE_CONVERSION, "parseCFTypeRef", NULL, pid, begin, nanoTime(), result ? kAXErrorSuccess : kAXErrorFailure);
+    return result;
+}
+
+/*
+ * tracedParseCFTypeRef for the value of an attribute, which returns the same
+ * string object for repeats of a short string value if the attribute is
+ * interned (see configure_intern_cache).
+ */
+static PyObject * convertAttributeValue(ModuleState * state, CFStringRef attribute, CFTypeRef value, pid_t pid) {
+    if (CFGetTypeID(value) != CFStringGetTypeID() || CFStringGetLength(value) > INTERN_MAX_LENGTH)
+        return tracedParseCFTypeRef(state, value, pid);
+
+    PyObject * result = NULL;
+    int wanted = 0;
+    CFHashCode hash = 0;
+    pthread_mutex_lock(&state->intern_lock);
+    for (size_t i = 0; state->intern_capacity > 0 && !wanted && i < state->intern_attribute_count; i++) {
+        CFStringRef name = state->intern_attributes[i];
+        wanted = (name == attribute) || CFEqual(name, attribute);
+    }
+    if (wanted) {
+        hash = CFHash(value);
+        InternEntry * entry = &state->intern_entries[hash & (state->intern_capacity - 1)];
+        if (entry->string != NULL && (entry->string == value || (entry->hash == hash && CFEqual(entry->string, value)))) {
+            result = entry->value;
+            Py_INCREF(result);
+            state->intern_hits++;
         }
-        CGPoint pos = CGPointMake((CGFloat) pair[0], (CGFloat) pair[1]);
-        CFTypeRef position = (CFTypeRef) AXValueCreate(kAXValueCGPointType, (const void *) &pos);
-        AXError error = AXUIElementSetAttributeValue(self->_ref, kAXPositionAttribute, position);
+    }
+    pthread_mutex_unlock(&state->intern_lock);
+    if (result != NULL) return result;
+
+    result = tracedParseCFTypeRef(state, value, pid);
+    if (result == NULL || !wanted) return result;
+
+    // Whatever had the slot is let go of once the lock is released
+    CFStringRef old_string = NULL;
+    PyObject * old_value = NULL;
+    pthread_mutex_lock(&state->intern_lock);
+    if (state->intern_capacity > 0) {
+        InternEntry * entry = &state->intern_entries[hash & (state->intern_capacity - 1)];
+        old_string = entry->string;
+        old_value = entry->value;
+        entry->string = (CFStringRef) CFRetain(value);
+        entry->hash = hash;
+        entry->value = result;
+        Py_INCREF(result);
+        state->intern_misses++;
+        if (old_string != NULL) state->intern_evictions++;
+    }
+    pthread_mutex_unlock(&state->intern_lock);
+    if (old_string != NULL) CFRelease(old_string);
+    Py_XDECREF(old_value);
+    return result;
+}
 
-        result = Py_BuildValue("i", error);
-        return result;
-    } else if (CFStringCompare(name_strref, kAXSizeAttribute, 0) == kCFCompareEqualTo) {
-        
-        // For size, need a tuple of floats
-        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
-        float pair[2];
-        if (!PyTuple_Check(value)) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
-            return NULL;
-        } else if (PyTuple_Size(value) != 2) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
-            return NULL;
-        } else if (!PyArg_ParseTuple(value, "ff", &pair[0], &pair[1])) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXSize requires a tuple of exactly two floats.");
+/*
+ * Converts the parameter of a parameterized attribute: elements, booleans,
+ * points, sizes and rectangles, (location, length) tuples as ranges, numbers
+ * and strings. Returns a new reference, or NULL with an exception set.
+ */
+static CFTypeRef CFParameterFromPyObject(ModuleState * state, PyObject * parameter) {
+    if (PyObject_TypeCheck(parameter, state->AccessibleElement_type)) {
+        return CFRetain(((AccessibleElement *) parameter)->_ref);
+    } else if (PyBool_Check(parameter)) {
+        return CFRetain(parameter == Py_True ? kCFBooleanTrue : kCFBooleanFalse);
+    } else if (PyObject_TypeCheck(parameter, state->Point_type) || PyObject_TypeCheck(parameter, state->Size_type)) {
+        double pair[2];
+        if (!PyArg_ParseTuple(parameter, "dd", &pair[0], &pair[1])) return NULL;
+        if (PyObject_TypeCheck(parameter, state->Point_type)) {
+            CGPoint point = CGPointMake((CGFloat) pair[0], (CGFloat) pair[1]);
+            return AXValueCreate(kAXValueCGPointType, (const void *) &point);
+        }
+        CGSize size = CGSizeMake((CGFloat) pair[0], (CGFloat) pair[1]);
+        return AXValueCreate(kAXValueCGSizeType, (const void *) &size);
+    } else if (PyObject_TypeCheck(parameter, state->Rect_type)) {
+        double x, y, width, height;
+        if (!PyArg_ParseTuple(parameter, "dddd", &x, &y, &width, &height)) return NULL;
+        CGRect rect = CGRectMake((CGFloat) x, (CGFloat) y, (CGFloat) width, (CGFloat) height);
+        return AXValueCreate(kAXValueCGRectType, (const void *) &rect);
+    } else if (PyTuple_Check(parameter)) {
+        long long location, length;
+        if (PyTuple_Size(parameter) != 2 || !PyArg_ParseTuple(parameter, "LL", &location, &length)) {
+            PyErr_SetString(PyExc_TypeError, "A range parameter must be a tuple of exactly two integers.");
             return NULL;
         }
-        CGSize s = CGSizeMake((CGFloat) pair[0], (CGFloat) pair[1]);
-        CFTypeRef size = (CFTypeRef) AXValueCreate(kAXValueCGSizeType, (const void *) &s);
-        AXError error = AXUIElementSetAttributeValue(self->_ref, kAXSizeAttribute, size);
+        CFRange range = CFRangeMake((CFIndex) location, (CFIndex) length);
+        return AXValueCreate(kAXValueCFRangeType, (const void *) &range);
+#if PY_MAJOR_VERSION < 3
+    } else if (PyInt_Check(parameter) || PyLong_Check(parameter)) {
+#else
+    } else if (PyLong_Check(parameter)) {
+#endif
+        long long number = PyLong_AsLongLong(parameter);
+        if (number == -1 && PyErr_Occurred()) return NULL;
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &number);
+    } else if (PyFloat_Check(parameter)) {
+        double number = PyFloat_AsDouble(parameter);
+        return CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &number);
+    }
+    char * c_string = NULL;
+    CFTypeRef string = CFStringFromPyString(parameter, &c_string);
+    if (string == NULL) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError, "Parameters must be elements, booleans, numbers, strings or tuples.");
+    }
+    return string;
+}
+
+static void handleAXErrors(ModuleState * state, const char * attribute_name, AXError error) {
+    if (attribute_name == NULL) attribute_name = "(unknown)";
+    switch(error) {
+        case kAXErrorCannotComplete:
+            PyErr_Format(state->NotRespondingError, "The request for %s could not be completed (perhaps the application is not responding?).", attribute_name);
+            break;
+
+        case kAXErrorCircuitOpen:
+            PyErr_Format(state->CircuitOpenError, "The request for %s was not sent because the application has repeatedly failed to respond.", attribute_name);
+            break;
+
+        case kAXErrorAttributeUnsupported:
+            PyErr_Format(PyExc_KeyError, "This element does not possess the attribute %s.", attribute_name);
+            break;
+
+        case kAXErrorParameterizedAttributeUnsupported:
+            PyErr_Format(PyExc_KeyError, "This element does not possess the parameterized attribute %s.", attribute_name);
+            break;
+
+        case kAXErrorActionUnsupported:
+            PyErr_Format(PyExc_KeyError, "This element does not support the action %s. Note: the system-wide element does not support ANY actions.", attribute_name);
+            break;
+
+        case kAXErrorIllegalArgument:
+            PyErr_SetString(PyExc_ValueError, "Invalid argument. This is probably caused by a faulty AccessibleElement.");
+            break;
 
-        result = Py_BuildValue("i", error);
-        return result;
-    } else if (CFStringCompare(name_strref, kAXHiddenAttribute, 0) == kCFCompareEqualTo) {
+        case kAXErrorNoValue:
+            PyErr_Format(PyExc_ValueError, "The attribute %s has no value.", attribute_name);
+            break;
 
-        // For hidden, need a bool
-        PyObject * value = PyTuple_GetItem(args, (Py_ssize_t) 1);
-        if (PyObject_IsTrue(value) == -1) {
-            PyErr_SetString(PyExc_ValueError, "Setting AXHidden requires a bool.");
-            return NULL;
-        }
-        
-        AXError error;
-        if (PyObject_IsTrue(value)) {
-            error = AXUIElementSetAttributeValue(self->_ref, kAXHiddenAttribute, kCFBooleanTrue);
-        } else {
-            error = AXUIElementSetAttributeValue(self->_ref, kAXHiddenAttribute, kCFBooleanFalse);
-        }
-        result = Py_BuildValue("i", error);
-        return result;
+        case kAXErrorInvalidUIElement:
+            PyErr_SetString(state->InvalidUIElementError, "This element is no longer valid (perhaps the application has been closed?).");
+            break;
+
+        case kAXErrorNotImplemented:
+            PyErr_Format(PyExc_NotImplementedError, "This element does not implement the Accessibility API for the attribute %s.", attribute_name);
+            break;
+
+        case kAXErrorAPIDisabled:
+            PyErr_SetString(state->APIDisabledError, "This element does not respond to Accessibility requests -- perhaps Accessibility is not enabled on the system?");
+            break;
+
+        default:
+            PyErr_Format(PyExc_Exception, "Error %ld encountered with attibute %s.", (long) error, attribute_name);
+            break;
     }
+}
 
-    PyErr_SetString(PyExc_NotImplementedError, "Not all attributes can yet be modified.");
-    return result;
+static double monotonicTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
 }
 
-static PyObject * AccessibleElement_set_callback(AccessibleElement * self, PyObject * args) {
-    PyObject * callable = NULL;
-    
-    if (!PyArg_ParseTuple(args, "O", &callable))
-        return NULL;
+/*
+ * Like handleAXErrors, but also forgets a cached application element once it
+ * reports that it is no longer valid.
+ */
+static void handleElementAXErrors(AccessibleElement * self, const char * attribute_name, AXError error) {
+    if (error == kAXErrorInvalidUIElement) evictCachedApplication(self);
+    handleAXErrors(typeState(Py_TYPE(self)), attribute_name, error);
+}
 
-    // The argument should be a callable
-    if (!PyCallable_Check(callable)) {
-        PyErr_SetString(PyExc_TypeError, "The callback must be callable.");
-        return NULL;
+static void evictCachedApplication(AccessibleElement * self) {
+    ModuleState * state = typeState(Py_TYPE(self));
+    PyObject * application_cache = state->application_cache;
+    if (application_cache == NULL || self->pid == Py_None) return;
+    // Only the cached element itself is evicted; other elements of the same
+    // application (e.g. a closed window) going stale says nothing about it.
+    Py_BEGIN_CRITICAL_SECTION(application_cache);
+    if (PyDict_GetItem(application_cache, self->pid) == (PyObject *) self) {
+        PyDict_DelItem(application_cache, self->pid);
+        state->application_cache_evictions++;
     }
-    Py_XINCREF(callable);
-    Py_XDECREF(self->callback);
-    self->callback = callable;
+    Py_END_CRITICAL_SECTION();
+}
 
-    Py_RETURN_NONE;
+/* Application health
+======== */
+
+static int compareFloats(const void * a, const void * b) {
+    float x = *(const float *) a;
+    float y = *(const float *) b;
+    return (x > y) - (x < y);
 }
 
-static PyObject * AccessibleElement_set_timeout(AccessibleElement * self, PyObject * args) {
-    float timeout;
+// Refreshes the cached percentiles. Must be called with the entry's stripe locked.
+static void healthSortSamples(ApplicationHealth * health) {
+    float sorted[HEALTH_SAMPLES];
+    int n = health->sample_count;
+    memcpy(sorted, health->samples, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compareFloats);
+    health->p50 = sorted[n / 2];
+    health->p99 = sorted[(n * 99 + 99) / 100 - 1];
+    health->samples_since_sort = 0;
+}
 
-    if (!PyArg_ParseTuple(args, "f", &timeout))
-        return NULL;
+/*
+ * The adaptive timeout for an application, from its (sorted) percentiles,
+ * never less than least.
+ */
+static double healthTimeout(ApplicationHealth * health, BreakerConfig * config, float least) {
+    double t = health->p99 * config->multiplier;
+    if (t < config->min_timeout) t = config->min_timeout;
+    if (t > config->max_timeout) t = config->max_timeout;
+    if (t < least) t = least;
+    return t;
+}
 
-    AXError error = AXUIElementSetMessagingTimeout(self->_ref, timeout);
-    
-    if (error != kAXErrorSuccess) {
-        handleAXErrors("timeout", error);
-        return NULL;
-    } else {
-        Py_RETURN_NONE;
+static void healthInit(void) {
+    for (int s = 0; s < HEALTH_STRIPES; s++) {
+        pthread_mutex_init(&health_stripes[s].lock, NULL);
+        pthread_cond_init(&health_stripes[s].available, NULL);
     }
 }
 
-static PyObject * AccessibleElement_watch(AccessibleElement * self, PyObject * args) {
-    if (self->pid == Py_None) {
-        PyErr_SetString(PyExc_TypeError, "Must have a PID to watch for notifications.");
-        return NULL;
-    }
+static HealthStripe * healthStripe(pid_t pid) {
+    pthread_once(&health_once, healthInit);
+    // The top bits of the hash pick the stripe, the bottom ones the slot in it
+    return &health_stripes[((uint32_t) pid * 2654435761u) >> 28];
+}
 
-    // The observer needs to be initialized before notifications can be watched
-    if (self->_obs == NULL) {
-        // Get PID
-        pid_t pid;
-        AXError error = AXUIElementGetPid(self->_ref, &pid);
-        if (error != kAXErrorSuccess) {
-            handleAXErrors("pid", error);
-            return NULL;
-        }
+// Always in the same order, so that two threads doing so cannot deadlock.
+static void healthLockAll(void) {
+    pthread_once(&health_once, healthInit);
+    for (int s = 0; s < HEALTH_STRIPES; s++) pthread_mutex_lock(&health_stripes[s].lock);
+}
 
-        // Create observer
-        AXObserverRef temp = NULL;
-        error = AXObserverCreate(pid, NotifcationCallback, &temp);
-        if (error != kAXErrorSuccess) {
-            handleAXErrors("observer", error);
-            return NULL;
+static void healthUnlockAll(void) {
+    for (int s = HEALTH_STRIPES - 1; s >= 0; s--) pthread_mutex_unlock(&health_stripes[s].lock);
+}
+
+// Finds (or adds) the entry for a PID. Must be called with the stripe locked.
+static ApplicationHealth * healthFind(HealthStripe * stripe, pid_t pid) {
+    if (stripe->count * 2 >= stripe->capacity) {
+        size_t capacity = stripe->capacity ? stripe->capacity * 2 : 16;
+        ApplicationHealth * table = (ApplicationHealth *) calloc(capacity, sizeof(ApplicationHealth));
+        if (table == NULL) return NULL;
+        for (size_t i = 0; i < stripe->capacity; i++) {
+            if (!stripe->table[i].in_use) continue;
+            size_t j = ((size_t) stripe->table[i].pid * 2654435761u) & (capacity - 1);
+            while (table[j].in_use) j = (j + 1) & (capacity - 1);
+            table[j] = stripe->table[i];
         }
-        self->_obs = temp;
+        free(stripe->table);
+        stripe->table = table;
+        stripe->capacity = capacity;
+    }
 
-        // Add the observer to the run loop
-        CFRunLoopAddSource(CFRunLoopGetCurrent(), AXObserverGetRunLoopSource(self->_obs), kCFRunLoopDefaultMode);
+    size_t i = ((size_t) pid * 2654435761u) & (stripe->capacity - 1);
+    while (stripe->table[i].in_use) {
+        if (stripe->table[i].pid == pid) return &stripe->table[i];
+        i = (i + 1) & (stripe->capacity - 1);
     }
-    
-    // Since the method accepts an arbitrary number of strings...
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    
-    for (int i = 0; i < attribute_count; i++) {
-        // The arguments should be strings
-        PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) i);
-        if (!name) {
-            return NULL; // PyTuple_GetItem will set an Index error.
-        }
-        char * name_string = NULL;
-        CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-        if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+    memset(&stripe->table[i], 0, sizeof(ApplicationHealth));
+    stripe->table[i].pid = pid;
+    stripe->table[i].in_use = 1;
+    stripe->count++;
+    return &stripe->table[i];
+}
 
-        // Add the notification
-        AXError error = AXObserverAddNotification(self->_obs, self->_ref, name_strref, self);
-        CFRelease(name_strref);
-        
-        if (error != kAXErrorSuccess) {
-            handleAXErrors(name_string, error);
-            return NULL;
+/*
+ * Decides whether a request to the application may be sent at all, and if so
+ * (and timeout is not NULL), the adaptive timeout to send it with, or 0 to
+ * leave the element's timeout alone.
+ */
+static AXError healthAdmit(pid_t pid, float * timeout) {
+    if (timeout != NULL) *timeout = 0;
+    if (pid <= 0) return kAXErrorSuccess; // e.g. the system-wide element
+
+    AXError error = kAXErrorSuccess;
+    HealthStripe * stripe = healthStripe(pid);
+    pthread_mutex_lock(&stripe->lock);
+    ApplicationHealth * health = healthFind(stripe, pid);
+    if (health != NULL) {
+        if (breaker_config.threshold > 0 && health->consecutive_failures >= breaker_config.threshold
+                && monotonicTime() < health->open_until) {
+            health->rejected++;
+            error = kAXErrorCircuitOpen;
+        } else if (timeout != NULL && breaker_config.adaptive_timeout && health->sample_count >= HEALTH_MIN_SAMPLES) {
+            // Percentiles are only refreshed every few samples, which is
+            // plenty for a timeout that is a multiple of them anyway.
+            if (health->samples_since_sort >= HEALTH_SAMPLES / 8) healthSortSamples(health);
+            *timeout = (float) healthTimeout(health, &breaker_config, system_timeout);
         }
     }
+    pthread_mutex_unlock(&stripe->lock);
+    return error;
+}
 
-    Py_RETURN_NONE;
+static void healthSetSystemTimeout(float timeout) {
+    healthLockAll();
+    system_timeout = (timeout > 0) ? timeout : 0;
+    healthUnlockAll();
 }
 
-static PyObject * AccessibleElement_actions(AccessibleElement * self, PyObject * args) {
-    PyObject * result = NULL;
-    CFArrayRef names;
-    AXError error = AXUIElementCopyActionNames(self->_ref, &names);
-    if (error == kAXErrorSuccess) {
-        result = parseCFTypeRef(names);
-    } else {
-        handleAXErrors("action names", error);
+/*
+ * Records the outcome of a request, which was sent with the given timeout (0
+ * if the element's is the default).
+ */
+static void healthRecord(pid_t pid, AXOperation operation, double latency, float timeout, AXError error) {
+    if (pid <= 0 || error == kAXErrorCircuitOpen) return;
+
+    HealthStripe * stripe = healthStripe(pid);
+    pthread_mutex_lock(&stripe->lock);
+    ApplicationHealth * health = healthFind(stripe, pid);
+    if (health != NULL) {
+        health->requests++;
+        if (error == kAXErrorCannotComplete) {
+            health->failures++;
+            health->consecutive_failures++;
+            if (breaker_config.threshold > 0 && health->consecutive_failures >= breaker_config.threshold) {
+                health->open_until = monotonicTime() + breaker_config.cooldown;
+            }
+            // A reply that never came took at least as long as it was waited
+            // for, which keeps the slow tail in the percentiles
+            if (timeout <= 0) timeout = system_timeout;
+            if (latency < timeout) latency = timeout;
+        } else {
+            health->consecutive_failures = 0;
+        }
+        // Actions and writes take as long as whatever they set off, which
+        // says nothing about how soon a read is answered
+        if (operation != OP_PERFORM_ACTION && operation != OP_SET_ATTRIBUTE_VALUE) {
+            health->samples[health->sample_head] = (float) latency;
+            health->sample_head = (health->sample_head + 1) % HEALTH_SAMPLES;
+            if (health->sample_count < HEALTH_SAMPLES) health->sample_count++;
+            health->samples_since_sort++;
+        }
     }
+    pthread_mutex_unlock(&stripe->lock);
+}
 
-    if (names != NULL) CFRelease(names);
-    return result;
+/* Request scheduling
+======== */
+
+static RequestPriority currentPriority(void) {
+    // Stored off by one, as threads that never set it have NULL
+    intptr_t value = (intptr_t) pthread_getspecific(priority_key);
+    return value ? (RequestPriority) (value - 1) : PRIORITY_NORMAL;
 }
 
-static PyObject * AccessibleElement_action_description(AccessibleElement * self, PyObject * args) {
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count != 1) {
-        PyErr_SetString(PyExc_ValueError, "An action name must be specified to retrieve its description.");
-        return NULL;
-    }
-    // The first argument should be a string
-    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
-    if (!name) {
-        return NULL; // PyTuple_GetItem will set an Index error.
+// Finds the entry for a PID without adding one. Must be called with the stripe locked.
+static ApplicationHealth * healthLookup(HealthStripe * stripe, pid_t pid) {
+    if (stripe->capacity == 0) return NULL;
+    size_t i = ((size_t) pid * 2654435761u) & (stripe->capacity - 1);
+    while (stripe->table[i].in_use) {
+        if (stripe->table[i].pid == pid) return &stripe->table[i];
+        i = (i + 1) & (stripe->capacity - 1);
     }
-    char * name_string = NULL;
-    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
-
-    // Check for the action's description
-    CFStringRef descr;
-    AXError error = AXUIElementCopyActionDescription(self->_ref, name_strref, &descr);
-    if (name_strref != NULL) CFRelease(name_strref);
+    return NULL;
+}
 
-    if (error != kAXErrorSuccess) {
-        handleAXErrors(name_string, error);
-        return NULL;
+static int scheduleWaiting(RequestQueue * queue) {
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        if (queue->next_ticket[p] != queue->serving[p]) return 1;
     }
-    return parseCFTypeRef(descr);
+    return 0;
 }
 
-static PyObject * AccessibleElement_perform_action(AccessibleElement * self, PyObject * args) {
-    Py_ssize_t attribute_count = PyTuple_Size(args);
-    if (attribute_count != 1) {
-        PyErr_SetString(PyExc_ValueError, "An action name must be specified.");
-        return NULL;
+// Whether the slot's turn has come. Must be called with the stripe locked.
+static int scheduleReady(RequestQueue * queue, RequestSlot * slot) {
+    int limit = scheduler_config.max_in_flight;
+    int background_limit = scheduler_config.background_in_flight;
+    if (limit <= 0) return 1; // turned off meanwhile
+    if (slot->ticket != queue->serving[slot->priority]) return 0;
+    for (int p = 0; p < (int) slot->priority; p++) {
+        if (queue->next_ticket[p] != queue->serving[p]) return 0;
     }
-    // The first argument should be a string
-    PyObject * name = PyTuple_GetItem(args, (Py_ssize_t) 0);
-    if (!name) {
-        return NULL; // PyTuple_GetItem will set an Index error.
+    if (queue->in_flight >= limit) return 0;
+    return slot->priority != PRIORITY_BACKGROUND || background_limit <= 0
+        || queue->in_flight_background < background_limit;
+}
+
+static void scheduleTake(HealthStripe * stripe, RequestQueue * queue, RequestSlot * slot, double waited) {
+    queue->serving[slot->priority]++;
+    queue->in_flight++;
+    if (slot->priority == PRIORITY_BACKGROUND) queue->in_flight_background++;
+    slot->holding = 1;
+
+    SchedulerCounters * counters = &stripe->counters[slot->priority];
+    counters->requests++;
+    if (waited >= 0) {
+        counters->waited++;
+        counters->wait_total += waited;
+        if (waited > counters->wait_max) counters->wait_max = waited;
     }
-    char * name_string = NULL;
-    CFStringRef name_strref = CFStringFromPyString(name, &name_string);
-    if (!name_strref) return NULL; // CFStringFromPyString will set an error.
+    // The next in line may be free to go as well
+    if (scheduleWaiting(queue)) pthread_cond_broadcast(&stripe->available);
+}
 
-    // Check for the action's description
-    AXError error = AXUIElementPerformAction(self->_ref, name_strref);
-    if (name_strref != NULL) CFRelease(name_strref);
+// Waits for the slot's turn, and takes it. Must be called with the stripe locked.
+static void scheduleWait(HealthStripe * stripe, RequestSlot * slot) {
+    double started = monotonicTime();
+    ApplicationHealth * health;
+    // The entry is looked up again after every wait, as the table may have
+    // grown meanwhile
+    while ((health = healthLookup(stripe, slot->pid)) != NULL && !scheduleReady(&health->queue, slot)) {
+        pthread_cond_wait(&stripe->available, &stripe->lock);
+    }
+    if (health != NULL) scheduleTake(stripe, &health->queue, slot, monotonicTime() - started);
+}
 
-    if (error != kAXErrorSuccess) {
-        handleAXErrors(name_string, error);
-        return NULL;
+/*
+ * Takes one of the application's slots for a request, waiting for its turn
+ * if need be. With attached set, the caller holds the GIL (or is attached to
+ * its interpreter), which is released while waiting. Every call must be
+ * followed by scheduleLeave once the request is done.
+ */
+static void scheduleEnter(RequestSlot * slot, pid_t pid, RequestPriority priority, int attached) {
+    slot->pid = pid;
+    slot->priority = priority;
+    slot->holding = 0;
+    if (pid <= 0 || __atomic_load_n(&scheduler_config.max_in_flight, __ATOMIC_RELAXED) <= 0) return;
+
+    HealthStripe * stripe = healthStripe(pid);
+    pthread_mutex_lock(&stripe->lock);
+    ApplicationHealth * health = healthFind(stripe, pid);
+    if (health == NULL) {
+        // Out of memory, so the request goes unscheduled
+        pthread_mutex_unlock(&stripe->lock);
+        return;
+    }
+    slot->ticket = health->queue.next_ticket[priority]++;
+    if (scheduleReady(&health->queue, slot)) {
+        scheduleTake(stripe, &health->queue, slot, -1);
+        pthread_mutex_unlock(&stripe->lock);
+    } else if (attached) {
+        // The lock is let go before the GIL is taken back, so that no one
+        // can hold the one while waiting for the other
+        pthread_mutex_unlock(&stripe->lock);
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&stripe->lock);
+        scheduleWait(stripe, slot);
+        pthread_mutex_unlock(&stripe->lock);
+        Py_END_ALLOW_THREADS
+    } else {
+        scheduleWait(stripe, slot);
+        pthread_mutex_unlock(&stripe->lock);
     }
-    Py_RETURN_NONE;
 }
 
-static PyMethodDef AccessibleElement_methods[] = {
-    // Attributes
-    {"keys", (PyCFunction) AccessibleElement_keys, METH_NOARGS, keys_docstring},
-    {"count", (PyCFunction) AccessibleElement_count, METH_VARARGS, count_docstring},
-    {"get", (PyCFunction) AccessibleElement_get, METH_VARARGS, get_docstring},
-    {"set", (PyCFunction) AccessibleElement_set, METH_VARARGS, set_docstring},
-    {"can_set", (PyCFunction) AccessibleElement_can_set, METH_VARARGS, can_set_docstring},
-    // Notification API
-    {"watch", (PyCFunction) AccessibleElement_watch, METH_VARARGS, watch_docstring},
-    {"set_callback", (PyCFunction) AccessibleElement_set_callback, METH_VARARGS, set_callback_docstring},
-    // Action API
-    {"actions", (PyCFunction) AccessibleElement_actions, METH_NOARGS, actions_docstring},
-    {"action_description", (PyCFunction) AccessibleElement_action_description, METH_VARARGS, action_desciption_docstring},
-    {"perform_action", (PyCFunction) AccessibleElement_perform_action, METH_VARARGS, perform_action_docstring},
-    // Misc
-    {"set_timeout", (PyCFunction) AccessibleElement_set_timeout, METH_VARARGS, set_timeout_docstring},
-    {"is_alive", (PyCFunction) AccessibleElement_is_alive, METH_NOARGS, is_alive_docstring},
-    {NULL, NULL, 0, NULL}
-};
+static void scheduleLeave(RequestSlot * slot) {
+    if (!slot->holding) return;
+    slot->holding = 0;
+
+    HealthStripe * stripe = healthStripe(slot->pid);
+    pthread_mutex_lock(&stripe->lock);
+    ApplicationHealth * health = healthLookup(stripe, slot->pid);
+    if (health != NULL) {
+        RequestQueue * queue = &health->queue;
+        if (queue->in_flight > 0) queue->in_flight--;
+        if (slot->priority == PRIORITY_BACKGROUND && queue->in_flight_background > 0) queue->in_flight_background--;
+        if (scheduleWaiting(queue)) pthread_cond_broadcast(&stripe->available);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
 
-static PyMemberDef AccessibleElement_members[] = {
-    {"pid", T_OBJECT_EX, offsetof(AccessibleElement, pid), READONLY, "The process ID associated with this element, if it has one."},
-    {NULL, 0, 0, 0, NULL}
-};
+/* Call statistics
+======== */
 
-static PyTypeObject AccessibleElement_type = {
-#if PY_MAJOR_VERSION >= 3
-    PyVarObject_HEAD_INIT(NULL, 0)
-#else
-    PyObject_HEAD_INIT(NULL) 0, /*ob_size*/
-#endif
-    "accessibility.AccessibleElement", /*tp_name*/
-    sizeof(AccessibleElement), /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    (destructor) AccessibleElement_dealloc, /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    &AccessibleElement_as_sequence, /*tp_as_sequence*/
-    &AccessibleElement_as_mapping, /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    AccessibleElement_docstring, /* tp_doc */
-    0,                       /* tp_traverse */
-    0,                       /* tp_clear */
-    (richcmpfunc) &AccessibleElement_richcompare, /* tp_richcompare */
-    0,                       /* tp_weaklistoffset */
-    0,                       /* tp_iter */
-    0,                       /* tp_iternext */
-    AccessibleElement_methods, /* tp_methods */
-    AccessibleElement_members /* tp_members */
-};
+static uint64_t nanoTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
 
-/* Module functions implementation
-======== */
+/*
+ * Returns the time a call starts, or 0 when neither statistics nor tracing are
+ * enabled, in which case callEnd does nothing.
+ */
+static uint64_t callBegin(void) {
+    if (!stats_enabled && !trace_enabled) return 0;
+    uint64_t now = nanoTime();
+    return now ? now : 1;
+}
 
-#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_9
+static int statsBucketIndex(uint64_t value) {
+    if (value < STATS_SUB_BUCKETS) return (int) value;
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > STATS_MAX_EXPONENT) return STATS_BUCKETS - 1;
+    return (exponent - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS
+        + (int) ((value >> (exponent - STATS_SUB_BITS)) - STATS_SUB_BUCKETS);
+}
 
-// Use the prompt system for Mavericks & later
-static PyObject * is_enabled(PyObject * self, PyObject * args, PyObject * kwargs) {  
-    static char *kwlist [] = {"prompt", NULL};
-    int prompt = 1;
-    
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &prompt))
-        return NULL;
+// The largest value that falls into a bucket
+static uint64_t statsBucketValue(int index) {
+    if (index < STATS_SUB_BUCKETS) return (uint64_t) index;
+    int exponent = index / STATS_SUB_BUCKETS - 1 + STATS_SUB_BITS;
+    uint64_t sub = (uint64_t) (index % STATS_SUB_BUCKETS);
+    uint64_t width = 1ull << (exponent - STATS_SUB_BITS);
+    return (STATS_SUB_BUCKETS + sub) * width + width - 1;
+}
 
-    if (prompt == 1) {
-        const void * keys[] = { kAXTrustedCheckOptionPrompt };
-        const void * values[] = { kCFBooleanTrue };
-        if (AXIsProcessTrustedWithOptions(CFDictionaryCreate(NULL, keys, values, 1, NULL, NULL))){
-            Py_RETURN_TRUE;
-        } else {
-            Py_RETURN_FALSE;
+// Finds (or adds) the entry for a key. Must be called with stats_lock held.
+static CallStats * statsFind(AXOperation operation, CFStringRef attribute, pid_t pid) {
+    size_t hash = (size_t) operation * 31u + (size_t) pid * 2654435761u;
+    if (attribute != NULL) hash ^= (size_t) CFHash(attribute);
+
+    if (stats_count * 2 >= stats_capacity) {
+        if (stats_count >= STATS_MAX_KEYS) return NULL;
+        size_t capacity = stats_capacity ? stats_capacity * 2 : 64;
+        CallStats * table = (CallStats *) calloc(capacity, sizeof(CallStats));
+        if (table == NULL) return NULL;
+        for (size_t i = 0; i < stats_capacity; i++) {
+            CallStats * old = &stats_table[i];
+            if (!old->in_use) continue;
+            size_t h = (size_t) old->operation * 31u + (size_t) old->pid * 2654435761u;
+            if (old->attribute != NULL) h ^= (size_t) CFHash(old->attribute);
+            size_t j = h & (capacity - 1);
+            while (table[j].in_use) j = (j + 1) & (capacity - 1);
+            table[j] = *old;
         }
-    } else {
-        if (AXIsProcessTrustedWithOptions(NULL)) {
-            Py_RETURN_TRUE;
-        } else {
-            Py_RETURN_FALSE;
+        free(stats_table);
+        stats_table = table;
+        stats_capacity = capacity;
+    }
+
+    size_t i = hash & (stats_capacity - 1);
+    while (stats_table[i].in_use) {
+        CallStats * entry = &stats_table[i];
+        if (entry->operation == operation && entry->pid == pid && (entry->attribute == attribute
+                || (entry->attribute != NULL && attribute != NULL && CFEqual(entry->attribute, attribute)))) {
+            return entry;
         }
+        i = (i + 1) & (stats_capacity - 1);
     }
-#else
+    CallStats * entry = &stats_table[i];
+    memset(entry, 0, sizeof(CallStats));
+    entry->in_use = 1;
+    entry->operation = operation;
+    entry->attribute = (attribute != NULL) ? (CFStringRef) CFRetain(attribute) : NULL;
+    entry->pid = pid;
+    entry->min = UINT64_MAX;
+    stats_count++;
+    return entry;
+}
 
-// Use the old system otherwise
-static PyObject * is_enabled(PyObject * self) {
-    if (AXAPIEnabled()) {
-        Py_RETURN_TRUE;
+static void statsRecord(AXOperation operation, CFStringRef attribute, pid_t pid, uint64_t elapsed, AXError error) {
+    pthread_mutex_lock(&stats_lock);
+    CallStats * entry = statsFind(operation, attribute, pid);
+    if (entry != NULL) {
+        entry->count++;
+        entry->total += elapsed;
+        if (elapsed < entry->min) entry->min = elapsed;
+        if (elapsed > entry->max) entry->max = elapsed;
+        entry->buckets[statsBucketIndex(elapsed)]++;
+        if (error != kAXErrorSuccess) entry->errors++;
     } else {
-        Py_RETURN_FALSE;
+        stats_overflow++;
     }
-#endif
+
+    if (error == kAXErrorCircuitOpen) {
+        stats_circuit_open++;
+    } else if (error <= kAXErrorFailure && error > kAXErrorFailure - STATS_ERROR_CODES) {
+        stats_error_counts[kAXErrorFailure - error]++;
+    } else if (error != kAXErrorSuccess) {
+        stats_other_errors++;
+    }
+    pthread_mutex_unlock(&stats_lock);
 }
 
-static PyObject * is_trusted(PyObject * self) {
-    if (AXIsProcessTrusted()) {
-        Py_RETURN_TRUE;
+static void callEnd(AXOperation operation, CFStringRef attribute, pid_t pid, uint64_t started, AXError error) {
+    if (started == 0) return;
+    uint64_t now = nanoTime();
+    if (stats_enabled) statsRecord(operation, attribute, pid, now - started, error);
+    if (trace_enabled) traceRecord(TRACE_IPC, operation_names[operation], attribute, pid, started, now, error);
+}
+
+static AXError setMessagingTimeout(AXUIElementRef ref, pid_t pid, float timeout) {
+    uint64_t call_started = callBegin();
+    AXError error = ax_backend->setMessagingTimeout(ref, timeout);
+    callEnd(OP_SET_MESSAGING_TIMEOUT, NULL, pid, call_started, error);
+    return error;
+}
+
+/* Tracing
+======== */
+
+// Releases the events' details. Must be called with trace_lock held.
+static void traceBufferClear(TraceBuffer * buffer) {
+    for (size_t i = 0; i < buffer->count; i++) {
+        if (buffer->events[i].detail != NULL) CFRelease(buffer->events[i].detail);
+    }
+    buffer->count = 0;
+    buffer->dropped = 0;
+}
+
+static void traceThreadExit(void * arg) {
+    pthread_mutex_lock(&trace_lock);
+    ((TraceBuffer *) arg)->orphaned = 1;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Returns this thread's buffer for the current trace, creating or resetting it
+static TraceBuffer * traceBuffer(void) {
+    TraceBuffer * buffer = (TraceBuffer *) pthread_getspecific(trace_key);
+    unsigned long generation = __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE);
+    if (buffer != NULL && buffer->generation == generation) return buffer;
+
+    pthread_mutex_lock(&trace_lock);
+    if (buffer == NULL) {
+        buffer = (TraceBuffer *) calloc(1, sizeof(TraceBuffer));
+        if (buffer != NULL) {
+            buffer->thread_id = ++trace_threads;
+            buffer->next = trace_buffers;
+            trace_buffers = buffer;
+            pthread_setspecific(trace_key, buffer);
+        }
     } else {
-        Py_RETURN_FALSE;
+        traceBufferClear(buffer);
+    }
+    if (buffer != NULL && buffer->capacity != trace_capacity) {
+        free(buffer->events);
+        buffer->events = (TraceEvent *) malloc(trace_capacity * sizeof(TraceEvent));
+        buffer->capacity = (buffer->events != NULL) ? trace_capacity : 0;
+    }
+    if (buffer != NULL) buffer->generation = trace_generation;
+    pthread_mutex_unlock(&trace_lock);
+    return buffer;
+}
+
+static void traceRecord(TraceCategory category, const char * name, CFStringRef detail, pid_t pid, uint64_t begin, uint64_t end, AXError error) {
+    TraceBuffer * buffer = traceBuffer();
+    if (buffer == NULL) return;
+
+    size_t count = buffer->count;
+    if (count >= buffer->capacity) {
+        buffer->dropped++;
+        return;
     }
+    TraceEvent * event = &buffer->events[count];
+    event->begin = begin;
+    event->end = end;
+    event->name = name;
+    event->detail = (detail != NULL) ? (CFStringRef) CFRetain(detail) : NULL;
+    event->pid = pid;
+    event->error = error;
+    event->category = category;
+    __atomic_store_n(&buffer->count, count + 1, __ATOMIC_RELEASE);
 }
 
-static AccessibleElement * create_application_ref(PyObject * self, PyObject * args, PyObject * kwargs) {
-    static char *kwlist [] = {"pid", "force", NULL};
-    pid_t pid;
-    int force = 0;
- 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|i", kwlist, &pid, &force))
-        return NULL;
+static void traceWriteString(FILE * file, CFStringRef string) {
+    char stack_buffer[256];
+    char * buffer = stack_buffer;
+    const char * c_string = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+    if (c_string == NULL) {
+        CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+        if (size > (CFIndex) sizeof(stack_buffer)) buffer = (char *) malloc(size);
+        if (buffer != NULL && CFStringGetCString(string, buffer, size, kCFStringEncodingUTF8)) c_string = buffer;
+    }
 
-    AXUIElementRef ref = AXUIElementCreateApplication(pid);
-    
-    // Just check to see if the element responds to a basic attribute request
-    // This might cause problems in some extreme cases, but it also alleviates
-    // the common mistake of passing in a PID with a typo, only to have a call
-    // fail later.
-    CFTypeRef value = NULL;
-    AXError error = AXUIElementCopyAttributeValue(ref, kAXRoleAttribute, &value);
-    if (value != NULL) CFRelease(value);
-    
-    if (error == kAXErrorAPIDisabled) {
-        PyErr_SetString(APIDisabledError, "The element created with this PID does not respond to Accessibility requests -- perhaps Accessibility is not enabled on the system?");
-        return NULL;
-    } else if (error != kAXErrorSuccess && force == 0) {
-        PyErr_SetString(PyExc_ValueError, formattedMessage(
-           "The element does not respond to a request for its AXRole, which is \n\
-supposedly required of all Accessibility API-enabled objects. For this reason, \n\
-it is inadvisable to try and create an AccessibleElement for this PID. You may \n\
-override this failure case by passing ``force = True`` to this function.", error));
-        return NULL;
+    fputc('"', file);
+    for (const char * c = c_string ? c_string : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char) *c);
+        } else {
+            fputc(*c, file);
+        }
     }
-    
-    return elementWithRef(&ref);
+    fputc('"', file);
+    if (buffer != stack_buffer) free(buffer);
 }
 
-static AccessibleElement * create_systemwide_ref(PyObject * self, PyObject * args) {
-    AXUIElementRef ref = AXUIElementCreateSystemWide();
-    return elementWithRef(&ref);
+// Writes the current trace as Chrome trace JSON. Must be called with trace_lock held.
+static unsigned long traceWrite(FILE * file) {
+    unsigned long written = 0;
+    uint64_t dropped = 0;
+    int pid = (int) getpid();
+
+    fputs("{\"traceEvents\":[\n", file);
+    for (TraceBuffer * buffer = trace_buffers; buffer != NULL; buffer = buffer->next) {
+        if (buffer->generation != trace_generation) continue;
+        size_t count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        dropped += buffer->dropped;
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+            written ? ",\n" : "", pid, buffer->thread_id, buffer->thread_id);
+        written++;
+
+        for (size_t i = 0; i < count; i++) {
+            TraceEvent * event = &buffer->events[i];
+            // Timestamps are in microseconds relative to the start of the trace
+            double ts = (event->begin > trace_origin) ? (event->begin - trace_origin) / 1e3 : 0.0;
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                event->name, trace_category_names[event->category], ts, (event->end - event->begin) / 1e3, pid, buffer->thread_id);
+            if (event->detail != NULL) {
+                fputs(event->category == TRACE_CALLBACK ? "\"notification\":" : "\"attribute\":", file);
+                traceWriteString(file, event->detail);
+                fputc(',', file);
+            }
+            if (event->pid > 0) fprintf(file, "\"target_pid\":%d,", (int) event->pid);
+            fprintf(file, "\"error\":%d}}", (int) event->error);
+            written++;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}\n", (unsigned long long) dropped);
+    return written;
 }
 
-static AccessibleElement * element_at_position(PyObject * self, PyObject * args, PyObject * kwargs) {
-    AccessibleElement * result = NULL;
-    AccessibleElement * parent = NULL;
-    float x, y;
+/* Requests
+======== */
 
-    static char *kwlist [] = {"x", "y", "element", NULL};
-    
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ff|O", kwlist, &x, &y, &parent))
-        return NULL;
-    
-    AXUIElementRef ref = (parent != NULL) ? parent->_ref : AXUIElementCreateSystemWide();
-    AXUIElementRef element;
-    AXError error = AXUIElementCopyElementAtPosition (ref, x, y, &element);
+/*
+ * Every request to an application, from an AccessibleElement or from one of
+ * the native workers, is bracketed by requestBegin and requestEnd. They apply
+ * the circuit breaker, take a slot from the scheduler (releasing the GIL while
+ * waiting, if attached), send the request with the right timeout, and record
+ * the outcome in the application's health, the call statistics and the trace.
+ * The request's operation, attribute, element and PID are filled in first.
+ *
+ * A timeout of the request's own (own > 0) takes precedence over the adaptive
+ * one. Where the caller keeps the timeout last set on the element in *applied,
+ * it is only set again when it changes; otherwise it is set for this request
+ * alone. If requestBegin returns an error, the request was turned away and
+ * requestEnd is not called.
+ */
 
-    if (error == kAXErrorSuccess) {
-        result = elementWithRef(&element);
+// Sets the request's timeout on the element unless it is already the one set.
+static void requestApplyTimeout(Request * request, float * applied) {
+    // Setting the timeout is local to this process, but skip it when unchanged
+    if (request->timeout != *applied) {
+        setMessagingTimeout(request->ref, request->pid, request->timeout);
+        *applied = request->timeout;
+    }
+}
+
+static AXError requestBegin(Request * request, RequestPriority priority, int attached, float own, float * applied) {
+    float adaptive_timeout = 0;
+    AXError error = healthAdmit(request->pid, (own > 0) ? NULL : &adaptive_timeout);
+    if (error != kAXErrorSuccess) {
+        callEnd(request->operation, request->attribute, request->pid, callBegin(), error);
+        return error;
+    }
+    scheduleEnter(&request->slot, request->pid, priority, attached);
+
+    request->timeout = (own > 0) ? own : adaptive_timeout;
+    request->restore = 0;
+    if (applied == NULL) {
+        if (request->timeout > 0) {
+            setMessagingTimeout(request->ref, request->pid, request->timeout);
+            request->restore = 1;
+        }
+    } else if (request->owner != NULL) {
+        Py_BEGIN_CRITICAL_SECTION(request->owner);
+        requestApplyTimeout(request, applied);
+        Py_END_CRITICAL_SECTION();
     } else {
-        handleAXErrors("(element at position)", error);
+        requestApplyTimeout(request, applied);
     }
+    request->call_started = callBegin();
+    request->started = monotonicTime();
+    return kAXErrorSuccess;
+}
 
-    if (ref != NULL && parent == NULL) CFRelease(ref);
-    return result;
+static void requestEnd(Request * request, AXError error) {
+    scheduleLeave(&request->slot);
+    healthRecord(request->pid, request->operation, monotonicTime() - request->started, request->timeout, error);
+    callEnd(request->operation, request->attribute, request->pid, request->call_started, error);
+    // Leave the element on the default timeout, as its owner expects
+    if (request->restore) setMessagingTimeout(request->ref, request->pid, 0);
 }
 
-/* Module definition
-======== */
- 
-static PyMethodDef methods[] = {
-#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_9
-    {"is_enabled", (PyCFunction) is_enabled, METH_VARARGS|METH_KEYWORDS, is_enabled_docstring},
-#else
-    {"is_enabled", (PyCFunction) is_enabled, METH_NOARGS, "is_enabled()\n\nCheck if accessibility has been enabled on the system."},
-#endif
-    {"is_trusted", (PyCFunction) is_trusted, METH_NOARGS, "is_trusted()\n\nCheck if this application is a trusted process."},
-    {"create_application_ref", (PyCFunction) create_application_ref, METH_VARARGS|METH_KEYWORDS, "create_application_ref(pid, force = False)\n\nCreate an accessibile application with the given PID."},
-    {"create_systemwide_ref", (PyCFunction) create_systemwide_ref, METH_NOARGS, "create_systemwide_ref()\n\nGet a system-wide accessible element reference."},
-    {"element_at_position", (PyCFunction) element_at_position, METH_VARARGS|METH_KEYWORDS, element_at_position_docstring},
-    {NULL, NULL, 0, NULL}
-};
+// Begins a request of an AccessibleElement, with the GIL held.
+static AXError beginRequest(AccessibleElement * self, Request * request) {
+    request->ref = self->_ref;
+    request->pid = self->_pid;
+    request->owner = (PyObject *) self;
+    return requestBegin(request, currentPriority(), 1, self->_timeout, &self->_applied_timeout);
+}
 
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef module = {
-    PyModuleDef_HEAD_INIT,
-    "accessibility",
-    module_docstring,
-    (Py_ssize_t) -1,
-    methods,
-    NULL,
-    NULL,
-    NULL,
-    NULL
-};
+static AXError copyAttributeValue(AccessibleElement * self, CFStringRef name, CFTypeRef * value) {
+    Request request = { .operation = OP_COPY_ATTRIBUTE_VALUE, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = axSessionCopy(&ax_session, self->_ref, name, value);
+    requestEnd(&request, error);
+    return error;
+}
 
-PyMODINIT_FUNC PyInit_accessibility(void) {
-    PyObject * m = PyModule_Create(&module);
-#else
-PyMODINIT_FUNC initaccessibility(void) {
-    PyObject * m = Py_InitModule3("accessibility", methods, module_docstring);
-    if (m == NULL) {
-        return;
-    }
-#endif
+static AXError copyMultipleAttributeValues(AccessibleElement * self, CFArrayRef names, CFArrayRef * values) {
+    Request request = { .operation = OP_COPY_MULTIPLE_ATTRIBUTE_VALUES };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = axSessionCopyMultiple(&ax_session, self->_ref, names, 0, values);
+    requestEnd(&request, error);
+    return error;
+}
 
-    AccessibleElement_type.tp_new = PyType_GenericNew;
-#if PY_MAJOR_VERSION >= 3
-    if (PyType_Ready(&AccessibleElement_type) < 0) return m;
-#else
-    if (PyType_Ready(&AccessibleElement_type) < 0) return;
-#endif
+static AXError copyParameterizedAttributeValue(AccessibleElement * self, CFStringRef name, CFTypeRef parameter, CFTypeRef * value) {
+    Request request = { .operation = OP_COPY_PARAMETERIZED_ATTRIBUTE_VALUE, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->copyParameterizedAttributeValue(self->_ref, name, parameter, value);
+    requestEnd(&request, error);
+    return error;
+}
 
-    Py_INCREF(&AccessibleElement_type);
-    PyModule_AddObject(m, "AccessibleElement", (PyObject *) &AccessibleElement_type);
-    PyModule_AddObject(m, "DEFAULT_TIMEOUT", PyFloat_FromDouble(0.0));
-#if PY_MAJOR_VERSION >= 3
-    PyModule_AddObject(m, "__author__", PyBytes_FromString("Aaron Jacobs <atheriel@gmail.com>"));
-    PyModule_AddObject(m, "__version__", PyBytes_FromString("0.4.0"));
-#else
-    PyModule_AddObject(m, "__author__", PyString_FromString("Aaron Jacobs <atheriel@gmail.com>"));
-    PyModule_AddObject(m, "__version__", PyString_FromString("0.4.0"));
-#endif
+static AXError copyAttributeNames(AccessibleElement * self, CFArrayRef * names) {
+    Request request = { .operation = OP_COPY_ATTRIBUTE_NAMES };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->copyAttributeNames(self->_ref, names);
+    requestEnd(&request, error);
+    return error;
+}
 
-    InvalidUIElementError = PyErr_NewExceptionWithDoc("accessibility.InvalidUIElementError", InvalidUIElementError_docstring, PyExc_ValueError, NULL);
-    PyModule_AddObject(m, "InvalidUIElementError", InvalidUIElementError);
+static AXError getAttributeValueCount(AccessibleElement * self, CFStringRef name, CFIndex * count) {
+    Request request = { .operation = OP_GET_ATTRIBUTE_VALUE_COUNT, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->getAttributeValueCount(self->_ref, name, count);
+    requestEnd(&request, error);
+    return error;
+}
 
-    APIDisabledError = PyErr_NewExceptionWithDoc("accessibility.APIDisabledError", APIDisabledError_docstring, PyExc_Exception, NULL);
-    PyModule_AddObject(m, "APIDisabledError", APIDisabledError);
+static AXError isAttributeSettable(AccessibleElement * self, CFStringRef name, Boolean * settable) {
+    Request request = { .operation = OP_IS_ATTRIBUTE_SETTABLE, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->isAttributeSettable(self->_ref, name, settable);
+    requestEnd(&request, error);
+    return error;
+}
 
-    if (!PyEval_ThreadsInitialized()) {
-        PyEval_InitThreads();
-    }
+static AXError setAttributeValue(AccessibleElement * self, CFStringRef name, CFTypeRef value) {
+    Request request = { .operation = OP_SET_ATTRIBUTE_VALUE, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->setAttributeValue(self->_ref, name, value);
+    requestEnd(&request, error);
+    return error;
+}
 
-#if PY_MAJOR_VERSION >= 3
-    return m;
-#endif
+static AXError copyActionNames(AccessibleElement * self, CFArrayRef * names) {
+    Request request = { .operation = OP_COPY_ACTION_NAMES };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->copyActionNames(self->_ref, names);
+    requestEnd(&request, error);
+    return error;
 }
 
-/* ========
-    Private Member Implementations
-======== */
+static AXError copyActionDescription(AccessibleElement * self, CFStringRef name, CFStringRef * description) {
+    Request request = { .operation = OP_COPY_ACTION_DESCRIPTION, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->copyActionDescription(self->_ref, name, description);
+    requestEnd(&request, error);
+    return error;
+}
 
-static AccessibleElement * elementWithRef(AXUIElementRef * ref) {
-    AccessibleElement * self;
-    self = PyObject_New(AccessibleElement, &AccessibleElement_type);
-    if (self == NULL)
-        return NULL;
-    self->_ref = *ref;
-    self->_obs = NULL;
+static AXError performAction(AccessibleElement * self, CFStringRef name) {
+    Request request = { .operation = OP_PERFORM_ACTION, .attribute = name };
+    AXError error = beginRequest(self, &request);
+    if (error != kAXErrorSuccess) return error;
+    error = ax_backend->performAction(self->_ref, name);
+    requestEnd(&request, error);
+    return error;
+}
 
-    // Sets the pid, which should never change
-    pid_t pid;
-    AXError error = AXUIElementGetPid(*ref, &pid);
-    if (error == kAXErrorSuccess) {
-#if PY_MAJOR_VERSION >= 3
-        self->pid = PyLong_FromLong(pid);
-#else
-        self->pid = PyInt_FromLong(pid);
+static void NotifcationCallback(AXUIElementRef ref, CFStringRef notification, void * element) {
+    uint64_t dispatch_started = trace_enabled ? nanoTime() : 0;
+    uint64_t delivery_started = stats_enabled ? (dispatch_started ? dispatch_started : nanoTime()) : 0;
+#ifndef __APPLE__
+    // Our own run loops know when the notification was posted
+    if (delivery_started && AXCompatRunLoopGetPostTime() != 0) delivery_started = AXCompatRunLoopGetPostTime();
 #endif
+    // Inside run_loop() the waiting thread state is taken back (and put
+    // aside, as the callback holds it). Any other run loop, such as
+    // Quartz.CFRunLoopRun(), gets a new one for the interpreter that asked
+    // for the notifications, as poll watchers do: PyGILState_Ensure would
+    // only ever pick the main interpreter.
+    AccessibleElement * elem = (AccessibleElement *) element;
+    PyThreadState * loop_state = (PyThreadState *) pthread_getspecific(loop_key);
+    PyInterpreterState * interp = elem->_interp;
+    PyGILState_STATE gstate = PyGILState_LOCKED;
+    if (loop_state != NULL) {
+        PyEval_RestoreThread(loop_state);
+        pthread_setspecific(loop_key, NULL);
+    } else if (interp != NULL) {
+        PyEval_RestoreThread(PyThreadState_New(interp));
     } else {
-        self->pid = Py_None;
-        Py_INCREF(Py_None);
+        gstate = PyGILState_Ensure();
+    }
+    if (dispatch_started) {
+        // Named after whichever call took the GIL, as they cost differently
+        traceRecord(TRACE_CALLBACK, loop_state != NULL ? "PyEval_RestoreThread" : (interp != NULL ? "PyThreadState_New" : "PyGILState_Ensure"),
+                    NULL, -1, dispatch_started, nanoTime(), kAXErrorSuccess);
     }
 
-    // Set the callback to None for now
-    self->callback = Py_None;
-    Py_INCREF(Py_None);
-    
-    return self;
-}
+    AXError delivery_error = kAXErrorSuccess;
 
-static PyObject * parseCFTypeRef(const CFTypeRef value) {
-    PyObject * result = NULL;
+    // Hold on to the callback, in case another thread replaces it meanwhile
+    PyObject * callback;
+    Py_BEGIN_CRITICAL_SECTION(elem);
+    callback = elem->callback;
+    Py_INCREF(callback);
+    Py_END_CRITICAL_SECTION();
     
-    // Check what type the return is
-    if (CFGetTypeID(value) == CFStringGetTypeID()) {
-        
-        // The value is a CFStringRef, so try to decode it to a char *
-        CFIndex length = CFStringGetLength(value);
-        if (length == 0) { // Empty string
-            result = Py_None;
-        } else {
-            char * buffer = CFStringGetCStringPtr(value, kCFStringEncodingUTF8); // Fast way
-            if (!buffer) {
-                // Slow way
-                CFIndex maxSize = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8);
-                buffer = (char *) malloc(maxSize);
-                if (CFStringGetCString(value, buffer, maxSize, kCFStringEncodingUTF8)) {
-                    result = Py_BuildValue("s", buffer);
-                } else {
-                    PyErr_SetString(PyExc_TypeError, "The referenced string representation could not be parsed.");
-                }
-            } else {
-                result = Py_BuildValue("s", buffer);
-            }
-        }
-
-    } else if (CFGetTypeID(value) == CFBooleanGetTypeID()) {
-
-        // The value is a boolean, so get its value and return True/False
-        if (CFBooleanGetValue(value)) {
-            result = Py_True;
-        } else {
-            result = Py_False;
+    if (callback != Py_None) {
+        PyObject * args = PyTuple_New(0);
+        // Keyword names must be str on Python 3, so let Py_BuildValue decide
+        PyObject * kwargs = Py_BuildValue("{s:O,s:N}", "element", elem, "notification", parseCFTypeRef(typeState(Py_TYPE(elem)), notification));
+        uint64_t call_started = trace_enabled ? nanoTime() : 0;
+        PyObject * result = kwargs ? PyObject_Call(callback, args, kwargs) : NULL;
+        if (call_started) {
+            traceRecord(TRACE_CALLBACK, "PyObject_Call", NULL, elem->_pid, call_started, nanoTime(), result ? kAXErrorSuccess : kAXErrorFailure);
         }
+        // Any exception raised by the callback (or while building its
+        // arguments) is printed below rather than replaced
+        if (result == NULL) delivery_error = kAXErrorFailure;
+        Py_XDECREF(args);
+        Py_XDECREF(kwargs);
+        Py_XDECREF(result); 
+    } else {
+        delivery_error = kAXErrorFailure;
+        PyErr_SetString(PyExc_Exception, "No callback is defined to handle notifications. Be sure to make use of myelement.set_callback(func).");
+    }
 
-    } else if (CFGetTypeID(value) == AXUIElementGetTypeID()) {
+    Py_DECREF(callback);
 
-        // The value is another AXUIElementRef (probably a window...)
-        result = (PyObject *) elementWithRef((AXUIElementRef *) &value);
+    if (PyErr_Occurred() != NULL) {
+        PyErr_Print();
+    }
 
-    } else if (CFGetTypeID(value) == AXValueGetTypeID()) {
+    if (dispatch_started) {
+        traceRecord(TRACE_CALLBACK, "NotificationCallback", notification, elem->_pid, dispatch_started, nanoTime(), kAXErrorSuccess);
+    }
+    if (delivery_started && stats_enabled) {
+        statsRecord(OP_OBSERVER_CALLBACK, notification, elem->_pid, nanoTime() - delivery_started, delivery_error);
+    }
+    if (loop_state != NULL) {
+        pthread_setspecific(loop_key, loop_state);
+        PyEval_SaveThread();
+    } else if (interp != NULL) {
+        PyThreadState_Clear(PyThreadState_Get());
+        PyThreadState_DeleteCurrent();
+    } else {
+        PyGILState_Release(gstate);
+    }
+}
 
-        // The value is one of the AXValues
-        AXValueType value_type = AXValueGetType(value);
-        if (value_type == kAXValueCGPointType) {
-            
-            // It's a point
-            CGPoint point;
-            if (AXValueGetValue(value, kAXValueCGPointType, (void *) &point)) {
-                result = Py_BuildValue("ff", point.x, point.y);
-            } else {
-                PyErr_SetString(PyExc_ValueError, "The value cannot be retrieved.");
-                result = NULL;
-            }
-        } else if (value_type == kAXValueCGSizeType) {
-            
-            // It's a size
-            CGSize size;
-            if (AXValueGetValue(value, kAXValueCGSizeType, (void *) &size)) {
-                result = Py_BuildValue("ff", size.width, size.height);
-            } else {
-                PyErr_SetString(PyExc_ValueError, "The value cannot be retrieved.");
-                result = NULL;
-            }
-        } else if (value_type == kAXValueCGRectType) {
-            
-            // It's a rect
-            PyErr_SetString(PyExc_NotImplementedError, "Not all AXValue can yet be parsed.");
-            result = NULL;
-        } else {
-            
-            PyErr_SetString(PyExc_NotImplementedError, "Not all AXValue can yet be parsed.");
-            result = NULL;
+#ifndef __APPLE__
+
+static int checkConfigKeys(PyObject * dict, const char ** allowed, const char * what) {
+    PyObject * key;
+    PyObject * value;
+    Py_ssize_t position = 0;
+    while (PyDict_Next(dict, &position, &key, &value)) {
+        char * name = NULL;
+        if (!PyArg_Parse(key, "s", &name)) return -1;
+        const char ** candidate = allowed;
+        while (*candidate != NULL && strcmp(*candidate, name) != 0) candidate++;
+        if (*candidate == NULL) {
+            PyErr_Format(PyExc_ValueError, "Unknown %s setting '%s'.", what, name);
+            return -1;
         }
+    }
+    return 0;
+}
 
-    } else if (CFGetTypeID(value) == CFArrayGetTypeID()) {
+static int configDouble(PyObject * dict, const char * key, double * out) {
+    PyObject * value = PyDict_GetItemString(dict, key);
+    if (value == NULL) return 0;
+    double result = PyFloat_AsDouble(value);
+    if (result == -1 && PyErr_Occurred()) return -1;
+    *out = result;
+    return 0;
+}
 
-        // An array
-        if (CFArrayGetCount(value) <= 0) {
-            // Empty array
-            result = Py_None;
-        } else {
-            // It's an array... gonna have to do this recursively...
-            Py_ssize_t size = CFArrayGetCount(value);
-            PyObject * list = PyList_New(size);
-            if (!list) {
-                // Shouldn't happen
-                PyErr_SetString(PyExc_TypeError, "A list could not be created for the reference.");
-            } else {
-                for (CFIndex i = 0; i < CFArrayGetCount(value); i++) {
-                    PyObject * element = parseCFTypeRef(CFArrayGetValueAtIndex(value, i));
-                    PyList_SetItem(list, i, element);
-                }
-                result = list;
-            }
-        }
-    } else {
-        PyErr_SetString(PyExc_TypeError, "Unknown CFTypeRef type.");
+static int configInt(PyObject * dict, const char * key, int * out) {
+    double result = *out;
+    if (configDouble(dict, key, &result) == -1) return -1;
+    if (result < 0 || result > 2147483647.0) {
+        PyErr_Format(PyExc_ValueError, "The setting '%s' is out of range.", key);
+        return -1;
     }
-
-    return result;
+    *out = (int) result;
+    return 0;
 }
 
-static void handleAXErrors(const char * attribute_name, AXError error) {
-    switch(error) {
-        case kAXErrorCannotComplete:
-            PyErr_SetString(PyExc_Exception, formattedMessage("The request for %s could not be completed (perhaps the application is not responding?).", attribute_name));
-            break;
+static int parseSimulatedLatency(PyObject * spec, SimLatency * latency) {
+    if (!PyTuple_Check(spec)) {
+        latency->kind = SIM_LATENCY_FIXED;
+        latency->a = PyFloat_AsDouble(spec);
+        return (latency->a == -1 && PyErr_Occurred()) ? -1 : 0;
+    }
 
-        case kAXErrorAttributeUnsupported:
-            PyErr_SetString(PyExc_KeyError, formattedMessage("This element does not possess the attribute %s.", attribute_name));
-            break;
+    char * kind = NULL;
+    double a = 0, b = 0;
+    if (!PyArg_ParseTuple(spec, "sd|d", &kind, &a, &b))
+        return -1;
+
+    if (strcmp(kind, "fixed") == 0) latency->kind = SIM_LATENCY_FIXED;
+    else if (strcmp(kind, "uniform") == 0) latency->kind = SIM_LATENCY_UNIFORM;
+    else if (strcmp(kind, "exponential") == 0) latency->kind = SIM_LATENCY_EXPONENTIAL;
+    else if (strcmp(kind, "lognormal") == 0) latency->kind = SIM_LATENCY_LOGNORMAL;
+    else {
+        PyErr_Format(PyExc_ValueError, "Unknown latency distribution '%s'.", kind);
+        return -1;
+    }
+    latency->a = a;
+    latency->b = b;
+    return 0;
+}
 
-        case kAXErrorActionUnsupported:
-            PyErr_SetString(PyExc_KeyError, formattedMessage("This element does not support the action %s. Note: the system-wide element does not support ANY actions.", attribute_name));
-            break;
+static int parseSimulatedApplication(PyObject * spec, SimApplication * application) {
+    static const char * allowed[] = {"pid", "name", "windows", "nodes", "fanout", "text_length", "text",
+        "latency", "hang", "errors", "notification_rate", "notifications", NULL};
+    static const char * errors_allowed[] = {"cannot_complete", "invalid_element", "no_value", NULL};
 
-        case kAXErrorIllegalArgument:
-            PyErr_SetString(PyExc_ValueError, formattedMessage("Invalid argument. This is probably caused by a faulty AccessibleElement."));
-            break;
+    if (!PyDict_Check(spec)) {
+        PyErr_SetString(PyExc_TypeError, "Each simulated application must be described by a dictionary.");
+        return -1;
+    }
+    if (checkConfigKeys(spec, allowed, "application") == -1) return -1;
 
-        case kAXErrorNoValue:
-            PyErr_SetString(PyExc_ValueError, formattedMessage("The attribute %s has no value.", attribute_name));
-            break;
+    PyObject * pid = PyDict_GetItemString(spec, "pid");
+    if (pid == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Each simulated application needs a pid.");
+        return -1;
+    }
+    int pid_value = 0;
+    if (!PyArg_Parse(pid, "i", &pid_value)) return -1;
+    simulatedDefaultApplication(application, (pid_t) pid_value);
 
-        case kAXErrorInvalidUIElement:
-            PyErr_SetString(InvalidUIElementError, formattedMessage("This element is no longer valid (perhaps the application has been closed?)."));
-            break;
+    PyObject * name = PyDict_GetItemString(spec, "name");
+    if (name != NULL) {
+        char * name_string = NULL;
+        if (!PyArg_Parse(name, "s", &name_string)) return -1;
+        snprintf(application->name, sizeof(application->name), "%s", name_string);
+    }
 
-        case kAXErrorNotImplemented:
-            PyErr_SetString(PyExc_NotImplementedError, formattedMessage("This element does not implement the Accessibility API for the attribute %s.", attribute_name));
-            break;
+    PyObject * text = PyDict_GetItemString(spec, "text");
+    if (text != NULL) {
+        char * text_string = NULL;
+        if (!PyArg_Parse(text, "es", "utf-8", &text_string)) return -1;
+        size_t size = strlen(text_string);
+        if (size < sizeof(application->text)) memcpy(application->text, text_string, size + 1);
+        PyMem_Free(text_string);
+        if (size >= sizeof(application->text)) {
+            PyErr_SetString(PyExc_ValueError, "The text setting is too long.");
+            return -1;
+        }
+    }
 
-        case kAXErrorAPIDisabled:
-            PyErr_SetString(APIDisabledError, formattedMessage("This element does not respond to Accessibility requests -- perhaps Accessibility is not enabled on the system?"));
-            break;
+    if (configInt(spec, "windows", &application->windows) == -1
+            || configInt(spec, "nodes", &application->nodes) == -1
+            || configInt(spec, "fanout", &application->fanout) == -1
+            || configInt(spec, "text_length", &application->text_length) == -1
+            || configDouble(spec, "notification_rate", &application->notification_rate) == -1)
+        return -1;
+
+    PyObject * latency = PyDict_GetItemString(spec, "latency");
+    if (latency != NULL && parseSimulatedLatency(latency, &application->latency) == -1) return -1;
+
+    PyObject * hang = PyDict_GetItemString(spec, "hang");
+    if (hang != NULL && !PyArg_ParseTuple(hang, "dd", &application->latency.hang_probability, &application->latency.hang_duration))
+        return -1;
+
+    PyObject * errors = PyDict_GetItemString(spec, "errors");
+    if (errors != NULL) {
+        if (!PyDict_Check(errors)) {
+            PyErr_SetString(PyExc_TypeError, "The errors setting must be a dictionary.");
+            return -1;
+        }
+        if (checkConfigKeys(errors, errors_allowed, "error") == -1
+                || configDouble(errors, "cannot_complete", &application->cannot_complete) == -1
+                || configDouble(errors, "invalid_element", &application->invalid_element) == -1
+                || configDouble(errors, "no_value", &application->no_value) == -1)
+            return -1;
+    }
 
-        default:
-            PyErr_SetString(PyExc_Exception, formattedMessage("Error %ld encountered with attibute %s.", error, attribute_name));
-            break;
+    PyObject * notifications = PyDict_GetItemString(spec, "notifications");
+    if (notifications != NULL) {
+        PyObject * sequence = sequenceCopy(notifications, "The notifications setting must be a sequence of names.");
+        if (sequence == NULL) return -1;
+        Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+        int limit = (int) (sizeof(application->notifications) / sizeof(application->notifications[0]));
+        if (count > limit) {
+            PyErr_Format(PyExc_ValueError, "At most %d notification names can be given.", limit);
+            Py_DECREF(sequence);
+            return -1;
+        }
+        for (Py_ssize_t i = 0; i < count; i++) {
+            char * notification = NULL;
+            if (!PyArg_Parse(PySequence_Fast_GET_ITEM(sequence, i), "s", &notification)) {
+                Py_DECREF(sequence);
+                return -1;
+            }
+            snprintf(application->notifications[i], sizeof(application->notifications[i]), "%s", notification);
+        }
+        application->notification_count = (int) count;
+        Py_DECREF(sequence);
     }
+
+    return 0;
 }
 
-static void NotifcationCallback(AXObserverRef obs, AXUIElementRef ref, CFStringRef notification, void * element) {
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
+/*
+ * Fills in a SimConfig from the dictionary given to set_backend (or a single
+ * default application for None). The applications array is the caller's to
+ * free.
+ */
+static int parseSimulatedConfig(PyObject * spec, SimConfig * config) {
+    static const char * allowed[] = {"seed", "trusted", "queue_capacity", "applications", NULL};
+
+    memset(config, 0, sizeof(SimConfig));
+    config->trusted = 1;
 
-    AccessibleElement * elem = (AccessibleElement *) element;
-    
-    if (elem->callback != Py_None) {
-        PyObject * args = Py_BuildValue("()");
-        PyObject * kwargs = PyDict_New();
-#if PY_MAJOR_VERSION >= 3
-        PyObject * element_key = PyBytes_FromString("element");
-        PyObject * notification_key = PyBytes_FromString("notification");
-#else
-        PyObject * element_key = PyString_FromString("element");
-        PyObject * notification_key = PyString_FromString("notification");
-#endif
-        if (PyDict_SetItem(kwargs, element_key, elem) == -1) {
-            PyErr_SetString(PyExc_Warning, "The element could not be passed to the callback.");
+    PyObject * applications = NULL;
+    if (spec != Py_None) {
+        if (!PyDict_Check(spec)) {
+            PyErr_SetString(PyExc_TypeError, "The configuration must be a dictionary.");
+            return -1;
         }
+        if (checkConfigKeys(spec, allowed, "backend") == -1) return -1;
 
-        // The notification is a CFStringRef, so try to decode it to a char *
-        CFIndex length = CFStringGetLength(notification);
-        if (length == 0) {
-            if (PyDict_SetItem(kwargs, notification_key, Py_None) == -1) {
-                PyErr_SetString(PyExc_Warning, "The notification type passed to the callback could not be identified.");
-            } else {
-                Py_INCREF(Py_None);
-            }
-        } else { // Non-empty string
-            char * buffer = CFStringGetCStringPtr(notification, kCFStringEncodingUTF8); // Fast way
-            if (!buffer) {
-                // Slow way
-                CFIndex maxSize = CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8);
-                buffer = (char *) malloc(maxSize);
-                if (CFStringGetCString(notification, buffer, maxSize, kCFStringEncodingUTF8)) {
+        PyObject * seed = PyDict_GetItemString(spec, "seed");
+        if (seed != NULL) {
 #if PY_MAJOR_VERSION >= 3
-                    PyObject * buffer_value = PyBytes_FromString(buffer);
+            unsigned long long seed_value = PyLong_AsUnsignedLongLongMask(seed);
 #else
-                    PyObject * buffer_value = PyString_FromString(buffer);
+            unsigned long long seed_value = PyInt_AsUnsignedLongLongMask(seed);
 #endif
-                    if (PyDict_SetItem(kwargs, notification_key, buffer_value) == -1) {
-                        PyErr_SetString(PyExc_Warning, "The callback could not be constructed.");
-                    }
-                } else {
-                    if (PyDict_SetItem(kwargs, notification_key, Py_None) == -1) {
-                        PyErr_SetString(PyExc_Warning, "The notification type passed to the callback could not be identified.");
-                    } else {
-                        Py_INCREF(Py_None);
-                    }
-                }
-            } else {
-#if PY_MAJOR_VERSION >= 3
-                PyObject * buffer_value = PyBytes_FromString(buffer);
-#else
-                PyObject * buffer_value = PyString_FromString(buffer);
-#endif
-                if (PyDict_SetItem(kwargs, notification_key, buffer_value) == -1) {
-                    PyErr_SetString(PyExc_Warning, "The callback could not be constructed.");
-                }
+            if (PyErr_Occurred()) return -1;
+            config->seed = (uint64_t) seed_value;
+        }
+
+        PyObject * trusted = PyDict_GetItemString(spec, "trusted");
+        if (trusted != NULL) {
+            config->trusted = PyObject_IsTrue(trusted);
+            if (config->trusted == -1) return -1;
+        }
+
+        if (configInt(spec, "queue_capacity", &config->queue_capacity) == -1) return -1;
+
+        applications = PyDict_GetItemString(spec, "applications");
+    }
+
+    if (applications == NULL) {
+        config->application_count = 1;
+        config->applications = malloc(sizeof(SimApplication));
+        if (config->applications == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        simulatedDefaultApplication(config->applications, SIMULATED_DEFAULT_PID);
+        return 0;
+    }
+
+    PyObject * sequence = sequenceCopy(applications, "The applications setting must be a sequence of dictionaries.");
+    if (sequence == NULL) return -1;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+    config->applications = calloc(count > 0 ? (size_t) count : 1, sizeof(SimApplication));
+    if (config->applications == NULL) {
+        Py_DECREF(sequence);
+        PyErr_NoMemory();
+        return -1;
+    }
+    config->application_count = (int) count;
+
+    for (Py_ssize_t i = 0; i < count; i++) {
+        int failed = parseSimulatedApplication(PySequence_Fast_GET_ITEM(sequence, i), &config->applications[i]);
+        for (Py_ssize_t j = 0; !failed && j < i; j++) {
+            if (config->applications[j].pid == config->applications[i].pid) {
+                PyErr_Format(PyExc_ValueError, "More than one simulated application has the pid %d.", (int) config->applications[i].pid);
+                failed = -1;
             }
         }
-        PyObject * result = PyObject_Call(elem->callback, args, kwargs);
-        if (result == NULL) {
-            PyErr_SetString(PyExc_Warning, "The callback could not be completed.");
+        if (failed) {
+            Py_DECREF(sequence);
+            free(config->applications);
+            config->applications = NULL;
+            return -1;
         }
-        Py_XDECREF(args);
-        Py_XDECREF(kwargs);
-        Py_XDECREF(result); 
-    } else {
-        PyErr_SetString(PyExc_Exception, "No callback is defined to handle notifications. Be sure to make use of myelement.set_callback(func).");
     }
+    Py_DECREF(sequence);
+    return 0;
+}
+
+static int parseReplayConfig(PyObject * spec, char ** path, double * speed) {
+    static const char * allowed[] = {"path", "speed", NULL};
+
+    if (spec == Py_None || !PyDict_Check(spec)) {
+        PyErr_SetString(PyExc_TypeError, "The replay backend needs a configuration dictionary with a path.");
+        return -1;
+    }
+    if (checkConfigKeys(spec, allowed, "backend") == -1) return -1;
 
-    if (PyErr_Occurred() != NULL) {
-        PyErr_Print();
+    PyObject * path_object = PyDict_GetItemString(spec, "path");
+    if (path_object == NULL) {
+        PyErr_SetString(PyExc_ValueError, "The replay backend needs the path of a session log.");
+        return -1;
     }
+    if (!PyArg_Parse(path_object, "s", path)) return -1;
 
-    PyGILState_Release(gstate);
+    if (configDouble(spec, "speed", speed) == -1) return -1;
+    if (*speed < 0) {
+        PyErr_SetString(PyExc_ValueError, "The replay speed must not be negative.");
+        return -1;
+    }
+    return 0;
 }
+
+#endif
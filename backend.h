@@ -0,0 +1,176 @@
+/*
+ * The Accessibility API as the module sees it. Every call the module makes
+ * into HIServices goes through the active backend, so that the real API can
+ * be swapped for a simulated one (which is the only option on platforms
+ * without HIServices).
+ *
+ * Backends must accept references created by other backends and reject them
+ * with kAXErrorInvalidUIElement rather than crash, since elements created
+ * before a switch can outlive it.
+ */
+
+#ifndef ACCESSIBILITY_BACKEND_H
+#define ACCESSIBILITY_BACKEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <Accessibility.h>
+
+typedef struct {
+    const char * name;
+
+    AXUIElementRef (*createApplication)(pid_t pid);
+    AXUIElementRef (*createSystemWide)(void);
+    Boolean (*processExists)(pid_t pid);
+    Boolean (*isProcessTrusted)(CFDictionaryRef options);
+
+    AXError (*copyAttributeValue)(AXUIElementRef element, CFStringRef attribute, CFTypeRef * value);
+    AXError (*copyMultipleAttributeValues)(AXUIElementRef element, CFArrayRef attributes, AXCopyMultipleAttributeOptions options, CFArrayRef * values);
+    AXError (*copyParameterizedAttributeValue)(AXUIElementRef element, CFStringRef attribute, CFTypeRef parameter, CFTypeRef * value);
+    AXError (*copyAttributeNames)(AXUIElementRef element, CFArrayRef * names);
+    AXError (*getAttributeValueCount)(AXUIElementRef element, CFStringRef attribute, CFIndex * count);
+    AXError (*isAttributeSettable)(AXUIElementRef element, CFStringRef attribute, Boolean * settable);
+    AXError (*setAttributeValue)(AXUIElementRef element, CFStringRef attribute, CFTypeRef value);
+    AXError (*copyActionNames)(AXUIElementRef element, CFArrayRef * names);
+    AXError (*copyActionDescription)(AXUIElementRef element, CFStringRef action, CFStringRef * description);
+    AXError (*performAction)(AXUIElementRef element, CFStringRef action);
+    AXError (*copyElementAtPosition)(AXUIElementRef element, float x, float y, AXUIElementRef * result);
+    AXError (*getPid)(AXUIElementRef element, pid_t * pid);
+    AXError (*setMessagingTimeout)(AXUIElementRef element, float timeout);
+
+    AXError (*observerCreate)(pid_t pid, AXObserverCallback callback, AXObserverRef * observer);
+    AXError (*observerAddNotification)(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon);
+    AXError (*observerRemoveNotification)(AXObserverRef observer, AXUIElementRef element, CFStringRef notification);
+    CFRunLoopSourceRef (*observerGetRunLoopSource)(AXObserverRef observer);
+} AXBackend;
+
+/* Recording backend
+======== */
+
+/*
+ * Passes every call through to another backend while appending it, with its
+ * response, latency and the notifications delivered, to a session log (see
+ * recording.h).
+ */
+extern const AXBackend recording_backend;
+
+/*
+ * Starts recording calls to backend into a new log at path. Returns 0, or an
+ * errno value if the log could not be created (EBUSY if already recording).
+ */
+int recordingStart(const AXBackend * backend, const char * path);
+
+/*
+ * Stops recording and closes the log, returning how many calls it holds, or
+ * -1 if not recording or if the log could not be written in full.
+ */
+long recordingStop(void);
+
+// The backend being recorded, or NULL if not recording.
+const AXBackend * recordingInner(void);
+
+#ifdef __APPLE__
+extern const AXBackend hiservices_backend;
+#else
+
+/* Simulated backend
+======== */
+
+typedef enum {
+    SIM_LATENCY_FIXED,
+    SIM_LATENCY_UNIFORM,
+    SIM_LATENCY_EXPONENTIAL,
+    SIM_LATENCY_LOGNORMAL
+} SimLatencyKind;
+
+/*
+ * Per-call latency in seconds: fixed (a), uniform on [a, b), exponential
+ * with mean a, or lognormal with median a and shape b. With the given
+ * probability a call hangs for hang_duration instead, as a busy application
+ * does; either way calls give up with kAXErrorCannotComplete once they
+ * exceed the element's messaging timeout.
+ */
+typedef struct {
+    SimLatencyKind kind;
+    double a;
+    double b;
+    double hang_probability;
+    double hang_duration;
+} SimLatency;
+
+typedef struct {
+    pid_t pid;
+    char name[64];
+    int windows;
+    int nodes;
+    int fanout;
+    int text_length;
+    char text[64]; // repeated in text values instead of random words, if set
+    SimLatency latency;
+
+    // Probability that any one call fails with the given error.
+    double cannot_complete;
+    double invalid_element;
+    double no_value;
+
+    // Notifications are posted at random to registered observers as a
+    // Poisson process with this rate (per second), optionally restricted to
+    // the given names.
+    double notification_rate;
+    int notification_count;
+    char notifications[16][64];
+} SimApplication;
+
+typedef struct {
+    uint64_t seed;
+    int trusted;
+    int queue_capacity; // per run loop created afterwards; 0 for the default
+    int application_count;
+    SimApplication * applications;
+} SimConfig;
+
+extern const AXBackend simulated_backend;
+
+/*
+ * Replaces the simulated world with a new one built from config, which is
+ * copied. Elements from the previous world become invalid. Returns 0 on
+ * success and -1 if memory ran out.
+ */
+int simulatedConfigure(const SimConfig * config);
+void simulatedDefaultApplication(SimApplication * application, pid_t pid);
+
+/*
+ * Posts count notifications on behalf of the element to every observer
+ * registered for it, returning how many were queued (-1 if the element is
+ * not part of the simulated world).
+ */
+long simulatedPostNotification(AXUIElementRef element, CFStringRef notification, long count);
+
+/* Replay backend
+======== */
+
+extern const AXBackend replay_backend;
+
+typedef struct {
+    uint64_t calls;         // recorded in the log
+    uint64_t notifications; // recorded in the log
+    double duration;        // of the recording, in seconds
+    uint64_t hits;          // requests answered from the log
+    uint64_t misses;        // requests the log has no answer to
+    uint64_t posted;        // notifications delivered to observers
+    uint64_t unheard;       // notifications nobody was registered for
+} ReplayInfo;
+
+/*
+ * Serves the session log at path, replacing any log being served; elements
+ * from that become invalid. Speed scales the recorded timing, and 0 replays
+ * as fast as possible. Returns 0, or -1 with a message if the log could not
+ * be read.
+ */
+int replayOpen(const char * path, double speed, char * message, size_t message_size);
+void replayClose(void);
+void replayGetInfo(ReplayInfo * info);
+
+#endif
+
+#endif /* ACCESSIBILITY_BACKEND_H */
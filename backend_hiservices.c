@@ -0,0 +1,53 @@
+/*
+ * The real thing: forwards every call to HIServices unchanged.
+ */
+
+#include <signal.h>
+#include <errno.h>
+#include "backend.h"
+
+static Boolean processExists(pid_t pid) {
+    // A signal of 0 only checks that the process still exists
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+static Boolean isProcessTrusted(CFDictionaryRef options) {
+#if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_9
+    return AXIsProcessTrustedWithOptions(options);
+#else
+    return AXIsProcessTrusted();
+#endif
+}
+
+static AXError copyElementAtPosition(AXUIElementRef element, float x, float y, AXUIElementRef * result) {
+    return AXUIElementCopyElementAtPosition(element, x, y, result);
+}
+
+static AXError observerCreate(pid_t pid, AXObserverCallback callback, AXObserverRef * observer) {
+    return AXObserverCreate(pid, callback, observer);
+}
+
+const AXBackend hiservices_backend = {
+    "hiservices",
+    AXUIElementCreateApplication,
+    AXUIElementCreateSystemWide,
+    processExists,
+    isProcessTrusted,
+    AXUIElementCopyAttributeValue,
+    AXUIElementCopyMultipleAttributeValues,
+    AXUIElementCopyParameterizedAttributeValue,
+    AXUIElementCopyAttributeNames,
+    AXUIElementGetAttributeValueCount,
+    AXUIElementIsAttributeSettable,
+    AXUIElementSetAttributeValue,
+    AXUIElementCopyActionNames,
+    AXUIElementCopyActionDescription,
+    AXUIElementPerformAction,
+    copyElementAtPosition,
+    AXUIElementGetPid,
+    AXUIElementSetMessagingTimeout,
+    observerCreate,
+    AXObserverAddNotification,
+    AXObserverRemoveNotification,
+    AXObserverGetRunLoopSource
+};
@@ -0,0 +1,728 @@
+/*
+ * Wraps another backend, passing every call through unchanged while logging
+ * the request, its result and how long it took, along with every
+ * notification delivered, in the format described in recording.h.
+ *
+ * Elements and names are given small ids the first time they are seen. An
+ * element's kind (application, system-wide or other) is worked out by
+ * comparing it with the application element of its pid, so that a replay can
+ * hand out the same elements from create_application_ref.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "backend.h"
+#include "recording.h"
+
+typedef struct {
+    CFTypeRef key; // retained
+    uint32_t id;
+} RecordingEntry;
+
+typedef struct {
+    RecordingEntry * entries;
+    size_t capacity; // a power of two, or 0
+    size_t count;
+} RecordingTable;
+
+typedef struct {
+    pid_t pid;
+    AXUIElementRef application;
+} RecordingApplication;
+
+typedef struct {
+    AXObserverRef observer; // weak; only compared
+    uint32_t element;
+    uint32_t notification;
+} RecordingRegistration;
+
+static pthread_mutex_t recording_lock = PTHREAD_MUTEX_INITIALIZER;
+static const AXBackend * inner = NULL;
+static FILE * recording_file = NULL;
+static int recording_failed;
+static uint64_t recording_started;
+static uint64_t recording_calls;
+
+static LogBuffer record;
+static LogBuffer definition;
+static RecordingTable elements;
+static RecordingTable names;
+static uint32_t element_count;
+static uint32_t name_count;
+
+static AXUIElementRef system_wide;
+static RecordingApplication * applications;
+static int application_count;
+static int application_capacity;
+
+static RecordingRegistration * registrations;
+static int registration_count;
+static int registration_capacity;
+
+// The module only ever uses one callback; observers created while recording
+// get ours instead, which logs and then calls it.
+static AXObserverCallback observer_callback;
+
+static uint64_t recordingNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+void logReserve(LogBuffer * buffer, size_t extra) {
+    if (buffer->failed || buffer->length + extra <= buffer->capacity) return;
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    uint8_t * grown = realloc(buffer->bytes, capacity);
+    if (grown == NULL) {
+        buffer->failed = 1;
+        return;
+    }
+    buffer->bytes = grown;
+    buffer->capacity = capacity;
+}
+
+/* Writing
+======== */
+
+// Expects recording_lock to be held.
+static void recordingWrite(LogRecordType type, LogBuffer * payload) {
+    if (recording_file == NULL || recording_failed) return;
+    if (payload->failed) {
+        recording_failed = 1;
+        return;
+    }
+
+    uint8_t header[11];
+    size_t length = 0;
+    header[length++] = (uint8_t) type;
+    uint64_t size = payload->length;
+    while (size >= 0x80) {
+        header[length++] = (uint8_t) (size | 0x80);
+        size >>= 7;
+    }
+    header[length++] = (uint8_t) size;
+
+    if (fwrite(header, 1, length, recording_file) != length
+            || fwrite(payload->bytes, 1, payload->length, recording_file) != payload->length)
+        recording_failed = 1;
+}
+
+/* Ids
+======== */
+
+static RecordingEntry * recordingFind(RecordingTable * table, CFTypeRef key) {
+    size_t mask = table->capacity - 1;
+    size_t index = (size_t) CFHash(key) & mask;
+    while (table->entries[index].key != NULL && !CFEqual(table->entries[index].key, key)) {
+        index = (index + 1) & mask;
+    }
+    return &table->entries[index];
+}
+
+/*
+ * Returns the id of key, or 0 if it is new, in which case it is added with
+ * the given id. Also returns 0 (having added nothing) if memory ran out.
+ */
+static uint32_t recordingIntern(RecordingTable * table, CFTypeRef key, uint32_t id) {
+    if (table->count * 2 >= table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 64;
+        RecordingEntry * entries = calloc(capacity, sizeof(RecordingEntry));
+        if (entries == NULL) {
+            recording_failed = 1;
+            return 0;
+        }
+        RecordingTable grown = { entries, capacity, table->count };
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key != NULL) *recordingFind(&grown, table->entries[i].key) = table->entries[i];
+        }
+        free(table->entries);
+        *table = grown;
+    }
+
+    RecordingEntry * entry = recordingFind(table, key);
+    if (entry->key != NULL) return entry->id;
+    entry->key = CFRetain(key);
+    entry->id = id;
+    table->count++;
+    return 0;
+}
+
+static void recordingTableClear(RecordingTable * table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key != NULL) CFRelease(table->entries[i].key);
+    }
+    free(table->entries);
+    memset(table, 0, sizeof(RecordingTable));
+}
+
+/*
+ * Returns the UTF-8 bytes of a string, either borrowed from it (leaving *copy
+ * NULL) or in a copy for the caller to free.
+ */
+static const char * recordingUTF8(CFStringRef string, char ** copy) {
+    *copy = NULL;
+    const char * bytes = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+    if (bytes != NULL) return bytes;
+
+    CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+    *copy = malloc(size);
+    if (*copy == NULL || !CFStringGetCString(string, *copy, size, kCFStringEncodingUTF8)) return "";
+    return *copy;
+}
+
+static void recordingString(LogBuffer * buffer, CFStringRef string) {
+    char * copy;
+    const char * bytes = recordingUTF8(string, &copy);
+    size_t length = strlen(bytes);
+    logVarint(buffer, length);
+    logBytes(buffer, bytes, length);
+    free(copy);
+}
+
+// Expects recording_lock to be held. Returns 0 for NULL.
+static uint32_t recordingName(CFStringRef name) {
+    if (name == NULL) return 0;
+    uint32_t id = recordingIntern(&names, name, name_count + 1);
+    if (id != 0 || recording_failed) return id;
+
+    id = ++name_count;
+    char * copy;
+    const char * bytes = recordingUTF8(name, &copy);
+    definition.length = 0;
+    logVarint(&definition, id);
+    logBytes(&definition, bytes, strlen(bytes));
+    free(copy);
+    recordingWrite(LOG_STRING, &definition);
+    return id;
+}
+
+// Expects recording_lock to be held.
+static LogElementKind recordingKind(AXUIElementRef element, pid_t pid) {
+    if (system_wide != NULL && CFEqual(element, system_wide)) return LOG_ELEMENT_SYSTEM_WIDE;
+    if (pid < 0) return LOG_ELEMENT_OTHER;
+
+    AXUIElementRef application = NULL;
+    for (int i = 0; i < application_count; i++) {
+        if (applications[i].pid == pid) application = applications[i].application;
+    }
+    if (application == NULL) {
+        application = inner->createApplication(pid);
+        if (application == NULL) return LOG_ELEMENT_OTHER;
+        if (application_count == application_capacity) {
+            int capacity = application_capacity ? application_capacity * 2 : 16;
+            RecordingApplication * grown = realloc(applications, sizeof(RecordingApplication) * capacity);
+            if (grown == NULL) {
+                CFRelease(application);
+                return LOG_ELEMENT_OTHER;
+            }
+            applications = grown;
+            application_capacity = capacity;
+        }
+        applications[application_count].pid = pid;
+        applications[application_count].application = application;
+        application_count++;
+    }
+    return CFEqual(element, application) ? LOG_ELEMENT_APPLICATION : LOG_ELEMENT_OTHER;
+}
+
+// Expects recording_lock to be held. Returns 0 for NULL.
+static uint32_t recordingElement(AXUIElementRef element) {
+    if (element == NULL) return 0;
+    uint32_t id = recordingIntern(&elements, element, element_count + 1);
+    if (id != 0 || recording_failed) return id;
+
+    id = ++element_count;
+    pid_t pid;
+    if (inner->getPid(element, &pid) != kAXErrorSuccess) pid = -1;
+    definition.length = 0;
+    logVarint(&definition, id);
+    logSigned(&definition, pid);
+    logByte(&definition, (uint8_t) recordingKind(element, pid));
+    recordingWrite(LOG_ELEMENT, &definition);
+    return id;
+}
+
+/* Values
+======== */
+
+// Expects recording_lock to be held (elements get ids as they are seen).
+static void recordingValue(LogBuffer * buffer, CFTypeRef value, int depth) {
+    if (value == NULL || depth > LOG_MAX_DEPTH) {
+        logByte(buffer, LOG_VALUE_NONE);
+        return;
+    }
+
+    CFTypeID type = CFGetTypeID(value);
+    if (type == CFStringGetTypeID()) {
+        logByte(buffer, LOG_VALUE_STRING);
+        recordingString(buffer, (CFStringRef) value);
+    } else if (type == CFBooleanGetTypeID()) {
+        logByte(buffer, CFBooleanGetValue((CFBooleanRef) value) ? LOG_VALUE_TRUE : LOG_VALUE_FALSE);
+    } else if (type == CFNumberGetTypeID()) {
+        if (CFNumberIsFloatType((CFNumberRef) value)) {
+            double real = 0;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberDoubleType, &real);
+            logByte(buffer, LOG_VALUE_REAL);
+            logReal(buffer, real);
+        } else {
+            long long integer = 0;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberLongLongType, &integer);
+            logByte(buffer, LOG_VALUE_INTEGER);
+            logSigned(buffer, integer);
+        }
+    } else if (type == AXUIElementGetTypeID()) {
+        logByte(buffer, LOG_VALUE_ELEMENT);
+        logVarint(buffer, recordingElement((AXUIElementRef) value));
+    } else if (type == CFArrayGetTypeID()) {
+        CFIndex count = CFArrayGetCount((CFArrayRef) value);
+        logByte(buffer, LOG_VALUE_ARRAY);
+        logVarint(buffer, (uint64_t) count);
+        for (CFIndex i = 0; i < count; i++) {
+            recordingValue(buffer, CFArrayGetValueAtIndex((CFArrayRef) value, i), depth + 1);
+        }
+    } else if (type == CFDictionaryGetTypeID()) {
+        CFIndex count = CFDictionaryGetCount((CFDictionaryRef) value);
+        const void ** keys = malloc(sizeof(void *) * (count > 0 ? count : 1) * 2);
+        if (keys == NULL) {
+            buffer->failed = 1;
+            return;
+        }
+        const void ** values = keys + count;
+        CFDictionaryGetKeysAndValues((CFDictionaryRef) value, keys, values);
+        logByte(buffer, LOG_VALUE_DICTIONARY);
+        logVarint(buffer, (uint64_t) count);
+        for (CFIndex i = 0; i < count; i++) {
+            recordingValue(buffer, keys[i], depth + 1);
+            recordingValue(buffer, values[i], depth + 1);
+        }
+        free(keys);
+    } else if (type == CFURLGetTypeID()) {
+        logByte(buffer, LOG_VALUE_URL);
+        recordingString(buffer, CFURLGetString((CFURLRef) value));
+    } else if (type == CFAttributedStringGetTypeID()) {
+        logByte(buffer, LOG_VALUE_ATTRIBUTED);
+        recordingString(buffer, CFAttributedStringGetString((CFAttributedStringRef) value));
+    } else if (type == AXValueGetTypeID()) {
+        AXValueType value_type = AXValueGetType((AXValueRef) value);
+        if (value_type == kAXValueCGPointType) {
+            CGPoint point;
+            AXValueGetValue((AXValueRef) value, kAXValueCGPointType, &point);
+            logByte(buffer, LOG_VALUE_POINT);
+            logReal(buffer, point.x);
+            logReal(buffer, point.y);
+        } else if (value_type == kAXValueCGSizeType) {
+            CGSize size;
+            AXValueGetValue((AXValueRef) value, kAXValueCGSizeType, &size);
+            logByte(buffer, LOG_VALUE_SIZE);
+            logReal(buffer, size.width);
+            logReal(buffer, size.height);
+        } else if (value_type == kAXValueCGRectType) {
+            CGRect rect;
+            AXValueGetValue((AXValueRef) value, kAXValueCGRectType, &rect);
+            logByte(buffer, LOG_VALUE_RECT);
+            logReal(buffer, rect.origin.x);
+            logReal(buffer, rect.origin.y);
+            logReal(buffer, rect.size.width);
+            logReal(buffer, rect.size.height);
+        } else if (value_type == kAXValueCFRangeType) {
+            CFRange range;
+            AXValueGetValue((AXValueRef) value, kAXValueCFRangeType, &range);
+            logByte(buffer, LOG_VALUE_RANGE);
+            logSigned(buffer, range.location);
+            logSigned(buffer, range.length);
+        } else if (value_type == kAXValueAXErrorType) {
+            AXError error;
+            AXValueGetValue((AXValueRef) value, kAXValueAXErrorType, &error);
+            logByte(buffer, LOG_VALUE_AXERROR);
+            logSigned(buffer, error);
+        } else {
+            logByte(buffer, LOG_VALUE_NONE);
+        }
+    } else {
+        logByte(buffer, LOG_VALUE_NONE);
+    }
+}
+
+/* Calls
+======== */
+
+/*
+ * Starts the record of a call, leaving recording_lock held, and returns 1; or
+ * returns 0 if nothing is being recorded. Finish with recordingEnd.
+ */
+static int recordingBegin(LogOperation operation, uint64_t started, uint64_t finished, AXUIElementRef element, CFStringRef name, AXError error) {
+    pthread_mutex_lock(&recording_lock);
+    if (recording_file == NULL || recording_failed) {
+        pthread_mutex_unlock(&recording_lock);
+        return 0;
+    }
+
+    // Ids first, since they may write definitions of their own
+    uint32_t element_id = recordingElement(element);
+    uint32_t name_id = recordingName(name);
+
+    record.length = 0;
+    logVarint(&record, operation);
+    logVarint(&record, started > recording_started ? started - recording_started : 0);
+    logVarint(&record, finished - started);
+    logVarint(&record, element_id);
+    logVarint(&record, name_id);
+    logSigned(&record, error);
+    return 1;
+}
+
+static void recordingEnd(void) {
+    recordingWrite(LOG_CALL, &record);
+    recording_calls++;
+    pthread_mutex_unlock(&recording_lock);
+}
+
+static AXUIElementRef recordingCreateApplication(pid_t pid) {
+    return inner->createApplication(pid);
+}
+
+static AXUIElementRef recordingCreateSystemWide(void) {
+    return inner->createSystemWide();
+}
+
+static Boolean recordingProcessExists(pid_t pid) {
+    return inner->processExists(pid);
+}
+
+static Boolean recordingIsProcessTrusted(CFDictionaryRef options) {
+    return inner->isProcessTrusted(options);
+}
+
+static AXError recordingCopyAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef * value) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyAttributeValue(element, attribute, value);
+    if (recordingBegin(LOG_COPY_ATTRIBUTE_VALUE, started, recordingNow(), element, attribute, error)) {
+        if (error == kAXErrorSuccess) recordingValue(&record, *value, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyMultipleAttributeValues(AXUIElementRef element, CFArrayRef attributes, AXCopyMultipleAttributeOptions options, CFArrayRef * values) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyMultipleAttributeValues(element, attributes, options, values);
+    if (recordingBegin(LOG_COPY_MULTIPLE_ATTRIBUTE_VALUES, started, recordingNow(), element, NULL, error)) {
+        CFIndex count = CFArrayGetCount(attributes);
+        logVarint(&record, (uint64_t) count);
+        for (CFIndex i = 0; i < count; i++)
+            logVarint(&record, recordingName(CFArrayGetValueAtIndex(attributes, i)));
+        logByte(&record, (uint8_t) options);
+        if (error == kAXErrorSuccess) recordingValue(&record, *values, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyParameterizedAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef parameter, CFTypeRef * value) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyParameterizedAttributeValue(element, attribute, parameter, value);
+    if (recordingBegin(LOG_COPY_PARAMETERIZED_ATTRIBUTE_VALUE, started, recordingNow(), element, attribute, error)) {
+        recordingValue(&record, parameter, 0);
+        if (error == kAXErrorSuccess) recordingValue(&record, *value, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyAttributeNames(AXUIElementRef element, CFArrayRef * names) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyAttributeNames(element, names);
+    if (recordingBegin(LOG_COPY_ATTRIBUTE_NAMES, started, recordingNow(), element, NULL, error)) {
+        if (error == kAXErrorSuccess) recordingValue(&record, *names, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingGetAttributeValueCount(AXUIElementRef element, CFStringRef attribute, CFIndex * count) {
+    uint64_t started = recordingNow();
+    AXError error = inner->getAttributeValueCount(element, attribute, count);
+    if (recordingBegin(LOG_GET_ATTRIBUTE_VALUE_COUNT, started, recordingNow(), element, attribute, error)) {
+        if (error == kAXErrorSuccess) logVarint(&record, (uint64_t) *count);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingIsAttributeSettable(AXUIElementRef element, CFStringRef attribute, Boolean * settable) {
+    uint64_t started = recordingNow();
+    AXError error = inner->isAttributeSettable(element, attribute, settable);
+    if (recordingBegin(LOG_IS_ATTRIBUTE_SETTABLE, started, recordingNow(), element, attribute, error)) {
+        if (error == kAXErrorSuccess) logByte(&record, *settable ? 1 : 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingSetAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef value) {
+    uint64_t started = recordingNow();
+    AXError error = inner->setAttributeValue(element, attribute, value);
+    if (recordingBegin(LOG_SET_ATTRIBUTE_VALUE, started, recordingNow(), element, attribute, error)) {
+        recordingValue(&record, value, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyActionNames(AXUIElementRef element, CFArrayRef * names) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyActionNames(element, names);
+    if (recordingBegin(LOG_COPY_ACTION_NAMES, started, recordingNow(), element, NULL, error)) {
+        if (error == kAXErrorSuccess) recordingValue(&record, *names, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyActionDescription(AXUIElementRef element, CFStringRef action, CFStringRef * description) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyActionDescription(element, action, description);
+    if (recordingBegin(LOG_COPY_ACTION_DESCRIPTION, started, recordingNow(), element, action, error)) {
+        if (error == kAXErrorSuccess) recordingValue(&record, *description, 0);
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingPerformAction(AXUIElementRef element, CFStringRef action) {
+    uint64_t started = recordingNow();
+    AXError error = inner->performAction(element, action);
+    if (recordingBegin(LOG_PERFORM_ACTION, started, recordingNow(), element, action, error)) {
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingCopyElementAtPosition(AXUIElementRef element, float x, float y, AXUIElementRef * result) {
+    uint64_t started = recordingNow();
+    AXError error = inner->copyElementAtPosition(element, x, y, result);
+    if (recordingBegin(LOG_COPY_ELEMENT_AT_POSITION, started, recordingNow(), element, NULL, error)) {
+        logFloat(&record, x);
+        logFloat(&record, y);
+        if (error == kAXErrorSuccess) logVarint(&record, recordingElement(*result));
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingGetPid(AXUIElementRef element, pid_t * pid) {
+    return inner->getPid(element, pid);
+}
+
+static AXError recordingSetMessagingTimeout(AXUIElementRef element, float timeout) {
+    return inner->setMessagingTimeout(element, timeout);
+}
+
+/* Observers
+======== */
+
+static void recordingCallback(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    uint64_t now = recordingNow();
+    pthread_mutex_lock(&recording_lock);
+    if (recording_file != NULL && !recording_failed) {
+        uint32_t element_id = recordingElement(element);
+        uint32_t name_id = recordingName(notification);
+
+        // Notifications about descendants arrive for the registration of an
+        // ancestor (usually the application), which the replay must post to
+        uint32_t target = 0;
+        for (int i = 0; i < registration_count; i++) {
+            RecordingRegistration * registration = &registrations[i];
+            if (registration->observer != observer || registration->notification != name_id) continue;
+            if (target == 0 || registration->element == element_id) target = registration->element;
+        }
+
+        pid_t pid;
+        if (inner->getPid(element, &pid) != kAXErrorSuccess) pid = -1;
+        record.length = 0;
+        logVarint(&record, now > recording_started ? now - recording_started : 0);
+        logVarint(&record, target ? target : element_id);
+        logVarint(&record, element_id);
+        logVarint(&record, name_id);
+        logSigned(&record, pid);
+        logVarint(&record, recording_calls);
+        recordingWrite(LOG_NOTIFICATION, &record);
+    }
+    AXObserverCallback callback = observer_callback;
+    pthread_mutex_unlock(&recording_lock);
+
+    if (callback != NULL) callback(observer, element, notification, refcon);
+}
+
+static AXError recordingObserverCreate(pid_t pid, AXObserverCallback callback, AXObserverRef * observer) {
+    pthread_mutex_lock(&recording_lock);
+    observer_callback = callback;
+    pthread_mutex_unlock(&recording_lock);
+
+    AXError error = inner->observerCreate(pid, recordingCallback, observer);
+    if (error == kAXErrorSuccess) {
+        // Whatever was registered at this address belonged to a dead observer
+        pthread_mutex_lock(&recording_lock);
+        for (int i = 0; i < registration_count; ) {
+            if (registrations[i].observer == *observer) registrations[i] = registrations[--registration_count];
+            else i++;
+        }
+        pthread_mutex_unlock(&recording_lock);
+    }
+    return error;
+}
+
+static AXError recordingObserverAddNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    uint64_t started = recordingNow();
+    AXError error = inner->observerAddNotification(observer, element, notification, refcon);
+    if (recordingBegin(LOG_OBSERVER_ADD_NOTIFICATION, started, recordingNow(), element, notification, error)) {
+        if (error == kAXErrorSuccess) {
+            if (registration_count == registration_capacity) {
+                int capacity = registration_capacity ? registration_capacity * 2 : 16;
+                RecordingRegistration * grown = realloc(registrations, sizeof(RecordingRegistration) * capacity);
+                if (grown != NULL) {
+                    registrations = grown;
+                    registration_capacity = capacity;
+                }
+            }
+            if (registration_count < registration_capacity) {
+                registrations[registration_count].observer = observer;
+                registrations[registration_count].element = recordingElement(element);
+                registrations[registration_count].notification = recordingName(notification);
+                registration_count++;
+            }
+        }
+        recordingEnd();
+    }
+    return error;
+}
+
+static AXError recordingObserverRemoveNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification) {
+    uint64_t started = recordingNow();
+    AXError error = inner->observerRemoveNotification(observer, element, notification);
+    if (recordingBegin(LOG_OBSERVER_REMOVE_NOTIFICATION, started, recordingNow(), element, notification, error)) {
+        uint32_t element_id = recordingElement(element);
+        uint32_t name_id = recordingName(notification);
+        for (int i = 0; i < registration_count; i++) {
+            RecordingRegistration * registration = &registrations[i];
+            if (registration->observer == observer && registration->element == element_id && registration->notification == name_id) {
+                *registration = registrations[--registration_count];
+                break;
+            }
+        }
+        recordingEnd();
+    }
+    return error;
+}
+
+static CFRunLoopSourceRef recordingObserverGetRunLoopSource(AXObserverRef observer) {
+    return inner->observerGetRunLoopSource(observer);
+}
+
+/* Control
+======== */
+
+int recordingStart(const AXBackend * backend, const char * path) {
+    pthread_mutex_lock(&recording_lock);
+    if (recording_file != NULL) {
+        pthread_mutex_unlock(&recording_lock);
+        return EBUSY;
+    }
+
+    FILE * file = fopen(path, "wb");
+    if (file == NULL) {
+        int error = errno;
+        pthread_mutex_unlock(&recording_lock);
+        return error;
+    }
+
+    uint8_t header[LOG_HEADER_LENGTH] = { 0 };
+    memcpy(header, LOG_MAGIC, LOG_MAGIC_LENGTH);
+    header[LOG_MAGIC_LENGTH] = LOG_VERSION;
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        int error = errno;
+        fclose(file);
+        pthread_mutex_unlock(&recording_lock);
+        return error ? error : EIO;
+    }
+
+    inner = backend;
+    recording_file = file;
+    recording_failed = 0;
+    recording_calls = 0;
+    element_count = 0;
+    name_count = 0;
+    system_wide = inner->createSystemWide();
+    recording_started = recordingNow();
+    pthread_mutex_unlock(&recording_lock);
+    return 0;
+}
+
+long recordingStop(void) {
+    pthread_mutex_lock(&recording_lock);
+    if (recording_file == NULL) {
+        pthread_mutex_unlock(&recording_lock);
+        return -1;
+    }
+
+    if (fclose(recording_file) != 0) recording_failed = 1;
+    recording_file = NULL;
+
+    recordingTableClear(&elements);
+    recordingTableClear(&names);
+    for (int i = 0; i < application_count; i++) CFRelease(applications[i].application);
+    free(applications);
+    applications = NULL;
+    application_count = application_capacity = 0;
+    if (system_wide != NULL) CFRelease(system_wide);
+    system_wide = NULL;
+    free(registrations);
+    registrations = NULL;
+    registration_count = registration_capacity = 0;
+    free(record.bytes);
+    free(definition.bytes);
+    memset(&record, 0, sizeof(LogBuffer));
+    memset(&definition, 0, sizeof(LogBuffer));
+
+    long calls = recording_failed ? -1 : (long) recording_calls;
+    pthread_mutex_unlock(&recording_lock);
+    return calls;
+}
+
+// Observers created while recording keep calling through inner afterwards.
+const AXBackend * recordingInner(void) {
+    pthread_mutex_lock(&recording_lock);
+    const AXBackend * backend = recording_file != NULL ? inner : NULL;
+    pthread_mutex_unlock(&recording_lock);
+    return backend;
+}
+
+const AXBackend recording_backend = {
+    "recording",
+    recordingCreateApplication,
+    recordingCreateSystemWide,
+    recordingProcessExists,
+    recordingIsProcessTrusted,
+    recordingCopyAttributeValue,
+    recordingCopyMultipleAttributeValues,
+    recordingCopyParameterizedAttributeValue,
+    recordingCopyAttributeNames,
+    recordingGetAttributeValueCount,
+    recordingIsAttributeSettable,
+    recordingSetAttributeValue,
+    recordingCopyActionNames,
+    recordingCopyActionDescription,
+    recordingPerformAction,
+    recordingCopyElementAtPosition,
+    recordingGetPid,
+    recordingSetMessagingTimeout,
+    recordingObserverCreate,
+    recordingObserverAddNotification,
+    recordingObserverRemoveNotification,
+    recordingObserverGetRunLoopSource
+};
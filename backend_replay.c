@@ -0,0 +1,1202 @@
+/*
+ * Serves a session log written by the recording backend (see recording.h)
+ * from a memory-mapped file. Each request is answered with the next recorded
+ * response to the same request (the same operation, element and name), and
+ * once those run out, with the last one again; requests that were never
+ * recorded fail with kAXErrorCannotComplete, as if nobody answered.
+ *
+ * At speed 1 every response takes as long as it originally did and
+ * notifications are posted at their original times (relative to when the
+ * log was opened); other speeds scale both. At speed 0 responses come back
+ * at once and each notification is posted as soon as as many requests have
+ * been served as had been made before it.
+ *
+ * Opening a log indexes it in one pass; values are only decoded when served.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "backend.h"
+#include "recording.h"
+
+#define REPLAY_SERIAL_SHIFT 40
+#define REPLAY_ID_MASK ((1ULL << REPLAY_SERIAL_SHIFT) - 1)
+
+typedef struct {
+    uint32_t operation;
+    uint32_t element;
+    uint32_t name;
+    uint32_t x; // bits of the hit test position
+    uint32_t y;
+    uint32_t attributes; // hash of the attributes and options of a bulk copy, or of a parameter
+} ReplayKey;
+
+typedef struct {
+    int used;
+    ReplayKey key;
+    size_t * offsets; // of the calls' payloads, in order
+    size_t count;
+    size_t capacity;
+    size_t cursor;
+} ReplaySlot;
+
+typedef struct {
+    pid_t pid;
+    uint8_t kind;
+    int defined;
+} ReplayElement;
+
+typedef struct {
+    uint64_t time;
+    uint32_t target;
+    uint32_t element;
+    uint32_t name;
+    uint64_t calls_before;
+} ReplayNotification;
+
+typedef struct {
+    AXObserverRef observer; // weak, see replayObserverFinalize
+    uint32_t element;
+    uint32_t name;
+    void * refcon;
+} ReplayRegistration;
+
+typedef struct {
+    uint32_t serial;
+    const uint8_t * map;
+    size_t size;
+    double speed;
+    double opened;
+
+    ReplayElement * elements; // by id
+    uint32_t element_count;
+    CFStringRef * names; // by id
+    uint32_t name_count;
+    uint32_t * name_index; // ids hashed by name
+    size_t name_index_capacity;
+
+    ReplaySlot * slots;
+    size_t slot_capacity;
+    size_t slot_count;
+
+    ReplayNotification * notifications;
+    size_t notification_count;
+    uint64_t calls;
+    double duration;
+
+    pthread_mutex_t lock; // cursors and counters
+    uint64_t served;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t posted;
+    uint64_t unheard;
+} ReplayLog;
+
+static ReplayLog * replay = NULL;
+static uint32_t replay_serial = 0;
+static pthread_rwlock_t replay_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static ReplayRegistration * registrations = NULL;
+static int registration_count = 0;
+static int registration_capacity = 0;
+static pthread_mutex_t registration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t poster;
+static int poster_running = 0;
+static int poster_stopping = 0;
+static pthread_mutex_t poster_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poster_wake = PTHREAD_COND_INITIALIZER;
+
+static double replayNow(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static void replaySleep(double seconds) {
+    if (seconds <= 0) return;
+    struct timespec duration;
+    duration.tv_sec = (time_t) seconds;
+    duration.tv_nsec = (long) ((seconds - (double) duration.tv_sec) * 1e9);
+    while (nanosleep(&duration, &duration) == -1 && errno == EINTR);
+}
+
+/* Index
+======== */
+
+static size_t replayHash(const ReplayKey * key) {
+    uint64_t hash = 1469598103934665603ULL;
+    const uint32_t * words = (const uint32_t *) key;
+    for (size_t i = 0; i < sizeof(ReplayKey) / sizeof(uint32_t); i++) {
+        hash = (hash ^ words[i]) * 1099511628211ULL;
+    }
+    return (size_t) (hash ^ (hash >> 29));
+}
+
+static ReplaySlot * replayFindSlot(ReplaySlot * slots, size_t capacity, const ReplayKey * key) {
+    size_t mask = capacity - 1;
+    size_t index = replayHash(key) & mask;
+    while (slots[index].used && memcmp(&slots[index].key, key, sizeof(ReplayKey)) != 0) {
+        index = (index + 1) & mask;
+    }
+    return &slots[index];
+}
+
+static int replayAddCall(ReplayLog * log, const ReplayKey * key, size_t offset) {
+    if (log->slot_count * 2 >= log->slot_capacity) {
+        size_t capacity = log->slot_capacity ? log->slot_capacity * 2 : 256;
+        ReplaySlot * slots = calloc(capacity, sizeof(ReplaySlot));
+        if (slots == NULL) return -1;
+        for (size_t i = 0; i < log->slot_capacity; i++) {
+            if (log->slots[i].used) *replayFindSlot(slots, capacity, &log->slots[i].key) = log->slots[i];
+        }
+        free(log->slots);
+        log->slots = slots;
+        log->slot_capacity = capacity;
+    }
+
+    ReplaySlot * slot = replayFindSlot(log->slots, log->slot_capacity, key);
+    if (!slot->used) {
+        slot->used = 1;
+        slot->key = *key;
+        log->slot_count++;
+    }
+    if (slot->count == slot->capacity) {
+        size_t capacity = slot->capacity ? slot->capacity * 2 : 4;
+        size_t * offsets = realloc(slot->offsets, sizeof(size_t) * capacity);
+        if (offsets == NULL) return -1;
+        slot->offsets = offsets;
+        slot->capacity = capacity;
+    }
+    slot->offsets[slot->count++] = offset;
+    return 0;
+}
+
+// Grows an array indexed by id so that id fits, zeroing the new entries.
+static int replayGrow(void ** array, uint32_t * count, uint32_t id, size_t size) {
+    if (id < *count) return 0;
+    uint32_t grown = *count ? *count : 64;
+    while (grown <= id) grown *= 2;
+    void * resized = realloc(*array, size * grown);
+    if (resized == NULL) return -1;
+    memset((char *) resized + size * *count, 0, size * (grown - *count));
+    *array = resized;
+    *count = grown;
+    return 0;
+}
+
+static uint32_t replayNameId(ReplayLog * log, CFStringRef name) {
+    if (name == NULL || log->name_index_capacity == 0) return 0;
+    size_t mask = log->name_index_capacity - 1;
+    size_t index = (size_t) CFHash(name) & mask;
+    while (log->name_index[index] != 0) {
+        if (CFEqual(log->names[log->name_index[index]], name)) return log->name_index[index];
+        index = (index + 1) & mask;
+    }
+    return 0;
+}
+
+static int replayIndexNames(ReplayLog * log) {
+    size_t capacity = 64;
+    while (capacity < (size_t) log->name_count * 2) capacity *= 2;
+    log->name_index = calloc(capacity, sizeof(uint32_t));
+    if (log->name_index == NULL) return -1;
+    log->name_index_capacity = capacity;
+    for (uint32_t id = 1; id < log->name_count; id++) {
+        if (log->names[id] == NULL) continue;
+        size_t index = (size_t) CFHash(log->names[id]) & (capacity - 1);
+        while (log->name_index[index] != 0) index = (index + 1) & (capacity - 1);
+        log->name_index[index] = id;
+    }
+    return 0;
+}
+
+static void replayFree(ReplayLog * log) {
+    if (log == NULL) return;
+    for (uint32_t id = 0; id < log->name_count; id++) {
+        if (log->names[id] != NULL) CFRelease(log->names[id]);
+    }
+    for (size_t i = 0; i < log->slot_capacity; i++) free(log->slots[i].offsets);
+    free(log->names);
+    free(log->name_index);
+    free(log->elements);
+    free(log->slots);
+    free(log->notifications);
+    pthread_mutex_destroy(&log->lock);
+    if (log->map != NULL) munmap((void *) log->map, log->size);
+    free(log);
+}
+
+// Folds one word of a bulk copy's attribute list into its hash (FNV-1a).
+static uint32_t replayAttributeHash(uint32_t hash, uint32_t word) {
+    return (hash ^ word) * 16777619U;
+}
+
+static uint32_t replayHashWord(uint32_t hash, uint64_t word) {
+    return replayAttributeHash(replayAttributeHash(hash, (uint32_t) word), (uint32_t) (word >> 32));
+}
+
+static uint64_t replayRealBits(double real) {
+    uint64_t bits;
+    memcpy(&bits, &real, sizeof(bits));
+    return bits;
+}
+
+/*
+ * Hashes the parameter of a parameterized copy as recorded, in step with
+ * replayParameterHash, which hashes the one requested. Parameters are
+ * scalars; anything else fails the reader, so the call is never served.
+ */
+static uint32_t replayRecordedParameterHash(LogReader * reader) {
+    uint8_t tag = logReadByte(reader);
+    uint32_t hash = replayAttributeHash(2166136261U, tag);
+    int reals = 0;
+    switch (tag) {
+        case LOG_VALUE_NONE:
+        case LOG_VALUE_FALSE:
+        case LOG_VALUE_TRUE:
+            break;
+        case LOG_VALUE_INTEGER:
+        case LOG_VALUE_AXERROR:
+            hash = replayHashWord(hash, (uint64_t) logReadSigned(reader));
+            break;
+        case LOG_VALUE_ELEMENT:
+            hash = replayHashWord(hash, logReadVarint(reader));
+            break;
+        case LOG_VALUE_RANGE:
+            hash = replayHashWord(hash, (uint64_t) logReadSigned(reader));
+            hash = replayHashWord(hash, (uint64_t) logReadSigned(reader));
+            break;
+        case LOG_VALUE_STRING: {
+            uint64_t length = logReadVarint(reader);
+            if (reader->failed || length > (uint64_t) (reader->end - reader->position)) {
+                reader->failed = 1;
+                break;
+            }
+            hash = replayHashWord(hash, length);
+            for (uint64_t i = 0; i < length; i++) hash = replayAttributeHash(hash, reader->position[i]);
+            reader->position += length;
+            break;
+        }
+        case LOG_VALUE_REAL: reals = 1; break;
+        case LOG_VALUE_POINT:
+        case LOG_VALUE_SIZE: reals = 2; break;
+        case LOG_VALUE_RECT: reals = 4; break;
+        default:
+            reader->failed = 1;
+            break;
+    }
+    for (int i = 0; i < reals; i++) hash = replayHashWord(hash, replayRealBits(logReadReal(reader)));
+    return hash;
+}
+
+/*
+ * Hashes a requested parameter as it would have been recorded. Returns 0 if
+ * it could not have been (such as an element from elsewhere), so that the
+ * request is a miss.
+ */
+static uint32_t replayParameterHash(CFTypeRef parameter) {
+    if (parameter == NULL) return replayAttributeHash(2166136261U, LOG_VALUE_NONE);
+
+    CFTypeID type = CFGetTypeID(parameter);
+    if (type == CFBooleanGetTypeID()) {
+        return replayAttributeHash(2166136261U, CFBooleanGetValue(parameter) ? LOG_VALUE_TRUE : LOG_VALUE_FALSE);
+    } else if (type == CFNumberGetTypeID()) {
+        if (CFNumberIsFloatType(parameter)) {
+            double real = 0;
+            CFNumberGetValue(parameter, kCFNumberDoubleType, &real);
+            return replayHashWord(replayAttributeHash(2166136261U, LOG_VALUE_REAL), replayRealBits(real));
+        }
+        long long integer = 0;
+        CFNumberGetValue(parameter, kCFNumberLongLongType, &integer);
+        return replayHashWord(replayAttributeHash(2166136261U, LOG_VALUE_INTEGER), (uint64_t) integer);
+    } else if (type == CFStringGetTypeID()) {
+        const char * bytes = CFStringGetCStringPtr(parameter, kCFStringEncodingUTF8);
+        if (bytes == NULL) return 0;
+        size_t length = strlen(bytes);
+        uint32_t hash = replayHashWord(replayAttributeHash(2166136261U, LOG_VALUE_STRING), length);
+        for (size_t i = 0; i < length; i++) hash = replayAttributeHash(hash, (uint8_t) bytes[i]);
+        return hash;
+    } else if (type == AXUIElementGetTypeID()) {
+        uint64_t identifier = AXCompatElementGetIdentifier(parameter);
+        if (AXCompatElementGetOwner(parameter) != &replay_backend || (identifier >> REPLAY_SERIAL_SHIFT) != replay->serial)
+            return 0;
+        return replayHashWord(replayAttributeHash(2166136261U, LOG_VALUE_ELEMENT), identifier & REPLAY_ID_MASK);
+    } else if (type != AXValueGetTypeID()) {
+        return 0;
+    }
+
+    double reals[4];
+    int count = 0;
+    uint32_t hash = 0;
+    switch (AXValueGetType(parameter)) {
+        case kAXValueCFRangeType: {
+            CFRange range;
+            AXValueGetValue(parameter, kAXValueCFRangeType, &range);
+            hash = replayAttributeHash(2166136261U, LOG_VALUE_RANGE);
+            hash = replayHashWord(hash, (uint64_t) (int64_t) range.location);
+            return replayHashWord(hash, (uint64_t) (int64_t) range.length);
+        }
+        case kAXValueCGPointType: {
+            CGPoint point;
+            AXValueGetValue(parameter, kAXValueCGPointType, &point);
+            hash = replayAttributeHash(2166136261U, LOG_VALUE_POINT);
+            reals[count++] = point.x;
+            reals[count++] = point.y;
+            break;
+        }
+        case kAXValueCGSizeType: {
+            CGSize size;
+            AXValueGetValue(parameter, kAXValueCGSizeType, &size);
+            hash = replayAttributeHash(2166136261U, LOG_VALUE_SIZE);
+            reals[count++] = size.width;
+            reals[count++] = size.height;
+            break;
+        }
+        case kAXValueCGRectType: {
+            CGRect rect;
+            AXValueGetValue(parameter, kAXValueCGRectType, &rect);
+            hash = replayAttributeHash(2166136261U, LOG_VALUE_RECT);
+            reals[count++] = rect.origin.x;
+            reals[count++] = rect.origin.y;
+            reals[count++] = rect.size.width;
+            reals[count++] = rect.size.height;
+            break;
+        }
+        default:
+            return 0;
+    }
+    for (int i = 0; i < count; i++) hash = replayHashWord(hash, replayRealBits(reals[i]));
+    return hash;
+}
+
+/*
+ * Reads the header of a call, leaving the reader at whatever follows the
+ * common fields.
+ */
+static void replayCallHeader(LogReader * reader, ReplayKey * key, uint64_t * time, uint64_t * latency, AXError * error) {
+    memset(key, 0, sizeof(ReplayKey));
+    key->operation = (uint32_t) logReadVarint(reader);
+    *time = logReadVarint(reader);
+    *latency = logReadVarint(reader);
+    key->element = (uint32_t) logReadVarint(reader);
+    key->name = (uint32_t) logReadVarint(reader);
+    *error = (AXError) logReadSigned(reader);
+    if (key->operation == LOG_COPY_ELEMENT_AT_POSITION) {
+        float x = logReadFloat(reader);
+        float y = logReadFloat(reader);
+        memcpy(&key->x, &x, sizeof(float));
+        memcpy(&key->y, &y, sizeof(float));
+    } else if (key->operation == LOG_COPY_MULTIPLE_ATTRIBUTE_VALUES) {
+        uint64_t count = logReadVarint(reader);
+        uint32_t hash = replayAttributeHash(2166136261U, (uint32_t) count);
+        for (uint64_t i = 0; i < count && !reader->failed; i++)
+            hash = replayAttributeHash(hash, (uint32_t) logReadVarint(reader));
+        key->attributes = replayAttributeHash(hash, logReadByte(reader));
+    } else if (key->operation == LOG_COPY_PARAMETERIZED_ATTRIBUTE_VALUE) {
+        key->attributes = replayRecordedParameterHash(reader);
+    }
+}
+
+static int replayIndex(ReplayLog * log, char * message, size_t message_size) {
+    LogReader file = { log->map + LOG_HEADER_LENGTH, log->map + log->size, 0 };
+    size_t notification_capacity = 0;
+
+    while (file.position < file.end) {
+        uint8_t type = logReadByte(&file);
+        uint64_t length = logReadVarint(&file);
+        // A record cut short is where the recording stopped
+        if (file.failed || length > (uint64_t) (file.end - file.position)) break;
+        LogReader payload = { file.position, file.position + length, 0 };
+        size_t offset = (size_t) (file.position - log->map);
+        file.position += length;
+
+        if (type == LOG_STRING) {
+            uint32_t id = (uint32_t) logReadVarint(&payload);
+            if (payload.failed || id == 0 || replayGrow((void **) &log->names, &log->name_count, id, sizeof(CFStringRef)) == -1) continue;
+            if (log->names[id] != NULL) CFRelease(log->names[id]);
+            log->names[id] = CFStringCreateWithBytes(kCFAllocatorDefault, payload.position, payload.end - payload.position, kCFStringEncodingUTF8, 0);
+        } else if (type == LOG_ELEMENT) {
+            uint32_t id = (uint32_t) logReadVarint(&payload);
+            pid_t pid = (pid_t) logReadSigned(&payload);
+            uint8_t kind = logReadByte(&payload);
+            if (payload.failed || id == 0 || replayGrow((void **) &log->elements, &log->element_count, id, sizeof(ReplayElement)) == -1) continue;
+            log->elements[id].pid = pid;
+            log->elements[id].kind = kind;
+            log->elements[id].defined = 1;
+        } else if (type == LOG_CALL) {
+            ReplayKey key;
+            uint64_t time, latency;
+            AXError error;
+            replayCallHeader(&payload, &key, &time, &latency, &error);
+            if (payload.failed) continue;
+            if (replayAddCall(log, &key, offset) == -1) {
+                snprintf(message, message_size, "Out of memory indexing the log.");
+                return -1;
+            }
+            log->calls++;
+            if ((time + latency) / 1e9 > log->duration) log->duration = (time + latency) / 1e9;
+        } else if (type == LOG_NOTIFICATION) {
+            ReplayNotification notification;
+            notification.time = logReadVarint(&payload);
+            notification.target = (uint32_t) logReadVarint(&payload);
+            notification.element = (uint32_t) logReadVarint(&payload);
+            notification.name = (uint32_t) logReadVarint(&payload);
+            logReadSigned(&payload); // the observer's pid, implied by the target
+            notification.calls_before = logReadVarint(&payload);
+            if (payload.failed) continue;
+            if (log->notification_count == notification_capacity) {
+                size_t capacity = notification_capacity ? notification_capacity * 2 : 256;
+                ReplayNotification * grown = realloc(log->notifications, sizeof(ReplayNotification) * capacity);
+                if (grown == NULL) {
+                    snprintf(message, message_size, "Out of memory indexing the log.");
+                    return -1;
+                }
+                log->notifications = grown;
+                notification_capacity = capacity;
+            }
+            log->notifications[log->notification_count++] = notification;
+            if (notification.time / 1e9 > log->duration) log->duration = notification.time / 1e9;
+        }
+        // Anything else is from a later version and skipped
+    }
+
+    if (replayIndexNames(log) == -1) {
+        snprintf(message, message_size, "Out of memory indexing the log.");
+        return -1;
+    }
+    return 0;
+}
+
+/* Values
+======== */
+
+static AXUIElementRef replayElement(ReplayLog * log, uint32_t id) {
+    pid_t pid = (id < log->element_count && log->elements[id].defined) ? log->elements[id].pid : -1;
+    return AXCompatElementCreate(&replay_backend, ((uint64_t) log->serial << REPLAY_SERIAL_SHIFT) | id, pid);
+}
+
+static CFStringRef replayString(LogReader * reader) {
+    uint64_t length = logReadVarint(reader);
+    if (reader->failed || length > (uint64_t) (reader->end - reader->position)) {
+        reader->failed = 1;
+        return NULL;
+    }
+    CFStringRef string = CFStringCreateWithBytes(kCFAllocatorDefault, reader->position, (CFIndex) length, kCFStringEncodingUTF8, 0);
+    reader->position += length;
+    return string;
+}
+
+// Returns the next value (which the caller owns), or NULL for none.
+static CFTypeRef replayValue(ReplayLog * log, LogReader * reader, int depth) {
+    uint8_t tag = logReadByte(reader);
+    if (reader->failed || depth > LOG_MAX_DEPTH) return NULL;
+
+    switch (tag) {
+        case LOG_VALUE_STRING:
+            return replayString(reader);
+
+        case LOG_VALUE_FALSE:
+            return CFRetain(kCFBooleanFalse);
+
+        case LOG_VALUE_TRUE:
+            return CFRetain(kCFBooleanTrue);
+
+        case LOG_VALUE_INTEGER: {
+            long long integer = logReadSigned(reader);
+            return CFNumberCreate(kCFAllocatorDefault, kCFNumberLongLongType, &integer);
+        }
+
+        case LOG_VALUE_REAL: {
+            double real = logReadReal(reader);
+            return CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &real);
+        }
+
+        case LOG_VALUE_ELEMENT:
+            return replayElement(log, (uint32_t) logReadVarint(reader));
+
+        case LOG_VALUE_ARRAY: {
+            uint64_t count = logReadVarint(reader);
+            // Every value takes at least a byte, which bounds a bogus count
+            if (reader->failed || count > (uint64_t) (reader->end - reader->position)) return NULL;
+            CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, (CFIndex) count, &kCFTypeArrayCallBacks);
+            for (uint64_t i = 0; array != NULL && i < count && !reader->failed; i++) {
+                CFTypeRef item = replayValue(log, reader, depth + 1);
+                if (item != NULL) {
+                    CFArrayAppendValue(array, item);
+                    CFRelease(item);
+                }
+            }
+            return array;
+        }
+
+        case LOG_VALUE_DICTIONARY: {
+            uint64_t count = logReadVarint(reader);
+            if (reader->failed || count > (uint64_t) (reader->end - reader->position) / 2) return NULL;
+            const void ** keys = calloc(count ? count * 2 : 1, sizeof(void *));
+            if (keys == NULL) return NULL;
+            const void ** values = keys + count;
+            CFIndex filled = 0;
+            for (uint64_t i = 0; i < count; i++) {
+                CFTypeRef key = replayValue(log, reader, depth + 1);
+                CFTypeRef value = replayValue(log, reader, depth + 1);
+                if (key != NULL && value != NULL) {
+                    keys[filled] = key;
+                    values[filled] = value;
+                    filled++;
+                } else {
+                    if (key != NULL) CFRelease(key);
+                    if (value != NULL) CFRelease(value);
+                }
+            }
+            CFDictionaryRef dictionary = CFDictionaryCreate(kCFAllocatorDefault, keys, values, filled, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+            for (CFIndex i = 0; i < filled; i++) {
+                CFRelease(keys[i]);
+                CFRelease(values[i]);
+            }
+            free(keys);
+            return dictionary;
+        }
+
+        case LOG_VALUE_URL: {
+            CFStringRef string = replayString(reader);
+            if (string == NULL) return NULL;
+            CFURLRef url = CFURLCreateWithString(kCFAllocatorDefault, string, NULL);
+            CFRelease(string);
+            return url;
+        }
+
+        case LOG_VALUE_ATTRIBUTED: {
+            CFStringRef string = replayString(reader);
+            if (string == NULL) return NULL;
+            CFAttributedStringRef attributed = CFAttributedStringCreate(kCFAllocatorDefault, string, NULL);
+            CFRelease(string);
+            return attributed;
+        }
+
+        case LOG_VALUE_POINT: {
+            CGPoint point;
+            point.x = logReadReal(reader);
+            point.y = logReadReal(reader);
+            return AXValueCreate(kAXValueCGPointType, &point);
+        }
+
+        case LOG_VALUE_SIZE: {
+            CGSize size;
+            size.width = logReadReal(reader);
+            size.height = logReadReal(reader);
+            return AXValueCreate(kAXValueCGSizeType, &size);
+        }
+
+        case LOG_VALUE_RECT: {
+            CGRect rect;
+            rect.origin.x = logReadReal(reader);
+            rect.origin.y = logReadReal(reader);
+            rect.size.width = logReadReal(reader);
+            rect.size.height = logReadReal(reader);
+            return AXValueCreate(kAXValueCGRectType, &rect);
+        }
+
+        case LOG_VALUE_RANGE: {
+            CFRange range;
+            range.location = (CFIndex) logReadSigned(reader);
+            range.length = (CFIndex) logReadSigned(reader);
+            return AXValueCreate(kAXValueCFRangeType, &range);
+        }
+
+        case LOG_VALUE_AXERROR: {
+            AXError error = (AXError) logReadSigned(reader);
+            return AXValueCreate(kAXValueAXErrorType, &error);
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/* Requests
+======== */
+
+/*
+ * Finds the id of a replayed element, taking the read lock; call replayEnd
+ * afterwards whatever this returns. Elements of applications missing from
+ * the log have id 0.
+ */
+static AXError replayBegin(AXUIElementRef element, uint32_t * id) {
+    pthread_rwlock_rdlock(&replay_lock);
+    if (replay == NULL || element == NULL || CFGetTypeID(element) != AXUIElementGetTypeID()
+            || AXCompatElementGetOwner(element) != &replay_backend)
+        return kAXErrorInvalidUIElement;
+
+    uint64_t identifier = AXCompatElementGetIdentifier(element);
+    *id = (uint32_t) (identifier & REPLAY_ID_MASK);
+    if ((identifier >> REPLAY_SERIAL_SHIFT) != replay->serial || *id >= replay->element_count + (*id == 0))
+        return kAXErrorInvalidUIElement;
+    return kAXErrorSuccess;
+}
+
+static void replayEnd(void) {
+    pthread_rwlock_unlock(&replay_lock);
+}
+
+/*
+ * Counts a request as served, which is what notifications wait for at speed
+ * 0. Registering for notifications counts too, since the recording did.
+ */
+static void replayCount(void) {
+    pthread_mutex_lock(&replay->lock);
+    replay->served++;
+    pthread_mutex_unlock(&replay->lock);
+
+    pthread_mutex_lock(&poster_lock);
+    pthread_cond_broadcast(&poster_wake);
+    pthread_mutex_unlock(&poster_lock);
+}
+
+/*
+ * Looks up the response to a request, waiting as long as it originally took,
+ * and leaves reader at what follows the call's common fields. An element of
+ * 0 is always a miss. Expects the read lock to be held (see replayBegin).
+ */
+static AXError replayServe(LogOperation operation, uint32_t element, CFStringRef name, float x, float y, uint32_t attributes, LogReader * reader) {
+    ReplayKey key;
+    memset(&key, 0, sizeof(ReplayKey));
+    key.operation = operation;
+    key.element = element;
+    key.name = replayNameId(replay, name);
+    key.attributes = attributes;
+    if (operation == LOG_COPY_ELEMENT_AT_POSITION) {
+        memcpy(&key.x, &x, sizeof(float));
+        memcpy(&key.y, &y, sizeof(float));
+    }
+
+    ReplaySlot * slot = NULL;
+    if (element != 0 && (name == NULL || key.name != 0) && replay->slot_capacity > 0) {
+        slot = replayFindSlot(replay->slots, replay->slot_capacity, &key);
+        if (!slot->used) slot = NULL;
+    }
+
+    pthread_mutex_lock(&replay->lock);
+    size_t offset = 0;
+    if (slot != NULL) {
+        offset = slot->offsets[slot->cursor];
+        if (slot->cursor + 1 < slot->count) slot->cursor++;
+        replay->hits++;
+    } else {
+        replay->misses++;
+    }
+    pthread_mutex_unlock(&replay->lock);
+    replayCount();
+
+    if (slot == NULL) return kAXErrorCannotComplete;
+
+    reader->position = replay->map + offset;
+    reader->end = replay->map + replay->size;
+    reader->failed = 0;
+    uint64_t time, latency;
+    AXError error;
+    replayCallHeader(reader, &key, &time, &latency, &error);
+    if (replay->speed > 0) replaySleep(latency / 1e9 / replay->speed);
+    return reader->failed ? kAXErrorFailure : error;
+}
+
+static AXUIElementRef replayCreateApplication(pid_t pid) {
+    pthread_rwlock_rdlock(&replay_lock);
+    AXUIElementRef element = NULL;
+    if (replay != NULL) {
+        uint32_t id = 0;
+        for (uint32_t i = 1; i < replay->element_count && id == 0; i++) {
+            if (replay->elements[i].defined && replay->elements[i].kind == LOG_ELEMENT_APPLICATION && replay->elements[i].pid == pid) id = i;
+        }
+        element = AXCompatElementCreate(&replay_backend, ((uint64_t) replay->serial << REPLAY_SERIAL_SHIFT) | id, pid);
+    }
+    pthread_rwlock_unlock(&replay_lock);
+    return element;
+}
+
+static AXUIElementRef replayCreateSystemWide(void) {
+    pthread_rwlock_rdlock(&replay_lock);
+    AXUIElementRef element = NULL;
+    if (replay != NULL) {
+        uint32_t id = 0;
+        for (uint32_t i = 1; i < replay->element_count && id == 0; i++) {
+            if (replay->elements[i].defined && replay->elements[i].kind == LOG_ELEMENT_SYSTEM_WIDE) id = i;
+        }
+        element = AXCompatElementCreate(&replay_backend, ((uint64_t) replay->serial << REPLAY_SERIAL_SHIFT) | id, -1);
+    }
+    pthread_rwlock_unlock(&replay_lock);
+    return element;
+}
+
+static Boolean replayProcessExists(pid_t pid) {
+    pthread_rwlock_rdlock(&replay_lock);
+    Boolean exists = 0;
+    for (uint32_t i = 1; replay != NULL && i < replay->element_count && !exists; i++) {
+        exists = replay->elements[i].defined && replay->elements[i].pid == pid;
+    }
+    pthread_rwlock_unlock(&replay_lock);
+    return exists;
+}
+
+static Boolean replayIsProcessTrusted(CFDictionaryRef options) {
+    return 1;
+}
+
+static AXError replayCopyAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef * value) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_COPY_ATTRIBUTE_VALUE, id, attribute, 0, 0, 0, &reader);
+    if (error == kAXErrorSuccess) {
+        *value = replayValue(replay, &reader, 0);
+        if (*value == NULL) error = kAXErrorNoValue;
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyMultipleAttributeValues(AXUIElementRef element, CFArrayRef attributes, AXCopyMultipleAttributeOptions options, CFArrayRef * values) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) {
+        CFIndex count = CFArrayGetCount(attributes);
+        uint32_t hash = replayAttributeHash(2166136261U, (uint32_t) count);
+        for (CFIndex i = 0; i < count; i++) {
+            uint32_t name = replayNameId(replay, CFArrayGetValueAtIndex(attributes, i));
+            if (name == 0) id = 0; // never recorded, so a miss
+            hash = replayAttributeHash(hash, name);
+        }
+        hash = replayAttributeHash(hash, (uint8_t) options);
+        error = replayServe(LOG_COPY_MULTIPLE_ATTRIBUTE_VALUES, id, NULL, 0, 0, hash, &reader);
+    }
+    if (error == kAXErrorSuccess) {
+        CFTypeRef value = replayValue(replay, &reader, 0);
+        if (value != NULL && CFGetTypeID(value) == CFArrayGetTypeID()) {
+            *values = (CFArrayRef) value;
+        } else {
+            if (value != NULL) CFRelease(value);
+            error = kAXErrorFailure;
+        }
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyParameterizedAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef parameter, CFTypeRef * value) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) {
+        uint32_t hash = replayParameterHash(parameter);
+        if (hash == 0) id = 0;
+        error = replayServe(LOG_COPY_PARAMETERIZED_ATTRIBUTE_VALUE, id, attribute, 0, 0, hash, &reader);
+    }
+    if (error == kAXErrorSuccess) {
+        *value = replayValue(replay, &reader, 0);
+        if (*value == NULL) error = kAXErrorNoValue;
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyNames(LogOperation operation, AXUIElementRef element, CFArrayRef * names) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(operation, id, NULL, 0, 0, 0, &reader);
+    if (error == kAXErrorSuccess) {
+        CFTypeRef value = replayValue(replay, &reader, 0);
+        if (value != NULL && CFGetTypeID(value) == CFArrayGetTypeID()) {
+            *names = (CFArrayRef) value;
+        } else {
+            if (value != NULL) CFRelease(value);
+            error = kAXErrorFailure;
+        }
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyAttributeNames(AXUIElementRef element, CFArrayRef * names) {
+    return replayCopyNames(LOG_COPY_ATTRIBUTE_NAMES, element, names);
+}
+
+static AXError replayGetAttributeValueCount(AXUIElementRef element, CFStringRef attribute, CFIndex * count) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_GET_ATTRIBUTE_VALUE_COUNT, id, attribute, 0, 0, 0, &reader);
+    if (error == kAXErrorSuccess) *count = (CFIndex) logReadVarint(&reader);
+    replayEnd();
+    return error;
+}
+
+static AXError replayIsAttributeSettable(AXUIElementRef element, CFStringRef attribute, Boolean * settable) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_IS_ATTRIBUTE_SETTABLE, id, attribute, 0, 0, 0, &reader);
+    if (error == kAXErrorSuccess) *settable = logReadByte(&reader) ? 1 : 0;
+    replayEnd();
+    return error;
+}
+
+// The recorded value is not compared; the request just gets the same result.
+static AXError replaySetAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef value) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_SET_ATTRIBUTE_VALUE, id, attribute, 0, 0, 0, &reader);
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyActionNames(AXUIElementRef element, CFArrayRef * names) {
+    return replayCopyNames(LOG_COPY_ACTION_NAMES, element, names);
+}
+
+static AXError replayCopyActionDescription(AXUIElementRef element, CFStringRef action, CFStringRef * description) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_COPY_ACTION_DESCRIPTION, id, action, 0, 0, 0, &reader);
+    if (error == kAXErrorSuccess) {
+        CFTypeRef value = replayValue(replay, &reader, 0);
+        if (value != NULL && CFGetTypeID(value) == CFStringGetTypeID()) {
+            *description = (CFStringRef) value;
+        } else {
+            if (value != NULL) CFRelease(value);
+            error = kAXErrorFailure;
+        }
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayPerformAction(AXUIElementRef element, CFStringRef action) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_PERFORM_ACTION, id, action, 0, 0, 0, &reader);
+    replayEnd();
+    return error;
+}
+
+static AXError replayCopyElementAtPosition(AXUIElementRef element, float x, float y, AXUIElementRef * result) {
+    uint32_t id;
+    LogReader reader;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) error = replayServe(LOG_COPY_ELEMENT_AT_POSITION, id, NULL, x, y, 0, &reader);
+    if (error == kAXErrorSuccess) {
+        uint32_t found = (uint32_t) logReadVarint(&reader);
+        *result = reader.failed ? NULL : replayElement(replay, found);
+        if (*result == NULL) error = kAXErrorFailure;
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayGetPid(AXUIElementRef element, pid_t * pid) {
+    uint32_t id;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) {
+        if (id != 0 && replay->elements[id].kind == LOG_ELEMENT_SYSTEM_WIDE) error = kAXErrorIllegalArgument;
+        else *pid = AXCompatElementGetPid(element);
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replaySetMessagingTimeout(AXUIElementRef element, float timeout) {
+    if (timeout < 0) return kAXErrorIllegalArgument;
+    uint32_t id;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) AXCompatElementSetTimeout(element, timeout);
+    replayEnd();
+    return error;
+}
+
+/* Observers
+======== */
+
+// Registrations hold observers weakly, as with the simulated backend.
+static void replayObserverFinalize(AXObserverRef observer) {
+    pthread_mutex_lock(&registration_lock);
+    for (int i = 0; i < registration_count; ) {
+        if (registrations[i].observer == observer) registrations[i] = registrations[--registration_count];
+        else i++;
+    }
+    pthread_mutex_unlock(&registration_lock);
+}
+
+static AXError replayObserverCreate(pid_t pid, AXObserverCallback callback, AXObserverRef * observer) {
+    if (callback == NULL) return kAXErrorIllegalArgument;
+    *observer = AXCompatObserverCreate(&replay_backend, pid, callback, replayObserverFinalize);
+    return *observer != NULL ? kAXErrorSuccess : kAXErrorFailure;
+}
+
+static int replayFindRegistration(AXObserverRef observer, uint32_t element, uint32_t name) {
+    for (int i = 0; i < registration_count; i++) {
+        if (registrations[i].observer == observer && registrations[i].element == element && registrations[i].name == name) return i;
+    }
+    return -1;
+}
+
+static AXError replayObserverAddNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    if (observer == NULL || AXCompatObserverGetOwner(observer) != &replay_backend)
+        return kAXErrorInvalidUIElementObserver;
+
+    uint32_t id;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) {
+        replayCount();
+        // Names the log never mentions are accepted, but never posted
+        uint32_t name = replayNameId(replay, notification);
+        pthread_mutex_lock(&registration_lock);
+        if (name != 0 && replayFindRegistration(observer, id, name) >= 0) {
+            error = kAXErrorNotificationAlreadyRegistered;
+        } else if (name != 0) {
+            if (registration_count == registration_capacity) {
+                int capacity = registration_capacity ? registration_capacity * 2 : 16;
+                ReplayRegistration * grown = realloc(registrations, sizeof(ReplayRegistration) * capacity);
+                if (grown == NULL) error = kAXErrorFailure;
+                else {
+                    registrations = grown;
+                    registration_capacity = capacity;
+                }
+            }
+            if (error == kAXErrorSuccess) {
+                ReplayRegistration * registration = &registrations[registration_count++];
+                registration->observer = observer;
+                registration->element = id;
+                registration->name = name;
+                registration->refcon = refcon;
+            }
+        }
+        pthread_mutex_unlock(&registration_lock);
+    }
+    replayEnd();
+    return error;
+}
+
+static AXError replayObserverRemoveNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification) {
+    if (observer == NULL || AXCompatObserverGetOwner(observer) != &replay_backend)
+        return kAXErrorInvalidUIElementObserver;
+
+    uint32_t id;
+    AXError error = replayBegin(element, &id);
+    if (error == kAXErrorSuccess) {
+        replayCount();
+        uint32_t name = replayNameId(replay, notification);
+        pthread_mutex_lock(&registration_lock);
+        int index = replayFindRegistration(observer, id, name);
+        if (index >= 0) registrations[index] = registrations[--registration_count];
+        else error = kAXErrorNotificationNotRegistered;
+        pthread_mutex_unlock(&registration_lock);
+    }
+    replayEnd();
+    return error;
+}
+
+static CFRunLoopSourceRef replayObserverGetRunLoopSource(AXObserverRef observer) {
+    return AXCompatObserverGetRunLoopSource(observer);
+}
+
+/* Notifications
+======== */
+
+static void replayPost(ReplayLog * log, const ReplayNotification * notification) {
+    AXUIElementRef element = replayElement(log, notification->element);
+    CFStringRef name = notification->name < log->name_count ? log->names[notification->name] : NULL;
+    uint64_t posted = 0;
+
+    if (element != NULL && name != NULL) {
+        pthread_mutex_lock(&registration_lock);
+        for (int i = 0; i < registration_count; i++) {
+            ReplayRegistration * registration = &registrations[i];
+            if (registration->element == notification->target && registration->name == notification->name) {
+                posted += AXCompatObserverPost(registration->observer, element, name, registration->refcon);
+            }
+        }
+        pthread_mutex_unlock(&registration_lock);
+    }
+    if (element != NULL) CFRelease(element);
+
+    pthread_mutex_lock(&log->lock);
+    if (posted) log->posted += posted;
+    else log->unheard++;
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void * replayPostNotifications(void * unused) {
+    pthread_rwlock_rdlock(&replay_lock);
+    ReplayLog * log = replay;
+    pthread_rwlock_unlock(&replay_lock);
+
+    // The log outlives this thread: replayClose stops it before freeing
+    for (size_t i = 0; log != NULL && i < log->notification_count; i++) {
+        const ReplayNotification * notification = &log->notifications[i];
+
+        pthread_mutex_lock(&poster_lock);
+        while (!poster_stopping) {
+            if (log->speed > 0) {
+                double due = log->opened + notification->time / 1e9 / log->speed;
+                if (replayNow() >= due) break;
+                struct timespec deadline;
+                deadline.tv_sec = (time_t) due;
+                deadline.tv_nsec = (long) ((due - (double) deadline.tv_sec) * 1e9);
+                pthread_cond_timedwait(&poster_wake, &poster_lock, &deadline);
+            } else {
+                pthread_mutex_lock(&log->lock);
+                int due = log->served >= notification->calls_before;
+                pthread_mutex_unlock(&log->lock);
+                if (due) break;
+                pthread_cond_wait(&poster_wake, &poster_lock);
+            }
+        }
+        int stopping = poster_stopping;
+        pthread_mutex_unlock(&poster_lock);
+        if (stopping) break;
+
+        replayPost(log, notification);
+    }
+    return NULL;
+}
+
+static void replayPosterStop(void) {
+    pthread_mutex_lock(&poster_lock);
+    int running = poster_running;
+    poster_stopping = 1;
+    pthread_cond_broadcast(&poster_wake);
+    pthread_mutex_unlock(&poster_lock);
+
+    if (running) pthread_join(poster, NULL);
+
+    pthread_mutex_lock(&poster_lock);
+    poster_running = 0;
+    poster_stopping = 0;
+    pthread_mutex_unlock(&poster_lock);
+}
+
+/* Control
+======== */
+
+int replayOpen(const char * path, double speed, char * message, size_t message_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        snprintf(message, message_size, "Could not open %s: %s.", path, strerror(errno));
+        return -1;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 || (size_t) status.st_size < LOG_HEADER_LENGTH) {
+        snprintf(message, message_size, "%s is not a session log.", path);
+        close(fd);
+        return -1;
+    }
+    const uint8_t * map = mmap(NULL, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(message, message_size, "Could not map %s: %s.", path, strerror(errno));
+        return -1;
+    }
+    if (memcmp(map, LOG_MAGIC, LOG_MAGIC_LENGTH) != 0 || map[LOG_MAGIC_LENGTH] != LOG_VERSION) {
+        snprintf(message, message_size, "%s is not a session log this version can read.", path);
+        munmap((void *) map, (size_t) status.st_size);
+        return -1;
+    }
+
+    ReplayLog * log = calloc(1, sizeof(ReplayLog));
+    if (log == NULL) {
+        munmap((void *) map, (size_t) status.st_size);
+        snprintf(message, message_size, "Out of memory indexing the log.");
+        return -1;
+    }
+    log->map = map;
+    log->size = (size_t) status.st_size;
+    log->speed = speed;
+    pthread_mutex_init(&log->lock, NULL);
+    if (replayIndex(log, message, message_size) == -1) {
+        replayFree(log);
+        return -1;
+    }
+
+    replayClose();
+    pthread_rwlock_wrlock(&replay_lock);
+    log->serial = ++replay_serial & 0xFFFFFF;
+    log->opened = replayNow();
+    replay = log;
+    pthread_rwlock_unlock(&replay_lock);
+
+    if (log->notification_count > 0) {
+        pthread_mutex_lock(&poster_lock);
+        poster_running = pthread_create(&poster, NULL, replayPostNotifications, NULL) == 0;
+        pthread_mutex_unlock(&poster_lock);
+    }
+    return 0;
+}
+
+void replayClose(void) {
+    replayPosterStop();
+
+    pthread_rwlock_wrlock(&replay_lock);
+    ReplayLog * log = replay;
+    replay = NULL;
+    pthread_mutex_lock(&registration_lock);
+    registration_count = 0;
+    pthread_mutex_unlock(&registration_lock);
+    pthread_rwlock_unlock(&replay_lock);
+
+    replayFree(log);
+}
+
+void replayGetInfo(ReplayInfo * info) {
+    memset(info, 0, sizeof(ReplayInfo));
+    pthread_rwlock_rdlock(&replay_lock);
+    if (replay != NULL) {
+        info->calls = replay->calls;
+        info->notifications = replay->notification_count;
+        info->duration = replay->duration;
+        pthread_mutex_lock(&replay->lock);
+        info->hits = replay->hits;
+        info->misses = replay->misses;
+        info->posted = replay->posted;
+        info->unheard = replay->unheard;
+        pthread_mutex_unlock(&replay->lock);
+    }
+    pthread_rwlock_unlock(&replay_lock);
+}
+
+const AXBackend replay_backend = {
+    "replay",
+    replayCreateApplication,
+    replayCreateSystemWide,
+    replayProcessExists,
+    replayIsProcessTrusted,
+    replayCopyAttributeValue,
+    replayCopyMultipleAttributeValues,
+    replayCopyParameterizedAttributeValue,
+    replayCopyAttributeNames,
+    replayGetAttributeValueCount,
+    replayIsAttributeSettable,
+    replaySetAttributeValue,
+    replayCopyActionNames,
+    replayCopyActionDescription,
+    replayPerformAction,
+    replayCopyElementAtPosition,
+    replayGetPid,
+    replaySetMessagingTimeout,
+    replayObserverCreate,
+    replayObserverAddNotification,
+    replayObserverRemoveNotification,
+    replayObserverGetRunLoopSource
+};
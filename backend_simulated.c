@@ -0,0 +1,1531 @@
+/*
+ * An in-process stand-in for the accessibility server. Each simulated
+ * application owns a synthetic element tree (windows, groups and a mix of
+ * controls), answers calls after a configurable latency, fails some fraction
+ * of them on purpose, and can post notifications to registered observers on
+ * its own schedule. Everything is deterministic for a given seed, apart from
+ * thread interleaving.
+ *
+ * The tree is generated breadth-first and stored as a flat array; element
+ * references just name a node, so references handed out before a
+ * reconfiguration are recognised (by the world serial in the identifier) and
+ * rejected afterwards.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "backend.h"
+
+#define SIM_NODE_BITS 40
+#define SIM_NODE_MASK ((1ULL << SIM_NODE_BITS) - 1)
+#define SIM_SYSTEM_WIDE ((int64_t) SIM_NODE_MASK)
+#define SIM_UNKNOWN_APPLICATION ((int64_t) SIM_NODE_MASK - 1)
+
+#define SIM_DEFAULT_TIMEOUT 6.0f
+#define SIM_VISIBLE_CHARACTERS 2000
+
+/* Roles, attributes
+======== */
+
+typedef enum {
+    SIM_ROLE_APPLICATION,
+    SIM_ROLE_WINDOW,
+    SIM_ROLE_GROUP,
+    SIM_ROLE_BUTTON,
+    SIM_ROLE_STATIC_TEXT,
+    SIM_ROLE_TEXT_FIELD,
+    SIM_ROLE_TEXT_AREA,
+    SIM_ROLE_CHECK_BOX,
+    SIM_ROLE_SLIDER,
+    SIM_ROLE_LINK,
+    SIM_ROLE_SYSTEM_WIDE
+} SimRole;
+
+static const char * role_names[] = {
+    "AXApplication", "AXWindow", "AXGroup", "AXButton", "AXStaticText", "AXTextField",
+    "AXTextArea", "AXCheckBox", "AXSlider", "AXLink", "AXSystemWide"
+};
+
+static const char * role_descriptions[] = {
+    "application", "standard window", "group", "button", "text", "text field",
+    "text entry area", "check box", "slider", "link", "system wide"
+};
+
+// The order leaves end up in, cycling through the local index.
+static const SimRole leaf_roles[] = {
+    SIM_ROLE_BUTTON, SIM_ROLE_STATIC_TEXT, SIM_ROLE_TEXT_FIELD, SIM_ROLE_CHECK_BOX,
+    SIM_ROLE_SLIDER, SIM_ROLE_LINK, SIM_ROLE_TEXT_AREA, SIM_ROLE_STATIC_TEXT
+};
+
+typedef enum {
+    SIM_ROLE_ATTRIBUTE,
+    SIM_SUBROLE_ATTRIBUTE,
+    SIM_ROLE_DESCRIPTION_ATTRIBUTE,
+    SIM_TITLE_ATTRIBUTE,
+    SIM_DESCRIPTION_ATTRIBUTE,
+    SIM_IDENTIFIER_ATTRIBUTE,
+    SIM_VALUE_ATTRIBUTE,
+    SIM_ENABLED_ATTRIBUTE,
+    SIM_FOCUSED_ATTRIBUTE,
+    SIM_POSITION_ATTRIBUTE,
+    SIM_SIZE_ATTRIBUTE,
+    SIM_FRAME_ATTRIBUTE,
+    SIM_PARENT_ATTRIBUTE,
+    SIM_CHILDREN_ATTRIBUTE,
+    SIM_WINDOW_ATTRIBUTE,
+    SIM_TOP_LEVEL_ATTRIBUTE,
+    SIM_WINDOWS_ATTRIBUTE,
+    SIM_MAIN_WINDOW_ATTRIBUTE,
+    SIM_FOCUSED_WINDOW_ATTRIBUTE,
+    SIM_FOCUSED_UI_ELEMENT_ATTRIBUTE,
+    SIM_FOCUSED_APPLICATION_ATTRIBUTE,
+    SIM_HIDDEN_ATTRIBUTE,
+    SIM_FRONTMOST_ATTRIBUTE,
+    SIM_MAIN_ATTRIBUTE,
+    SIM_MINIMIZED_ATTRIBUTE,
+    SIM_NUMBER_OF_CHARACTERS_ATTRIBUTE,
+    SIM_SELECTED_TEXT_RANGE_ATTRIBUTE,
+    SIM_VISIBLE_CHARACTER_RANGE_ATTRIBUTE,
+    SIM_MIN_VALUE_ATTRIBUTE,
+    SIM_MAX_VALUE_ATTRIBUTE,
+    SIM_URL_ATTRIBUTE,
+    SIM_ATTRIBUTE_COUNT
+} SimAttribute;
+
+static const char * attribute_names[] = {
+    "AXRole", "AXSubrole", "AXRoleDescription", "AXTitle", "AXDescription", "AXIdentifier",
+    "AXValue", "AXEnabled", "AXFocused", "AXPosition", "AXSize", "AXFrame", "AXParent",
+    "AXChildren", "AXWindow", "AXTopLevelUIElement", "AXWindows", "AXMainWindow",
+    "AXFocusedWindow", "AXFocusedUIElement", "AXFocusedApplication", "AXHidden", "AXFrontmost",
+    "AXMain", "AXMinimized", "AXNumberOfCharacters", "AXSelectedTextRange",
+    "AXVisibleCharacterRange", "AXMinValue", "AXMaxValue", "AXURL"
+};
+
+#define BIT(attribute) (1ULL << (attribute))
+
+#define SIM_ELEMENT_ATTRIBUTES (BIT(SIM_ROLE_ATTRIBUTE) | BIT(SIM_ROLE_DESCRIPTION_ATTRIBUTE) \
+    | BIT(SIM_TITLE_ATTRIBUTE) | BIT(SIM_DESCRIPTION_ATTRIBUTE) | BIT(SIM_IDENTIFIER_ATTRIBUTE) \
+    | BIT(SIM_ENABLED_ATTRIBUTE) | BIT(SIM_FOCUSED_ATTRIBUTE) | BIT(SIM_POSITION_ATTRIBUTE) \
+    | BIT(SIM_SIZE_ATTRIBUTE) | BIT(SIM_FRAME_ATTRIBUTE) | BIT(SIM_PARENT_ATTRIBUTE) \
+    | BIT(SIM_CHILDREN_ATTRIBUTE) | BIT(SIM_WINDOW_ATTRIBUTE) | BIT(SIM_TOP_LEVEL_ATTRIBUTE))
+
+#define SIM_TEXT_ATTRIBUTES (SIM_ELEMENT_ATTRIBUTES | BIT(SIM_VALUE_ATTRIBUTE) \
+    | BIT(SIM_NUMBER_OF_CHARACTERS_ATTRIBUTE) | BIT(SIM_SELECTED_TEXT_RANGE_ATTRIBUTE) \
+    | BIT(SIM_VISIBLE_CHARACTER_RANGE_ATTRIBUTE))
+
+static const uint64_t role_attributes[] = {
+    BIT(SIM_ROLE_ATTRIBUTE) | BIT(SIM_ROLE_DESCRIPTION_ATTRIBUTE) | BIT(SIM_TITLE_ATTRIBUTE)
+        | BIT(SIM_CHILDREN_ATTRIBUTE) | BIT(SIM_WINDOWS_ATTRIBUTE) | BIT(SIM_MAIN_WINDOW_ATTRIBUTE)
+        | BIT(SIM_FOCUSED_WINDOW_ATTRIBUTE) | BIT(SIM_FOCUSED_UI_ELEMENT_ATTRIBUTE)
+        | BIT(SIM_HIDDEN_ATTRIBUTE) | BIT(SIM_FRONTMOST_ATTRIBUTE),
+    (SIM_ELEMENT_ATTRIBUTES & ~(BIT(SIM_WINDOW_ATTRIBUTE) | BIT(SIM_TOP_LEVEL_ATTRIBUTE)))
+        | BIT(SIM_SUBROLE_ATTRIBUTE) | BIT(SIM_MAIN_ATTRIBUTE) | BIT(SIM_MINIMIZED_ATTRIBUTE),
+    SIM_ELEMENT_ATTRIBUTES,
+    SIM_ELEMENT_ATTRIBUTES,
+    SIM_ELEMENT_ATTRIBUTES | BIT(SIM_VALUE_ATTRIBUTE),
+    SIM_TEXT_ATTRIBUTES,
+    SIM_TEXT_ATTRIBUTES,
+    SIM_ELEMENT_ATTRIBUTES | BIT(SIM_VALUE_ATTRIBUTE),
+    SIM_ELEMENT_ATTRIBUTES | BIT(SIM_VALUE_ATTRIBUTE) | BIT(SIM_MIN_VALUE_ATTRIBUTE) | BIT(SIM_MAX_VALUE_ATTRIBUTE),
+    SIM_ELEMENT_ATTRIBUTES | BIT(SIM_URL_ATTRIBUTE),
+    BIT(SIM_ROLE_ATTRIBUTE) | BIT(SIM_ROLE_DESCRIPTION_ATTRIBUTE) | BIT(SIM_FOCUSED_APPLICATION_ATTRIBUTE)
+        | BIT(SIM_FOCUSED_UI_ELEMENT_ATTRIBUTE)
+};
+
+static const uint64_t role_settable[] = {
+    BIT(SIM_HIDDEN_ATTRIBUTE) | BIT(SIM_FRONTMOST_ATTRIBUTE),
+    BIT(SIM_POSITION_ATTRIBUTE) | BIT(SIM_SIZE_ATTRIBUTE) | BIT(SIM_MAIN_ATTRIBUTE) | BIT(SIM_FOCUSED_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE) | BIT(SIM_VALUE_ATTRIBUTE) | BIT(SIM_SELECTED_TEXT_RANGE_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE) | BIT(SIM_VALUE_ATTRIBUTE) | BIT(SIM_SELECTED_TEXT_RANGE_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE) | BIT(SIM_VALUE_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE) | BIT(SIM_VALUE_ATTRIBUTE),
+    BIT(SIM_FOCUSED_ATTRIBUTE),
+    0
+};
+
+static const char * role_actions[][3] = {
+    { NULL },
+    { "AXRaise", NULL },
+    { NULL },
+    { "AXPress", NULL },
+    { NULL },
+    { "AXConfirm", NULL },
+    { NULL },
+    { "AXPress", NULL },
+    { "AXIncrement", "AXDecrement", NULL },
+    { "AXPress", NULL },
+    { NULL }
+};
+
+static const char * words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+    "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et"
+};
+
+/* World state
+======== */
+
+typedef struct {
+    int32_t parent;
+    int32_t first_child;
+    int32_t child_count;
+    int32_t window;
+    uint16_t application;
+    uint8_t role;
+    uint8_t depth;
+    uint32_t version;
+    float frame[4];
+    CFTypeRef value; // set through AXValue; generated otherwise
+    CFRange selection;
+} SimNode;
+
+typedef struct {
+    SimApplication config;
+    int32_t base;
+    int32_t count;
+    int32_t focused;
+    int32_t focused_window;
+    int hidden;
+    uint64_t random;
+    double next_notification;
+    CFStringRef text;      // the text last generated, since long ones are read a range at a time
+    int64_t text_node;
+    uint32_t text_version;
+    pthread_mutex_t lock; // random state and any node in this application
+} SimApp;
+
+typedef struct {
+    uint32_t serial;
+    int trusted;
+    float default_timeout;
+    int application_count;
+    int focused_application;
+    SimApp * applications;
+    int32_t node_count;
+    SimNode * nodes;
+} SimWorld;
+
+typedef struct {
+    AXObserverRef observer; // weak, see simObserverFinalize()
+    AXUIElementRef element;
+    CFStringRef notification;
+    void * refcon;
+    pid_t pid;
+} SimRegistration;
+
+static SimWorld * world = NULL;
+static uint32_t world_serial = 0;
+static pthread_rwlock_t world_lock;
+static pthread_once_t world_once = PTHREAD_ONCE_INIT;
+
+static SimRegistration * registrations = NULL;
+static int registration_count = 0;
+static int registration_capacity = 0;
+static pthread_mutex_t registration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t generator;
+static int generator_running = 0;
+static int generator_stopping = 0;
+static pthread_mutex_t generator_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t generator_wake = PTHREAD_COND_INITIALIZER;
+
+static void simWorldLockInit(void) {
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    // Reconfiguring should not wait for a steady stream of calls to dry up
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&world_lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+/* Randomness, time
+======== */
+
+static uint64_t simSplitMix(uint64_t * state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t simNext(uint64_t * state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double simUniform(uint64_t * state) {
+    return (simNext(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double simNormal(uint64_t * state) {
+    double u = simUniform(state), v = simUniform(state);
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+}
+
+static double simLatency(const SimLatency * latency, uint64_t * state) {
+    if (latency->hang_probability > 0 && simUniform(state) < latency->hang_probability)
+        return latency->hang_duration;
+
+    switch (latency->kind) {
+        case SIM_LATENCY_UNIFORM:
+            return latency->a + (latency->b - latency->a) * simUniform(state);
+        case SIM_LATENCY_EXPONENTIAL:
+            return -latency->a * log(1.0 - simUniform(state));
+        case SIM_LATENCY_LOGNORMAL:
+            return latency->a * exp(latency->b * simNormal(state));
+        default:
+            return latency->a;
+    }
+}
+
+static double simNow(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static void simSleep(double seconds) {
+    if (seconds <= 0) return;
+    struct timespec duration;
+    duration.tv_sec = (time_t) seconds;
+    duration.tv_nsec = (long) ((seconds - (double) duration.tv_sec) * 1e9);
+    while (nanosleep(&duration, &duration) == -1 && errno == EINTR);
+}
+
+/* Tree construction
+======== */
+
+static void simLayout(SimNode * nodes, SimNode * node, int index) {
+    SimNode * parent = &nodes[node->parent];
+    float height = (parent->frame[3] - 8) / parent->child_count;
+    node->frame[0] = parent->frame[0] + 4;
+    node->frame[1] = parent->frame[1] + 4 + index * height;
+    node->frame[2] = parent->frame[2] - 8;
+    node->frame[3] = height;
+}
+
+static void simBuildApplication(SimWorld * w, int index, int32_t base) {
+    SimApp * app = &w->applications[index];
+    SimNode * nodes = w->nodes + base;
+    int32_t count = app->count;
+    int windows = app->config.windows < count - 1 ? app->config.windows : count - 1;
+
+    for (int32_t i = 0; i < count; i++) {
+        nodes[i].parent = -1;
+        nodes[i].window = -1;
+        nodes[i].application = (uint16_t) index;
+    }
+
+    nodes[0].role = SIM_ROLE_APPLICATION;
+    nodes[0].first_child = 1;
+    nodes[0].child_count = windows;
+    for (int i = 1; i <= windows; i++) {
+        nodes[i].parent = 0;
+        nodes[i].depth = 1;
+        nodes[i].window = i;
+        nodes[i].frame[0] = 40.0f + 40.0f * (i - 1);
+        nodes[i].frame[1] = 60.0f + 40.0f * (i - 1);
+        nodes[i].frame[2] = 800.0f;
+        nodes[i].frame[3] = 600.0f;
+    }
+
+    // Breadth-first, so that every node's children are contiguous
+    int32_t next = windows + 1;
+    for (int32_t q = 1; q < next && next < count && app->config.fanout > 0; q++) {
+        int32_t children = count - next < app->config.fanout ? count - next : app->config.fanout;
+        nodes[q].first_child = next;
+        nodes[q].child_count = children;
+        for (int32_t c = 0; c < children; c++) {
+            SimNode * child = &nodes[next + c];
+            child->parent = q;
+            child->depth = nodes[q].depth + 1;
+            child->window = nodes[q].window;
+            simLayout(nodes, child, c);
+        }
+        next += children;
+    }
+
+    for (int32_t i = windows + 1; i < count; i++) {
+        nodes[i].role = nodes[i].child_count > 0 ? SIM_ROLE_GROUP : leaf_roles[i % (sizeof(leaf_roles) / sizeof(leaf_roles[0]))];
+    }
+    for (int i = 1; i <= windows; i++) nodes[i].role = SIM_ROLE_WINDOW;
+
+    // Store global indices from here on
+    for (int32_t i = 0; i < count; i++) {
+        if (nodes[i].parent >= 0) nodes[i].parent += base;
+        if (nodes[i].window >= 0) nodes[i].window += base;
+        if (nodes[i].child_count > 0) nodes[i].first_child += base;
+    }
+
+    app->base = base;
+    app->focused_window = windows > 0 ? base + 1 : -1;
+    app->focused = app->focused_window >= 0 ? app->focused_window : base;
+}
+
+static void simWorldFree(SimWorld * w) {
+    if (w == NULL) return;
+    for (int32_t i = 0; i < w->node_count; i++) {
+        if (w->nodes[i].value) CFRelease(w->nodes[i].value);
+    }
+    for (int i = 0; i < w->application_count; i++) {
+        if (w->applications[i].text) CFRelease(w->applications[i].text);
+        pthread_mutex_destroy(&w->applications[i].lock);
+    }
+    free(w->nodes);
+    free(w->applications);
+    free(w);
+}
+
+/* Element references
+======== */
+
+static AXUIElementRef simElement(SimWorld * w, int64_t node) {
+    uint64_t identifier = ((uint64_t) w->serial << SIM_NODE_BITS) | (uint64_t) node;
+    pid_t pid = 0;
+    if (node >= 0 && node < w->node_count) pid = w->applications[w->nodes[node].application].config.pid;
+    return AXCompatElementCreate(&simulated_backend, identifier, pid);
+}
+
+typedef struct {
+    SimWorld * world;
+    SimApp * application;
+    int64_t node; // SIM_SYSTEM_WIDE for the system-wide element
+    float timeout;
+} SimTarget;
+
+static SimApp * simApplicationForPid(SimWorld * w, pid_t pid) {
+    for (int i = 0; i < w->application_count; i++) {
+        if (w->applications[i].config.pid == pid) return &w->applications[i];
+    }
+    return NULL;
+}
+
+// Takes a read lock on the world, which simEnd() releases.
+static AXError simBegin(AXUIElementRef element, SimTarget * target) {
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_rdlock(&world_lock);
+
+    SimWorld * w = world;
+    if (w == NULL || element == NULL || CFGetTypeID(element) != AXUIElementGetTypeID()
+            || AXCompatElementGetOwner(element) != &simulated_backend)
+        return kAXErrorInvalidUIElement;
+
+    uint64_t identifier = AXCompatElementGetIdentifier(element);
+    if ((identifier >> SIM_NODE_BITS) != w->serial)
+        return kAXErrorInvalidUIElement;
+    if (!w->trusted)
+        return kAXErrorAPIDisabled;
+
+    target->world = w;
+    target->node = (int64_t) (identifier & SIM_NODE_MASK);
+    target->timeout = AXCompatElementGetTimeout(element);
+    if (target->timeout <= 0) target->timeout = w->default_timeout;
+
+    if (target->node == SIM_SYSTEM_WIDE) {
+        target->application = &w->applications[w->focused_application];
+        return kAXErrorSuccess;
+    }
+    if (target->node == SIM_UNKNOWN_APPLICATION || target->node >= w->node_count)
+        return kAXErrorCannotComplete;
+    target->application = &w->applications[w->nodes[target->node].application];
+    return kAXErrorSuccess;
+}
+
+static void simEnd(void) {
+    pthread_rwlock_unlock(&world_lock);
+}
+
+/*
+ * Stands in for the round trip to the application: waits out the sampled
+ * latency (or the timeout, if that comes first) and then maybe fails on
+ * purpose.
+ */
+static AXError simRoundTrip(SimTarget * target, int can_have_no_value) {
+    SimApp * app = target->application;
+
+    pthread_mutex_lock(&app->lock);
+    double latency = simLatency(&app->config.latency, &app->random);
+    double draw = simUniform(&app->random);
+    pthread_mutex_unlock(&app->lock);
+
+    if (latency > target->timeout) {
+        simSleep(target->timeout);
+        return kAXErrorCannotComplete;
+    }
+    simSleep(latency);
+
+    if (draw < app->config.cannot_complete) return kAXErrorCannotComplete;
+    draw -= app->config.cannot_complete;
+    if (draw < app->config.invalid_element) return kAXErrorInvalidUIElement;
+    draw -= app->config.invalid_element;
+    if (can_have_no_value && draw < app->config.no_value) return kAXErrorNoValue;
+    return kAXErrorSuccess;
+}
+
+static SimRole simRole(SimTarget * target) {
+    if (target->node == SIM_SYSTEM_WIDE) return SIM_ROLE_SYSTEM_WIDE;
+    return (SimRole) target->world->nodes[target->node].role;
+}
+
+static int simAttributeIndex(CFStringRef attribute) {
+    const char * name = CFStringGetCStringPtr(attribute, kCFStringEncodingUTF8);
+    if (name == NULL) return -1;
+    for (int i = 0; i < SIM_ATTRIBUTE_COUNT; i++) {
+        if (strcmp(name, attribute_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* Attribute values
+======== */
+
+// Whole copies of a configured sample, padded with spaces to length.
+static CFStringRef simRepeat(const char * sample, int length) {
+    CFStringRef unit = CFStringCreateWithCString(kCFAllocatorDefault, sample, kCFStringEncodingUTF8);
+    if (unit == NULL) return NULL;
+    CFIndex units = CFStringGetLength(unit);
+    CFRelease(unit);
+
+    size_t size = strlen(sample);
+    char * text = malloc(((size_t) length / (size_t) units + 1) * size + (size_t) length + 1);
+    if (text == NULL) return NULL;
+    size_t used = 0;
+    for (int filled = 0; filled < length; ) {
+        if (filled + units <= length) {
+            memcpy(text + used, sample, size);
+            used += size;
+            filled += (int) units;
+        } else {
+            text[used++] = ' ';
+            filled++;
+        }
+    }
+    text[used] = '\0';
+
+    CFStringRef string = CFStringCreateWithCString(kCFAllocatorDefault, text, kCFStringEncodingUTF8);
+    free(text);
+    return string;
+}
+
+static CFStringRef simText(SimTarget * target, const SimNode * node, int64_t index) {
+    int length = target->application->config.text_length;
+    if (node->role == SIM_ROLE_TEXT_FIELD && length > 40) length = 40;
+    if (node->role == SIM_ROLE_STATIC_TEXT && length > 24) length = 24;
+
+    const char * sample = target->application->config.text;
+    if (sample[0] != '\0') return simRepeat(sample, length);
+
+    char * text = malloc((size_t) length + 1);
+    if (text == NULL) return NULL;
+
+    uint64_t state = (uint64_t) index * 0x9E3779B97F4A7C15ULL + node->version;
+    int used = 0;
+    while (used < length) {
+        const char * word = words[simSplitMix(&state) % (sizeof(words) / sizeof(words[0]))];
+        for (const char * c = word; *c && used < length; c++) text[used++] = *c;
+        if (used < length) text[used++] = ' ';
+    }
+    text[length] = '\0';
+
+    CFStringRef string = CFStringCreateWithCString(kCFAllocatorDefault, text, kCFStringEncodingUTF8);
+    free(text);
+    return string;
+}
+
+static CFStringRef simString(const char * format, ...) __attribute__((format(printf, 1, 2)));
+
+static CFStringRef simString(const char * format, ...) {
+    char buffer[256];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+    return CFStringCreateWithCString(kCFAllocatorDefault, buffer, kCFStringEncodingUTF8);
+}
+
+static CFArrayRef simChildren(SimWorld * w, const SimNode * node) {
+    CFMutableArrayRef children = CFArrayCreateMutable(kCFAllocatorDefault, node->child_count, &kCFTypeArrayCallBacks);
+    for (int32_t i = 0; i < node->child_count; i++) {
+        AXUIElementRef child = simElement(w, node->first_child + i);
+        CFArrayAppendValue(children, child);
+        CFRelease(child);
+    }
+    return children;
+}
+
+static CFTypeRef simBoolean(int value) {
+    return CFRetain(value ? kCFBooleanTrue : kCFBooleanFalse);
+}
+
+static CFTypeRef simNumber(double value) {
+    return CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &value);
+}
+
+// Generated values for AXValue; expects the application lock to be held.
+static CFTypeRef simValue(SimTarget * target, const SimNode * node) {
+    SimApp * app = target->application;
+    if (node->value) return CFRetain(node->value);
+    switch (node->role) {
+        case SIM_ROLE_TEXT_FIELD:
+        case SIM_ROLE_TEXT_AREA:
+        case SIM_ROLE_STATIC_TEXT:
+            if (app->text == NULL || app->text_node != target->node || app->text_version != node->version) {
+                CFStringRef text = simText(target, node, target->node);
+                if (text == NULL) return NULL;
+                if (app->text) CFRelease(app->text);
+                app->text = text;
+                app->text_node = target->node;
+                app->text_version = node->version;
+            }
+            return CFRetain(app->text);
+        case SIM_ROLE_CHECK_BOX: {
+            int checked = (int) (node->version & 1);
+            return CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &checked);
+        }
+        case SIM_ROLE_SLIDER:
+            return simNumber((double) ((target->node * 7 + node->version) % 101));
+        default:
+            return NULL;
+    }
+}
+
+static CFIndex simTextLength(SimTarget * target, const SimNode * node) {
+    CFTypeRef value = simValue(target, node);
+    CFIndex length = 0;
+    if (value != NULL) {
+        if (CFGetTypeID(value) == CFStringGetTypeID()) length = CFStringGetLength(value);
+        CFRelease(value);
+    }
+    return length;
+}
+
+static AXError simCopyValue(SimTarget * target, SimAttribute attribute, CFTypeRef * value) {
+    SimWorld * w = target->world;
+    SimApp * app = target->application;
+
+    if (target->node == SIM_SYSTEM_WIDE) {
+        switch (attribute) {
+            case SIM_ROLE_ATTRIBUTE: *value = simString("%s", role_names[SIM_ROLE_SYSTEM_WIDE]); break;
+            case SIM_ROLE_DESCRIPTION_ATTRIBUTE: *value = simString("%s", role_descriptions[SIM_ROLE_SYSTEM_WIDE]); break;
+            case SIM_FOCUSED_APPLICATION_ATTRIBUTE: *value = simElement(w, app->base); break;
+            case SIM_FOCUSED_UI_ELEMENT_ATTRIBUTE: *value = simElement(w, app->focused); break;
+            default: return kAXErrorAttributeUnsupported;
+        }
+        return kAXErrorSuccess;
+    }
+
+    const SimNode * node = &w->nodes[target->node];
+    int64_t local = target->node - app->base;
+    CGPoint point;
+    CGSize size;
+    CGRect rect;
+    CFRange range;
+
+    pthread_mutex_lock(&app->lock);
+    switch (attribute) {
+        case SIM_ROLE_ATTRIBUTE:
+            *value = simString("%s", role_names[node->role]);
+            break;
+        case SIM_SUBROLE_ATTRIBUTE:
+            *value = simString("AXStandardWindow");
+            break;
+        case SIM_ROLE_DESCRIPTION_ATTRIBUTE:
+            *value = simString("%s", role_descriptions[node->role]);
+            break;
+        case SIM_TITLE_ATTRIBUTE:
+            if (node->role == SIM_ROLE_APPLICATION)
+                *value = simString("%s", app->config.name);
+            else if (node->version > 0)
+                *value = simString("%s %lld (%u)", role_names[node->role] + 2, (long long) local, node->version);
+            else
+                *value = simString("%s %lld", role_names[node->role] + 2, (long long) local);
+            break;
+        case SIM_DESCRIPTION_ATTRIBUTE:
+            *value = simString("%s %lld", role_descriptions[node->role], (long long) local);
+            break;
+        case SIM_IDENTIFIER_ATTRIBUTE:
+            *value = simString("node-%lld", (long long) local);
+            break;
+        case SIM_VALUE_ATTRIBUTE:
+            *value = simValue(target, node);
+            break;
+        case SIM_ENABLED_ATTRIBUTE:
+            *value = simBoolean(1);
+            break;
+        case SIM_FOCUSED_ATTRIBUTE:
+            *value = simBoolean(app->focused == target->node);
+            break;
+        case SIM_POSITION_ATTRIBUTE:
+            point = CGPointMake(node->frame[0], node->frame[1]);
+            *value = AXValueCreate(kAXValueCGPointType, &point);
+            break;
+        case SIM_SIZE_ATTRIBUTE:
+            size = CGSizeMake(node->frame[2], node->frame[3]);
+            *value = AXValueCreate(kAXValueCGSizeType, &size);
+            break;
+        case SIM_FRAME_ATTRIBUTE:
+            rect = CGRectMake(node->frame[0], node->frame[1], node->frame[2], node->frame[3]);
+            *value = AXValueCreate(kAXValueCGRectType, &rect);
+            break;
+        case SIM_PARENT_ATTRIBUTE:
+            *value = node->parent >= 0 ? simElement(w, node->parent) : NULL;
+            break;
+        case SIM_CHILDREN_ATTRIBUTE:
+        case SIM_WINDOWS_ATTRIBUTE:
+            *value = simChildren(w, node);
+            break;
+        case SIM_WINDOW_ATTRIBUTE:
+        case SIM_TOP_LEVEL_ATTRIBUTE:
+            *value = node->window >= 0 ? simElement(w, node->window) : NULL;
+            break;
+        case SIM_MAIN_WINDOW_ATTRIBUTE:
+        case SIM_FOCUSED_WINDOW_ATTRIBUTE:
+            *value = app->focused_window >= 0 ? simElement(w, app->focused_window) : NULL;
+            break;
+        case SIM_FOCUSED_UI_ELEMENT_ATTRIBUTE:
+            *value = simElement(w, app->focused);
+            break;
+        case SIM_HIDDEN_ATTRIBUTE:
+            *value = simBoolean(app->hidden);
+            break;
+        case SIM_FRONTMOST_ATTRIBUTE:
+            *value = simBoolean(app == &w->applications[w->focused_application]);
+            break;
+        case SIM_MAIN_ATTRIBUTE:
+            *value = simBoolean(app->focused_window == target->node);
+            break;
+        case SIM_MINIMIZED_ATTRIBUTE:
+            *value = simBoolean(0);
+            break;
+        case SIM_NUMBER_OF_CHARACTERS_ATTRIBUTE:
+            range.length = simTextLength(target, node);
+            *value = CFNumberCreate(kCFAllocatorDefault, kCFNumberCFIndexType, &range.length);
+            break;
+        case SIM_SELECTED_TEXT_RANGE_ATTRIBUTE:
+            range = node->selection;
+            *value = AXValueCreate(kAXValueCFRangeType, &range);
+            break;
+        case SIM_VISIBLE_CHARACTER_RANGE_ATTRIBUTE:
+            range.location = 0;
+            range.length = simTextLength(target, node);
+            if (range.length > SIM_VISIBLE_CHARACTERS) range.length = SIM_VISIBLE_CHARACTERS;
+            *value = AXValueCreate(kAXValueCFRangeType, &range);
+            break;
+        case SIM_MIN_VALUE_ATTRIBUTE:
+            *value = simNumber(0.0);
+            break;
+        case SIM_MAX_VALUE_ATTRIBUTE:
+            *value = simNumber(100.0);
+            break;
+        case SIM_URL_ATTRIBUTE: {
+            CFStringRef string = simString("https://example.com/%d/%lld", (int) app->config.pid, (long long) local);
+            *value = CFURLCreateWithString(kCFAllocatorDefault, string, NULL);
+            CFRelease(string);
+            break;
+        }
+        default:
+            *value = NULL;
+            break;
+    }
+    pthread_mutex_unlock(&app->lock);
+
+    return *value == NULL ? kAXErrorNoValue : kAXErrorSuccess;
+}
+
+/* Backend implementation
+======== */
+
+static AXUIElementRef simCreateApplication(pid_t pid) {
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_rdlock(&world_lock);
+    AXUIElementRef element = NULL;
+    if (world != NULL) {
+        SimApp * app = simApplicationForPid(world, pid);
+        element = simElement(world, app ? app->base : SIM_UNKNOWN_APPLICATION);
+        if (app == NULL) {
+            // Keep the pid anyway, as the real function does
+            CFRelease(element);
+            element = AXCompatElementCreate(&simulated_backend,
+                ((uint64_t) world->serial << SIM_NODE_BITS) | (uint64_t) SIM_UNKNOWN_APPLICATION, pid);
+        }
+    } else {
+        element = AXCompatElementCreate(&simulated_backend, SIM_NODE_MASK - 1, pid);
+    }
+    pthread_rwlock_unlock(&world_lock);
+    return element;
+}
+
+static AXUIElementRef simCreateSystemWide(void) {
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_rdlock(&world_lock);
+    uint32_t serial = world != NULL ? world->serial : 0;
+    pthread_rwlock_unlock(&world_lock);
+    return AXCompatElementCreate(&simulated_backend, ((uint64_t) serial << SIM_NODE_BITS) | SIM_NODE_MASK, 0);
+}
+
+static Boolean simProcessExists(pid_t pid) {
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_rdlock(&world_lock);
+    Boolean exists = world != NULL && simApplicationForPid(world, pid) != NULL;
+    pthread_rwlock_unlock(&world_lock);
+    return exists;
+}
+
+static Boolean simIsProcessTrusted(CFDictionaryRef options) {
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_rdlock(&world_lock);
+    Boolean trusted = world != NULL && world->trusted;
+    pthread_rwlock_unlock(&world_lock);
+    return trusted;
+}
+
+static AXError simCopyAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef * value) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 1);
+    if (error == kAXErrorSuccess) {
+        int index = simAttributeIndex(attribute);
+        if (index < 0 || !(role_attributes[simRole(&target)] & BIT(index)))
+            error = kAXErrorAttributeUnsupported;
+        else
+            error = simCopyValue(&target, (SimAttribute) index, value);
+    }
+    simEnd();
+    return error;
+}
+
+/*
+ * One round trip for all of the attributes, as with the real API. Attributes
+ * that fail are answered with an AXValue holding the error, unless asked to
+ * stop at the first one.
+ */
+static AXError simCopyMultipleAttributeValues(AXUIElementRef element, CFArrayRef attributes, AXCopyMultipleAttributeOptions options, CFArrayRef * values) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        CFIndex count = CFArrayGetCount(attributes);
+        uint64_t mask = role_attributes[simRole(&target)];
+        CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
+        for (CFIndex i = 0; i < count && error == kAXErrorSuccess; i++) {
+            int index = simAttributeIndex(CFArrayGetValueAtIndex(attributes, i));
+            CFTypeRef value = NULL;
+            AXError failure = kAXErrorAttributeUnsupported;
+            if (index >= 0 && (mask & BIT(index)))
+                failure = simCopyValue(&target, (SimAttribute) index, &value);
+            if (failure != kAXErrorSuccess) {
+                if (options & kAXCopyMultipleAttributeOptionStopOnError) {
+                    error = failure;
+                    break;
+                }
+                value = AXValueCreate(kAXValueAXErrorType, &failure);
+            }
+            CFArrayAppendValue(array, value);
+            CFRelease(value);
+        }
+        if (error == kAXErrorSuccess) *values = array;
+        else CFRelease(array);
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simCopyAttributeNames(AXUIElementRef element, CFArrayRef * names) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        uint64_t mask = role_attributes[simRole(&target)];
+        CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, SIM_ATTRIBUTE_COUNT, &kCFTypeArrayCallBacks);
+        for (int i = 0; i < SIM_ATTRIBUTE_COUNT; i++) {
+            if (!(mask & BIT(i))) continue;
+            CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, attribute_names[i], kCFStringEncodingUTF8);
+            CFArrayAppendValue(array, name);
+            CFRelease(name);
+        }
+        *names = array;
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simGetAttributeValueCount(AXUIElementRef element, CFStringRef attribute, CFIndex * count) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        int index = simAttributeIndex(attribute);
+        if (index < 0 || !(role_attributes[simRole(&target)] & BIT(index)))
+            error = kAXErrorAttributeUnsupported;
+        else if (index == SIM_CHILDREN_ATTRIBUTE || index == SIM_WINDOWS_ATTRIBUTE)
+            *count = target.node == SIM_SYSTEM_WIDE ? 0 : target.world->nodes[target.node].child_count;
+        else
+            error = kAXErrorIllegalArgument;
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simIsAttributeSettable(AXUIElementRef element, CFStringRef attribute, Boolean * settable) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        int index = simAttributeIndex(attribute);
+        SimRole role = simRole(&target);
+        if (index < 0 || !(role_attributes[role] & BIT(index)))
+            error = kAXErrorAttributeUnsupported;
+        else
+            *settable = (role_settable[role] & BIT(index)) != 0;
+    }
+    simEnd();
+    return error;
+}
+
+static int simGetAXValue(CFTypeRef value, AXValueType type, void * out) {
+    return value != NULL && CFGetTypeID(value) == AXValueGetTypeID() && AXValueGetValue(value, type, out);
+}
+
+static int simGetBoolean(CFTypeRef value, int * out) {
+    if (value == NULL || CFGetTypeID(value) != CFBooleanGetTypeID()) return 0;
+    *out = CFBooleanGetValue(value);
+    return 1;
+}
+
+static AXError simSetAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef value) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error != kAXErrorSuccess) {
+        simEnd();
+        return error;
+    }
+
+    int index = simAttributeIndex(attribute);
+    SimRole role = simRole(&target);
+    if (index < 0 || !(role_attributes[role] & BIT(index))) {
+        simEnd();
+        return kAXErrorAttributeUnsupported;
+    }
+    if (!(role_settable[role] & BIT(index))) {
+        simEnd();
+        return kAXErrorIllegalArgument;
+    }
+
+    SimWorld * w = target.world;
+    SimApp * app = target.application;
+    SimNode * node = &w->nodes[target.node];
+    CGPoint point;
+    CGSize size;
+    CFRange range;
+    int flag;
+
+    pthread_mutex_lock(&app->lock);
+    switch (index) {
+        case SIM_POSITION_ATTRIBUTE:
+            if (!simGetAXValue(value, kAXValueCGPointType, &point)) error = kAXErrorIllegalArgument;
+            else {
+                node->frame[0] = (float) point.x;
+                node->frame[1] = (float) point.y;
+            }
+            break;
+        case SIM_SIZE_ATTRIBUTE:
+            if (!simGetAXValue(value, kAXValueCGSizeType, &size)) error = kAXErrorIllegalArgument;
+            else {
+                node->frame[2] = (float) size.width;
+                node->frame[3] = (float) size.height;
+            }
+            break;
+        case SIM_SELECTED_TEXT_RANGE_ATTRIBUTE:
+            if (!simGetAXValue(value, kAXValueCFRangeType, &range)) error = kAXErrorIllegalArgument;
+            else node->selection = range;
+            break;
+        case SIM_VALUE_ATTRIBUTE:
+            if (value == NULL) {
+                error = kAXErrorIllegalArgument;
+                break;
+            }
+            if (node->value) CFRelease(node->value);
+            node->value = CFRetain(value);
+            node->version++;
+            break;
+        case SIM_FOCUSED_ATTRIBUTE:
+            if (!simGetBoolean(value, &flag)) error = kAXErrorIllegalArgument;
+            else if (flag) app->focused = (int32_t) target.node;
+            break;
+        case SIM_MAIN_ATTRIBUTE:
+            if (!simGetBoolean(value, &flag)) error = kAXErrorIllegalArgument;
+            else if (flag) app->focused_window = (int32_t) target.node;
+            break;
+        case SIM_HIDDEN_ATTRIBUTE:
+            if (!simGetBoolean(value, &flag)) error = kAXErrorIllegalArgument;
+            else app->hidden = flag;
+            break;
+        case SIM_FRONTMOST_ATTRIBUTE:
+            if (!simGetBoolean(value, &flag)) error = kAXErrorIllegalArgument;
+            else if (flag) w->focused_application = (int) (app - w->applications);
+            break;
+        default:
+            error = kAXErrorIllegalArgument;
+            break;
+    }
+    pthread_mutex_unlock(&app->lock);
+
+    simEnd();
+    return error;
+}
+
+// Only AXStringForRange, which text elements answer from their AXValue.
+static AXError simCopyParameterizedAttributeValue(AXUIElementRef element, CFStringRef attribute, CFTypeRef parameter, CFTypeRef * value) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error != kAXErrorSuccess) {
+        simEnd();
+        return error;
+    }
+
+    CFRange range;
+    if (!(role_attributes[simRole(&target)] & BIT(SIM_NUMBER_OF_CHARACTERS_ATTRIBUTE))
+            || CFStringCompare(attribute, kAXStringForRangeParameterizedAttribute, 0) != kCFCompareEqualTo) {
+        error = kAXErrorParameterizedAttributeUnsupported;
+    } else if (!simGetAXValue(parameter, kAXValueCFRangeType, &range)) {
+        error = kAXErrorIllegalArgument;
+    } else {
+        SimApp * app = target.application;
+        pthread_mutex_lock(&app->lock);
+        CFTypeRef text = simValue(&target, &target.world->nodes[target.node]);
+        pthread_mutex_unlock(&app->lock);
+
+        if (text == NULL || CFGetTypeID(text) != CFStringGetTypeID()) error = kAXErrorNoValue;
+        else if (range.location < 0 || range.length < 0 || range.location + range.length > CFStringGetLength(text))
+            error = kAXErrorIllegalArgument;
+        else *value = CFStringCreateWithSubstring(kCFAllocatorDefault, text, range);
+        if (text != NULL) CFRelease(text);
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simCopyActionNames(AXUIElementRef element, CFArrayRef * names) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 2, &kCFTypeArrayCallBacks);
+        for (const char ** action = role_actions[simRole(&target)]; *action != NULL; action++) {
+            CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, *action, kCFStringEncodingUTF8);
+            CFArrayAppendValue(array, name);
+            CFRelease(name);
+        }
+        *names = array;
+    }
+    simEnd();
+    return error;
+}
+
+static int simActionIndex(SimRole role, CFStringRef action) {
+    const char * name = CFStringGetCStringPtr(action, kCFStringEncodingUTF8);
+    for (int i = 0; name != NULL && role_actions[role][i] != NULL; i++) {
+        if (strcmp(name, role_actions[role][i]) == 0) return i;
+    }
+    return -1;
+}
+
+static AXError simCopyActionDescription(AXUIElementRef element, CFStringRef action, CFStringRef * description) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        SimRole role = simRole(&target);
+        int index = simActionIndex(role, action);
+        if (index < 0) {
+            error = kAXErrorActionUnsupported;
+        } else {
+            // "AXPress" is described as "press", and so on
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "%s", role_actions[role][index] + 2);
+            buffer[0] = (char) (buffer[0] - 'A' + 'a');
+            *description = CFStringCreateWithCString(kCFAllocatorDefault, buffer, kCFStringEncodingUTF8);
+        }
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simPerformAction(AXUIElementRef element, CFStringRef action) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        SimRole role = simRole(&target);
+        int index = simActionIndex(role, action);
+        if (index < 0) {
+            error = kAXErrorActionUnsupported;
+        } else {
+            SimWorld * w = target.world;
+            SimApp * app = target.application;
+            SimNode * node = &w->nodes[target.node];
+
+            pthread_mutex_lock(&app->lock);
+            if (role == SIM_ROLE_WINDOW) {
+                app->focused_window = (int32_t) target.node;
+                w->focused_application = (int) (app - w->applications);
+            } else if (role == SIM_ROLE_SLIDER && node->value == NULL) {
+                // Without an explicit value, the version drives the slider
+                if (index == 0) node->version++;
+                else if (node->version > 0) node->version--;
+            } else {
+                node->version++;
+            }
+            pthread_mutex_unlock(&app->lock);
+        }
+    }
+    simEnd();
+    return error;
+}
+
+static int simContains(const SimNode * node, float x, float y) {
+    return x >= node->frame[0] && x < node->frame[0] + node->frame[2]
+        && y >= node->frame[1] && y < node->frame[1] + node->frame[3];
+}
+
+static int64_t simHitTest(SimWorld * w, SimApp * app, float x, float y) {
+    SimNode * root = &w->nodes[app->base];
+    int64_t hit = -1;
+
+    // The focused window is on top
+    if (app->focused_window >= 0 && simContains(&w->nodes[app->focused_window], x, y))
+        hit = app->focused_window;
+    for (int32_t i = 0; hit < 0 && i < root->child_count; i++) {
+        if (simContains(&w->nodes[root->first_child + i], x, y)) hit = root->first_child + i;
+    }
+
+    while (hit >= 0) {
+        SimNode * node = &w->nodes[hit];
+        int64_t deeper = -1;
+        for (int32_t i = 0; i < node->child_count; i++) {
+            if (simContains(&w->nodes[node->first_child + i], x, y)) {
+                deeper = node->first_child + i;
+                break;
+            }
+        }
+        if (deeper < 0) break;
+        hit = deeper;
+    }
+    return hit;
+}
+
+static AXError simCopyElementAtPosition(AXUIElementRef element, float x, float y, AXUIElementRef * result) {
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess) error = simRoundTrip(&target, 0);
+    if (error == kAXErrorSuccess) {
+        SimWorld * w = target.world;
+        int64_t hit = -1;
+
+        pthread_mutex_lock(&target.application->lock);
+        hit = simHitTest(w, target.application, x, y);
+        pthread_mutex_unlock(&target.application->lock);
+
+        // The system-wide element looks behind the frontmost application too
+        for (int i = 0; hit < 0 && target.node == SIM_SYSTEM_WIDE && i < w->application_count; i++) {
+            SimApp * app = &w->applications[i];
+            if (app == target.application) continue;
+            pthread_mutex_lock(&app->lock);
+            hit = simHitTest(w, app, x, y);
+            pthread_mutex_unlock(&app->lock);
+        }
+
+        if (hit < 0) error = kAXErrorNoValue;
+        else *result = simElement(w, hit);
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simGetPid(AXUIElementRef element, pid_t * pid) {
+    if (element == NULL || CFGetTypeID(element) != AXUIElementGetTypeID()
+            || AXCompatElementGetOwner(element) != &simulated_backend)
+        return kAXErrorInvalidUIElement;
+    if ((AXCompatElementGetIdentifier(element) & SIM_NODE_MASK) == (uint64_t) SIM_SYSTEM_WIDE)
+        return kAXErrorIllegalArgument;
+    *pid = AXCompatElementGetPid(element);
+    return kAXErrorSuccess;
+}
+
+static AXError simSetMessagingTimeout(AXUIElementRef element, float timeout) {
+    if (timeout < 0) return kAXErrorIllegalArgument;
+    if (element == NULL || CFGetTypeID(element) != AXUIElementGetTypeID()
+            || AXCompatElementGetOwner(element) != &simulated_backend)
+        return kAXErrorInvalidUIElement;
+
+    // As with the real thing, the system-wide element sets the default
+    if ((AXCompatElementGetIdentifier(element) & SIM_NODE_MASK) == (uint64_t) SIM_SYSTEM_WIDE) {
+        pthread_once(&world_once, simWorldLockInit);
+        pthread_rwlock_rdlock(&world_lock);
+        if (world != NULL) world->default_timeout = timeout > 0 ? timeout : SIM_DEFAULT_TIMEOUT;
+        pthread_rwlock_unlock(&world_lock);
+    } else {
+        AXCompatElementSetTimeout(element, timeout);
+    }
+    return kAXErrorSuccess;
+}
+
+/* Observers
+======== */
+
+static void simRegistrationRelease(SimRegistration * registration) {
+    CFRelease(registration->element);
+    CFRelease(registration->notification);
+}
+
+/*
+ * Registrations only hold their observer weakly, like the real server; this
+ * runs before an observer is freed and drops whatever it left behind.
+ * Posting to an observer that is being finalized is a no-op, so holding the
+ * registration lock here is enough to make the weak reference safe.
+ */
+static void simObserverFinalize(AXObserverRef observer) {
+    pthread_mutex_lock(&registration_lock);
+    for (int i = 0; i < registration_count; ) {
+        if (registrations[i].observer == observer) {
+            simRegistrationRelease(&registrations[i]);
+            registrations[i] = registrations[--registration_count];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&registration_lock);
+}
+
+static AXError simObserverCreate(pid_t pid, AXObserverCallback callback, AXObserverRef * observer) {
+    if (callback == NULL) return kAXErrorIllegalArgument;
+    *observer = AXCompatObserverCreate(&simulated_backend, pid, callback, simObserverFinalize);
+    return *observer != NULL ? kAXErrorSuccess : kAXErrorFailure;
+}
+
+static int simFindRegistration(AXObserverRef observer, AXUIElementRef element, CFStringRef notification) {
+    for (int i = 0; i < registration_count; i++) {
+        if (registrations[i].observer == observer && CFEqual(registrations[i].element, element)
+                && CFEqual(registrations[i].notification, notification))
+            return i;
+    }
+    return -1;
+}
+
+static AXError simObserverAddNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    if (observer == NULL || AXCompatObserverGetOwner(observer) != &simulated_backend)
+        return kAXErrorInvalidUIElementObserver;
+
+    SimTarget target;
+    AXError error = simBegin(element, &target);
+    if (error == kAXErrorSuccess && target.node != SIM_SYSTEM_WIDE
+            && target.application->config.pid != AXCompatObserverGetPid(observer))
+        error = kAXErrorIllegalArgument;
+
+    if (error == kAXErrorSuccess) {
+        pthread_mutex_lock(&registration_lock);
+        if (simFindRegistration(observer, element, notification) >= 0) {
+            error = kAXErrorNotificationAlreadyRegistered;
+        } else {
+            if (registration_count == registration_capacity) {
+                int capacity = registration_capacity ? registration_capacity * 2 : 16;
+                SimRegistration * grown = realloc(registrations, sizeof(SimRegistration) * capacity);
+                if (grown == NULL) error = kAXErrorFailure;
+                else {
+                    registrations = grown;
+                    registration_capacity = capacity;
+                }
+            }
+            if (error == kAXErrorSuccess) {
+                SimRegistration * registration = &registrations[registration_count++];
+                registration->observer = observer;
+                registration->element = CFRetain(element);
+                registration->notification = CFRetain(notification);
+                registration->refcon = refcon;
+                registration->pid = AXCompatObserverGetPid(observer);
+            }
+        }
+        pthread_mutex_unlock(&registration_lock);
+    }
+    simEnd();
+    return error;
+}
+
+static AXError simObserverRemoveNotification(AXObserverRef observer, AXUIElementRef element, CFStringRef notification) {
+    if (observer == NULL || AXCompatObserverGetOwner(observer) != &simulated_backend)
+        return kAXErrorInvalidUIElementObserver;
+
+    AXError error = kAXErrorNotificationNotRegistered;
+    pthread_mutex_lock(&registration_lock);
+    int index = simFindRegistration(observer, element, notification);
+    if (index >= 0) {
+        simRegistrationRelease(&registrations[index]);
+        registrations[index] = registrations[--registration_count];
+        error = kAXErrorSuccess;
+    }
+    pthread_mutex_unlock(&registration_lock);
+    return error;
+}
+
+long simulatedPostNotification(AXUIElementRef element, CFStringRef notification, long count) {
+    SimTarget target;
+    long posted = 0;
+    if (simBegin(element, &target) != kAXErrorSuccess) {
+        simEnd();
+        return -1;
+    }
+
+    pthread_mutex_lock(&registration_lock);
+    for (int i = 0; i < registration_count; i++) {
+        SimRegistration * registration = &registrations[i];
+        if (!CFEqual(registration->element, element) || !CFEqual(registration->notification, notification))
+            continue;
+        for (long n = 0; n < count; n++) {
+            posted += AXCompatObserverPost(registration->observer, element, notification, registration->refcon);
+        }
+    }
+    pthread_mutex_unlock(&registration_lock);
+
+    simEnd();
+    return posted;
+}
+
+/* Notification generator
+======== */
+
+static int simNotificationAllowed(const SimApplication * config, CFStringRef notification) {
+    if (config->notification_count == 0) return 1;
+    const char * name = CFStringGetCStringPtr(notification, kCFStringEncodingUTF8);
+    for (int i = 0; name != NULL && i < config->notification_count; i++) {
+        if (strcmp(name, config->notifications[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Makes the world agree with what is about to be announced, and returns the
+// node it is about. Expects the application lock to be held.
+static int64_t simApplyNotification(SimWorld * w, SimApp * app, CFStringRef notification) {
+    const char * name = CFStringGetCStringPtr(notification, kCFStringEncodingUTF8);
+    SimNode * root = &w->nodes[app->base];
+    int64_t node = app->base + (int64_t) (simNext(&app->random) % (uint64_t) app->count);
+
+    if (name == NULL) return node;
+    if (strcmp(name, "AXFocusedUIElementChanged") == 0) {
+        app->focused = (int32_t) node;
+        if (w->nodes[node].window >= 0) app->focused_window = w->nodes[node].window;
+    } else if (strcmp(name, "AXFocusedWindowChanged") == 0 || strcmp(name, "AXMainWindowChanged") == 0) {
+        if (root->child_count == 0) return app->base;
+        node = root->first_child + (int64_t) (simNext(&app->random) % (uint64_t) root->child_count);
+        app->focused_window = (int32_t) node;
+    } else if (strcmp(name, "AXApplicationActivated") == 0) {
+        w->focused_application = (int) (app - w->applications);
+        node = app->base;
+    } else if (strcmp(name, "AXValueChanged") == 0 || strcmp(name, "AXTitleChanged") == 0) {
+        w->nodes[node].version++;
+    }
+    return node;
+}
+
+static void simFire(SimWorld * w, SimApp * app) {
+    int candidates[64];
+    int count = 0;
+
+    pthread_mutex_lock(&registration_lock);
+    for (int i = 0; i < registration_count && count < 64; i++) {
+        if (registrations[i].pid == app->config.pid && simNotificationAllowed(&app->config, registrations[i].notification))
+            candidates[count++] = i;
+    }
+    if (count > 0) {
+        pthread_mutex_lock(&app->lock);
+        SimRegistration * registration = &registrations[candidates[simNext(&app->random) % (uint64_t) count]];
+        int64_t node = simApplyNotification(w, app, registration->notification);
+        pthread_mutex_unlock(&app->lock);
+
+        // Registrations on the application hear about everything in it;
+        // others only about themselves.
+        uint64_t identifier = AXCompatElementGetIdentifier(registration->element) & SIM_NODE_MASK;
+        AXUIElementRef element = identifier == (uint64_t) app->base
+            ? simElement(w, node) : (AXUIElementRef) CFRetain(registration->element);
+        AXCompatObserverPost(registration->observer, element, registration->notification, registration->refcon);
+        CFRelease(element);
+    }
+    pthread_mutex_unlock(&registration_lock);
+}
+
+static void * simGenerate(void * unused) {
+    pthread_mutex_lock(&generator_lock);
+    while (!generator_stopping) {
+        double now = simNow();
+        double next = now + 1.0;
+
+        pthread_rwlock_rdlock(&world_lock);
+        SimWorld * w = world;
+        for (int i = 0; w != NULL && i < w->application_count; i++) {
+            SimApp * app = &w->applications[i];
+            if (app->config.notification_rate <= 0) continue;
+
+            // Catch up on everything that is due, but never by more than a
+            // second's worth if the process stalled.
+            if (app->next_notification < now - 1.0) app->next_notification = now - 1.0;
+            while (app->next_notification <= now) {
+                simFire(w, app);
+                pthread_mutex_lock(&app->lock);
+                app->next_notification += -log(1.0 - simUniform(&app->random)) / app->config.notification_rate;
+                pthread_mutex_unlock(&app->lock);
+            }
+            if (app->next_notification < next) next = app->next_notification;
+        }
+        pthread_rwlock_unlock(&world_lock);
+
+        if (generator_stopping) break;
+        struct timespec deadline;
+        deadline.tv_sec = (time_t) next;
+        deadline.tv_nsec = (long) ((next - (double) deadline.tv_sec) * 1e9);
+        pthread_cond_timedwait(&generator_wake, &generator_lock, &deadline);
+    }
+    pthread_mutex_unlock(&generator_lock);
+    return NULL;
+}
+
+static void simGeneratorStop(void) {
+    pthread_mutex_lock(&generator_lock);
+    int running = generator_running;
+    generator_stopping = 1;
+    pthread_cond_broadcast(&generator_wake);
+    pthread_mutex_unlock(&generator_lock);
+
+    if (running) pthread_join(generator, NULL);
+
+    pthread_mutex_lock(&generator_lock);
+    generator_running = 0;
+    generator_stopping = 0;
+    pthread_mutex_unlock(&generator_lock);
+}
+
+/* Configuration
+======== */
+
+void simulatedDefaultApplication(SimApplication * application, pid_t pid) {
+    memset(application, 0, sizeof(SimApplication));
+    application->pid = pid;
+    snprintf(application->name, sizeof(application->name), "Application %d", (int) pid);
+    application->windows = 2;
+    application->nodes = 64;
+    application->fanout = 4;
+    application->text_length = 256;
+    application->latency.kind = SIM_LATENCY_FIXED;
+}
+
+int simulatedConfigure(const SimConfig * config) {
+    SimWorld * w = calloc(1, sizeof(SimWorld));
+    if (w == NULL) return -1;
+
+    int64_t total = 0;
+    for (int i = 0; i < config->application_count; i++) {
+        int nodes = config->applications[i].nodes;
+        total += nodes > 1 ? nodes : 1;
+    }
+
+    w->trusted = config->trusted;
+    w->default_timeout = SIM_DEFAULT_TIMEOUT;
+    w->application_count = config->application_count;
+    w->applications = calloc(config->application_count > 0 ? config->application_count : 1, sizeof(SimApp));
+    w->nodes = calloc(total > 0 ? (size_t) total : 1, sizeof(SimNode));
+    w->node_count = (int32_t) total;
+    if (w->applications == NULL || w->nodes == NULL || total >= SIM_UNKNOWN_APPLICATION) {
+        free(w->applications);
+        free(w->nodes);
+        free(w);
+        return -1;
+    }
+
+    uint64_t seed = config->seed;
+    int32_t base = 0;
+    double now = simNow();
+    for (int i = 0; i < config->application_count; i++) {
+        SimApp * app = &w->applications[i];
+        app->config = config->applications[i];
+        app->count = app->config.nodes > 1 ? app->config.nodes : 1;
+        app->random = simSplitMix(&seed) | 1;
+        pthread_mutex_init(&app->lock, NULL);
+        simBuildApplication(w, i, base);
+        if (app->config.notification_rate > 0)
+            app->next_notification = now - log(1.0 - simUniform(&app->random)) / app->config.notification_rate;
+        base += app->count;
+    }
+
+    // Nothing may post into the old world while it is torn down
+    simGeneratorStop();
+
+    pthread_once(&world_once, simWorldLockInit);
+    pthread_rwlock_wrlock(&world_lock);
+    SimWorld * old = world;
+    w->serial = ++world_serial & 0xFFFFFF;
+    world = w;
+
+    pthread_mutex_lock(&registration_lock);
+    for (int i = 0; i < registration_count; i++) simRegistrationRelease(&registrations[i]);
+    registration_count = 0;
+    pthread_mutex_unlock(&registration_lock);
+    pthread_rwlock_unlock(&world_lock);
+
+    simWorldFree(old);
+    AXCompatRunLoopSetQueueCapacity(config->queue_capacity);
+
+    for (int i = 0; i < config->application_count; i++) {
+        if (config->applications[i].notification_rate > 0) {
+            pthread_mutex_lock(&generator_lock);
+            generator_running = pthread_create(&generator, NULL, simGenerate, NULL) == 0;
+            pthread_mutex_unlock(&generator_lock);
+            break;
+        }
+    }
+    return 0;
+}
+
+static CFRunLoopSourceRef simObserverGetRunLoopSource(AXObserverRef observer) {
+    return AXCompatObserverGetRunLoopSource(observer);
+}
+
+const AXBackend simulated_backend = {
+    "simulated",
+    simCreateApplication,
+    simCreateSystemWide,
+    simProcessExists,
+    simIsProcessTrusted,
+    simCopyAttributeValue,
+    simCopyMultipleAttributeValues,
+    simCopyParameterizedAttributeValue,
+    simCopyAttributeNames,
+    simGetAttributeValueCount,
+    simIsAttributeSettable,
+    simSetAttributeValue,
+    simCopyActionNames,
+    simCopyActionDescription,
+    simPerformAction,
+    simCopyElementAtPosition,
+    simGetPid,
+    simSetMessagingTimeout,
+    simObserverCreate,
+    simObserverAddNotification,
+    simObserverRemoveNotification,
+    simObserverGetRunLoopSource
+};
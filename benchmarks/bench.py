@@ -0,0 +1,624 @@
+"""bench.py
+
+Times the module's hot paths, both in isolation and end to end:
+
+* conversion/*: turning each kind of value into a Python object.
+* get/*: reading attributes through subscripts and ``get``, with and without
+  statistics collection and a limit on requests in flight.
+* focus/*: finding the focused element, by asking the system-wide element
+  and from a ``track_focus`` tracker.
+* dispatch/*: handing notifications to a callback, directly and through an
+  observer and the run loop.
+* traversal/*: walking every element of trees with 1k, 10k and 100k elements.
+* geometry/*: reading the position and size of every element of the 1k tree,
+  one attribute at a time and in bulk with ``geometry``.
+* snapshot/*: capturing the 10k tree with ``snapshot``, finding nodes by
+  role in the result, reading every role from it, and reading it back
+  through shared memory.
+* probe/*: finding which of a few attributes every element of the 1k tree
+  has, with ``in`` and ``can_set`` in a loop and in bulk with ``probe``.
+* schema/*: listing the attributes and actions of every element of the 1k
+  tree and whether each attribute can be set, by asking each element and
+  from schemas shared by role with ``enable_schema_cache``.
+* locator/*: finding the deepest element of the 1k tree again, by following
+  its path from the application in Python and with a ``Locator``: checking
+  the element it keeps, returning it within its time to live, and following
+  the whole path again after ``invalidate``.
+* poll/*: checking the 1k tree for changes to attributes, with a loop in
+  Python and with ``poll_watch``.
+* text/*: reading a document of a million characters whole through
+  ``AXValue`` and in chunks with a ``TextReader``, and re-reading the one
+  chunk a change touched.
+* actions/*: raising every window of eight applications, one
+  ``perform_action`` at a time and in bulk with ``perform_actions``.
+* threads/*: reading attributes from 1, 2, 4 and 8 threads at once, each
+  from an application of its own. Per request times only fall as threads are
+  added on free-threaded builds of Python; elsewhere the GIL serializes the
+  conversion to Python objects.
+
+Everything runs against the simulated backend with no latency and a fixed
+seed, so that results only change when the module does and can be compared
+across commits and machines. Results are written as JSON (see ``--output``),
+and ``--compare`` checks them against an earlier run.
+
+Usage: python benchmarks/bench.py [--quick] [--filter TEXT] [--output FILE]
+                                  [--compare FILE] [--threshold FRACTION]
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+import threading
+import time
+
+import accessibility as acc
+
+try:
+    clock = time.perf_counter
+except AttributeError:
+    clock = time.time
+
+FORMAT = 1
+SEED = 1
+
+# Applications of the simulated world, by pid
+SMALL = 100
+TREES = [(1000, 101), (10000, 102), (100000, 103)]
+DOCUMENT = 104
+DOCUMENT_LENGTH = 1000000
+WORKERS = list(range(110, 118))
+
+CONVERSIONS = ['string', 'text', 'boolean', 'point', 'size', 'element',
+               'strings', 'elements']
+
+NOTIFICATION = 'AXValueChanged'
+
+
+def configure():
+    applications = [{'pid': SMALL, 'name': 'Small'}]
+    for nodes, pid in TREES:
+        applications.append({'pid': pid, 'name': 'Tree %d' % nodes,
+                             'windows': 4, 'nodes': nodes, 'fanout': 8})
+    applications.append({'pid': DOCUMENT, 'name': 'Document',
+                         'text_length': DOCUMENT_LENGTH})
+    for pid in WORKERS:
+        applications.append({'pid': pid, 'name': 'Worker %d' % pid})
+    acc.set_backend('simulated', {'seed': SEED, 'applications': applications})
+
+
+def measure(function, iterations, repeats):
+    """Calls function(iterations) repeats times; it returns the seconds taken
+    (or None to have them timed here). Returns a list of seconds per op."""
+    samples = []
+    for _ in range(repeats):
+        started = clock()
+        seconds = function(iterations)
+        if seconds is None:
+            seconds = clock() - started
+        samples.append(seconds / iterations)
+    return samples
+
+
+def conversion(kind):
+    return lambda n: acc._benchmark_conversion(kind, n)
+
+
+def subscript(element, name):
+    def run(n):
+        for _ in range(n):
+            element[name]
+    return run
+
+
+def get(element, name):
+    def run(n):
+        for _ in range(n):
+            element.get(name)
+    return run
+
+
+def contains(element, name):
+    def run(n):
+        for _ in range(n):
+            name in element
+    return run
+
+
+def with_scheduler(function):
+    def run(n):
+        acc.configure_scheduler(max_in_flight=4)
+        try:
+            started = clock()
+            function(n)
+            return clock() - started
+        finally:
+            acc.configure_scheduler(max_in_flight=0)
+    return run
+
+
+def with_stats(function):
+    def run(n):
+        acc.reset_stats()
+        acc.enable_stats(True)
+        try:
+            started = clock()
+            function(n)
+            return clock() - started
+        finally:
+            acc.enable_stats(False)
+    return run
+
+
+def focus_by_query():
+    systemwide = acc.create_systemwide_ref()
+    def run(n):
+        for _ in range(n):
+            systemwide['AXFocusedApplication']['AXFocusedUIElement']
+    return run
+
+
+def focus_by_tracker(pids):
+    def run(n):
+        tracker = acc.track_focus(pids)
+        try:
+            started = clock()
+            for _ in range(n):
+                tracker.focused()
+            return clock() - started
+        finally:
+            tracker.stop()
+    return run
+
+
+def direct_dispatch(element):
+    element.set_callback(lambda element, notification: None)
+    return lambda n: acc._benchmark_dispatch(element, NOTIFICATION, n)
+
+
+def run_loop_dispatch(element, batch=1000):
+    """Posts notifications in batches (to stay under the run loop's queue
+    limit) and times each from posting to the last callback."""
+    deliveries = []
+    element.set_callback(lambda element, notification: deliveries.append(clock()))
+    element.watch(NOTIFICATION)
+
+    def run(n):
+        seconds = 0.0
+        remaining = n
+        while remaining > 0:
+            del deliveries[:]
+            started = clock()
+            posted = acc.simulate_notification(element, NOTIFICATION, min(batch, remaining))
+            if posted <= 0:
+                raise RuntimeError('No notifications could be posted.')
+            while len(deliveries) < posted:
+                acc.run_loop(0.001)
+            seconds += deliveries[-1] - started
+            remaining -= posted
+        return seconds
+    return run
+
+
+def walk(element):
+    """Reads the role of every element below (and including) element,
+    returning how many there were."""
+    count = 0
+    stack = [element]
+    while stack:
+        current = stack.pop()
+        current['AXRole']
+        count += 1
+        try:
+            children = current['AXChildren']
+        except KeyError:
+            continue
+        if children:
+            stack.extend(children)
+    return count
+
+
+def traversal(pid, nodes):
+    def run(n):
+        for _ in range(n):
+            app = acc.create_application_ref(pid)
+            found = walk(app)
+            if found != nodes:
+                raise RuntimeError('Walked %d elements of %d.' % (found, nodes))
+    return run
+
+
+def descendants(element):
+    found = []
+    stack = [element]
+    while stack:
+        current = stack.pop()
+        found.append(current)
+        try:
+            children = current['AXChildren']
+        except KeyError:
+            continue
+        if children:
+            stack.extend(children)
+    return found
+
+
+def geometry_by_attribute(elements):
+    def run(n):
+        for _ in range(n):
+            for element in elements:
+                element['AXPosition']
+                element['AXSize']
+    return run
+
+
+def geometry_in_bulk(elements):
+    def run(n):
+        for _ in range(n):
+            acc.geometry(elements)
+    return run
+
+
+def snapshot_capture(pid):
+    def run(n):
+        app = acc.create_application_ref(pid)
+        for _ in range(n):
+            acc.snapshot(app)
+    return run
+
+
+def snapshot_find(pid):
+    data = acc.snapshot(acc.create_application_ref(pid))
+
+    def run(n):
+        for _ in range(n):
+            acc.Snapshot(data).find('AXRole', 'AXButton')
+    return run
+
+
+def snapshot_column(pid):
+    data = acc.snapshot(acc.create_application_ref(pid))
+
+    def run(n):
+        for _ in range(n):
+            acc.Snapshot(data).column('AXRole')
+    return run
+
+
+def snapshot_subscribe(pid):
+    # Subscribers keep the region mapped after the publisher removes its name
+    name = '/accessibility-bench-%d' % os.getpid()
+    publisher = acc.SnapshotPublisher(name)
+    subscriber = acc.SnapshotSubscriber(name)
+    publisher.publish(acc.snapshot(acc.create_application_ref(pid)))
+    publisher.close()
+
+    def run(n):
+        for _ in range(n):
+            subscriber.read()
+    return run
+
+
+PROBED = ['AXTitle', 'AXValue', 'AXChildren', 'AXURL']
+
+
+def probe_in_loop(elements):
+    def run(n):
+        for _ in range(n):
+            for element in elements:
+                for name in PROBED:
+                    if name in element:
+                        try:
+                            element.can_set(name)
+                        except (KeyError, ValueError):
+                            pass
+    return run
+
+
+def probe_in_bulk(elements):
+    def run(n):
+        for _ in range(n):
+            acc.probe(elements, PROBED, settable=True)
+    return run
+
+
+def describe(elements):
+    def run(n):
+        for _ in range(n):
+            for element in elements:
+                for name in element.keys() or []:
+                    element.can_set(name)
+                element.actions()
+    return run
+
+
+def with_schemas(function):
+    def run(n):
+        acc.enable_schema_cache(True)
+        try:
+            started = clock()
+            function(n)
+            return clock() - started
+        finally:
+            acc.enable_schema_cache(False)
+    return run
+
+
+def locate_in_python(app, path):
+    def run(n):
+        for _ in range(n):
+            element = app
+            for role, identifier, _, _ in path:
+                element = next(child for child in element['AXChildren']
+                               if child['AXRole'] == role and child['AXIdentifier'] == identifier)
+    return run
+
+
+def locate(locator, invalidate=False):
+    def run(n):
+        for _ in range(n):
+            if invalidate:
+                locator.invalidate()
+            locator.resolve()
+    return run
+
+
+POLLED = ['AXValue', 'AXTitle']
+
+
+def poll_in_python(elements):
+    last = [None] * (len(elements) * len(POLLED))
+
+    def run(n):
+        changes = []
+        for _ in range(n):
+            slot = 0
+            for element in elements:
+                for name in POLLED:
+                    try:
+                        value = element[name]
+                    except (KeyError, ValueError):
+                        value = None
+                    if last[slot] != value:
+                        changes.append((element, name, value))
+                        last[slot] = value
+                    slot += 1
+    return run
+
+
+def poll_natively(elements):
+    def run(n):
+        watcher = acc.poll_watch(elements, POLLED, 1e-6)
+        first = watcher.poll_count
+        started = clock()
+        while watcher.poll_count < first + n:
+            time.sleep(0.0005)
+        seconds = clock() - started
+        watcher.stop()
+        return seconds * n / (watcher.poll_count - first)
+    return run
+
+
+def document():
+    for element in descendants(acc.create_application_ref(DOCUMENT)):
+        if element['AXRole'] == 'AXTextArea':
+            return element
+
+
+def text_value(element):
+    def run(n):
+        for _ in range(n):
+            element['AXValue']
+    return run
+
+
+def text_chunks(element):
+    def run(n):
+        for _ in range(n):
+            acc.TextReader(element).read()
+    return run
+
+
+def text_refresh(element):
+    reader = acc.TextReader(element)
+    reader.read()
+
+    def run(n):
+        for _ in range(n):
+            reader.refresh((1000, 10))
+    return run
+
+
+def actions_in_loop(windows):
+    def run(n):
+        for _ in range(n):
+            for window in windows:
+                window.perform_action('AXRaise')
+    return run
+
+
+def actions_in_bulk(windows):
+    actions = [(window, 'AXRaise') for window in windows]
+    def run(n):
+        for _ in range(n):
+            acc.perform_actions(actions)
+    return run
+
+
+def parallel_get(windows, name):
+    def run(n):
+        threads = [threading.Thread(target=get(window, name), args=(n,)) for window in windows]
+        started = clock()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        return clock() - started
+    return run
+
+
+def benchmarks(quick):
+    """Yields (name, unit, function, iterations, repeats, per) in the order
+    run, where each iteration does per of the unit (traversals visit every
+    element of the tree in one iteration)."""
+    scale = 10 if quick else 1
+    repeats = 3 if quick else 7
+
+    for kind in CONVERSIONS:
+        iterations = 20000 if kind in ('strings', 'elements') else 200000
+        yield ('conversion/' + kind, 'value', conversion(kind), iterations // scale, repeats, 1)
+
+    app = acc.create_application_ref(SMALL)
+    window = app['AXWindows'][0]
+    for name, kind in [('AXRole', 'string'), ('AXEnabled', 'boolean'),
+                       ('AXPosition', 'point'), ('AXSize', 'size'),
+                       ('AXParent', 'element'), ('AXChildren', 'elements')]:
+        yield ('get/subscript/' + kind, 'request', subscript(window, name), 50000 // scale, repeats, 1)
+    yield ('get/method/string', 'request', get(window, 'AXRole'), 50000 // scale, repeats, 1)
+    yield ('get/contains', 'request', contains(window, 'AXRole'), 50000 // scale, repeats, 1)
+    yield ('get/subscript/string+stats', 'request', with_stats(subscript(window, 'AXRole')), 50000 // scale, repeats, 1)
+    yield ('get/subscript/string+scheduler', 'request', with_scheduler(subscript(window, 'AXRole')), 50000 // scale, repeats, 1)
+
+    yield ('focus/query', 'request', focus_by_query(), 50000 // scale, repeats, 1)
+    yield ('focus/tracked', 'request', focus_by_tracker([SMALL] + WORKERS), 50000 // scale, repeats, 1)
+
+    yield ('dispatch/callback', 'notification', direct_dispatch(acc.create_application_ref(SMALL, force=True)), 100000 // scale, repeats, 1)
+    yield ('dispatch/run_loop', 'notification', run_loop_dispatch(acc.create_application_ref(SMALL, force=True)), 20000 // scale, repeats, 1)
+
+    for nodes, pid in TREES:
+        runs = 1 if nodes >= 100000 else (10 if nodes < 10000 else 2)
+        yield ('traversal/%dk' % (nodes // 1000), 'element', traversal(pid, nodes), runs,
+               1 if quick else 3, nodes)
+
+    elements = [element for element in descendants(acc.create_application_ref(TREES[0][1]))
+                if 'AXPosition' in element]
+    yield ('geometry/attributes', 'element', geometry_by_attribute(elements), 20 // (2 if quick else 1), repeats, len(elements))
+    yield ('geometry/bulk', 'element', geometry_in_bulk(elements), 100 // (2 if quick else 1), repeats, len(elements))
+
+    yield ('probe/loop', 'element', probe_in_loop(elements), 20 // (2 if quick else 1), repeats, len(elements))
+    yield ('probe/bulk', 'element', probe_in_bulk(elements), 20 // (2 if quick else 1), repeats, len(elements))
+
+    yield ('schema/requests', 'element', describe(elements), 5 // (2 if quick else 1) + 1, repeats, len(elements))
+    yield ('schema/cached', 'element', with_schemas(describe(elements)), 5 // (2 if quick else 1) + 1, repeats, len(elements))
+
+    app = acc.create_application_ref(TREES[0][1])
+    deepest = acc.Locator(max(elements, key=lambda element: acc.Locator(element).depth))
+    yield ('locator/python', 'lookup', locate_in_python(app, deepest.path), 2000 // scale, repeats, 1)
+    yield ('locator/checked', 'lookup', locate(deepest), 20000 // scale, repeats, 1)
+    yield ('locator/ttl', 'lookup', locate(acc.Locator(app, deepest.path, ttl=3600)), 50000 // scale, repeats, 1)
+    yield ('locator/resolve', 'lookup', locate(deepest, invalidate=True), 2000 // scale, repeats, 1)
+
+    yield ('poll/python', 'element', poll_in_python(elements), 20 // (2 if quick else 1), repeats, len(elements))
+    yield ('poll/native', 'element', poll_natively(elements), 20 // (2 if quick else 1), repeats, len(elements))
+
+    nodes, pid = TREES[1]
+    yield ('snapshot/capture', 'element', snapshot_capture(pid), 2 if quick else 5, repeats, nodes)
+    yield ('snapshot/find', 'element', snapshot_find(pid), 20 if quick else 100, repeats, nodes)
+    yield ('snapshot/column', 'element', snapshot_column(pid), 20 if quick else 100, repeats, nodes)
+    yield ('snapshot/subscribe', 'element', snapshot_subscribe(pid), 20 if quick else 100, repeats, nodes)
+
+    text = document()
+    yield ('text/value', 'character', text_value(text), 20 if quick else 100, repeats, DOCUMENT_LENGTH)
+    yield ('text/chunks', 'character', text_chunks(text), 20 if quick else 100, repeats, DOCUMENT_LENGTH)
+    yield ('text/refresh', 'request', text_refresh(text), 2000 // scale, repeats, 1)
+
+    windows = [window for pid in WORKERS for window in acc.create_application_ref(pid)['AXWindows']]
+    yield ('actions/loop', 'action', actions_in_loop(windows), 2000 // scale, repeats, len(windows))
+    yield ('actions/bulk', 'action', actions_in_bulk(windows), 2000 // scale, repeats, len(windows))
+
+    windows = [acc.create_application_ref(pid)['AXWindows'][0] for pid in WORKERS]
+    for count in (1, 2, 4, 8):
+        yield ('threads/get/%d' % count, 'request', parallel_get(windows[:count], 'AXRole'), 20000 // scale, repeats, count)
+
+
+def commit():
+    try:
+        output = subprocess.check_output(['git', 'rev-parse', 'HEAD'], stderr=subprocess.STDOUT)
+        return output.decode('ascii').strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def compare(results, path, threshold):
+    """Prints how results compare with those in path, returning the names of
+    those that are slower by more than threshold."""
+    with open(path) as f:
+        baseline = json.load(f)['results']
+    regressions = []
+    for name in sorted(results):
+        if name not in baseline:
+            continue
+        ratio = results[name]['best'] / baseline[name]['best']
+        flag = ''
+        if ratio > 1 + threshold:
+            flag = '  REGRESSION'
+            regressions.append(name)
+        print('%-32s %7.3fx%s' % (name, ratio, flag), file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the accessibility module.')
+    parser.add_argument('--quick', action='store_true', help='run fewer iterations')
+    parser.add_argument('--filter', default='', help='only run benchmarks whose names contain this')
+    parser.add_argument('--output', help='write results to this file instead of standard output')
+    parser.add_argument('--compare', help='compare with the results in this file')
+    parser.add_argument('--threshold', type=float, default=0.10,
+                        help='slowdown (as a fraction) counted as a regression; default 0.10')
+    options = parser.parse_args()
+
+    try:
+        configure()
+    except ValueError as error:
+        print('The simulated backend is not available: %s' % error, file=sys.stderr)
+        sys.exit(1)
+
+    results = {}
+    for name, unit, function, iterations, repeats, per in benchmarks(options.quick):
+        if options.filter not in name:
+            continue
+        samples = [s / per for s in measure(function, iterations, repeats)]
+        samples.sort()
+        best = samples[0] * 1e9
+        median = samples[len(samples) // 2] * 1e9
+        results[name] = {
+            'unit': 'ns/' + unit,
+            'iterations': iterations * per,
+            'repeats': repeats,
+            'best': round(best, 2),
+            'median': round(median, 2),
+            'per_second': round(1e9 / best, 1),
+        }
+        print('%-32s %12.1f ns/%-12s (median %.1f)' % (name, best, unit, median), file=sys.stderr)
+
+    report = {
+        'format': FORMAT,
+        'date': datetime.datetime.utcnow().strftime('%Y-%m-%dT%H:%M:%SZ'),
+        'commit': commit(),
+        'python': '%s %s' % (platform.python_implementation(), platform.python_version()),
+        'platform': platform.platform(),
+        'machine': platform.machine(),
+        'backend': acc.current_backend(),
+        'seed': SEED,
+        'quick': options.quick,
+        'results': results,
+    }
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if options.output:
+        with open(options.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+    if options.compare:
+        if compare(results, options.compare, options.threshold):
+            sys.exit(2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,199 @@
+/*
+ * Times the native core (core.h) against the simulated backend, with no
+ * Python involved, to separate the cost of the core from that of the
+ * binding in benchmarks/bench.py. Build libaxcore first (see README.rst):
+ *
+ *     python setup.py build_clib -b build/core
+ *     cc -O2 -std=gnu99 -Icompat -I. benchmarks/core_bench.c build/core/libaxcore.a -lm -lpthread -lrt
+ *     ./a.out [--quick]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "core.h"
+
+#define SEED 1234
+#define SMALL 100
+#define TREE 101
+#define TREE_NODES 1000
+
+static double clockSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void * a, const void * b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Each benchmark does its operation count times and returns how many it did
+ * (which may differ, as for a tree walk).
+ */
+typedef long (*Benchmark)(long count);
+
+static void measure(const char * name, const char * unit, Benchmark benchmark, long count, int repeats) {
+    double samples[16];
+    if (repeats > 16) repeats = 16;
+    benchmark(count / 10 + 1); // warm up
+
+    for (int i = 0; i < repeats; i++) {
+        double started = clockSeconds();
+        long done = benchmark(count);
+        samples[i] = (clockSeconds() - started) / (done > 0 ? done : 1);
+    }
+    qsort(samples, repeats, sizeof(double), compareDoubles);
+    printf("%-32s %12.1f ns/%-12s (median %.1f)\n", name, samples[0] * 1e9, unit, samples[repeats / 2] * 1e9);
+    fflush(stdout);
+}
+
+static AXSession session;
+static AXUIElementRef small;
+static AXUIElementRef tree;
+
+/* Conversion
+======== */
+
+static long convertString(long count) {
+    CF_SCOPED CFStringRef string = CFStringCreateWithCString(kCFAllocatorDefault, "AXButton", kCFStringEncodingUTF8);
+    AXVariant variant;
+    for (long i = 0; i < count; i++) {
+        axVariantFromValue(string, &variant);
+        axVariantClear(&variant);
+    }
+    return count;
+}
+
+static long convertPoint(long count) {
+    CGPoint point = {12.0, 34.0};
+    CF_SCOPED AXValueRef value = AXValueCreate(kAXValueCGPointType, &point);
+    AXVariant variant;
+    for (long i = 0; i < count; i++) {
+        axVariantFromValue(value, &variant);
+        axVariantClear(&variant);
+    }
+    return count;
+}
+
+/* Requests
+======== */
+
+static long readBatch(long count) {
+    static const char * const names[] = {"AXRole", "AXTitle", "AXPosition", "AXSize"};
+    CF_SCOPED CFArrayRef attributes = axCreateNames(names, 4);
+    AXVariant values[4];
+    for (long i = 0; i < count; i++) {
+        axSessionRead(&session, small, attributes, values);
+        for (int j = 0; j < 4; j++) axVariantClear(&values[j]);
+    }
+    return count;
+}
+
+// Reads the role and children of each element, breadth first, a level at a time.
+static long walkTree(long count) {
+    static const char * const names[] = {"AXRole", "AXChildren"};
+    CF_SCOPED CFArrayRef attributes = axCreateNames(names, 2);
+    long visited = 0;
+
+    for (long i = 0; i < count; i++) {
+        size_t level_count = 1;
+        AXUIElementRef * level = malloc(sizeof(AXUIElementRef));
+        level[0] = (AXUIElementRef) CFRetain(tree);
+
+        while (level_count > 0) {
+            AXVariant * values = calloc(level_count * 2, sizeof(AXVariant));
+            axSessionReadMany(&session, level, level_count, attributes, values);
+            visited += level_count;
+
+            size_t next_count = 0;
+            for (size_t j = 0; j < level_count; j++) {
+                AXVariant * children = &values[j * 2 + 1];
+                if (children->type == AX_VARIANT_ARRAY) next_count += children->value.array.count;
+            }
+            AXUIElementRef * next = malloc((next_count ? next_count : 1) * sizeof(AXUIElementRef));
+            size_t k = 0;
+            for (size_t j = 0; j < level_count; j++) {
+                AXVariant * children = &values[j * 2 + 1];
+                if (children->type != AX_VARIANT_ARRAY) continue;
+                for (size_t c = 0; c < children->value.array.count; c++) {
+                    AXVariant * child = &children->value.array.items[c];
+                    if (child->type == AX_VARIANT_ELEMENT) next[k++] = (AXUIElementRef) CFRetain(child->value.element);
+                }
+            }
+
+            for (size_t j = 0; j < level_count * 2; j++) axVariantClear(&values[j]);
+            for (size_t j = 0; j < level_count; j++) CFRelease(level[j]);
+            free(values);
+            free(level);
+            level = next;
+            level_count = k;
+        }
+        free(level);
+    }
+    return visited;
+}
+
+/* Notifications
+======== */
+
+static void countNotification(AXUIElementRef element, CFStringRef notification, void * context) {
+    (void) element;
+    (void) notification;
+    (*(long *) context)++;
+}
+
+static long dispatch(long count) {
+    long received = 0;
+    AXSessionObserver * observer;
+    if (axSessionObserve(&session, small, "AXValueChanged", countNotification, &received, &observer) != kAXErrorSuccess) {
+        fprintf(stderr, "could not observe the element\n");
+        exit(1);
+    }
+
+    for (long posted = 0; posted < count; posted += 1000) {
+        long batch = count - posted < 1000 ? count - posted : 1000;
+        simulatedPostNotification(small, kAXValueChangedNotification, batch);
+        while (received < posted + batch) CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.001, 0);
+    }
+    axSessionObserverClose(observer);
+    return received;
+}
+
+int main(int argc, char ** argv) {
+    int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    int scale = quick ? 10 : 1;
+    int repeats = quick ? 3 : 7;
+
+    SimApplication applications[2];
+    simulatedDefaultApplication(&applications[0], SMALL);
+    simulatedDefaultApplication(&applications[1], TREE);
+    applications[1].windows = 4;
+    applications[1].nodes = TREE_NODES;
+    applications[1].fanout = 8;
+    SimConfig config = {SEED, 1, 0, 2, applications};
+    if (simulatedConfigure(&config) != 0) {
+        fprintf(stderr, "could not configure the simulated backend\n");
+        return 1;
+    }
+
+    axSessionInit(&session, &simulated_backend);
+    if (axSessionApplication(&session, SMALL, &small) != kAXErrorSuccess ||
+        axSessionApplication(&session, TREE, &tree) != kAXErrorSuccess) {
+        fprintf(stderr, "could not create the applications\n");
+        return 1;
+    }
+
+    measure("core/convert/string", "value", convertString, 1000000 / scale, repeats);
+    measure("core/convert/point", "value", convertPoint, 1000000 / scale, repeats);
+    measure("core/read/batch", "request", readBatch, 200000 / scale, repeats);
+    measure("core/traversal/1k", "element", walkTree, 100 / scale + 1, repeats);
+    measure("core/dispatch", "notification", dispatch, 200000 / scale, repeats);
+
+    CFRelease(small);
+    CFRelease(tree);
+    return 0;
+}
@@ -0,0 +1,293 @@
+"""load.py
+
+Load test for the observer and callback machinery: simulates many applications
+posting notifications to elements watched with ``watch`` and ``set_callback``,
+and reports what it costs to keep up.
+
+Every application of the simulated backend has ``--elements`` elements, of
+which ``--watched`` are watched for the given notifications, and posts
+notifications to them at random (as a Poisson process) at ``--rate`` per
+second. Callbacks run on ``--threads`` threads, each with its own run loop and
+its share of the applications. After ``--warmup`` seconds the harness measures
+for ``--duration`` seconds:
+
+* the latency of each notification, from being posted until its callback
+  returns (percentiles over all of them, and the worst application's p99),
+* how many were posted, delivered and dropped because a queue was full,
+* the CPU time of the whole process per delivered notification, which includes
+  the simulated applications posting them,
+* the growth of the resident set size over the run.
+
+The report is written as JSON (to standard output unless ``--output`` is
+given), with a summary on standard error.
+
+Usage: python benchmarks/load.py [--apps N] [--elements M] [--watched W]
+                                 [--rate R] [--duration S] [--threads T] ...
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import datetime
+import json
+import platform
+import resource
+import sys
+import threading
+import time
+
+import accessibility as acc
+
+try:
+    clock = time.perf_counter
+except AttributeError:
+    clock = time.time
+
+FORMAT = 1
+FIRST_PID = 2000
+NOTIFICATIONS = ['AXValueChanged', 'AXTitleChanged', 'AXFocusedUIElementChanged']
+
+
+def resident_bytes():
+    """The current resident set size, or the peak where that is all there is."""
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * resource.getpagesize()
+    except (IOError, OSError):
+        peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        return peak if sys.platform == 'darwin' else peak * 1024
+
+
+def cpu_seconds():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_utime + usage.ru_stime
+
+
+def configure(options):
+    applications = []
+    for i in range(options.apps):
+        applications.append({
+            'pid': FIRST_PID + i,
+            'name': 'Load %d' % i,
+            'nodes': options.elements,
+            'fanout': options.fanout,
+            'notification_rate': options.rate,
+            'notifications': options.notifications,
+        })
+    acc.set_backend('simulated', {'seed': options.seed,
+                                  'queue_capacity': options.queue_capacity,
+                                  'applications': applications})
+
+
+def watched_elements(pid, count):
+    """The application and then its elements breadth first, up to count."""
+    app = acc.create_application_ref(pid, force=True)
+    found = [app]
+    queue = [app]
+    while queue and len(found) < count:
+        current = queue.pop(0)
+        try:
+            children = current['AXChildren'] or []
+        except KeyError:
+            continue
+        for child in children:
+            if len(found) == count:
+                break
+            found.append(child)
+            queue.append(child)
+    return found
+
+
+class Worker(threading.Thread):
+    """Watches the elements of some applications and runs the run loop that
+    their notifications are delivered on."""
+
+    def __init__(self, pids, options, ready, stop):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.pids = pids
+        self.options = options
+        self.ready = ready
+        self.stop = stop
+        self.delivered = 0
+        self.error = None
+
+    def callback(self, element, notification):
+        self.delivered += 1
+        if self.options.work > 0:
+            until = clock() + self.options.work
+            while clock() < until:
+                pass
+
+    def run(self):
+        try:
+            # Elements must be watched on the thread whose run loop delivers
+            # their notifications, and kept alive for as long as it runs
+            self.elements = []
+            for pid in self.pids:
+                for element in watched_elements(pid, self.options.watched):
+                    element.set_callback(self.callback)
+                    element.watch(*self.options.notifications)
+                    self.elements.append(element)
+        except Exception as error:
+            self.error = error
+        finally:
+            self.ready.release()
+
+        while self.error is None and not self.stop.is_set():
+            acc.run_loop(0.1)
+
+
+def latency_summary(calls):
+    """Combines the histograms of the callbacks' statistics."""
+    histogram = {}
+    worst = None
+    count = 0
+    failures = 0
+    for call in calls:
+        if call['operation'] != 'AXObserverCallback':
+            continue
+        count += call['count']
+        failures += call['errors']
+        for latency, n in call['histogram']:
+            histogram[latency] = histogram.get(latency, 0) + n
+        if worst is None or call['p99'] > worst['p99']:
+            worst = call
+
+    summary = {'count': count, 'callback_errors': failures}
+    ordered = sorted(histogram.items())
+    for name, fraction in [('p50', 0.5), ('p90', 0.9), ('p99', 0.99), ('p999', 0.999)]:
+        summary[name] = None
+        target = fraction * count
+        seen = 0
+        for latency, n in ordered:
+            seen += n
+            if seen >= target:
+                summary[name] = latency
+                break
+    summary['max'] = ordered[-1][0] if ordered else None
+    if worst is not None:
+        summary['worst'] = {'pid': worst['pid'], 'notification': worst['attribute'], 'p99': worst['p99']}
+    return summary
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Load test notification delivery.')
+    parser.add_argument('--apps', type=int, default=50, help='simulated applications (default 50)')
+    parser.add_argument('--elements', type=int, default=200, help='elements per application (default 200)')
+    parser.add_argument('--fanout', type=int, default=4, help='children per group (default 4)')
+    parser.add_argument('--watched', type=int, default=10, help='elements watched per application (default 10)')
+    parser.add_argument('--rate', type=float, default=100.0,
+                        help='notifications per second per application (default 100)')
+    parser.add_argument('--notifications', nargs='+', default=NOTIFICATIONS, help='notifications to watch')
+    parser.add_argument('--threads', type=int, default=1, help='threads running run loops (default 1)')
+    parser.add_argument('--work', type=float, default=0.0, help='seconds each callback spends busy (default 0)')
+    parser.add_argument('--queue-capacity', type=int, default=0,
+                        help='notifications a run loop holds before dropping them (default 4096)')
+    parser.add_argument('--warmup', type=float, default=1.0, help='seconds before measuring (default 1)')
+    parser.add_argument('--duration', type=float, default=10.0, help='seconds to measure (default 10)')
+    parser.add_argument('--seed', type=int, default=1, help='seed for the simulated backend (default 1)')
+    parser.add_argument('--output', help='write the report to this file instead of standard output')
+    options = parser.parse_args()
+
+    try:
+        configure(options)
+    except ValueError as error:
+        print('The simulated backend is not available: %s' % error, file=sys.stderr)
+        sys.exit(1)
+
+    pids = [FIRST_PID + i for i in range(options.apps)]
+    threads = max(1, min(options.threads, options.apps))
+    ready = threading.Semaphore(0)
+    stop = threading.Event()
+    workers = [Worker(pids[i::threads], options, ready, stop) for i in range(threads)]
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        ready.acquire()
+    for worker in workers:
+        if worker.error is not None:
+            stop.set()
+            print('Could not watch the simulated applications: %s' % worker.error, file=sys.stderr)
+            sys.exit(1)
+
+    time.sleep(options.warmup)
+
+    acc.enable_stats(True)
+    acc.reset_stats()
+    memory = [(0.0, resident_bytes())]
+    cpu_started = cpu_seconds()
+    delivered_started = sum(worker.delivered for worker in workers)
+    started = clock()
+    while True:
+        elapsed = clock() - started
+        if elapsed >= options.duration:
+            break
+        time.sleep(min(0.5, options.duration - elapsed))
+        memory.append((round(clock() - started, 3), resident_bytes()))
+    elapsed = clock() - started
+    cpu = cpu_seconds() - cpu_started
+    delivered = sum(worker.delivered for worker in workers) - delivered_started
+    counts = acc.run_loop_info()
+    latency = latency_summary(acc.stats()['calls'])
+    acc.enable_stats(False)
+
+    stop.set()
+    for worker in workers:
+        worker.join()
+
+    report = {
+        'format': FORMAT,
+        'date': datetime.datetime.utcnow().strftime('%Y-%m-%dT%H:%M:%SZ'),
+        'python': '%s %s' % (platform.python_implementation(), platform.python_version()),
+        'platform': platform.platform(),
+        'options': {
+            'apps': options.apps, 'elements': options.elements, 'watched': options.watched,
+            'rate': options.rate, 'notifications': options.notifications, 'threads': threads,
+            'work': options.work, 'queue_capacity': counts['queue_capacity'],
+            'duration': options.duration, 'seed': options.seed,
+        },
+        'elapsed': round(elapsed, 3),
+        'offered_rate': options.apps * options.rate,
+        'events': {
+            'posted': counts['posted'],
+            'delivered': delivered,
+            'dropped': counts['dropped'],
+            'drop_rate': counts['dropped'] / counts['posted'] if counts['posted'] else 0.0,
+            'max_queue_depth': counts['max_depth'],
+            'per_second': delivered / elapsed,
+        },
+        'latency': latency,
+        'cpu': {
+            'seconds': round(cpu, 3),
+            'utilization': cpu / elapsed,
+            'per_event': cpu / delivered if delivered else None,
+        },
+        'memory': {
+            'start': memory[0][1],
+            'end': memory[-1][1],
+            'growth': memory[-1][1] - memory[0][1],
+            'growth_per_event': (memory[-1][1] - memory[0][1]) / delivered if delivered else None,
+            'samples': memory,
+        },
+    }
+
+    print('%d events/s delivered of %d offered; %d dropped (max queue depth %d)' % (
+        report['events']['per_second'], report['offered_rate'], counts['dropped'], counts['max_depth']), file=sys.stderr)
+    if latency['count']:
+        print('latency p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us' % (
+            latency['p50'] * 1e6, latency['p99'] * 1e6, latency['p999'] * 1e6, latency['max'] * 1e6), file=sys.stderr)
+    if delivered:
+        print('cpu %.1f us per event (%.0f%% of a core); memory %+d bytes' % (
+            report['cpu']['per_event'] * 1e6, report['cpu']['utilization'] * 100, report['memory']['growth']), file=sys.stderr)
+
+    text = json.dumps(report, indent=2, sort_keys=True)
+    if options.output:
+        with open(options.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+
+if __name__ == '__main__':
+    main()
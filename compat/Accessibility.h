@@ -0,0 +1,396 @@
+/*
+ * A minimal stand-in for the parts of CoreFoundation and HIServices that the
+ * accessibility module uses, so that it can be built and exercised on
+ * platforms without the Accessibility API (e.g. Linux). Only the simulated
+ * backend is available in such builds.
+ *
+ * The declarations mirror Apple's headers closely enough that the module
+ * source compiles unchanged against either. Objects are reference counted
+ * with CFRetain/CFRelease just like the real thing; constant strings created
+ * with CFSTR() are immortal.
+ */
+
+#ifndef ACCESSIBILITY_COMPAT_H
+#define ACCESSIBILITY_COMPAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CoreFoundation basics
+======== */
+
+typedef const void * CFTypeRef;
+typedef unsigned long CFTypeID;
+typedef unsigned long CFHashCode;
+typedef signed long CFIndex;
+typedef unsigned long CFOptionFlags;
+typedef unsigned char Boolean;
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef double CFTimeInterval;
+
+typedef const struct __CFAllocator * CFAllocatorRef;
+typedef const struct __CFString * CFStringRef;
+typedef const struct __CFArray * CFArrayRef;
+typedef struct __CFArray * CFMutableArrayRef;
+typedef const struct __CFBoolean * CFBooleanRef;
+typedef const struct __CFNumber * CFNumberRef;
+typedef const struct __CFDictionary * CFDictionaryRef;
+typedef const struct __CFURL * CFURLRef;
+typedef const struct __CFAttributedString * CFAttributedStringRef;
+typedef struct __CFRunLoop * CFRunLoopRef;
+typedef struct __CFRunLoopSource * CFRunLoopSourceRef;
+typedef CFStringRef CFRunLoopMode;
+
+#define kCFAllocatorDefault ((CFAllocatorRef) NULL)
+#define kCFNotFound ((CFIndex) -1)
+
+typedef struct {
+    CFIndex location;
+    CFIndex length;
+} CFRange;
+
+static inline CFRange CFRangeMake(CFIndex location, CFIndex length) {
+    CFRange range = { location, length };
+    return range;
+}
+
+typedef enum {
+    kCFCompareLessThan = -1,
+    kCFCompareEqualTo = 0,
+    kCFCompareGreaterThan = 1
+} CFComparisonResult;
+
+CFTypeRef CFRetain(CFTypeRef);
+void CFRelease(CFTypeRef);
+CFIndex CFGetRetainCount(CFTypeRef);
+CFTypeID CFGetTypeID(CFTypeRef);
+Boolean CFEqual(CFTypeRef, CFTypeRef);
+CFHashCode CFHash(CFTypeRef);
+
+/* Strings
+======== */
+
+typedef UInt32 CFStringEncoding;
+typedef UInt16 UniChar;
+#define kCFStringEncodingUTF8 ((CFStringEncoding) 0x08000100)
+#define kCFStringEncodingASCII ((CFStringEncoding) 0x0600)
+
+CFTypeID CFStringGetTypeID(void);
+CFStringRef CFStringCreateWithCString(CFAllocatorRef, const char *, CFStringEncoding);
+CFStringRef CFStringCreateWithBytes(CFAllocatorRef, const UInt8 *, CFIndex, CFStringEncoding, Boolean);
+CFIndex CFStringGetLength(CFStringRef);
+const char * CFStringGetCStringPtr(CFStringRef, CFStringEncoding);
+Boolean CFStringGetCString(CFStringRef, char *, CFIndex, CFStringEncoding);
+CFIndex CFStringGetMaximumSizeForEncoding(CFIndex, CFStringEncoding);
+CFComparisonResult CFStringCompare(CFStringRef, CFStringRef, CFOptionFlags);
+CFStringRef CFStringCreateWithSubstring(CFAllocatorRef, CFStringRef, CFRange);
+UniChar CFStringGetCharacterAtIndex(CFStringRef, CFIndex);
+
+static inline Boolean CFStringIsSurrogateHighCharacter(UniChar character) {
+    return character >= 0xD800 && character <= 0xDBFF;
+}
+
+static inline Boolean CFStringIsSurrogateLowCharacter(UniChar character) {
+    return character >= 0xDC00 && character <= 0xDFFF;
+}
+
+/*
+ * Constant strings are interned and never released, so repeated use of the
+ * same literal yields the same object.
+ */
+CFStringRef __CFStringMakeConstantString(const char *);
+#define CFSTR(cstr) __CFStringMakeConstantString("" cstr "")
+
+/* Booleans, numbers
+======== */
+
+CFTypeID CFBooleanGetTypeID(void);
+Boolean CFBooleanGetValue(CFBooleanRef);
+extern const CFBooleanRef kCFBooleanTrue;
+extern const CFBooleanRef kCFBooleanFalse;
+
+typedef enum {
+    kCFNumberSInt8Type = 1,
+    kCFNumberSInt16Type = 2,
+    kCFNumberSInt32Type = 3,
+    kCFNumberSInt64Type = 4,
+    kCFNumberFloat32Type = 5,
+    kCFNumberFloat64Type = 6,
+    kCFNumberCharType = 7,
+    kCFNumberShortType = 8,
+    kCFNumberIntType = 9,
+    kCFNumberLongType = 10,
+    kCFNumberLongLongType = 11,
+    kCFNumberFloatType = 12,
+    kCFNumberDoubleType = 13,
+    kCFNumberCFIndexType = 14,
+    kCFNumberNSIntegerType = 15,
+    kCFNumberCGFloatType = 16
+} CFNumberType;
+
+CFTypeID CFNumberGetTypeID(void);
+CFNumberRef CFNumberCreate(CFAllocatorRef, CFNumberType, const void *);
+CFNumberType CFNumberGetType(CFNumberRef);
+Boolean CFNumberIsFloatType(CFNumberRef);
+Boolean CFNumberGetValue(CFNumberRef, CFNumberType, void *);
+
+/* Collections
+======== */
+
+typedef struct {
+    CFIndex version;
+    const void * retain;
+    const void * release;
+    const void * copyDescription;
+    const void * equal;
+} CFArrayCallBacks;
+extern const CFArrayCallBacks kCFTypeArrayCallBacks;
+
+CFTypeID CFArrayGetTypeID(void);
+CFArrayRef CFArrayCreate(CFAllocatorRef, const void **, CFIndex, const CFArrayCallBacks *);
+CFMutableArrayRef CFArrayCreateMutable(CFAllocatorRef, CFIndex, const CFArrayCallBacks *);
+void CFArrayAppendValue(CFMutableArrayRef, const void *);
+CFIndex CFArrayGetCount(CFArrayRef);
+const void * CFArrayGetValueAtIndex(CFArrayRef, CFIndex);
+
+typedef struct {
+    CFIndex version;
+    const void * retain;
+    const void * release;
+    const void * copyDescription;
+    const void * equal;
+    const void * hash;
+} CFDictionaryKeyCallBacks;
+typedef struct {
+    CFIndex version;
+    const void * retain;
+    const void * release;
+    const void * copyDescription;
+    const void * equal;
+} CFDictionaryValueCallBacks;
+extern const CFDictionaryKeyCallBacks kCFTypeDictionaryKeyCallBacks;
+extern const CFDictionaryValueCallBacks kCFTypeDictionaryValueCallBacks;
+
+CFTypeID CFDictionaryGetTypeID(void);
+CFDictionaryRef CFDictionaryCreate(CFAllocatorRef, const void **, const void **, CFIndex, const CFDictionaryKeyCallBacks *, const CFDictionaryValueCallBacks *);
+CFIndex CFDictionaryGetCount(CFDictionaryRef);
+void CFDictionaryGetKeysAndValues(CFDictionaryRef, const void **, const void **);
+const void * CFDictionaryGetValue(CFDictionaryRef, const void *);
+
+/* URLs, attributed strings
+======== */
+
+CFTypeID CFURLGetTypeID(void);
+CFURLRef CFURLCreateWithString(CFAllocatorRef, CFStringRef, CFURLRef);
+CFStringRef CFURLGetString(CFURLRef);
+
+CFTypeID CFAttributedStringGetTypeID(void);
+CFAttributedStringRef CFAttributedStringCreate(CFAllocatorRef, CFStringRef, CFDictionaryRef);
+CFStringRef CFAttributedStringGetString(CFAttributedStringRef);
+
+/* Run loops
+======== */
+
+#define kCFRunLoopDefaultMode CFSTR("kCFRunLoopDefaultMode")
+#define kCFRunLoopCommonModes CFSTR("kCFRunLoopCommonModes")
+
+enum {
+    kCFRunLoopRunFinished = 1,
+    kCFRunLoopRunStopped = 2,
+    kCFRunLoopRunTimedOut = 3,
+    kCFRunLoopRunHandledSource = 4
+};
+typedef SInt32 CFRunLoopRunResult;
+
+CFRunLoopRef CFRunLoopGetCurrent(void);
+void CFRunLoopAddSource(CFRunLoopRef, CFRunLoopSourceRef, CFRunLoopMode);
+void CFRunLoopRemoveSource(CFRunLoopRef, CFRunLoopSourceRef, CFRunLoopMode);
+CFRunLoopRunResult CFRunLoopRunInMode(CFRunLoopMode, CFTimeInterval, Boolean);
+void CFRunLoopRun(void);
+void CFRunLoopStop(CFRunLoopRef);
+void CFRunLoopSourceInvalidate(CFRunLoopSourceRef);
+
+/* Geometry
+======== */
+
+typedef double CGFloat;
+typedef struct { CGFloat x; CGFloat y; } CGPoint;
+typedef struct { CGFloat width; CGFloat height; } CGSize;
+typedef struct { CGPoint origin; CGSize size; } CGRect;
+
+static inline CGPoint CGPointMake(CGFloat x, CGFloat y) {
+    CGPoint p = { x, y };
+    return p;
+}
+
+static inline CGSize CGSizeMake(CGFloat width, CGFloat height) {
+    CGSize s = { width, height };
+    return s;
+}
+
+static inline CGRect CGRectMake(CGFloat x, CGFloat y, CGFloat width, CGFloat height) {
+    CGRect r = { { x, y }, { width, height } };
+    return r;
+}
+
+/* Accessibility types
+======== */
+
+typedef const struct __AXUIElement * AXUIElementRef;
+typedef struct __AXObserver * AXObserverRef;
+typedef const struct __AXValue * AXValueRef;
+
+typedef SInt32 AXError;
+enum {
+    kAXErrorSuccess = 0,
+    kAXErrorFailure = -25200,
+    kAXErrorIllegalArgument = -25201,
+    kAXErrorInvalidUIElement = -25202,
+    kAXErrorInvalidUIElementObserver = -25203,
+    kAXErrorCannotComplete = -25204,
+    kAXErrorAttributeUnsupported = -25205,
+    kAXErrorActionUnsupported = -25206,
+    kAXErrorNotificationUnsupported = -25207,
+    kAXErrorNotImplemented = -25208,
+    kAXErrorNotificationAlreadyRegistered = -25209,
+    kAXErrorNotificationNotRegistered = -25210,
+    kAXErrorAPIDisabled = -25211,
+    kAXErrorNoValue = -25212,
+    kAXErrorParameterizedAttributeUnsupported = -25213,
+    kAXErrorNotEnoughPrecision = -25214
+};
+
+typedef UInt32 AXValueType;
+enum {
+    kAXValueIllegalType = 0,
+    kAXValueCGPointType = 1,
+    kAXValueCGSizeType = 2,
+    kAXValueCGRectType = 3,
+    kAXValueCFRangeType = 4,
+    kAXValueAXErrorType = 5
+};
+
+typedef UInt32 AXCopyMultipleAttributeOptions;
+enum {
+    kAXCopyMultipleAttributeOptionStopOnError = 0x1
+};
+
+typedef void (*AXObserverCallback)(AXObserverRef, AXUIElementRef, CFStringRef, void *);
+
+CFTypeID AXValueGetTypeID(void);
+AXValueRef AXValueCreate(AXValueType, const void *);
+AXValueType AXValueGetType(AXValueRef);
+Boolean AXValueGetValue(AXValueRef, AXValueType, void *);
+
+CFTypeID AXUIElementGetTypeID(void);
+CFTypeID AXObserverGetTypeID(void);
+
+/*
+ * Without a window server there is nobody to hand out element references, so
+ * backends mint their own. An element is identified by its owner (the
+ * backend's private state), a 64-bit identifier, and the pid it belongs to;
+ * two elements are equal when all three match. Like the real thing, each
+ * reference also carries its own messaging timeout (0 for the default).
+ */
+AXUIElementRef AXCompatElementCreate(const void * owner, uint64_t identifier, pid_t pid);
+const void * AXCompatElementGetOwner(AXUIElementRef);
+uint64_t AXCompatElementGetIdentifier(AXUIElementRef);
+pid_t AXCompatElementGetPid(AXUIElementRef);
+void AXCompatElementSetTimeout(AXUIElementRef, float);
+float AXCompatElementGetTimeout(AXUIElementRef);
+
+/*
+ * Observers carry the callback and pid; the backend that created one decides
+ * when notifications are posted. Posting queues the callback on every run
+ * loop the observer's source has been added to, and it runs the next time
+ * that loop is run, unless the source has been invalidated (or the observer
+ * released) in the meantime. Posting to a full queue drops the notification
+ * and returns false. The finalizer, if any, runs when the observer is freed.
+ */
+AXObserverRef AXCompatObserverCreate(const void * owner, pid_t pid, AXObserverCallback callback, void (*finalize)(AXObserverRef));
+const void * AXCompatObserverGetOwner(AXObserverRef);
+pid_t AXCompatObserverGetPid(AXObserverRef);
+CFRunLoopSourceRef AXCompatObserverGetRunLoopSource(AXObserverRef);
+Boolean AXCompatObserverPost(AXObserverRef, AXUIElementRef, CFStringRef, void *);
+
+typedef struct {
+    uint64_t posted;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t max_depth;
+    uint64_t queue_capacity;
+} AXCompatRunLoopStats;
+
+/*
+ * Counts every notification posted, delivered (i.e. its callback returned)
+ * and dropped because a run loop's queue was full, across all run loops,
+ * along with the most notifications any one queue has held.
+ */
+void AXCompatRunLoopGetStats(AXCompatRunLoopStats *);
+void AXCompatRunLoopResetStats(void);
+void AXCompatRunLoopSetQueueCapacity(CFIndex); // 0 restores the default
+
+/*
+ * While a callback runs, returns when its notification was posted (in
+ * nanoseconds of CLOCK_MONOTONIC); 0 outside of callbacks.
+ */
+uint64_t AXCompatRunLoopGetPostTime(void);
+
+/* Accessibility constants
+======== */
+
+#define kAXRoleAttribute CFSTR("AXRole")
+#define kAXSubroleAttribute CFSTR("AXSubrole")
+#define kAXRoleDescriptionAttribute CFSTR("AXRoleDescription")
+#define kAXTitleAttribute CFSTR("AXTitle")
+#define kAXDescriptionAttribute CFSTR("AXDescription")
+#define kAXIdentifierAttribute CFSTR("AXIdentifier")
+#define kAXValueAttribute CFSTR("AXValue")
+#define kAXHiddenAttribute CFSTR("AXHidden")
+#define kAXPositionAttribute CFSTR("AXPosition")
+#define kAXSizeAttribute CFSTR("AXSize")
+#define kAXParentAttribute CFSTR("AXParent")
+#define kAXChildrenAttribute CFSTR("AXChildren")
+#define kAXWindowsAttribute CFSTR("AXWindows")
+#define kAXMainWindowAttribute CFSTR("AXMainWindow")
+#define kAXFocusedWindowAttribute CFSTR("AXFocusedWindow")
+#define kAXFocusedUIElementAttribute CFSTR("AXFocusedUIElement")
+#define kAXFocusedApplicationAttribute CFSTR("AXFocusedApplication")
+#define kAXFocusedAttribute CFSTR("AXFocused")
+#define kAXNumberOfCharactersAttribute CFSTR("AXNumberOfCharacters")
+#define kAXSelectedTextRangeAttribute CFSTR("AXSelectedTextRange")
+#define kAXVisibleCharacterRangeAttribute CFSTR("AXVisibleCharacterRange")
+#define kAXStringForRangeParameterizedAttribute CFSTR("AXStringForRange")
+
+#define kAXRaiseAction CFSTR("AXRaise")
+#define kAXPressAction CFSTR("AXPress")
+
+#define kAXMainWindowChangedNotification CFSTR("AXMainWindowChanged")
+#define kAXFocusedWindowChangedNotification CFSTR("AXFocusedWindowChanged")
+#define kAXFocusedUIElementChangedNotification CFSTR("AXFocusedUIElementChanged")
+#define kAXApplicationActivatedNotification CFSTR("AXApplicationActivated")
+#define kAXApplicationDeactivatedNotification CFSTR("AXApplicationDeactivated")
+#define kAXValueChangedNotification CFSTR("AXValueChanged")
+#define kAXUIElementDestroyedNotification CFSTR("AXUIElementDestroyed")
+#define kAXTitleChangedNotification CFSTR("AXTitleChanged")
+#define kAXMovedNotification CFSTR("AXMoved")
+#define kAXResizedNotification CFSTR("AXResized")
+#define kAXWindowMovedNotification CFSTR("AXWindowMoved")
+#define kAXWindowResizedNotification CFSTR("AXWindowResized")
+#define kAXWindowCreatedNotification CFSTR("AXWindowCreated")
+
+#define kAXTrustedCheckOptionPrompt CFSTR("AXTrustedCheckOptionPrompt")
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACCESSIBILITY_COMPAT_H */
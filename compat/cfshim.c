@@ -0,0 +1,1070 @@
+/*
+ * Implementation of the CoreFoundation/HIServices stand-in declared in
+ * compat/Accessibility.h. Only what the module and its backends need is
+ * provided, and performance is secondary to being simple and thread-safe.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "Accessibility.h"
+
+/* Objects
+======== */
+
+enum {
+    kCFCompatStringTypeID = 7,
+    kCFCompatBooleanTypeID,
+    kCFCompatNumberTypeID,
+    kCFCompatArrayTypeID,
+    kCFCompatDictionaryTypeID,
+    kCFCompatURLTypeID,
+    kCFCompatAttributedStringTypeID,
+    kCFCompatRunLoopTypeID,
+    kCFCompatRunLoopSourceTypeID,
+    kCFCompatAXValueTypeID,
+    kCFCompatAXUIElementTypeID,
+    kCFCompatAXObserverTypeID
+};
+
+#define CF_IMMORTAL (-1L)
+
+typedef struct {
+    CFTypeID type;
+    long retain_count;
+} CFObject;
+
+struct __CFString {
+    CFObject base;
+    CFIndex length; // in UTF-16 code units, like the real thing
+    size_t size; // in bytes, excluding the terminator
+    CFHashCode hash;
+    Boolean lone; // holds half of a surrogate pair, kept as its three byte form
+    char bytes[1];
+};
+
+struct __CFBoolean {
+    CFObject base;
+    Boolean value;
+};
+
+struct __CFNumber {
+    CFObject base;
+    CFNumberType type;
+    Boolean is_float;
+    union {
+        int64_t integer;
+        double real;
+    } value;
+};
+
+struct __CFArray {
+    CFObject base;
+    Boolean retains;
+    CFIndex count;
+    CFIndex capacity;
+    const void ** values;
+};
+
+struct __CFDictionary {
+    CFObject base;
+    Boolean retains;
+    CFIndex count;
+    const void ** keys;
+    const void ** values;
+};
+
+struct __CFURL {
+    CFObject base;
+    CFStringRef string;
+};
+
+struct __CFAttributedString {
+    CFObject base;
+    CFStringRef string;
+};
+
+struct __AXValue {
+    CFObject base;
+    AXValueType type;
+    union {
+        CGPoint point;
+        CGSize size;
+        CGRect rect;
+        CFRange range;
+        AXError error;
+    } value;
+};
+
+struct __AXUIElement {
+    CFObject base;
+    const void * owner;
+    uint64_t identifier;
+    pid_t pid;
+    float timeout;
+};
+
+#define RUN_LOOP_MAX_LOOPS 8
+
+struct __CFRunLoopSource {
+    CFObject base;
+    AXObserverRef observer; // weak, cleared when the observer is freed
+    CFRunLoopRef loops[RUN_LOOP_MAX_LOOPS];
+    int loop_count;
+    int valid;
+};
+
+struct __AXObserver {
+    CFObject base;
+    const void * owner;
+    pid_t pid;
+    AXObserverCallback callback;
+    void (*finalize)(AXObserverRef);
+    CFRunLoopSourceRef source;
+};
+
+typedef struct {
+    AXObserverRef observer;
+    AXUIElementRef element;
+    CFStringRef notification;
+    void * refcon;
+    uint64_t posted_at;
+} RunLoopItem;
+
+struct __CFRunLoop {
+    CFObject base;
+    pthread_mutex_t lock;
+    pthread_cond_t signal;
+    RunLoopItem * queue;
+    CFIndex capacity;
+    CFIndex head;
+    CFIndex count;
+    int sources;
+    int stopped;
+    uint64_t delivering; // when the notification being delivered was posted
+};
+
+// Guards the source/loop bookkeeping; queues have their own locks.
+static pthread_mutex_t run_loop_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void * objectCreate(CFTypeID type, size_t size) {
+    CFObject * object = calloc(1, size);
+    if (object == NULL) return NULL;
+    object->type = type;
+    object->retain_count = 1;
+    return object;
+}
+
+static void objectFinalize(CFObject * object);
+
+CFTypeRef CFRetain(CFTypeRef cf) {
+    CFObject * object = (CFObject *) cf;
+    if (object->retain_count != CF_IMMORTAL)
+        __atomic_add_fetch(&object->retain_count, 1, __ATOMIC_RELAXED);
+    return cf;
+}
+
+void CFRelease(CFTypeRef cf) {
+    CFObject * object = (CFObject *) cf;
+    if (object->retain_count == CF_IMMORTAL) return;
+    if (__atomic_sub_fetch(&object->retain_count, 1, __ATOMIC_ACQ_REL) == 0) {
+        objectFinalize(object);
+        free(object);
+    }
+}
+
+// Retains an object unless its last reference is already being released.
+static int objectTryRetain(CFObject * object) {
+    long count = __atomic_load_n(&object->retain_count, __ATOMIC_RELAXED);
+    while (count != CF_IMMORTAL) {
+        if (count == 0) return 0;
+        if (__atomic_compare_exchange_n(&object->retain_count, &count, count + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 1;
+}
+
+CFIndex CFGetRetainCount(CFTypeRef cf) {
+    long count = __atomic_load_n(&((CFObject *) cf)->retain_count, __ATOMIC_RELAXED);
+    return count == CF_IMMORTAL ? (CFIndex) 0x7fffffff : (CFIndex) count;
+}
+
+CFTypeID CFGetTypeID(CFTypeRef cf) {
+    return ((CFObject *) cf)->type;
+}
+
+CFTypeID CFStringGetTypeID(void) { return kCFCompatStringTypeID; }
+CFTypeID CFBooleanGetTypeID(void) { return kCFCompatBooleanTypeID; }
+CFTypeID CFNumberGetTypeID(void) { return kCFCompatNumberTypeID; }
+CFTypeID CFArrayGetTypeID(void) { return kCFCompatArrayTypeID; }
+CFTypeID CFDictionaryGetTypeID(void) { return kCFCompatDictionaryTypeID; }
+CFTypeID CFURLGetTypeID(void) { return kCFCompatURLTypeID; }
+CFTypeID CFAttributedStringGetTypeID(void) { return kCFCompatAttributedStringTypeID; }
+CFTypeID AXValueGetTypeID(void) { return kCFCompatAXValueTypeID; }
+CFTypeID AXUIElementGetTypeID(void) { return kCFCompatAXUIElementTypeID; }
+CFTypeID AXObserverGetTypeID(void) { return kCFCompatAXObserverTypeID; }
+
+Boolean CFEqual(CFTypeRef a, CFTypeRef b) {
+    if (a == b) return 1;
+    if (a == NULL || b == NULL) return 0;
+
+    CFTypeID type = CFGetTypeID(a);
+    if (type != CFGetTypeID(b)) return 0;
+
+    switch (type) {
+        case kCFCompatStringTypeID: {
+            CFStringRef x = a, y = b;
+            return x->size == y->size && x->hash == y->hash && memcmp(x->bytes, y->bytes, x->size) == 0;
+        }
+        case kCFCompatNumberTypeID: {
+            CFNumberRef x = a, y = b;
+            if (x->is_float || y->is_float) {
+                double p = x->is_float ? x->value.real : (double) x->value.integer;
+                double q = y->is_float ? y->value.real : (double) y->value.integer;
+                return p == q;
+            }
+            return x->value.integer == y->value.integer;
+        }
+        case kCFCompatArrayTypeID: {
+            CFArrayRef x = a, y = b;
+            if (x->count != y->count) return 0;
+            for (CFIndex i = 0; i < x->count; i++) {
+                if (!CFEqual(x->values[i], y->values[i])) return 0;
+            }
+            return 1;
+        }
+        case kCFCompatDictionaryTypeID: {
+            CFDictionaryRef x = a, y = b;
+            if (x->count != y->count) return 0;
+            for (CFIndex i = 0; i < x->count; i++) {
+                const void * other = CFDictionaryGetValue(y, x->keys[i]);
+                if (other == NULL || !CFEqual(x->values[i], other)) return 0;
+            }
+            return 1;
+        }
+        case kCFCompatURLTypeID:
+            return CFEqual(((CFURLRef) a)->string, ((CFURLRef) b)->string);
+        case kCFCompatAttributedStringTypeID:
+            return CFEqual(((CFAttributedStringRef) a)->string, ((CFAttributedStringRef) b)->string);
+        case kCFCompatAXValueTypeID: {
+            AXValueRef x = a, y = b;
+            if (x->type != y->type) return 0;
+            switch (x->type) {
+                case kAXValueCGPointType: return x->value.point.x == y->value.point.x && x->value.point.y == y->value.point.y;
+                case kAXValueCGSizeType: return x->value.size.width == y->value.size.width && x->value.size.height == y->value.size.height;
+                case kAXValueCGRectType: return memcmp(&x->value.rect, &y->value.rect, sizeof(CGRect)) == 0;
+                case kAXValueCFRangeType: return x->value.range.location == y->value.range.location && x->value.range.length == y->value.range.length;
+                case kAXValueAXErrorType: return x->value.error == y->value.error;
+                default: return 0;
+            }
+        }
+        case kCFCompatAXUIElementTypeID: {
+            AXUIElementRef x = a, y = b;
+            return x->owner == y->owner && x->identifier == y->identifier && x->pid == y->pid;
+        }
+        default:
+            return 0;
+    }
+}
+
+CFHashCode CFHash(CFTypeRef cf) {
+    switch (CFGetTypeID(cf)) {
+        case kCFCompatStringTypeID:
+            return ((CFStringRef) cf)->hash;
+        case kCFCompatNumberTypeID: {
+            CFNumberRef number = cf;
+            if (number->is_float && number->value.real != (double) (int64_t) number->value.real) {
+                uint64_t bits;
+                memcpy(&bits, &number->value.real, sizeof(bits));
+                return (CFHashCode) (bits * 0x9E3779B97F4A7C15ULL);
+            }
+            int64_t integer = number->is_float ? (int64_t) number->value.real : number->value.integer;
+            return (CFHashCode) ((uint64_t) integer * 0x9E3779B97F4A7C15ULL);
+        }
+        case kCFCompatArrayTypeID:
+            return (CFHashCode) ((CFArrayRef) cf)->count;
+        case kCFCompatDictionaryTypeID:
+            return (CFHashCode) ((CFDictionaryRef) cf)->count;
+        case kCFCompatURLTypeID:
+            return CFHash(((CFURLRef) cf)->string);
+        case kCFCompatAttributedStringTypeID:
+            return CFHash(((CFAttributedStringRef) cf)->string);
+        case kCFCompatAXValueTypeID:
+            return (CFHashCode) ((AXValueRef) cf)->type;
+        case kCFCompatAXUIElementTypeID: {
+            AXUIElementRef element = cf;
+            uint64_t h = element->identifier ^ ((uint64_t) (uintptr_t) element->owner << 16) ^ (uint64_t) element->pid;
+            return (CFHashCode) (h * 0x9E3779B97F4A7C15ULL);
+        }
+        default:
+            return (CFHashCode) (uintptr_t) cf;
+    }
+}
+
+/* Strings
+======== */
+
+static CFHashCode stringHash(const char * bytes, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return (CFHashCode) hash;
+}
+
+// Counts UTF-16 code units in well-formed UTF-8; anything outside the BMP
+// takes two.
+static CFIndex stringLength(const char * bytes, size_t size) {
+    CFIndex length = 0;
+    for (size_t i = 0; i < size; i++) {
+        unsigned char c = (unsigned char) bytes[i];
+        if ((c & 0xC0) == 0x80) continue;
+        length += c >= 0xF0 ? 2 : 1;
+    }
+    return length;
+}
+
+static struct __CFString * stringCreate(const char * bytes, size_t size) {
+    struct __CFString * string = objectCreate(kCFCompatStringTypeID, sizeof(struct __CFString) + size);
+    if (string == NULL) return NULL;
+    memcpy(string->bytes, bytes, size);
+    string->bytes[size] = '\0';
+    string->size = size;
+    string->length = stringLength(bytes, size);
+    string->hash = stringHash(bytes, size);
+    string->lone = 0;
+    return string;
+}
+
+CFStringRef CFStringCreateWithCString(CFAllocatorRef allocator, const char * cstr, CFStringEncoding encoding) {
+    if (cstr == NULL) return NULL;
+    return stringCreate(cstr, strlen(cstr));
+}
+
+CFStringRef CFStringCreateWithBytes(CFAllocatorRef allocator, const UInt8 * bytes, CFIndex size, CFStringEncoding encoding, Boolean external) {
+    if (bytes == NULL || size < 0) return NULL;
+    return stringCreate((const char *) bytes, (size_t) size);
+}
+
+CFIndex CFStringGetLength(CFStringRef string) {
+    return string->length;
+}
+
+// Half a surrogate pair has no UTF-8, so like the real thing neither of these
+// converts a string holding one.
+const char * CFStringGetCStringPtr(CFStringRef string, CFStringEncoding encoding) {
+    return string->lone ? NULL : string->bytes;
+}
+
+Boolean CFStringGetCString(CFStringRef string, char * buffer, CFIndex size, CFStringEncoding encoding) {
+    if (string->lone || size <= 0 || (size_t) size <= string->size) return 0;
+    memcpy(buffer, string->bytes, string->size + 1);
+    return 1;
+}
+
+CFIndex CFStringGetMaximumSizeForEncoding(CFIndex length, CFStringEncoding encoding) {
+    return length * 3;
+}
+
+CFComparisonResult CFStringCompare(CFStringRef a, CFStringRef b, CFOptionFlags options) {
+    size_t size = a->size < b->size ? a->size : b->size;
+    int result = memcmp(a->bytes, b->bytes, size);
+    if (result == 0) result = (a->size > b->size) - (a->size < b->size);
+    return result < 0 ? kCFCompareLessThan : (result > 0 ? kCFCompareGreaterThan : kCFCompareEqualTo);
+}
+
+// Converts a UTF-16 offset into a byte offset, walking from byte i. An offset
+// between the halves of a surrogate pair lands after the pair, and sets *split.
+static size_t stringOffsetFrom(CFStringRef string, size_t i, CFIndex units, int * split) {
+    while (i < string->size && units > 0) {
+        unsigned char c = (unsigned char) string->bytes[i];
+        size_t width = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : (c >= 0xC0 ? 2 : 1));
+        units -= c >= 0xF0 ? 2 : 1;
+        i += width;
+    }
+    *split = units < 0;
+    return i < string->size ? i : string->size;
+}
+
+// The high (0) or low (1) half of the pair for the four byte sequence at bytes.
+static UniChar stringSurrogate(const char * bytes, int half) {
+    const unsigned char * b = (const unsigned char *) bytes;
+    UInt32 point = ((UInt32) (b[0] & 0x07) << 18 | (UInt32) (b[1] & 0x3F) << 12 | (UInt32) (b[2] & 0x3F) << 6 | (b[3] & 0x3F)) - 0x10000;
+    return (UniChar) (half ? 0xDC00 + (point & 0x3FF) : 0xD800 + (point >> 10));
+}
+
+static size_t stringPutSurrogate(char * bytes, UniChar surrogate) {
+    bytes[0] = (char) 0xED;
+    bytes[1] = (char) (0x80 | ((surrogate >> 6) & 0x3F));
+    bytes[2] = (char) (0x80 | (surrogate & 0x3F));
+    return 3;
+}
+
+// A range that cuts a surrogate pair keeps the half inside it, as the real
+// thing does.
+CFStringRef CFStringCreateWithSubstring(CFAllocatorRef allocator, CFStringRef string, CFRange range) {
+    if (range.location < 0 || range.length < 0 || range.location + range.length > string->length) return NULL;
+    if ((size_t) string->length == string->size) // ASCII, one byte per unit
+        return stringCreate(string->bytes + range.location, (size_t) range.length);
+    if (range.length == 0) return stringCreate("", 0);
+
+    int split_start, split_end;
+    size_t start = stringOffsetFrom(string, 0, range.location, &split_start);
+    size_t end = stringOffsetFrom(string, start, range.length - split_start, &split_end);
+    if (split_end) end -= 4;
+    char * bytes = malloc(end - start + 6);
+    if (bytes == NULL) return NULL;
+    size_t size = 0;
+    if (split_start) size += stringPutSurrogate(bytes, stringSurrogate(string->bytes + start - 4, 1));
+    memcpy(bytes + size, string->bytes + start, end - start);
+    size += end - start;
+    if (split_end) size += stringPutSurrogate(bytes + size, stringSurrogate(string->bytes + end, 0));
+    struct __CFString * substring = stringCreate(bytes, size);
+    free(bytes);
+    if (substring != NULL && (string->lone || split_start || split_end)) {
+        for (size_t i = 0; i + 1 < size; i++) {
+            if ((unsigned char) substring->bytes[i] == 0xED && (unsigned char) substring->bytes[i + 1] >= 0xA0) substring->lone = 1;
+        }
+    }
+    return substring;
+}
+
+UniChar CFStringGetCharacterAtIndex(CFStringRef string, CFIndex index) {
+    const unsigned char * b = (const unsigned char *) string->bytes;
+    size_t i = 0;
+    while (i < string->size) {
+        unsigned char c = b[i];
+        if (c >= 0xF0) {
+            if (index < 2) return stringSurrogate(string->bytes + i, (int) index);
+            index -= 2;
+            i += 4;
+            continue;
+        }
+        if (index == 0) {
+            if (c >= 0xE0) return (UniChar) ((c & 0x0F) << 12 | (b[i + 1] & 0x3F) << 6 | (b[i + 2] & 0x3F));
+            if (c >= 0xC0) return (UniChar) ((c & 0x1F) << 6 | (b[i + 1] & 0x3F));
+            return c;
+        }
+        index--;
+        i += c >= 0xE0 ? 3 : (c >= 0xC0 ? 2 : 1);
+    }
+    return 0;
+}
+
+#define CONSTANT_STRING_BUCKETS 1024
+
+typedef struct ConstantString {
+    const char * literal;
+    struct __CFString * string;
+    struct ConstantString * next;
+} ConstantString;
+
+static ConstantString * constant_strings[CONSTANT_STRING_BUCKETS];
+static pthread_mutex_t constant_strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+CFStringRef __CFStringMakeConstantString(const char * cstr) {
+    size_t size = strlen(cstr);
+    CFHashCode hash = stringHash(cstr, size);
+    ConstantString ** bucket = &constant_strings[hash % CONSTANT_STRING_BUCKETS];
+
+    // Literals are usually repeated from the same call site, so the common
+    // case is a pointer match on the first entry.
+    pthread_mutex_lock(&constant_strings_lock);
+    ConstantString * entry = *bucket;
+    while (entry != NULL) {
+        if (entry->literal == cstr || (entry->string->size == size && memcmp(entry->string->bytes, cstr, size) == 0))
+            break;
+        entry = entry->next;
+    }
+    if (entry == NULL) {
+        entry = malloc(sizeof(ConstantString));
+        entry->literal = cstr;
+        entry->string = stringCreate(cstr, size);
+        entry->string->base.retain_count = CF_IMMORTAL;
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    pthread_mutex_unlock(&constant_strings_lock);
+    return entry->string;
+}
+
+/* Booleans, numbers
+======== */
+
+static struct __CFBoolean boolean_true = { { kCFCompatBooleanTypeID, CF_IMMORTAL }, 1 };
+static struct __CFBoolean boolean_false = { { kCFCompatBooleanTypeID, CF_IMMORTAL }, 0 };
+const CFBooleanRef kCFBooleanTrue = &boolean_true;
+const CFBooleanRef kCFBooleanFalse = &boolean_false;
+
+Boolean CFBooleanGetValue(CFBooleanRef boolean) {
+    return boolean->value;
+}
+
+static Boolean numberTypeIsFloat(CFNumberType type) {
+    return type == kCFNumberFloat32Type || type == kCFNumberFloat64Type || type == kCFNumberFloatType
+        || type == kCFNumberDoubleType || type == kCFNumberCGFloatType;
+}
+
+CFNumberRef CFNumberCreate(CFAllocatorRef allocator, CFNumberType type, const void * value) {
+    struct __CFNumber * number = objectCreate(kCFCompatNumberTypeID, sizeof(struct __CFNumber));
+    if (number == NULL) return NULL;
+    number->type = type;
+    number->is_float = numberTypeIsFloat(type);
+
+    switch (type) {
+        case kCFNumberSInt8Type: case kCFNumberCharType: number->value.integer = *(const int8_t *) value; break;
+        case kCFNumberSInt16Type: case kCFNumberShortType: number->value.integer = *(const int16_t *) value; break;
+        case kCFNumberSInt32Type: case kCFNumberIntType: number->value.integer = *(const int32_t *) value; break;
+        case kCFNumberLongType: number->value.integer = *(const long *) value; break;
+        case kCFNumberCFIndexType: case kCFNumberNSIntegerType: number->value.integer = *(const CFIndex *) value; break;
+        case kCFNumberFloat32Type: case kCFNumberFloatType: number->value.real = *(const float *) value; break;
+        case kCFNumberFloat64Type: case kCFNumberDoubleType: case kCFNumberCGFloatType: number->value.real = *(const double *) value; break;
+        default: number->value.integer = *(const int64_t *) value; break;
+    }
+    return number;
+}
+
+CFNumberType CFNumberGetType(CFNumberRef number) {
+    return number->type;
+}
+
+Boolean CFNumberIsFloatType(CFNumberRef number) {
+    return number->is_float;
+}
+
+Boolean CFNumberGetValue(CFNumberRef number, CFNumberType type, void * out) {
+    int64_t integer = number->is_float ? (int64_t) number->value.real : number->value.integer;
+    double real = number->is_float ? number->value.real : (double) number->value.integer;
+
+    switch (type) {
+        case kCFNumberSInt8Type: case kCFNumberCharType: *(int8_t *) out = (int8_t) integer; break;
+        case kCFNumberSInt16Type: case kCFNumberShortType: *(int16_t *) out = (int16_t) integer; break;
+        case kCFNumberSInt32Type: case kCFNumberIntType: *(int32_t *) out = (int32_t) integer; break;
+        case kCFNumberLongType: *(long *) out = (long) integer; break;
+        case kCFNumberCFIndexType: case kCFNumberNSIntegerType: *(CFIndex *) out = (CFIndex) integer; break;
+        case kCFNumberFloat32Type: case kCFNumberFloatType: *(float *) out = (float) real; break;
+        case kCFNumberFloat64Type: case kCFNumberDoubleType: case kCFNumberCGFloatType: *(double *) out = real; break;
+        default: *(int64_t *) out = integer; break;
+    }
+
+    // Lossy conversions succeed but report it, as CoreFoundation does.
+    if (numberTypeIsFloat(type)) return number->is_float || (int64_t) real == integer;
+    return !number->is_float || (double) integer == real;
+}
+
+/* Collections
+======== */
+
+const CFArrayCallBacks kCFTypeArrayCallBacks = { 0, NULL, NULL, NULL, NULL };
+const CFDictionaryKeyCallBacks kCFTypeDictionaryKeyCallBacks = { 0, NULL, NULL, NULL, NULL, NULL };
+const CFDictionaryValueCallBacks kCFTypeDictionaryValueCallBacks = { 0, NULL, NULL, NULL, NULL };
+
+CFArrayRef CFArrayCreate(CFAllocatorRef allocator, const void ** values, CFIndex count, const CFArrayCallBacks * callbacks) {
+    CFMutableArrayRef array = CFArrayCreateMutable(allocator, count, callbacks);
+    if (array == NULL) return NULL;
+    for (CFIndex i = 0; i < count; i++) CFArrayAppendValue(array, values[i]);
+    return array;
+}
+
+CFMutableArrayRef CFArrayCreateMutable(CFAllocatorRef allocator, CFIndex capacity, const CFArrayCallBacks * callbacks) {
+    struct __CFArray * array = objectCreate(kCFCompatArrayTypeID, sizeof(struct __CFArray));
+    if (array == NULL) return NULL;
+    array->retains = callbacks != NULL;
+    array->capacity = capacity > 0 ? capacity : 4;
+    array->values = malloc(sizeof(void *) * array->capacity);
+    return array;
+}
+
+void CFArrayAppendValue(CFMutableArrayRef array, const void * value) {
+    if (array->count == array->capacity) {
+        array->capacity *= 2;
+        array->values = realloc(array->values, sizeof(void *) * array->capacity);
+    }
+    if (array->retains) CFRetain(value);
+    array->values[array->count++] = value;
+}
+
+CFIndex CFArrayGetCount(CFArrayRef array) {
+    return array->count;
+}
+
+const void * CFArrayGetValueAtIndex(CFArrayRef array, CFIndex index) {
+    return array->values[index];
+}
+
+CFDictionaryRef CFDictionaryCreate(CFAllocatorRef allocator, const void ** keys, const void ** values, CFIndex count, const CFDictionaryKeyCallBacks * key_callbacks, const CFDictionaryValueCallBacks * value_callbacks) {
+    struct __CFDictionary * dictionary = objectCreate(kCFCompatDictionaryTypeID, sizeof(struct __CFDictionary));
+    if (dictionary == NULL) return NULL;
+    dictionary->retains = key_callbacks != NULL;
+    dictionary->keys = malloc(sizeof(void *) * (count > 0 ? count : 1));
+    dictionary->values = malloc(sizeof(void *) * (count > 0 ? count : 1));
+    for (CFIndex i = 0; i < count; i++) {
+        if (dictionary->retains) {
+            CFRetain(keys[i]);
+            CFRetain(values[i]);
+        }
+        dictionary->keys[i] = keys[i];
+        dictionary->values[i] = values[i];
+    }
+    dictionary->count = count;
+    return dictionary;
+}
+
+CFIndex CFDictionaryGetCount(CFDictionaryRef dictionary) {
+    return dictionary->count;
+}
+
+void CFDictionaryGetKeysAndValues(CFDictionaryRef dictionary, const void ** keys, const void ** values) {
+    for (CFIndex i = 0; i < dictionary->count; i++) {
+        if (keys) keys[i] = dictionary->keys[i];
+        if (values) values[i] = dictionary->values[i];
+    }
+}
+
+const void * CFDictionaryGetValue(CFDictionaryRef dictionary, const void * key) {
+    for (CFIndex i = 0; i < dictionary->count; i++) {
+        if (CFEqual(dictionary->keys[i], key)) return dictionary->values[i];
+    }
+    return NULL;
+}
+
+/* URLs, attributed strings
+======== */
+
+CFURLRef CFURLCreateWithString(CFAllocatorRef allocator, CFStringRef string, CFURLRef base) {
+    struct __CFURL * url = objectCreate(kCFCompatURLTypeID, sizeof(struct __CFURL));
+    if (url == NULL) return NULL;
+    url->string = CFRetain(string);
+    return url;
+}
+
+CFStringRef CFURLGetString(CFURLRef url) {
+    return url->string;
+}
+
+CFAttributedStringRef CFAttributedStringCreate(CFAllocatorRef allocator, CFStringRef string, CFDictionaryRef attributes) {
+    struct __CFAttributedString * attributed = objectCreate(kCFCompatAttributedStringTypeID, sizeof(struct __CFAttributedString));
+    if (attributed == NULL) return NULL;
+    attributed->string = CFRetain(string);
+    return attributed;
+}
+
+CFStringRef CFAttributedStringGetString(CFAttributedStringRef attributed) {
+    return attributed->string;
+}
+
+/* Accessibility values, elements
+======== */
+
+AXValueRef AXValueCreate(AXValueType type, const void * value) {
+    struct __AXValue * ax_value = objectCreate(kCFCompatAXValueTypeID, sizeof(struct __AXValue));
+    if (ax_value == NULL) return NULL;
+    ax_value->type = type;
+    switch (type) {
+        case kAXValueCGPointType: ax_value->value.point = *(const CGPoint *) value; break;
+        case kAXValueCGSizeType: ax_value->value.size = *(const CGSize *) value; break;
+        case kAXValueCGRectType: ax_value->value.rect = *(const CGRect *) value; break;
+        case kAXValueCFRangeType: ax_value->value.range = *(const CFRange *) value; break;
+        case kAXValueAXErrorType: ax_value->value.error = *(const AXError *) value; break;
+        default:
+            free(ax_value);
+            return NULL;
+    }
+    return ax_value;
+}
+
+AXValueType AXValueGetType(AXValueRef value) {
+    return value->type;
+}
+
+Boolean AXValueGetValue(AXValueRef value, AXValueType type, void * out) {
+    if (value->type != type) return 0;
+    switch (type) {
+        case kAXValueCGPointType: *(CGPoint *) out = value->value.point; break;
+        case kAXValueCGSizeType: *(CGSize *) out = value->value.size; break;
+        case kAXValueCGRectType: *(CGRect *) out = value->value.rect; break;
+        case kAXValueCFRangeType: *(CFRange *) out = value->value.range; break;
+        case kAXValueAXErrorType: *(AXError *) out = value->value.error; break;
+        default: return 0;
+    }
+    return 1;
+}
+
+AXUIElementRef AXCompatElementCreate(const void * owner, uint64_t identifier, pid_t pid) {
+    struct __AXUIElement * element = objectCreate(kCFCompatAXUIElementTypeID, sizeof(struct __AXUIElement));
+    if (element == NULL) return NULL;
+    element->owner = owner;
+    element->identifier = identifier;
+    element->pid = pid;
+    return element;
+}
+
+const void * AXCompatElementGetOwner(AXUIElementRef element) {
+    return element->owner;
+}
+
+uint64_t AXCompatElementGetIdentifier(AXUIElementRef element) {
+    return element->identifier;
+}
+
+pid_t AXCompatElementGetPid(AXUIElementRef element) {
+    return element->pid;
+}
+
+void AXCompatElementSetTimeout(AXUIElementRef element, float timeout) {
+    __atomic_store(&((struct __AXUIElement *) element)->timeout, &timeout, __ATOMIC_RELAXED);
+}
+
+float AXCompatElementGetTimeout(AXUIElementRef element) {
+    float timeout;
+    __atomic_load(&((struct __AXUIElement *) element)->timeout, &timeout, __ATOMIC_RELAXED);
+    return timeout;
+}
+
+/* Run loops
+======== */
+
+#define RUN_LOOP_DEFAULT_CAPACITY 4096
+
+static CFIndex run_loop_capacity = RUN_LOOP_DEFAULT_CAPACITY;
+static uint64_t run_loop_posted = 0;
+static uint64_t run_loop_delivered = 0;
+static uint64_t run_loop_dropped = 0;
+static uint64_t run_loop_max_depth = 0;
+
+static pthread_key_t run_loop_key;
+static pthread_once_t run_loop_once = PTHREAD_ONCE_INIT;
+
+static uint64_t runLoopTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+static void runLoopThreadExit(void * loop) {
+    CFRelease(loop);
+}
+
+static void runLoopKeyCreate(void) {
+    pthread_key_create(&run_loop_key, runLoopThreadExit);
+}
+
+CFRunLoopRef CFRunLoopGetCurrent(void) {
+    pthread_once(&run_loop_once, runLoopKeyCreate);
+    CFRunLoopRef loop = pthread_getspecific(run_loop_key);
+    if (loop != NULL) return loop;
+
+    loop = objectCreate(kCFCompatRunLoopTypeID, sizeof(struct __CFRunLoop));
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->signal, NULL);
+    loop->capacity = __atomic_load_n(&run_loop_capacity, __ATOMIC_RELAXED);
+    loop->queue = malloc(sizeof(RunLoopItem) * loop->capacity);
+    pthread_setspecific(run_loop_key, loop);
+    return loop;
+}
+
+static void runLoopItemRelease(RunLoopItem * item) {
+    CFRelease(item->observer);
+    CFRelease(item->element);
+    CFRelease(item->notification);
+}
+
+void CFRunLoopAddSource(CFRunLoopRef loop, CFRunLoopSourceRef source, CFRunLoopMode mode) {
+    pthread_mutex_lock(&run_loop_lock);
+    int present = 0;
+    for (int i = 0; i < source->loop_count; i++) {
+        if (source->loops[i] == loop) present = 1;
+    }
+    if (!present && source->valid && source->loop_count < RUN_LOOP_MAX_LOOPS) {
+        source->loops[source->loop_count++] = (CFRunLoopRef) CFRetain(loop);
+        CFRetain(source);
+        pthread_mutex_lock(&loop->lock);
+        loop->sources++;
+        pthread_mutex_unlock(&loop->lock);
+    }
+    pthread_mutex_unlock(&run_loop_lock);
+}
+
+// Expects run_loop_lock to be held.
+static void runLoopDetach(CFRunLoopRef loop, CFRunLoopSourceRef source) {
+    pthread_mutex_lock(&loop->lock);
+    loop->sources--;
+    pthread_cond_broadcast(&loop->signal);
+    pthread_mutex_unlock(&loop->lock);
+    CFRelease(loop);
+}
+
+void CFRunLoopRemoveSource(CFRunLoopRef loop, CFRunLoopSourceRef source, CFRunLoopMode mode) {
+    int removed = 0;
+    pthread_mutex_lock(&run_loop_lock);
+    for (int i = 0; i < source->loop_count; i++) {
+        if (source->loops[i] == loop) {
+            source->loops[i] = source->loops[--source->loop_count];
+            runLoopDetach(loop, source);
+            removed = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&run_loop_lock);
+    if (removed) CFRelease(source);
+}
+
+void CFRunLoopSourceInvalidate(CFRunLoopSourceRef source) {
+    int count;
+    pthread_mutex_lock(&run_loop_lock);
+    source->valid = 0;
+    count = source->loop_count;
+    for (int i = 0; i < count; i++) runLoopDetach(source->loops[i], source);
+    source->loop_count = 0;
+    pthread_mutex_unlock(&run_loop_lock);
+    for (int i = 0; i < count; i++) CFRelease(source);
+}
+
+static int sourceIsValid(CFRunLoopSourceRef source) {
+    pthread_mutex_lock(&run_loop_lock);
+    int valid = source->valid && source->observer != NULL;
+    pthread_mutex_unlock(&run_loop_lock);
+    return valid;
+}
+
+CFRunLoopRunResult CFRunLoopRunInMode(CFRunLoopMode mode, CFTimeInterval seconds, Boolean return_after_source_handled) {
+    CFRunLoopRef loop = CFRunLoopGetCurrent();
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double end = now.tv_sec + now.tv_usec / 1e6 + (seconds > 0 ? seconds : 0);
+    struct timespec deadline;
+    deadline.tv_sec = (time_t) end;
+    deadline.tv_nsec = (long) ((end - (double) deadline.tv_sec) * 1e9);
+
+    CFRunLoopRunResult result = kCFRunLoopRunTimedOut;
+    pthread_mutex_lock(&loop->lock);
+    loop->stopped = 0;
+    while (1) {
+        if (loop->stopped) {
+            loop->stopped = 0;
+            result = kCFRunLoopRunStopped;
+            break;
+        }
+        if (loop->count == 0) {
+            if (loop->sources == 0) {
+                result = kCFRunLoopRunFinished;
+                break;
+            }
+            if (pthread_cond_timedwait(&loop->signal, &loop->lock, &deadline) == ETIMEDOUT && loop->count == 0) {
+                result = kCFRunLoopRunTimedOut;
+                break;
+            }
+            continue;
+        }
+
+        RunLoopItem item = loop->queue[loop->head];
+        loop->head = (loop->head + 1) % loop->capacity;
+        loop->count--;
+        pthread_mutex_unlock(&loop->lock);
+
+        // The observer's owner may have gone away while this was queued.
+        CFRunLoopSourceRef source = item.observer->source;
+        if (sourceIsValid(source)) {
+            uint64_t outer = loop->delivering; // callbacks may run the loop
+            loop->delivering = item.posted_at;
+            item.observer->callback(item.observer, item.element, item.notification, item.refcon);
+            loop->delivering = outer;
+            __atomic_add_fetch(&run_loop_delivered, 1, __ATOMIC_RELAXED);
+        }
+        runLoopItemRelease(&item);
+
+        pthread_mutex_lock(&loop->lock);
+        if (return_after_source_handled) {
+            result = kCFRunLoopRunHandledSource;
+            break;
+        }
+
+        // A queue that never empties must not keep the loop running forever
+        gettimeofday(&now, NULL);
+        if (now.tv_sec + now.tv_usec / 1e6 >= end) {
+            result = kCFRunLoopRunTimedOut;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return result;
+}
+
+void CFRunLoopRun(void) {
+    CFRunLoopRunResult result;
+    do {
+        result = CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0e10, 0);
+    } while (result != kCFRunLoopRunStopped && result != kCFRunLoopRunFinished);
+}
+
+void CFRunLoopStop(CFRunLoopRef loop) {
+    pthread_mutex_lock(&loop->lock);
+    loop->stopped = 1;
+    pthread_cond_broadcast(&loop->signal);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+void AXCompatRunLoopGetStats(AXCompatRunLoopStats * stats) {
+    stats->posted = __atomic_load_n(&run_loop_posted, __ATOMIC_RELAXED);
+    stats->delivered = __atomic_load_n(&run_loop_delivered, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&run_loop_dropped, __ATOMIC_RELAXED);
+    stats->max_depth = __atomic_load_n(&run_loop_max_depth, __ATOMIC_RELAXED);
+    stats->queue_capacity = (uint64_t) __atomic_load_n(&run_loop_capacity, __ATOMIC_RELAXED);
+}
+
+void AXCompatRunLoopResetStats(void) {
+    __atomic_store_n(&run_loop_posted, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&run_loop_delivered, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&run_loop_dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&run_loop_max_depth, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t AXCompatRunLoopGetPostTime(void) {
+    pthread_once(&run_loop_once, runLoopKeyCreate);
+    CFRunLoopRef loop = pthread_getspecific(run_loop_key);
+    return (loop != NULL) ? loop->delivering : 0;
+}
+
+// Only affects run loops created afterwards.
+void AXCompatRunLoopSetQueueCapacity(CFIndex capacity) {
+    if (capacity <= 0) capacity = RUN_LOOP_DEFAULT_CAPACITY;
+    __atomic_store_n(&run_loop_capacity, capacity, __ATOMIC_RELAXED);
+}
+
+/* Observers
+======== */
+
+AXObserverRef AXCompatObserverCreate(const void * owner, pid_t pid, AXObserverCallback callback, void (*finalize)(AXObserverRef)) {
+    struct __AXObserver * observer = objectCreate(kCFCompatAXObserverTypeID, sizeof(struct __AXObserver));
+    if (observer == NULL) return NULL;
+    struct __CFRunLoopSource * source = objectCreate(kCFCompatRunLoopSourceTypeID, sizeof(struct __CFRunLoopSource));
+    if (source == NULL) {
+        free(observer);
+        return NULL;
+    }
+    source->observer = observer;
+    source->valid = 1;
+    observer->owner = owner;
+    observer->pid = pid;
+    observer->callback = callback;
+    observer->finalize = finalize;
+    observer->source = source;
+    return observer;
+}
+
+const void * AXCompatObserverGetOwner(AXObserverRef observer) {
+    return observer->owner;
+}
+
+pid_t AXCompatObserverGetPid(AXObserverRef observer) {
+    return observer->pid;
+}
+
+CFRunLoopSourceRef AXCompatObserverGetRunLoopSource(AXObserverRef observer) {
+    return observer->source;
+}
+
+Boolean AXCompatObserverPost(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    CFRunLoopRef loops[RUN_LOOP_MAX_LOOPS];
+    int count = 0;
+
+    // Backends may hold observers weakly until their finalizer runs
+    if (!objectTryRetain((CFObject *) observer)) return 0;
+
+    pthread_mutex_lock(&run_loop_lock);
+    CFRunLoopSourceRef source = observer->source;
+    if (source->valid) {
+        for (int i = 0; i < source->loop_count; i++) loops[count++] = (CFRunLoopRef) CFRetain(source->loops[i]);
+    }
+    pthread_mutex_unlock(&run_loop_lock);
+
+    Boolean queued = 0;
+    uint64_t posted_at = runLoopTime();
+    for (int i = 0; i < count; i++) {
+        CFRunLoopRef loop = loops[i];
+        __atomic_add_fetch(&run_loop_posted, 1, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&loop->lock);
+        if (loop->count < loop->capacity) {
+            RunLoopItem * item = &loop->queue[(loop->head + loop->count) % loop->capacity];
+            item->observer = (AXObserverRef) CFRetain(observer);
+            item->element = CFRetain(element);
+            item->notification = CFRetain(notification);
+            item->refcon = refcon;
+            item->posted_at = posted_at;
+            loop->count++;
+            pthread_cond_signal(&loop->signal);
+            queued = 1;
+
+            uint64_t depth = (uint64_t) loop->count;
+            uint64_t max_depth = __atomic_load_n(&run_loop_max_depth, __ATOMIC_RELAXED);
+            while (depth > max_depth && !__atomic_compare_exchange_n(&run_loop_max_depth, &max_depth, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        } else {
+            __atomic_add_fetch(&run_loop_dropped, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&loop->lock);
+        CFRelease(loop);
+    }
+    CFRelease(observer);
+    return queued;
+}
+
+/* Finalization
+======== */
+
+static void objectFinalize(CFObject * object) {
+    switch (object->type) {
+        case kCFCompatArrayTypeID: {
+            struct __CFArray * array = (struct __CFArray *) object;
+            if (array->retains) {
+                for (CFIndex i = 0; i < array->count; i++) CFRelease(array->values[i]);
+            }
+            free(array->values);
+            break;
+        }
+        case kCFCompatDictionaryTypeID: {
+            struct __CFDictionary * dictionary = (struct __CFDictionary *) object;
+            if (dictionary->retains) {
+                for (CFIndex i = 0; i < dictionary->count; i++) {
+                    CFRelease(dictionary->keys[i]);
+                    CFRelease(dictionary->values[i]);
+                }
+            }
+            free(dictionary->keys);
+            free(dictionary->values);
+            break;
+        }
+        case kCFCompatURLTypeID:
+            CFRelease(((struct __CFURL *) object)->string);
+            break;
+        case kCFCompatAttributedStringTypeID:
+            CFRelease(((struct __CFAttributedString *) object)->string);
+            break;
+        case kCFCompatAXObserverTypeID: {
+            struct __AXObserver * observer = (struct __AXObserver *) object;
+            if (observer->finalize != NULL) observer->finalize(observer);
+            CFRunLoopSourceInvalidate(observer->source);
+            pthread_mutex_lock(&run_loop_lock);
+            observer->source->observer = NULL;
+            pthread_mutex_unlock(&run_loop_lock);
+            CFRelease(observer->source);
+            break;
+        }
+        case kCFCompatRunLoopTypeID: {
+            struct __CFRunLoop * loop = (struct __CFRunLoop *) object;
+            for (CFIndex i = 0; i < loop->count; i++)
+                runLoopItemRelease(&loop->queue[(loop->head + i) % loop->capacity]);
+            free(loop->queue);
+            pthread_mutex_destroy(&loop->lock);
+            pthread_cond_destroy(&loop->signal);
+            break;
+        }
+        default:
+            break;
+    }
+}
@@ -0,0 +1,338 @@
+/*
+ * Sessions, value conversion and observers for programs that use the
+ * backends without Python; see core.h.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+
+// The rest of cfStringUTF8, for strings whose bytes CF does not keep as UTF-8.
+const char * cfStringCopyUTF8(CFStringRef string, char * buffer, size_t size, size_t * length, char ** allocated) {
+    *allocated = NULL;
+    CFIndex needed = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+    char * bytes = buffer;
+    if (bytes == NULL || (size_t) needed > size) {
+        bytes = *allocated = (char *) malloc((size_t) needed);
+        if (bytes == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    if (!CFStringGetCString(string, bytes, needed, kCFStringEncodingUTF8)) {
+        free(*allocated);
+        *allocated = NULL;
+        errno = EILSEQ;
+        return NULL;
+    }
+    *length = strlen(bytes);
+    return bytes;
+}
+
+CFArrayRef axCreateNames(const char * const * names, size_t count) {
+    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, (CFIndex) count, &kCFTypeArrayCallBacks);
+    for (size_t i = 0; array != NULL && i < count; i++) {
+        CF_SCOPED CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, names[i], kCFStringEncodingUTF8);
+        if (name == NULL) {
+            CFRelease(array);
+            return NULL;
+        }
+        CFArrayAppendValue(array, name);
+    }
+    return array;
+}
+
+/* Values
+======== */
+
+static int variantFromString(CFStringRef string, AXVariant * variant) {
+    if (string == NULL || CFStringGetLength(string) == 0) return 0;
+
+    char stack[256];
+    char * allocated;
+    size_t length;
+    const char * bytes = cfStringUTF8(string, stack, sizeof(stack), &length, &allocated);
+    // Strings that cannot be encoded are read as no value
+    if (bytes == NULL) return (errno == ENOMEM) ? -1 : 0;
+    if (allocated == NULL) {
+        allocated = (char *) malloc(length + 1);
+        if (allocated == NULL) return -1;
+        memcpy(allocated, bytes, length + 1);
+    }
+    variant->type = AX_VARIANT_STRING;
+    variant->value.string.bytes = allocated;
+    variant->value.string.length = length;
+    return 0;
+}
+
+static int variantFromArray(CFArrayRef array, AXVariant * variant) {
+    CFIndex count = CFArrayGetCount(array);
+    if (count <= 0) return 0;
+
+    AXVariant * items = (AXVariant *) calloc((size_t) count, sizeof(AXVariant));
+    if (items == NULL) return -1;
+    for (CFIndex i = 0; i < count; i++) {
+        if (axVariantFromValue(CFArrayGetValueAtIndex(array, i), &items[i]) == -1) {
+            for (CFIndex j = 0; j < i; j++) axVariantClear(&items[j]);
+            free(items);
+            return -1;
+        }
+    }
+    variant->type = AX_VARIANT_ARRAY;
+    variant->value.array.items = items;
+    variant->value.array.count = (size_t) count;
+    return 0;
+}
+
+int axVariantFromAXValue(AXValueRef value, AXVariant * variant) {
+    switch (AXValueGetType(value)) {
+        case kAXValueCGPointType: {
+            CGPoint point;
+            if (!AXValueGetValue(value, kAXValueCGPointType, (void *) &point)) return -1;
+            variant->type = AX_VARIANT_POINT;
+            variant->value.geometry[0] = point.x;
+            variant->value.geometry[1] = point.y;
+            return 0;
+        }
+        case kAXValueCGSizeType: {
+            CGSize size;
+            if (!AXValueGetValue(value, kAXValueCGSizeType, (void *) &size)) return -1;
+            variant->type = AX_VARIANT_SIZE;
+            variant->value.geometry[0] = size.width;
+            variant->value.geometry[1] = size.height;
+            return 0;
+        }
+        case kAXValueCGRectType: {
+            CGRect rect;
+            if (!AXValueGetValue(value, kAXValueCGRectType, (void *) &rect)) return -1;
+            variant->type = AX_VARIANT_RECT;
+            variant->value.geometry[0] = rect.origin.x;
+            variant->value.geometry[1] = rect.origin.y;
+            variant->value.geometry[2] = rect.size.width;
+            variant->value.geometry[3] = rect.size.height;
+            return 0;
+        }
+        case kAXValueCFRangeType: {
+            CFRange range;
+            if (!AXValueGetValue(value, kAXValueCFRangeType, (void *) &range)) return -1;
+            variant->type = AX_VARIANT_RANGE;
+            variant->value.range.location = range.location;
+            variant->value.range.length = range.length;
+            return 0;
+        }
+        case kAXValueAXErrorType: {
+            AXError error;
+            if (!AXValueGetValue(value, kAXValueAXErrorType, (void *) &error)) return -1;
+            variant->type = AX_VARIANT_ERROR;
+            variant->value.integer = error;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+int axVariantFromValue(CFTypeRef value, AXVariant * variant) {
+    memset(variant, 0, sizeof(AXVariant));
+    if (value == NULL) return 0;
+
+    CFTypeID type = CFGetTypeID(value);
+    if (type == CFStringGetTypeID()) {
+        return variantFromString((CFStringRef) value, variant);
+    } else if (type == AXUIElementGetTypeID()) {
+        variant->type = AX_VARIANT_ELEMENT;
+        variant->value.element = (AXUIElementRef) CFRetain(value);
+        return 0;
+    } else if (type == CFArrayGetTypeID()) {
+        return variantFromArray((CFArrayRef) value, variant);
+    } else if (type == AXValueGetTypeID() && axVariantFromAXValue((AXValueRef) value, variant) == 0) {
+        return 0;
+    } else if (type == CFBooleanGetTypeID()) {
+        variant->type = AX_VARIANT_BOOLEAN;
+        variant->value.integer = CFBooleanGetValue((CFBooleanRef) value) ? 1 : 0;
+        return 0;
+    } else if (type == CFNumberGetTypeID()) {
+        if (CFNumberIsFloatType((CFNumberRef) value)) {
+            variant->type = AX_VARIANT_REAL;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberDoubleType, &variant->value.real);
+        } else {
+            long long integer = 0;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberLongLongType, &integer);
+            variant->type = AX_VARIANT_INTEGER;
+            variant->value.integer = integer;
+        }
+        return 0;
+    } else if (type == CFURLGetTypeID()) {
+        return variantFromString(CFURLGetString((CFURLRef) value), variant);
+    } else if (type == CFAttributedStringGetTypeID()) {
+        return variantFromString(CFAttributedStringGetString((CFAttributedStringRef) value), variant);
+    }
+
+    variant->type = AX_VARIANT_OTHER;
+    variant->value.other = CFRetain(value);
+    return 0;
+}
+
+void axVariantClear(AXVariant * variant) {
+    switch (variant->type) {
+        case AX_VARIANT_STRING:
+            free(variant->value.string.bytes);
+            break;
+        case AX_VARIANT_ELEMENT:
+            CFRelease(variant->value.element);
+            break;
+        case AX_VARIANT_ARRAY:
+            for (size_t i = 0; i < variant->value.array.count; i++) axVariantClear(&variant->value.array.items[i]);
+            free(variant->value.array.items);
+            break;
+        case AX_VARIANT_OTHER:
+            CFRelease(variant->value.other);
+            break;
+        default:
+            break;
+    }
+    memset(variant, 0, sizeof(AXVariant));
+}
+
+static void variantError(AXVariant * variant, AXError error) {
+    memset(variant, 0, sizeof(AXVariant));
+    variant->type = AX_VARIANT_ERROR;
+    variant->value.integer = error;
+}
+
+/* Sessions
+======== */
+
+void axSessionInit(AXSession * session, const AXBackend * backend) {
+    memset(session, 0, sizeof(AXSession));
+    session->backend = backend;
+}
+
+static AXError sessionCount(AXSession * session, AXError error) {
+    __atomic_fetch_add(&session->requests, 1, __ATOMIC_RELAXED);
+    if (error != kAXErrorSuccess) __atomic_fetch_add(&session->failures, 1, __ATOMIC_RELAXED);
+    return error;
+}
+
+static AXError sessionAdopt(AXSession * session, AXUIElementRef created, AXUIElementRef * element) {
+    *element = created;
+    if (created == NULL) return kAXErrorFailure;
+    // A timeout that does not take leaves the backend's own, which is no reason to fail
+    if (session->timeout > 0) sessionCount(session, session->backend->setMessagingTimeout(created, session->timeout));
+    return kAXErrorSuccess;
+}
+
+AXError axSessionApplication(AXSession * session, pid_t pid, AXUIElementRef * element) {
+    return sessionAdopt(session, session->backend->createApplication(pid), element);
+}
+
+AXError axSessionSystemWide(AXSession * session, AXUIElementRef * element) {
+    return sessionAdopt(session, session->backend->createSystemWide(), element);
+}
+
+AXError axSessionCopy(AXSession * session, AXUIElementRef element, CFStringRef name, CFTypeRef * value) {
+    return sessionCount(session, session->backend->copyAttributeValue(element, name, value));
+}
+
+AXError axSessionCopyMultiple(AXSession * session, AXUIElementRef element, CFArrayRef names,
+                              AXCopyMultipleAttributeOptions options, CFArrayRef * values) {
+    return sessionCount(session, session->backend->copyMultipleAttributeValues(element, names, options, values));
+}
+
+AXError axSessionRead(AXSession * session, AXUIElementRef element, CFArrayRef names, AXVariant * values) {
+    CFIndex count = CFArrayGetCount(names);
+    CF_SCOPED CFArrayRef results = NULL;
+    AXError error = axSessionCopyMultiple(session, element, names, 0, &results);
+    if (error != kAXErrorSuccess) return error;
+    if (results == NULL) return kAXErrorFailure;
+
+    CFIndex available = CFArrayGetCount(results);
+    for (CFIndex i = 0; i < count; i++) {
+        if (i >= available) {
+            variantError(&values[i], kAXErrorNoValue);
+        } else if (axVariantFromValue(CFArrayGetValueAtIndex(results, i), &values[i]) == -1) {
+            for (CFIndex j = 0; j < i; j++) axVariantClear(&values[j]);
+            return kAXErrorFailure;
+        }
+    }
+    return kAXErrorSuccess;
+}
+
+size_t axSessionReadMany(AXSession * session, const AXUIElementRef * elements, size_t count, CFArrayRef names, AXVariant * values) {
+    size_t width = (size_t) CFArrayGetCount(names);
+    size_t failed = 0;
+    for (size_t e = 0; e < count; e++) {
+        AXVariant * row = values + e * width;
+        AXError error = axSessionRead(session, elements[e], names, row);
+        if (error != kAXErrorSuccess) {
+            for (size_t a = 0; a < width; a++) variantError(&row[a], error);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/* Observers
+======== */
+
+struct AXSessionObserver {
+    const AXBackend * backend;
+    AXObserverRef observer;
+    AXUIElementRef element;    // retained
+    AXSessionCallback callback;
+    void * context;
+};
+
+static void observerDispatch(AXObserverRef observer, AXUIElementRef element, CFStringRef notification, void * refcon) {
+    AXSessionObserver * self = (AXSessionObserver *) refcon;
+    self->callback(element, notification, self->context);
+}
+
+AXError axSessionObserve(AXSession * session, AXUIElementRef element, const char * notification,
+                         AXSessionCallback callback, void * context, AXSessionObserver ** observer) {
+    *observer = NULL;
+    pid_t pid;
+    AXError error = sessionCount(session, session->backend->getPid(element, &pid));
+    if (error != kAXErrorSuccess) return error;
+
+    AXSessionObserver * self = (AXSessionObserver *) calloc(1, sizeof(AXSessionObserver));
+    if (self == NULL) return kAXErrorFailure;
+    self->backend = session->backend;
+    self->element = (AXUIElementRef) CFRetain(element);
+    self->callback = callback;
+    self->context = context;
+
+    error = sessionCount(session, self->backend->observerCreate(pid, observerDispatch, &self->observer));
+    if (error == kAXErrorSuccess && notification != NULL) error = axSessionObserverAdd(session, self, notification);
+    if (error != kAXErrorSuccess) {
+        axSessionObserverClose(self);
+        return error;
+    }
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), self->backend->observerGetRunLoopSource(self->observer), kCFRunLoopDefaultMode);
+    *observer = self;
+    return kAXErrorSuccess;
+}
+
+AXError axSessionObserverAdd(AXSession * session, AXSessionObserver * self, const char * notification) {
+    CF_SCOPED CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, notification, kCFStringEncodingUTF8);
+    if (name == NULL) return kAXErrorIllegalArgument;
+    return sessionCount(session, self->backend->observerAddNotification(self->observer, self->element, name, self));
+}
+
+void axSessionObserverStop(AXSessionObserver * self) {
+    // Queued notifications must not reach the callback after this
+    if (self->observer != NULL) CFRunLoopSourceInvalidate(self->backend->observerGetRunLoopSource(self->observer));
+}
+
+// The notifications go with the observer, so nothing is sent to remove them,
+// which could wait on an application that has stopped responding.
+void axSessionObserverClose(AXSessionObserver * self) {
+    if (self == NULL) return;
+    if (self->observer != NULL) {
+        axSessionObserverStop(self);
+        CFRelease(self->observer);
+    }
+    CFRelease(self->element);
+    free(self);
+}
@@ -0,0 +1,195 @@
+/*
+ * The native core of the module: what a program needs to read elements,
+ * convert their values and receive notifications through one of the
+ * backends, with no Python involved. It is built as a library of its own,
+ * libaxcore (see setup.py), along with the backends and snapshots, and the
+ * extension links it; a daemon can link it directly instead.
+ *
+ * Nothing here needs the GIL or takes any lock of its own. A session only
+ * counts its requests, atomically, so any number of threads can share one;
+ * the extension reads through a single session for all of them. An observer
+ * belongs to the thread whose run loop it was added to.
+ */
+
+#ifndef ACCESSIBILITY_CORE_H
+#define ACCESSIBILITY_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "backend.h"
+
+/* Scoped references
+======== */
+
+/*
+ * A CF reference declared CF_SCOPED is released when it goes out of scope,
+ * however the scope is left, so that early returns cannot leak it. It may be
+ * NULL. cfTake hands one on, leaving the variable NULL.
+ */
+#define CF_SCOPED __attribute__((cleanup(cfReleaseScoped)))
+
+static inline void cfReleaseScoped(void * reference) {
+    CFTypeRef value = *(CFTypeRef *) reference;
+    if (value != NULL) CFRelease(value);
+}
+
+#define cfTake(variable) ((__typeof__(variable)) cfTakeReference((CFTypeRef *) &(variable)))
+
+static inline CFTypeRef cfTakeReference(CFTypeRef * reference) {
+    CFTypeRef value = *reference;
+    *reference = NULL;
+    return value;
+}
+
+/*
+ * The UTF-8 bytes of a string and their length. They are the string's own
+ * when CF keeps them that way, or else are copied into buffer if they fit,
+ * or into memory from malloc that the caller frees (and *allocated is set
+ * to). Returns NULL if the string cannot be encoded or memory ran out.
+ */
+const char * cfStringCopyUTF8(CFStringRef string, char * buffer, size_t size, size_t * length, char ** allocated);
+
+static inline const char * cfStringUTF8(CFStringRef string, char * buffer, size_t size, size_t * length, char ** allocated) {
+    // Inline, as nearly every string takes this path
+    const char * fast = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+    if (fast == NULL) return cfStringCopyUTF8(string, buffer, size, length, allocated);
+    *allocated = NULL;
+    *length = strlen(fast);
+    return fast;
+}
+
+// Creates an array of attribute names, to read several at once.
+CFArrayRef axCreateNames(const char * const * names, size_t count);
+
+/* Values
+======== */
+
+typedef enum {
+    AX_VARIANT_NONE = 0,    // no value; also empty strings and arrays, as the module reads them
+    AX_VARIANT_ERROR = 1,   // integer: why one attribute of a batch could not be read
+    AX_VARIANT_BOOLEAN = 2, // integer
+    AX_VARIANT_INTEGER = 3,
+    AX_VARIANT_REAL = 4,
+    AX_VARIANT_STRING = 5,  // also URLs and attributed strings
+    AX_VARIANT_ELEMENT = 6,
+    AX_VARIANT_ARRAY = 7,
+    AX_VARIANT_POINT = 8,   // geometry: x, y
+    AX_VARIANT_SIZE = 9,    // geometry: width, height
+    AX_VARIANT_RECT = 10,   // geometry: x, y, width, height
+    AX_VARIANT_RANGE = 11,
+    AX_VARIANT_OTHER = 12   // anything else (dictionaries, for one), kept as it is
+} AXVariantType;
+
+/*
+ * A value converted out of CF. Strings and arrays are owned by the variant,
+ * and elements and other values are retained by it, until axVariantClear.
+ */
+typedef struct AXVariant {
+    AXVariantType type;
+    union {
+        int64_t integer;
+        double real;
+        struct {
+            char * bytes; // UTF-8, terminated
+            size_t length;
+        } string;
+        AXUIElementRef element;
+        struct {
+            struct AXVariant * items;
+            size_t count;
+        } array;
+        double geometry[4];
+        struct {
+            int64_t location;
+            int64_t length;
+        } range;
+        CFTypeRef other;
+    } value;
+} AXVariant;
+
+/*
+ * Converts value, which is only borrowed. Returns 0, or -1 if memory ran out
+ * (leaving the variant empty).
+ */
+int axVariantFromValue(CFTypeRef value, AXVariant * variant);
+void axVariantClear(AXVariant * variant);
+
+/*
+ * Decodes an AXValue (a point, size, rectangle, range or error) without
+ * allocating. Returns 0, or -1 if it is of a kind not known here.
+ */
+int axVariantFromAXValue(AXValueRef value, AXVariant * variant);
+
+/* Sessions
+======== */
+
+typedef struct {
+    const AXBackend * backend;
+    float timeout;       // the messaging timeout of elements it creates, or 0 for the backend's own
+    uint64_t requests;   // updated atomically
+    uint64_t failures;   // requests that failed outright
+} AXSession;
+
+void axSessionInit(AXSession * session, const AXBackend * backend);
+
+// Creates the element of an application, or the system-wide element.
+AXError axSessionApplication(AXSession * session, pid_t pid, AXUIElementRef * element);
+AXError axSessionSystemWide(AXSession * session, AXUIElementRef * element);
+
+/*
+ * Copy one attribute, or several with one request, as the backend returns
+ * them, for callers that convert values their own way (as the extension
+ * does, into Python objects).
+ */
+AXError axSessionCopy(AXSession * session, AXUIElementRef element, CFStringRef name, CFTypeRef * value);
+AXError axSessionCopyMultiple(AXSession * session, AXUIElementRef element, CFArrayRef names,
+                              AXCopyMultipleAttributeOptions options, CFArrayRef * values);
+
+/*
+ * Reads the named attributes of an element with one request, converting
+ * each into values[i]. Attributes that could not be read are left as
+ * AX_VARIANT_ERROR with the reason. Returns the error of the request itself,
+ * in which case nothing was read.
+ */
+AXError axSessionRead(AXSession * session, AXUIElementRef element, CFArrayRef names, AXVariant * values);
+
+/*
+ * Reads the same attributes of each element, one request per element, into
+ * values[element * number of names + attribute]. Elements whose request
+ * fails have all their attributes set to the error. Returns how many
+ * requests failed.
+ */
+size_t axSessionReadMany(AXSession * session, const AXUIElementRef * elements, size_t count, CFArrayRef names, AXVariant * values);
+
+/* Observers
+======== */
+
+// The notification is borrowed; cfStringUTF8 gives its name.
+typedef void (*AXSessionCallback)(AXUIElementRef element, CFStringRef notification, void * context);
+
+typedef struct AXSessionObserver AXSessionObserver;
+
+/*
+ * Calls callback with context for each notification of the given name
+ * posted for the element, from the run loop of the calling thread. With a
+ * NULL name, nothing is watched until axSessionObserverAdd. Returns
+ * kAXErrorSuccess with *observer set, to be closed with
+ * axSessionObserverClose.
+ */
+AXError axSessionObserve(AXSession * session, AXUIElementRef element, const char * notification,
+                         AXSessionCallback callback, void * context, AXSessionObserver ** observer);
+
+// Watches one more notification for the observer's element.
+AXError axSessionObserverAdd(AXSession * session, AXSessionObserver * observer, const char * notification);
+
+/*
+ * Stops notifications, including any already queued, but keeps the observer
+ * until it is closed, for a thread other than the one it belongs to.
+ */
+void axSessionObserverStop(AXSessionObserver * observer);
+
+// Stops notifications and frees the observer, along with what it watched.
+void axSessionObserverClose(AXSessionObserver * observer);
+
+#endif /* ACCESSIBILITY_CORE_H */
@@ -2,6 +2,8 @@
 
 Cycles through an application's windows and performs the first available
 action. More than likely this is AXRaise, which brings the window to the front.
+The actions are performed in one call, in order, with any failures reported
+afterwards.
 """
 
 from __future__ import print_function
@@ -31,9 +33,13 @@ if windows is None or len(windows) == 0:
     print('The application does not seem to have any windows.')
     sys.exit(1)
 
-if len(windows[0].actions()) > 0:
-    print('Available actions for the windows:', windows[0].actions())
-    for w in windows:
-        w.perform_action(w.actions()[0])
+actions = windows[0].actions()
+
+if len(actions) > 0:
+    print('Available actions for the windows:', actions)
+    errors = acc.perform_actions([(w, actions[0]) for w in windows])
+    for w, error in zip(windows, errors):
+        if error != 0:
+            print('Could not perform', actions[0], 'on', w, '(error %d)' % error)
 else:
     print('No actions available.')
@@ -0,0 +1,195 @@
+/*
+ * The session log written by the recording backend and served by the replay
+ * backend. A log is append-only: a header followed by records, each of which
+ * can be skipped without understanding it, so a log cut short by a crash is
+ * still readable up to its last complete record.
+ *
+ * Header: the 8 bytes "AXLOG\0\0\0", then the format version and a reserved
+ * word as little-endian 32-bit integers.
+ *
+ * Record: a type byte, the length of the payload as a varint, the payload.
+ * Integers in payloads are unsigned LEB128 varints (signed ones zigzag
+ * encoded first) and reals are little-endian IEEE doubles, except the
+ * position of a hit test, which keeps the float the API takes.
+ *
+ * LOG_STRING     id, UTF-8 bytes. Names of attributes, actions and
+ *                notifications, defined before first use.
+ * LOG_ELEMENT    id, pid (signed), kind. Defined before first use.
+ * LOG_CALL       operation, time and latency (nanoseconds; time counts from
+ *                the start of the recording), element id, name id (0 if
+ *                none), error (signed), then what the operation needs: a
+ *                value for copies and sets, a count, a settable byte, or the
+ *                position of a hit test followed by the element found. Bulk
+ *                copies have no name; instead the number of attributes,
+ *                their name ids and the options byte precede the value.
+ *                Parameterized copies have the parameter as a value first.
+ * LOG_NOTIFICATION  time, id of the element registered for it, id of the
+ *                element it is about, name id, pid of the observer, and the
+ *                number of calls recorded before it.
+ *
+ * Values are a tag byte and a payload (see LogValueTag).
+ */
+
+#ifndef ACCESSIBILITY_RECORDING_H
+#define ACCESSIBILITY_RECORDING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define LOG_MAGIC "AXLOG\0\0\0"
+#define LOG_MAGIC_LENGTH 8
+#define LOG_HEADER_LENGTH 16
+#define LOG_VERSION 1
+
+typedef enum {
+    LOG_STRING = 1,
+    LOG_ELEMENT = 2,
+    LOG_CALL = 3,
+    LOG_NOTIFICATION = 4
+} LogRecordType;
+
+typedef enum {
+    LOG_ELEMENT_OTHER = 0,
+    LOG_ELEMENT_APPLICATION = 1,
+    LOG_ELEMENT_SYSTEM_WIDE = 2
+} LogElementKind;
+
+typedef enum {
+    LOG_COPY_ATTRIBUTE_VALUE = 1,
+    LOG_COPY_ATTRIBUTE_NAMES = 2,
+    LOG_GET_ATTRIBUTE_VALUE_COUNT = 3,
+    LOG_IS_ATTRIBUTE_SETTABLE = 4,
+    LOG_SET_ATTRIBUTE_VALUE = 5,
+    LOG_COPY_ACTION_NAMES = 6,
+    LOG_COPY_ACTION_DESCRIPTION = 7,
+    LOG_PERFORM_ACTION = 8,
+    LOG_COPY_ELEMENT_AT_POSITION = 9,
+    LOG_OBSERVER_ADD_NOTIFICATION = 10,
+    LOG_OBSERVER_REMOVE_NOTIFICATION = 11,
+    LOG_COPY_MULTIPLE_ATTRIBUTE_VALUES = 12,
+    LOG_COPY_PARAMETERIZED_ATTRIBUTE_VALUE = 13
+} LogOperation;
+
+typedef enum {
+    LOG_VALUE_NONE = 0,        // no value, or one of a type not recorded
+    LOG_VALUE_STRING = 1,      // length, UTF-8 bytes
+    LOG_VALUE_FALSE = 2,
+    LOG_VALUE_TRUE = 3,
+    LOG_VALUE_INTEGER = 4,     // signed
+    LOG_VALUE_REAL = 5,        // double
+    LOG_VALUE_ELEMENT = 6,     // id
+    LOG_VALUE_ARRAY = 7,       // count, values
+    LOG_VALUE_DICTIONARY = 8,  // count, key and value pairs
+    LOG_VALUE_URL = 9,         // as a string
+    LOG_VALUE_ATTRIBUTED = 10, // the string only
+    LOG_VALUE_POINT = 11,      // x, y
+    LOG_VALUE_SIZE = 12,       // width, height
+    LOG_VALUE_RECT = 13,       // x, y, width, height
+    LOG_VALUE_RANGE = 14,      // location, length (signed)
+    LOG_VALUE_AXERROR = 15     // signed
+} LogValueTag;
+
+// Values nested deeper than this are recorded as LOG_VALUE_NONE.
+#define LOG_MAX_DEPTH 32
+
+/* Encoding helpers
+======== */
+
+typedef struct {
+    uint8_t * bytes;
+    size_t length;
+    size_t capacity;
+    int failed; // ran out of memory
+} LogBuffer;
+
+void logReserve(LogBuffer * buffer, size_t extra);
+
+static inline void logByte(LogBuffer * buffer, uint8_t byte) {
+    if (buffer->length + 1 > buffer->capacity) logReserve(buffer, 1);
+    if (!buffer->failed) buffer->bytes[buffer->length++] = byte;
+}
+
+static inline void logBytes(LogBuffer * buffer, const void * bytes, size_t length) {
+    if (buffer->length + length > buffer->capacity) logReserve(buffer, length);
+    if (!buffer->failed) {
+        memcpy(buffer->bytes + buffer->length, bytes, length);
+        buffer->length += length;
+    }
+}
+
+static inline void logVarint(LogBuffer * buffer, uint64_t value) {
+    while (value >= 0x80) {
+        logByte(buffer, (uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    logByte(buffer, (uint8_t) value);
+}
+
+static inline void logSigned(LogBuffer * buffer, int64_t value) {
+    logVarint(buffer, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static inline void logReal(LogBuffer * buffer, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; i++) logByte(buffer, (uint8_t) (bits >> (8 * i)));
+}
+
+static inline void logFloat(LogBuffer * buffer, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 4; i++) logByte(buffer, (uint8_t) (bits >> (8 * i)));
+}
+
+/* Decoding helpers
+======== */
+
+// Reads from [position, end); any read past the end sets failed and yields 0.
+typedef struct {
+    const uint8_t * position;
+    const uint8_t * end;
+    int failed;
+} LogReader;
+
+static inline uint8_t logReadByte(LogReader * reader) {
+    if (reader->position >= reader->end) {
+        reader->failed = 1;
+        return 0;
+    }
+    return *reader->position++;
+}
+
+static inline uint64_t logReadVarint(LogReader * reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = logReadByte(reader);
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    reader->failed = 1;
+    return 0;
+}
+
+static inline int64_t logReadSigned(LogReader * reader) {
+    uint64_t value = logReadVarint(reader);
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static inline double logReadReal(LogReader * reader) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) bits |= (uint64_t) logReadByte(reader) << (8 * i);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline float logReadFloat(LogReader * reader) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 4; i++) bits |= (uint32_t) logReadByte(reader) << (8 * i);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#endif /* ACCESSIBILITY_RECORDING_H */
@@ -1,4 +1,6 @@
+import sys
 from setuptools import setup, Extension
+from setuptools.command.build_ext import build_ext
 from platform import mac_ver
 
 # Deal with the new location of headers in Mavericks
@@ -7,6 +9,55 @@ if mac_ver()[0].startswith('10.9'):
 else:
     header_dir = '/System/Library/Frameworks/ApplicationServices.framework/Frameworks/HIServices.framework/Headers'
 
+# The native core (sessions, value conversion, observers), the backends and
+# snapshots, which use no Python and are built as a library of their own,
+# libaxcore, for the extension and for programs that link it directly.
+if sys.platform == 'darwin':
+    core = ('axcore', {
+        'sources': ['core.c', 'backend_hiservices.c', 'backend_recording.c', 'snapshot.c'],
+        'include_dirs': [header_dir],
+        'obj_deps': {'': ['core.h', 'backend.h', 'recording.h', 'snapshot.h']},
+    })
+    extension = Extension('accessibility',
+        sources = ['accessibility.c'],
+        include_dirs = [header_dir],
+        depends = ['core.h', 'backend.h', 'recording.h', 'snapshot.h'],
+        libraries = ['axcore'],
+        # Uncomment the next line to include debug symbols while compiling
+        # extra_compile_args = ['-g'],
+        extra_compile_args = ['-Wno-error=unused-command-line-argument-hard-error-in-future'],
+        extra_link_args = ['-framework', 'ApplicationServices', '-v']
+    )
+    headers = ['core.h', 'backend.h']
+else:
+    # Elsewhere there is no Accessibility API, so build against a stand-in for
+    # the parts of CoreFoundation we use, with the simulated and replay backends.
+    core = ('axcore', {
+        'sources': ['core.c', 'backend_simulated.c', 'backend_recording.c',
+                    'backend_replay.c', 'snapshot.c', 'compat/cfshim.c'],
+        'include_dirs': ['compat', '.'],
+        'obj_deps': {'': ['core.h', 'backend.h', 'recording.h', 'snapshot.h', 'compat/Accessibility.h']},
+        'cflags': ['-std=gnu99'],
+    })
+    extension = Extension('accessibility',
+        sources = ['accessibility.c'],
+        include_dirs = ['compat', '.'],
+        depends = ['core.h', 'backend.h', 'recording.h', 'snapshot.h', 'compat/Accessibility.h'],
+        extra_compile_args = ['-std=gnu99'],
+        libraries = ['axcore', 'm', 'pthread', 'rt']
+    )
+    # core.h includes the stand-in as <Accessibility.h>
+    headers = ['core.h', 'backend.h', 'compat/Accessibility.h']
+
+
+class build_ext_with_core(build_ext):
+    """Builds libaxcore first, so that build_ext --inplace works on its own."""
+
+    def run(self):
+        self.run_command('build_clib')
+        build_ext.run(self)
+
+
 setup(
     name = 'accessibility',
     description = 'Extension module that wraps the Accessibility API for Mac OS X.',
@@ -30,14 +81,10 @@ setup(
         'Topic :: Utilities'
     ],
 
-    ext_modules = [Extension('accessibility',
-        sources = ['accessibility.c'],
-        include_dirs = [header_dir],
-        # Uncomment the next line to include debug symbols while compiling
-        # extra_compile_args = ['-g'],
-        extra_compile_args = ['-Wno-error=unused-command-line-argument-hard-error-in-future'],
-        extra_link_args = ['-framework', 'ApplicationServices', '-v']
-    )],
+    libraries = [core],
+    headers = headers,
+    ext_modules = [extension],
+    cmdclass = {'build_ext': build_ext_with_core},
 
     install_requires = [
         # 'docutils>=0.3',
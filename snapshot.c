@@ -0,0 +1,795 @@
+/*
+ * Captures accessibility trees into the snapshot format described in
+ * snapshot.h, indexes snapshots for reading, and shares them between
+ * processes.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+/* Capture
+======== */
+
+typedef struct {
+    CFTypeRef key; // borrowed from the nodes or their values
+    uint32_t value;
+} SnapshotEntry;
+
+typedef struct {
+    SnapshotEntry * entries;
+    size_t capacity; // a power of two, or 0
+    size_t count;
+} SnapshotTable;
+
+typedef struct {
+    AXUIElementRef ref; // retained
+    uint32_t children;  // captured
+    CFArrayRef values;  // in the order requested, or NULL if the request failed
+} SnapshotNode;
+
+typedef struct {
+    AXUIElementRef ref; // retained
+    uint32_t parent;
+    int depth;
+} SnapshotPending;
+
+typedef struct {
+    SnapshotTable elements; // to node indices
+    SnapshotTable names;    // strings to their indices
+    LogBuffer strings;
+    uint32_t string_count;
+    int failed;
+} SnapshotEncoder;
+
+static SnapshotEntry * snapshotFind(SnapshotTable * table, CFTypeRef key) {
+    size_t mask = table->capacity - 1;
+    size_t index = (size_t) CFHash(key) & mask;
+    while (table->entries[index].key != NULL && !CFEqual(table->entries[index].key, key)) {
+        index = (index + 1) & mask;
+    }
+    return &table->entries[index];
+}
+
+/*
+ * Returns the entry for key, adding it with the given value if it is new.
+ * Returns NULL if memory ran out.
+ */
+static SnapshotEntry * snapshotIntern(SnapshotTable * table, CFTypeRef key, uint32_t value, int * added) {
+    if (table->count * 2 >= table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 256;
+        SnapshotEntry * entries = calloc(capacity, sizeof(SnapshotEntry));
+        if (entries == NULL) return NULL;
+        SnapshotTable grown = { entries, capacity, table->count };
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key != NULL) *snapshotFind(&grown, table->entries[i].key) = table->entries[i];
+        }
+        free(table->entries);
+        *table = grown;
+    }
+
+    SnapshotEntry * entry = snapshotFind(table, key);
+    *added = (entry->key == NULL);
+    if (*added) {
+        entry->key = key;
+        entry->value = value;
+        table->count++;
+    }
+    return entry;
+}
+
+static int snapshotGrow(void ** items, uint32_t * capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity) return 0;
+    uint32_t grown = *capacity ? *capacity * 2 : 256;
+    while (grown < needed) grown *= 2;
+    void * resized = realloc(*items, grown * size);
+    if (resized == NULL) return -1;
+    *items = resized;
+    *capacity = grown;
+    return 0;
+}
+
+static void snapshotSection(LogBuffer * out, SnapshotSection type, LogBuffer * payload) {
+    if (payload->failed) out->failed = 1;
+    logByte(out, (uint8_t) type);
+    logVarint(out, payload->length);
+    logBytes(out, payload->bytes, payload->length);
+    payload->length = 0;
+}
+
+static void snapshotCoordinate(LogBuffer * buffer, double value) {
+    // Whole numbers well inside the range of a double take a varint or two
+    if (value == (double) (int64_t) value && value > -4503599627370496.0 && value < 4503599627370496.0) {
+        int64_t integer = (int64_t) value;
+        logVarint(buffer, (((uint64_t) integer << 1) ^ (uint64_t) (integer >> 63)) << 1);
+    } else {
+        logVarint(buffer, 1);
+        logReal(buffer, value);
+    }
+}
+
+static uint32_t snapshotStringIndex(SnapshotEncoder * encoder, CFStringRef string) {
+    int added;
+    SnapshotEntry * entry = snapshotIntern(&encoder->names, string, encoder->string_count, &added);
+    if (entry == NULL) {
+        encoder->failed = 1;
+        return 0;
+    }
+    if (added) {
+        encoder->string_count++;
+        const char * bytes = CFStringGetCStringPtr(string, kCFStringEncodingUTF8);
+        char * copy = NULL;
+        if (bytes == NULL) {
+            CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+            copy = malloc(size);
+            bytes = (copy != NULL && CFStringGetCString(string, copy, size, kCFStringEncodingUTF8)) ? copy : "";
+        }
+        size_t length = strlen(bytes);
+        logVarint(&encoder->strings, length);
+        logBytes(&encoder->strings, bytes, length);
+        free(copy);
+    }
+    return entry->value;
+}
+
+static void snapshotValue(SnapshotEncoder * encoder, LogBuffer * buffer, CFTypeRef value, int depth) {
+    if (value == NULL || depth > LOG_MAX_DEPTH) {
+        logByte(buffer, SNAPSHOT_VALUE_NONE);
+        return;
+    }
+
+    CFTypeID type = CFGetTypeID(value);
+    if (type == CFStringGetTypeID()) {
+        logByte(buffer, SNAPSHOT_VALUE_STRING);
+        logVarint(buffer, snapshotStringIndex(encoder, (CFStringRef) value));
+    } else if (type == CFBooleanGetTypeID()) {
+        logByte(buffer, CFBooleanGetValue((CFBooleanRef) value) ? SNAPSHOT_VALUE_TRUE : SNAPSHOT_VALUE_FALSE);
+    } else if (type == CFNumberGetTypeID()) {
+        if (CFNumberIsFloatType((CFNumberRef) value)) {
+            double real = 0;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberDoubleType, &real);
+            logByte(buffer, SNAPSHOT_VALUE_REAL);
+            logReal(buffer, real);
+        } else {
+            long long integer = 0;
+            CFNumberGetValue((CFNumberRef) value, kCFNumberLongLongType, &integer);
+            logByte(buffer, SNAPSHOT_VALUE_INTEGER);
+            logSigned(buffer, integer);
+        }
+    } else if (type == AXUIElementGetTypeID()) {
+        uint32_t node = 0;
+        if (encoder->elements.capacity > 0) {
+            SnapshotEntry * entry = snapshotFind(&encoder->elements, value);
+            if (entry->key != NULL) node = entry->value + 1;
+        }
+        logByte(buffer, SNAPSHOT_VALUE_ELEMENT);
+        logVarint(buffer, node);
+    } else if (type == CFArrayGetTypeID()) {
+        CFIndex count = CFArrayGetCount((CFArrayRef) value);
+        logByte(buffer, SNAPSHOT_VALUE_ARRAY);
+        logVarint(buffer, (uint64_t) count);
+        for (CFIndex i = 0; i < count; i++) {
+            snapshotValue(encoder, buffer, CFArrayGetValueAtIndex((CFArrayRef) value, i), depth + 1);
+        }
+    } else if (type == CFURLGetTypeID()) {
+        logByte(buffer, SNAPSHOT_VALUE_STRING);
+        logVarint(buffer, snapshotStringIndex(encoder, CFURLGetString((CFURLRef) value)));
+    } else if (type == CFAttributedStringGetTypeID()) {
+        logByte(buffer, SNAPSHOT_VALUE_STRING);
+        logVarint(buffer, snapshotStringIndex(encoder, CFAttributedStringGetString((CFAttributedStringRef) value)));
+    } else if (type == AXValueGetTypeID()) {
+        AXValueType value_type = AXValueGetType((AXValueRef) value);
+        if (value_type == kAXValueCGPointType) {
+            CGPoint point;
+            AXValueGetValue((AXValueRef) value, kAXValueCGPointType, &point);
+            logByte(buffer, SNAPSHOT_VALUE_POINT);
+            snapshotCoordinate(buffer, point.x);
+            snapshotCoordinate(buffer, point.y);
+        } else if (value_type == kAXValueCGSizeType) {
+            CGSize size;
+            AXValueGetValue((AXValueRef) value, kAXValueCGSizeType, &size);
+            logByte(buffer, SNAPSHOT_VALUE_SIZE);
+            snapshotCoordinate(buffer, size.width);
+            snapshotCoordinate(buffer, size.height);
+        } else if (value_type == kAXValueCGRectType) {
+            CGRect rect;
+            AXValueGetValue((AXValueRef) value, kAXValueCGRectType, &rect);
+            logByte(buffer, SNAPSHOT_VALUE_RECT);
+            snapshotCoordinate(buffer, rect.origin.x);
+            snapshotCoordinate(buffer, rect.origin.y);
+            snapshotCoordinate(buffer, rect.size.width);
+            snapshotCoordinate(buffer, rect.size.height);
+        } else if (value_type == kAXValueCFRangeType) {
+            CFRange range;
+            AXValueGetValue((AXValueRef) value, kAXValueCFRangeType, &range);
+            logByte(buffer, SNAPSHOT_VALUE_RANGE);
+            logSigned(buffer, range.location);
+            logSigned(buffer, range.length);
+        } else {
+            logByte(buffer, SNAPSHOT_VALUE_NONE);
+        }
+    } else {
+        logByte(buffer, SNAPSHOT_VALUE_NONE);
+    }
+}
+
+// Whether a node has a value for an attribute, as opposed to an error.
+static CFTypeRef snapshotNodeValue(const SnapshotNode * node, CFIndex attribute) {
+    if (node->values == NULL || CFArrayGetCount(node->values) <= attribute) return NULL;
+    CFTypeRef value = CFArrayGetValueAtIndex(node->values, attribute);
+    if (CFGetTypeID(value) == AXValueGetTypeID() && AXValueGetType((AXValueRef) value) == kAXValueAXErrorType) return NULL;
+    return value;
+}
+
+static void snapshotEncode(SnapshotEncoder * encoder, pid_t pid, CFArrayRef attributes,
+                           SnapshotNode * nodes, uint32_t node_count, LogBuffer * out) {
+    LogBuffer payload = { NULL, 0, 0, 0 };
+    LogBuffer columns = { NULL, 0, 0, 0 };
+
+    // Columns first, since they add to the strings
+    CFIndex attribute_count = CFArrayGetCount(attributes);
+    for (CFIndex a = 0; a < attribute_count; a++) {
+        uint32_t present = 0;
+        for (uint32_t i = 0; i < node_count; i++) {
+            if (snapshotNodeValue(&nodes[i], a) != NULL) present++;
+        }
+        logVarint(&payload, snapshotStringIndex(encoder, CFArrayGetValueAtIndex(attributes, a)));
+        logVarint(&payload, present);
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < node_count; i++) {
+            if (snapshotNodeValue(&nodes[i], a) == NULL) continue;
+            logVarint(&payload, i - previous);
+            previous = i;
+        }
+        for (uint32_t i = 0; i < node_count; i++) {
+            CFTypeRef value = snapshotNodeValue(&nodes[i], a);
+            if (value != NULL) snapshotValue(encoder, &payload, value, 0);
+        }
+        snapshotSection(&columns, SNAPSHOT_COLUMN, &payload);
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    logBytes(out, SNAPSHOT_MAGIC, LOG_MAGIC_LENGTH);
+    uint8_t words[8] = { SNAPSHOT_VERSION, 0, 0, 0, 0, 0, 0, 0 };
+    logBytes(out, words, sizeof(words));
+
+    logSigned(&payload, pid);
+    logVarint(&payload, (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_usec);
+    logVarint(&payload, node_count);
+    snapshotSection(out, SNAPSHOT_META, &payload);
+
+    logVarint(&payload, encoder->string_count);
+    logBytes(&payload, encoder->strings.bytes, encoder->strings.length);
+    if (encoder->strings.failed) payload.failed = 1;
+    snapshotSection(out, SNAPSHOT_STRINGS, &payload);
+
+    for (uint32_t i = 0; i < node_count; i++) logVarint(&payload, nodes[i].children);
+    snapshotSection(out, SNAPSHOT_TREE, &payload);
+
+    logBytes(out, columns.bytes, columns.length);
+    if (columns.failed || encoder->failed) out->failed = 1;
+    free(payload.bytes);
+    free(columns.bytes);
+}
+
+uint32_t snapshotCapture(AXUIElementRef root, pid_t pid, CFArrayRef attributes, int max_depth,
+                         const SnapshotCalls * calls, LogBuffer * out, AXError * error) {
+    // Children come back with the attributes, after them
+    CFIndex children_index = CFArrayGetCount(attributes);
+    CFMutableArrayRef request = CFArrayCreateMutable(kCFAllocatorDefault, children_index + 1, &kCFTypeArrayCallBacks);
+    for (CFIndex i = 0; i < children_index; i++) CFArrayAppendValue(request, CFArrayGetValueAtIndex(attributes, i));
+    CFArrayAppendValue(request, kAXChildrenAttribute);
+
+    SnapshotEncoder encoder;
+    memset(&encoder, 0, sizeof(encoder));
+    SnapshotNode * nodes = NULL;
+    uint32_t node_count = 0, node_capacity = 0;
+    SnapshotPending * pending = NULL;
+    uint32_t pending_count = 0, pending_capacity = 0;
+    int added, failed = 0;
+
+    *error = kAXErrorSuccess;
+    if (snapshotGrow((void **) &pending, &pending_capacity, 1, sizeof(SnapshotPending)) == -1
+            || snapshotIntern(&encoder.elements, root, 0, &added) == NULL) {
+        failed = 1;
+    } else {
+        pending[pending_count++] = (SnapshotPending) { (AXUIElementRef) CFRetain(root), SNAPSHOT_NO_PARENT, 0 };
+    }
+
+    // Depth first, so that nodes are numbered in the order of the tree section
+    while (pending_count > 0 && !failed) {
+        SnapshotPending next = pending[--pending_count];
+        if (node_count == SNAPSHOT_MAX_NODES || snapshotGrow((void **) &nodes, &node_capacity, node_count + 1, sizeof(SnapshotNode)) == -1) {
+            CFRelease(next.ref);
+            failed = 1;
+            break;
+        }
+        uint32_t index = node_count++;
+        SnapshotNode * node = &nodes[index];
+        node->ref = next.ref;
+        node->children = 0;
+        node->values = NULL;
+        snapshotFind(&encoder.elements, next.ref)->value = index;
+
+        CFArrayRef values = NULL;
+        AXError result = calls->begin(calls->context, next.ref, pid);
+        if (result == kAXErrorSuccess) {
+            result = calls->backend->copyMultipleAttributeValues(next.ref, request, 0, &values);
+            calls->end(calls->context, result);
+        }
+        if (result != kAXErrorSuccess) {
+            if (index == 0) *error = result;
+            continue;
+        }
+        node->values = values;
+
+        CFTypeRef children = snapshotNodeValue(node, children_index);
+        if (children == NULL || CFGetTypeID(children) != CFArrayGetTypeID()) continue;
+        if (max_depth >= 0 && next.depth >= max_depth) continue;
+
+        // Pushed in reverse so that the first child is captured next
+        CFIndex count = CFArrayGetCount((CFArrayRef) children);
+        for (CFIndex i = count - 1; i >= 0 && !failed; i--) {
+            CFTypeRef child = CFArrayGetValueAtIndex((CFArrayRef) children, i);
+            if (CFGetTypeID(child) != AXUIElementGetTypeID()) continue;
+            if (snapshotIntern(&encoder.elements, child, SNAPSHOT_NO_PARENT, &added) == NULL
+                    || snapshotGrow((void **) &pending, &pending_capacity, pending_count + 1, sizeof(SnapshotPending)) == -1) {
+                failed = 1;
+            } else if (added) {
+                pending[pending_count++] = (SnapshotPending) { (AXUIElementRef) CFRetain(child), index, next.depth + 1 };
+                nodes[index].children++;
+            }
+        }
+    }
+
+    uint32_t captured = 0;
+    if (failed) {
+        out->failed = 1;
+    } else if (*error == kAXErrorSuccess) {
+        snapshotEncode(&encoder, pid, attributes, nodes, node_count, out);
+        if (!out->failed) captured = node_count;
+    }
+
+    for (uint32_t i = 0; i < pending_count; i++) CFRelease(pending[i].ref);
+    for (uint32_t i = 0; i < node_count; i++) {
+        CFRelease(nodes[i].ref);
+        if (nodes[i].values != NULL) CFRelease(nodes[i].values);
+    }
+    free(pending);
+    free(nodes);
+    free(encoder.elements.entries);
+    free(encoder.names.entries);
+    free(encoder.strings.bytes);
+    CFRelease(request);
+    return captured;
+}
+
+/* Reading
+======== */
+
+static int snapshotFail(char * message, size_t message_size, const char * reason) {
+    snprintf(message, message_size, "%s", reason);
+    return -1;
+}
+
+// Works out every node's parent and subtree size from the child counts.
+static int snapshotIndexTree(SnapshotReader * reader, LogReader * tree) {
+    uint32_t count = reader->node_count;
+    reader->parents = malloc(sizeof(uint32_t) * (count ? count : 1));
+    reader->sizes = malloc(sizeof(uint32_t) * (count ? count : 1));
+    uint32_t * open = malloc(sizeof(uint32_t) * (count ? count : 1));     // nodes still taking children
+    uint32_t * remaining = malloc(sizeof(uint32_t) * (count ? count : 1)); // how many each still takes
+    int result = -1;
+    if (reader->parents == NULL || reader->sizes == NULL || open == NULL || remaining == NULL) goto done;
+
+    uint32_t depth = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        while (depth > 0 && remaining[depth - 1] == 0) {
+            depth--;
+            reader->sizes[open[depth]] = i - open[depth];
+        }
+        if ((depth == 0) != (i == 0)) goto done; // a second root, or none
+        if (depth > 0) {
+            reader->parents[i] = open[depth - 1];
+            remaining[depth - 1]--;
+        } else {
+            reader->parents[i] = SNAPSHOT_NO_PARENT;
+        }
+        uint64_t children = logReadVarint(tree);
+        if (tree->failed || children > count - i - 1) goto done;
+        open[depth] = i;
+        remaining[depth] = (uint32_t) children;
+        depth++;
+    }
+    while (depth > 0) {
+        depth--;
+        if (remaining[depth] != 0) goto done;
+        reader->sizes[open[depth]] = count - open[depth];
+    }
+    result = 0;
+
+done:
+    free(open);
+    free(remaining);
+    return result;
+}
+
+int snapshotOpen(SnapshotReader * reader, const uint8_t * bytes, size_t size, char * message, size_t message_size) {
+    memset(reader, 0, sizeof(SnapshotReader));
+    reader->bytes = bytes;
+    reader->size = size;
+    if (size < LOG_HEADER_LENGTH || memcmp(bytes, SNAPSHOT_MAGIC, LOG_MAGIC_LENGTH) != 0)
+        return snapshotFail(message, message_size, "This is not a snapshot.");
+    uint32_t version = bytes[8] | (uint32_t) bytes[9] << 8 | (uint32_t) bytes[10] << 16 | (uint32_t) bytes[11] << 24;
+    if (version != SNAPSHOT_VERSION) {
+        snprintf(message, message_size, "Snapshots of version %u are not supported.", version);
+        return -1;
+    }
+
+    LogReader file = { bytes + LOG_HEADER_LENGTH, bytes + size, 0 };
+    int have_meta = 0, have_strings = 0, have_tree = 0;
+    uint32_t column_capacity = 0;
+    while (file.position < file.end) {
+        uint8_t type = logReadByte(&file);
+        uint64_t length = logReadVarint(&file);
+        if (file.failed || length > (uint64_t) (file.end - file.position)) break;
+        LogReader payload = { file.position, file.position + length, 0 };
+        file.position += length;
+
+        if (type == SNAPSHOT_META) {
+            reader->pid = (pid_t) logReadSigned(&payload);
+            reader->time = logReadVarint(&payload);
+            uint64_t count = logReadVarint(&payload);
+            if (payload.failed || count > SNAPSHOT_MAX_NODES) break;
+            reader->node_count = (uint32_t) count;
+            have_meta = 1;
+        } else if (type == SNAPSHOT_STRINGS && !have_strings) {
+            uint64_t count = logReadVarint(&payload);
+            // Every string takes at least a byte, which bounds the count
+            if (payload.failed || count > length) break;
+            reader->strings = malloc(sizeof(uint8_t *) * (count ? count : 1));
+            if (reader->strings == NULL) break;
+            for (uint64_t i = 0; i < count && !payload.failed; i++) {
+                reader->strings[i] = payload.position;
+                uint64_t string_length = logReadVarint(&payload);
+                if (string_length > (uint64_t) (payload.end - payload.position)) payload.failed = 1;
+                else payload.position += string_length;
+            }
+            if (payload.failed) break;
+            reader->string_count = (uint32_t) count;
+            have_strings = 1;
+        } else if (type == SNAPSHOT_TREE && have_meta && !have_tree) {
+            if (snapshotIndexTree(reader, &payload) == -1) break;
+            have_tree = 1;
+        } else if (type == SNAPSHOT_COLUMN) {
+            uint64_t name = logReadVarint(&payload);
+            if (payload.failed) break;
+            if (snapshotGrow((void **) &reader->columns, &column_capacity, reader->column_count + 1, sizeof(SnapshotColumn)) == -1) break;
+            SnapshotColumn * column = &reader->columns[reader->column_count++];
+            memset(column, 0, sizeof(SnapshotColumn));
+            column->name = (uint32_t) name;
+            column->start = payload.position;
+            column->end = payload.end;
+        }
+    }
+
+    if (file.position < file.end || !have_meta || !have_strings || !have_tree) {
+        snapshotClose(reader);
+        return snapshotFail(message, message_size, "The snapshot is damaged or incomplete.");
+    }
+    for (uint32_t i = 0; i < reader->column_count; i++) {
+        if (reader->columns[i].name >= reader->string_count) {
+            snapshotClose(reader);
+            return snapshotFail(message, message_size, "The snapshot is damaged or incomplete.");
+        }
+    }
+    return 0;
+}
+
+void snapshotClose(SnapshotReader * reader) {
+    for (uint32_t i = 0; i < reader->column_count; i++) {
+        free(reader->columns[i].slots);
+        free(reader->columns[i].values);
+    }
+    free(reader->columns);
+    free(reader->strings);
+    free(reader->parents);
+    free(reader->sizes);
+    memset(reader, 0, sizeof(SnapshotReader));
+}
+
+void snapshotSkipValue(LogReader * reader, int depth) {
+    if (depth > LOG_MAX_DEPTH) {
+        reader->failed = 1;
+        return;
+    }
+    switch (logReadByte(reader)) {
+        case SNAPSHOT_VALUE_NONE:
+        case SNAPSHOT_VALUE_FALSE:
+        case SNAPSHOT_VALUE_TRUE:
+            break;
+        case SNAPSHOT_VALUE_STRING:
+        case SNAPSHOT_VALUE_INTEGER:
+        case SNAPSHOT_VALUE_ELEMENT:
+            logReadVarint(reader);
+            break;
+        case SNAPSHOT_VALUE_REAL:
+            logReadReal(reader);
+            break;
+        case SNAPSHOT_VALUE_ARRAY: {
+            uint64_t count = logReadVarint(reader);
+            for (uint64_t i = 0; i < count && !reader->failed; i++) snapshotSkipValue(reader, depth + 1);
+            break;
+        }
+        case SNAPSHOT_VALUE_RECT:
+            snapshotReadCoordinate(reader);
+            snapshotReadCoordinate(reader);
+            // Falls through for the other two
+        case SNAPSHOT_VALUE_POINT:
+        case SNAPSHOT_VALUE_SIZE:
+            snapshotReadCoordinate(reader);
+            snapshotReadCoordinate(reader);
+            break;
+        case SNAPSHOT_VALUE_RANGE:
+            logReadVarint(reader);
+            logReadVarint(reader);
+            break;
+        default:
+            reader->failed = 1;
+    }
+}
+
+int snapshotLoadColumn(SnapshotReader * reader, SnapshotColumn * column) {
+    if (column->slots != NULL) return 0;
+
+    LogReader payload = { column->start, column->end, 0 };
+    uint64_t count = logReadVarint(&payload);
+    if (payload.failed || count > reader->node_count) return -1;
+    uint32_t * slots = calloc(reader->node_count ? reader->node_count : 1, sizeof(uint32_t));
+    const uint8_t ** values = malloc(sizeof(uint8_t *) * (count ? count : 1));
+    if (slots == NULL || values == NULL) goto failed;
+
+    uint64_t node = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t delta = logReadVarint(&payload);
+        if (i > 0 && delta == 0) goto failed;
+        node += delta;
+        if (payload.failed || node >= reader->node_count) goto failed;
+        slots[node] = (uint32_t) i + 1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        values[i] = payload.position;
+        snapshotSkipValue(&payload, 0);
+        if (payload.failed) goto failed;
+    }
+
+    column->count = (uint32_t) count;
+    column->slots = slots;
+    column->values = values;
+    return 0;
+
+failed:
+    free(slots);
+    free(values);
+    return -1;
+}
+
+const uint8_t * snapshotString(const SnapshotReader * reader, uint32_t index, size_t * length) {
+    if (index >= reader->string_count) return NULL;
+    LogReader string = { reader->strings[index], reader->bytes + reader->size, 0 };
+    *length = (size_t) logReadVarint(&string);
+    return string.position;
+}
+
+int64_t snapshotFindString(const SnapshotReader * reader, const char * bytes, size_t length) {
+    for (uint32_t i = 0; i < reader->string_count; i++) {
+        size_t candidate_length;
+        const uint8_t * candidate = snapshotString(reader, i, &candidate_length);
+        if (candidate_length == length && memcmp(candidate, bytes, length) == 0) return i;
+    }
+    return -1;
+}
+
+/* Sharing
+======== */
+
+#define SHARE_MAGIC "AXSHARE\0"
+#define SHARE_VERSION 1
+#define SHARE_HEADER_SIZE 128 // keeps the buffers clear of the header's cache lines
+
+/*
+ * The fields below the magic are only written by the publisher. Readers see
+ * a consistent generation, length and active buffer whenever the sequence is
+ * even and the same before and after they look.
+ */
+struct SnapshotRegion {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;   // of each buffer
+    uint64_t sequence;   // odd while a snapshot is being swapped in
+    uint64_t generation; // of the snapshot in the active buffer, 0 for none
+    uint64_t length;     // of that snapshot
+    uint64_t active;     // 0 or 1
+    uint64_t time;       // when it was published, in microseconds
+    int64_t publisher;   // pid
+};
+
+#define SHARE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define SHARE_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static uint8_t * shareBuffer(const SnapshotShare * share, uint64_t index) {
+    return (uint8_t *) share->region + SHARE_HEADER_SIZE + index * share->region->capacity;
+}
+
+int snapshotShareCreate(SnapshotShare * share, const char * name, size_t capacity) {
+    memset(share, 0, sizeof(SnapshotShare));
+    if (capacity == 0 || capacity > (SIZE_MAX - SHARE_HEADER_SIZE) / 2) return EINVAL;
+    capacity = (capacity + 63) & ~(size_t) 63;
+
+    // Refuse to take over from a publisher that is still running
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd != -1) {
+        SnapshotRegion existing;
+        int busy = pread(fd, &existing, sizeof(existing), 0) == (ssize_t) sizeof(existing)
+            && memcmp(existing.magic, SHARE_MAGIC, sizeof(existing.magic)) == 0
+            && existing.publisher > 0 && kill((pid_t) existing.publisher, 0) == 0;
+        close(fd);
+        if (busy) return EBUSY;
+    }
+
+    /*
+     * Anything left behind is replaced rather than reused, so that readers
+     * still attached to it keep a mapping that stays valid.
+     */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) return errno;
+
+    size_t size = SHARE_HEADER_SIZE + 2 * capacity;
+    if (ftruncate(fd, (off_t) size) == -1) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        return error;
+    }
+    void * mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) return error;
+
+    // The magic goes in last, so that readers never attach to half a header
+    SnapshotRegion * region = mapping;
+    region->version = SHARE_VERSION;
+    region->capacity = capacity;
+    region->publisher = getpid();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(region->magic, SHARE_MAGIC, sizeof(region->magic));
+
+    share->region = region;
+    share->size = size;
+    share->writable = 1;
+    return 0;
+}
+
+int snapshotShareAttach(SnapshotShare * share, const char * name) {
+    memset(share, 0, sizeof(SnapshotShare));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) return errno;
+
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+    size_t size = (size_t) info.st_size;
+    if (size < SHARE_HEADER_SIZE) {
+        close(fd);
+        return EINVAL;
+    }
+    void * mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) return error;
+
+    SnapshotRegion * region = mapping;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (memcmp(region->magic, SHARE_MAGIC, sizeof(region->magic)) != 0 || region->version != SHARE_VERSION
+        || region->capacity > (size - SHARE_HEADER_SIZE) / 2) {
+        munmap(mapping, size);
+        return EINVAL;
+    }
+    share->region = region;
+    share->size = size;
+    return 0;
+}
+
+void snapshotShareClose(SnapshotShare * share) {
+    if (share->region == NULL) return;
+    if (share->writable) SHARE_STORE(share->region->publisher, 0);
+    munmap(share->region, share->size);
+    share->region = NULL;
+}
+
+size_t snapshotShareCapacity(const SnapshotShare * share) {
+    return (size_t) share->region->capacity;
+}
+
+uint64_t snapshotSharePublish(SnapshotShare * share, const uint8_t * bytes, size_t length) {
+    SnapshotRegion * region = share->region;
+    if (length > region->capacity) return 0;
+
+    /*
+     * A reader still copying from the other buffer began before the last swap,
+     * so it will see the sequence has moved on; the fence keeps that swap
+     * ahead of the writes that follow.
+     */
+    uint64_t next = SHARE_LOAD(region->active) ^ 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shareBuffer(share, next), bytes, length);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t sequence = SHARE_LOAD(region->sequence);
+    uint64_t generation = SHARE_LOAD(region->generation) + 1;
+    SHARE_STORE(region->sequence, sequence + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    SHARE_STORE(region->active, next);
+    SHARE_STORE(region->length, (uint64_t) length);
+    SHARE_STORE(region->generation, generation);
+    SHARE_STORE(region->time, (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_usec);
+    __atomic_store_n(&region->sequence, sequence + 2, __ATOMIC_RELEASE);
+    return generation;
+}
+
+uint64_t snapshotShareGeneration(const SnapshotShare * share) {
+    return __atomic_load_n(&share->region->generation, __ATOMIC_ACQUIRE);
+}
+
+pid_t snapshotSharePublisher(const SnapshotShare * share) {
+    return (pid_t) SHARE_LOAD(share->region->publisher);
+}
+
+uint64_t snapshotShareTime(const SnapshotShare * share) {
+    return SHARE_LOAD(share->region->time);
+}
+
+int snapshotShareRead(const SnapshotShare * share, uint8_t * out, size_t size, size_t * length, uint64_t * generation) {
+    SnapshotRegion * region = share->region;
+    for (;;) {
+        uint64_t sequence = __atomic_load_n(&region->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) {
+            sched_yield();
+            continue;
+        }
+        uint64_t current = SHARE_LOAD(region->generation);
+        uint64_t current_length = SHARE_LOAD(region->length);
+        uint64_t active = SHARE_LOAD(region->active) & 1;
+
+        int result = -1;
+        if (current != 0 && current_length <= region->capacity) {
+            result = 1;
+            if (current_length <= size) {
+                memcpy(out, shareBuffer(share, active), (size_t) current_length);
+                result = 0;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (SHARE_LOAD(region->sequence) != sequence) continue;
+
+        *length = (size_t) current_length;
+        *generation = current;
+        return result;
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ * Snapshots of an accessibility tree, as captured by snapshot() and read by
+ * the Snapshot class. A snapshot is laid out so that it can be mapped into
+ * memory and queried where it lies: opening one only decodes the tree
+ * structure, and each attribute's column is decoded the first time it is
+ * asked for.
+ *
+ * Header: the 8 bytes "AXSNAP\0\0", then the format version and a reserved
+ * word as little-endian 32-bit integers.
+ *
+ * Sections are framed like the records of a session log (see recording.h):
+ * a type byte, the length of the payload as a varint, the payload. Readers
+ * skip sections they do not know.
+ *
+ * SNAPSHOT_META     pid (signed), capture time (microseconds since the
+ *                   epoch), number of nodes.
+ * SNAPSHOT_STRINGS  number of strings, then each as a length and UTF-8
+ *                   bytes. Attribute names and string values (which for
+ *                   roles repeat a great deal) refer to strings by index.
+ * SNAPSHOT_TREE     the number of children of each node, in depth-first
+ *                   order, so that node 0 is the root.
+ * SNAPSHOT_COLUMN   one per attribute: the index of its name, the number of
+ *                   nodes with a value for it, the indices of those nodes as
+ *                   increasing deltas, then their values in the same order.
+ *
+ * Values are a tag byte and a payload (see SnapshotValueTag). Coordinates
+ * are nearly always whole numbers, so they are written as a varint holding
+ * a zigzag encoded integer shifted left by one, or as a varint of 1 followed
+ * by a little-endian double when they are not.
+ */
+
+#ifndef ACCESSIBILITY_SNAPSHOT_H
+#define ACCESSIBILITY_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "backend.h"
+#include "recording.h"
+
+#define SNAPSHOT_MAGIC "AXSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+
+// Nodes are numbered with 32 bits, and this is kept clear of the top for
+// markers such as SNAPSHOT_NO_PARENT.
+#define SNAPSHOT_MAX_NODES 0x7FFFFFFFu
+#define SNAPSHOT_NO_PARENT 0xFFFFFFFFu
+
+typedef enum {
+    SNAPSHOT_META = 1,
+    SNAPSHOT_STRINGS = 2,
+    SNAPSHOT_TREE = 3,
+    SNAPSHOT_COLUMN = 4
+} SnapshotSection;
+
+typedef enum {
+    SNAPSHOT_VALUE_NONE = 0,    // no value, or one of a type not captured
+    SNAPSHOT_VALUE_STRING = 1,  // string index
+    SNAPSHOT_VALUE_FALSE = 2,
+    SNAPSHOT_VALUE_TRUE = 3,
+    SNAPSHOT_VALUE_INTEGER = 4, // signed
+    SNAPSHOT_VALUE_REAL = 5,    // double
+    SNAPSHOT_VALUE_ELEMENT = 6, // node index plus one, or 0 if not captured
+    SNAPSHOT_VALUE_ARRAY = 7,   // count, values
+    SNAPSHOT_VALUE_POINT = 8,   // x, y as coordinates
+    SNAPSHOT_VALUE_SIZE = 9,    // width, height as coordinates
+    SNAPSHOT_VALUE_RECT = 10,   // x, y, width, height as coordinates
+    SNAPSHOT_VALUE_RANGE = 11   // location, length (signed)
+} SnapshotValueTag;
+
+/* Capture
+======== */
+
+// How a capture makes its requests, so that they can be counted and
+// scheduled. Each is bracketed by begin and end, which are passed context.
+// A request that begin turns away with an error is not made, and not ended.
+typedef struct {
+    const AXBackend * backend;
+    AXError (*begin)(void * context, AXUIElementRef ref, pid_t pid);
+    void (*end)(void * context, AXError error);
+    void * context;
+} SnapshotCalls;
+
+/*
+ * Walks the tree below root (to at most max_depth levels below it, or all of
+ * it if max_depth is negative), reading the given attributes of each element
+ * with one request per element, and appends the snapshot to out. Elements
+ * seen twice are only captured once. Returns the number of nodes captured,
+ * or 0 with *error set if the root could not be read (or if memory ran out,
+ * in which case out->failed is set). Does not need the GIL.
+ */
+uint32_t snapshotCapture(AXUIElementRef root, pid_t pid, CFArrayRef attributes, int max_depth,
+                         const SnapshotCalls * calls, LogBuffer * out, AXError * error);
+
+/* Reading
+======== */
+
+typedef struct {
+    uint32_t name;            // string index
+    const uint8_t * start;    // the node count, deltas and values
+    const uint8_t * end;
+    uint32_t count;           // nodes with a value, once loaded
+    uint32_t * slots;         // per node, 1 + its value's index, or 0; NULL until loaded
+    const uint8_t ** values;  // where each value starts
+} SnapshotColumn;
+
+typedef struct {
+    const uint8_t * bytes;
+    size_t size;
+    pid_t pid;
+    uint64_t time;
+    uint32_t node_count;
+    uint32_t * parents;       // SNAPSHOT_NO_PARENT for the root
+    uint32_t * sizes;         // of each node's subtree, itself included
+    uint32_t string_count;
+    const uint8_t ** strings; // each at its length
+    uint32_t column_count;
+    SnapshotColumn * columns;
+} SnapshotReader;
+
+/*
+ * Indexes the snapshot in bytes, which must outlive the reader. Returns 0, or
+ * -1 with a message if it is not a snapshot or is damaged.
+ */
+int snapshotOpen(SnapshotReader * reader, const uint8_t * bytes, size_t size, char * message, size_t message_size);
+void snapshotClose(SnapshotReader * reader);
+
+// Decodes a column if it has not been already. Returns 0, or -1 if damaged.
+int snapshotLoadColumn(SnapshotReader * reader, SnapshotColumn * column);
+
+// Returns the UTF-8 bytes of a string, or NULL for an index out of range.
+const uint8_t * snapshotString(const SnapshotReader * reader, uint32_t index, size_t * length);
+
+// Returns the index of the string with these bytes, or -1 if there is none.
+int64_t snapshotFindString(const SnapshotReader * reader, const char * bytes, size_t length);
+
+// Moves the reader past one value, failing it if the value is malformed.
+void snapshotSkipValue(LogReader * reader, int depth);
+
+static inline double snapshotReadCoordinate(LogReader * reader) {
+    uint64_t bits = logReadVarint(reader);
+    if (bits == 1) return logReadReal(reader);
+    return (double) ((int64_t) (bits >> 2) ^ -(int64_t) ((bits >> 1) & 1));
+}
+
+/* Sharing
+======== */
+
+/*
+ * A region of shared memory through which one process publishes snapshots
+ * to any number of others. It has room for two: each new snapshot is copied
+ * into the one readers are not using and then swapped in under a sequence
+ * lock, so readers never hold up the publisher, and only have to retry if it
+ * publishes twice while they copy one out.
+ */
+typedef struct SnapshotRegion SnapshotRegion;
+
+typedef struct {
+    SnapshotRegion * region;
+    size_t size; // of the mapping
+    int writable;
+} SnapshotShare;
+
+/*
+ * Creates (or takes over) the region with the given shm_open name, with room
+ * for snapshots of up to capacity bytes. Returns 0, or an errno value: EBUSY
+ * if another live process publishes to it.
+ */
+int snapshotShareCreate(SnapshotShare * share, const char * name, size_t capacity);
+
+/*
+ * Maps an existing region for reading. Returns 0, or an errno value: EINVAL
+ * if it is not a snapshot region (or not set up yet).
+ */
+int snapshotShareAttach(SnapshotShare * share, const char * name);
+
+void snapshotShareClose(SnapshotShare * share);
+
+size_t snapshotShareCapacity(const SnapshotShare * share);
+
+// Returns the new generation, or 0 if the snapshot does not fit.
+uint64_t snapshotSharePublish(SnapshotShare * share, const uint8_t * bytes, size_t length);
+
+// The generation readers see now, 0 before anything is published.
+uint64_t snapshotShareGeneration(const SnapshotShare * share);
+
+// The pid of the publisher, and when it last published (in microseconds).
+pid_t snapshotSharePublisher(const SnapshotShare * share);
+uint64_t snapshotShareTime(const SnapshotShare * share);
+
+/*
+ * Copies the latest snapshot into out, setting its length and generation.
+ * Returns 0; 1 if out is too small, in which case *length is how much room
+ * it needs; or -1 if nothing has been published yet.
+ */
+int snapshotShareRead(const SnapshotShare * share, uint8_t * out, size_t size, size_t * length, uint64_t * generation);
+
+#endif /* ACCESSIBILITY_SNAPSHOT_H */
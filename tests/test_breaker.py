@@ -0,0 +1,76 @@
+"""test_breaker.py
+
+Checks the circuit breaker and adaptive timeouts against the simulated
+backend, so it needs a platform other than OS X. Build the module in place
+and run it from the top of the source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import time
+import unittest
+
+import accessibility as acc
+
+FAILING = {'pid': 101, 'name': 'Failing', 'errors': {'cannot_complete': 1.0}}
+FAST = {'pid': 102, 'name': 'Fast', 'latency': 0.001}
+THRESHOLD = 3
+COOLDOWN = 0.2
+
+
+class BreakerTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': [FAILING, FAST]})
+        self.defaults = acc.configure_breaker()
+        acc.configure_breaker(threshold=THRESHOLD, cooldown=COOLDOWN)
+        acc.reset_application_health()
+
+    def tearDown(self):
+        acc.create_systemwide_ref().set_timeout(0)
+        acc.configure_breaker(**self.defaults)
+        acc.reset_application_health()
+
+    def error(self, element):
+        # Which error a request fails with
+        try:
+            element.get('AXTitle')
+        except acc.NotRespondingError as error:
+            return type(error)
+        return None
+
+    def test_opens_after_threshold(self):
+        app = acc.create_application_ref(FAILING['pid'], force=True)  # fails once
+        for _ in range(THRESHOLD - 1):
+            self.assertIs(self.error(app), acc.NotRespondingError)
+        self.assertIs(self.error(app), acc.CircuitOpenError)
+        health = acc.application_health(FAILING['pid'])
+        self.assertTrue(health['open'])
+        self.assertEqual(health['requests'], THRESHOLD)
+
+    def test_resumes_after_cooldown(self):
+        app = acc.create_application_ref(FAILING['pid'], force=True)
+        for _ in range(THRESHOLD - 1):
+            self.error(app)
+        self.assertIs(self.error(app), acc.CircuitOpenError)
+        time.sleep(COOLDOWN * 1.5)
+        # The first request is sent again, and failing cuts the application
+        # off again straight away
+        self.assertIs(self.error(app), acc.NotRespondingError)
+        self.assertEqual(acc.application_health(FAILING['pid'])['requests'], THRESHOLD + 1)
+        self.assertIs(self.error(app), acc.CircuitOpenError)
+
+    def test_adaptive_timeout_not_below_system(self):
+        acc.create_systemwide_ref().set_timeout(0.5)
+        acc.configure_breaker(adaptive_timeout=True, min_timeout=0.01)
+        app = acc.create_application_ref(FAST['pid'])
+        for _ in range(50):
+            app.get('AXRole')
+        health = acc.application_health(FAST['pid'])
+        self.assertLess(health['p99'] * self.defaults['multiplier'], 0.5)
+        self.assertGreaterEqual(health['timeout'], 0.5)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,36 @@
+"""test_list_windows.py
+
+Checks list_windows against the simulated backend, so it needs a platform
+other than OS X. Build the module in place and run it from the top of the
+source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import unittest
+
+import accessibility as acc
+
+RESPONSIVE = {'pid': 101, 'name': 'Responsive', 'windows': 3}
+HUNG = {'pid': 102, 'name': 'Hung', 'hang': (1.0, 5.0)}
+BROKEN = {'pid': 103, 'name': 'Broken', 'errors': {'invalid_element': 1.0}}
+
+# The AXError code of an invalid element
+INVALID_UI_ELEMENT = -25202
+
+
+class ListWindowsTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': [RESPONSIVE, HUNG, BROKEN]})
+
+    def test_failures(self):
+        records, timed_out, errors = acc.list_windows([101, 102, 103], ['AXTitle'], timeout=0.1)
+        self.assertEqual([record[0] for record in records], [101, 101, 101])
+        self.assertEqual(timed_out, [102])
+        self.assertEqual(errors, {103: INVALID_UI_ELEMENT})
+
+
+if __name__ == '__main__':
+    unittest.main()
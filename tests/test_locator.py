@@ -0,0 +1,42 @@
+"""test_locator.py
+
+Checks Locator against the simulated backend, so it needs a platform other
+than OS X. Build the module in place and run it from the top of the source
+tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import unittest
+
+import accessibility as acc
+
+TREE = {'pid': 101, 'name': 'Tree', 'windows': 2, 'nodes': 100, 'fanout': 4}
+OTHER = {'pid': 102, 'name': 'Other'}
+
+
+class LocatorTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': [TREE]})
+        self.element = acc.create_application_ref(TREE['pid'])['AXChildren'][0]
+
+    def test_application_vanished(self):
+        locator = acc.Locator(self.element)
+        identifier = self.element['AXIdentifier']
+        acc.set_backend('simulated', {'seed': 1, 'applications': [OTHER]})
+        # The first lookup forgets the application; the second must not
+        # trip over its absence
+        self.assertIsNone(locator.resolve())
+        self.assertIsNone(locator.resolve())
+        self.assertEqual(locator.stats()['failures'], 2)
+
+        acc.set_backend('simulated', {'seed': 1, 'applications': [TREE]})
+        found = locator.resolve()
+        self.assertIsNotNone(found)
+        self.assertEqual(found['AXIdentifier'], identifier)
+
+
+if __name__ == '__main__':
+    unittest.main()
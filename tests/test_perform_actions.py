@@ -0,0 +1,44 @@
+"""test_perform_actions.py
+
+Checks perform_actions against the simulated backend, so it needs a platform
+other than OS X. Build the module in place and run it from the top of the
+source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import time
+import unittest
+
+import accessibility as acc
+
+LATENCY = 0.2
+SLOW = [{'pid': pid, 'name': 'Slow', 'windows': 2, 'latency': LATENCY} for pid in (101, 102)]
+
+
+class PerformActionsTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': SLOW})
+        self.windows = [window for app in SLOW for window in acc.create_application_ref(app['pid'])['AXWindows']]
+
+    def perform(self, actions, ordered_per_pid):
+        started = time.time()
+        errors = acc.perform_actions(actions, ordered_per_pid)
+        self.assertEqual(errors, [0] * len(actions))
+        return time.time() - started
+
+    def test_applications_concurrently(self):
+        # One action for each application: together, not one after the other
+        actions = [(self.windows[0], 'AXRaise'), (self.windows[2], 'AXRaise')]
+        self.assertLess(self.perform(actions, True), 1.5 * LATENCY)
+
+    def test_unordered(self):
+        actions = [(window, 'AXRaise') for window in self.windows]
+        self.assertLess(self.perform(actions, True), 3 * LATENCY)
+        self.assertLess(self.perform(actions, False), 1.5 * LATENCY)
+
+
+if __name__ == '__main__':
+    unittest.main()
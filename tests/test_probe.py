@@ -0,0 +1,55 @@
+"""test_probe.py
+
+Checks probe against the simulated backend, so it needs a platform other than
+OS X. Build the module in place and run it from the top of the source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import unittest
+
+import accessibility as acc
+
+# Text with no length, so that some values are empty strings
+TREE = {'pid': 101, 'name': 'Tree', 'windows': 3, 'nodes': 200, 'fanout': 4, 'text_length': 0}
+ATTRIBUTES = ['AXTitle', 'AXValue', 'AXChildren', 'AXDescription', 'AXRole', 'AXHelp']
+
+
+class ProbeTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 3, 'applications': [TREE]})
+        self.elements = []
+        pending = [acc.create_application_ref(TREE['pid'])]
+        while pending:
+            element = pending.pop()
+            self.elements.append(element)
+            pending.extend(element.get('AXChildren') or [])
+
+    def test_no_value_matches_get(self):
+        status = acc.probe(self.elements, ATTRIBUTES, values=True, strings=True)
+        for i, element in enumerate(self.elements):
+            for j, name in enumerate(ATTRIBUTES):
+                flags = status[i * len(ATTRIBUTES) + j]
+                if flags & acc.PROBE_PRESENT:
+                    self.assertEqual(bool(flags & acc.PROBE_NO_VALUE), element.get(name) is None,
+                                     (i, name))
+
+    def test_no_value_without_strings(self):
+        # Only counts and missing values are looked at, so empty strings
+        # count as values
+        status = acc.probe(self.elements, ATTRIBUTES, values=True)
+        empty_strings = 0
+        for i, element in enumerate(self.elements):
+            for j, name in enumerate(ATTRIBUTES):
+                flags = status[i * len(ATTRIBUTES) + j]
+                if flags & acc.PROBE_NO_VALUE:
+                    self.assertIsNone(element.get(name), (i, name))
+                elif flags & acc.PROBE_PRESENT and element.get(name) is None:
+                    empty_strings += 1
+        self.assertGreater(empty_strings, 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
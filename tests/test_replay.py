@@ -0,0 +1,79 @@
+"""test_replay.py
+
+Records a session against the simulated backend and serves it again with the
+replay backend, so it needs a platform other than OS X. Build the module in
+place and run it from the top of the source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import accessibility as acc
+
+TREE = {'pid': 101, 'name': 'Tree', 'windows': 2, 'nodes': 40, 'fanout': 4, 'text_length': 16}
+READ = ['AXRole', 'AXTitle', 'AXValue', 'AXPosition']
+
+
+def walk(element):
+    # The values of every element below element, in the order they were read
+    values = []
+    pending = [element]
+    while pending:
+        element = pending.pop()
+        for name in READ:
+            try:
+                values.append(element.get(name))
+            except KeyError:
+                values.append(KeyError)
+        pending.extend(element.get('AXChildren') or [])
+    return values
+
+
+class ReplayTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, 'session.axlog')
+        acc.set_backend('simulated', {'seed': 4, 'applications': [TREE]})
+        acc.start_recording(self.path)
+        self.recorded = walk(acc.create_application_ref(TREE['pid']))
+        acc.stop_recording()
+
+    def tearDown(self):
+        acc.set_backend('simulated')
+        shutil.rmtree(self.directory)
+
+    def truncate(self, size):
+        with open(self.path, 'rb') as log:
+            data = log.read()
+        with open(self.path, 'wb') as log:
+            log.write(data[:size])
+        return len(data)
+
+    def test_replays_recorded_values(self):
+        acc.set_backend('replay', {'path': self.path, 'speed': 0})
+        self.assertEqual(walk(acc.create_application_ref(TREE['pid'])), self.recorded)
+        self.assertEqual(acc.replay_info()['misses'], 0)
+
+    def test_rejects_truncated_header(self):
+        self.truncate(8)
+        self.assertRaises(ValueError, acc.set_backend, 'replay', {'path': self.path})
+
+    def test_serves_log_cut_short(self):
+        # Records are appended as they happen, so a log cut off in the middle
+        # of one is served up to the last complete one
+        acc.set_backend('replay', {'path': self.path, 'speed': 0})
+        calls = acc.replay_info()['calls']
+        acc.set_backend('simulated')
+        self.truncate(self.truncate(None) - 1)
+        acc.set_backend('replay', {'path': self.path, 'speed': 0})
+        self.assertEqual(acc.replay_info()['calls'], calls - 1)
+
+
+if __name__ == '__main__':
+    unittest.main()
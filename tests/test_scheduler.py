@@ -0,0 +1,84 @@
+"""test_scheduler.py
+
+Checks the request scheduler against the simulated backend, so it needs a
+platform other than OS X. Build the module in place and run it from the top
+of the source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import threading
+import time
+import unittest
+
+import accessibility as acc
+
+LATENCY = 0.1
+SLOW = {'pid': 101, 'name': 'Slow', 'windows': 1, 'latency': LATENCY}
+
+
+class SchedulerTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': [SLOW]})
+        self.window = acc.create_application_ref(SLOW['pid'])['AXWindows'][0]
+        self.finished = []
+        self.threads = []
+
+    def tearDown(self):
+        for thread in self.threads:
+            thread.join()
+        acc.configure_scheduler(max_in_flight=0, background_in_flight=0)
+
+    def start(self, priority):
+        # Element methods keep the GIL, but perform_actions lets it go while
+        # it waits for its turn and for the application
+        def run():
+            acc.set_priority(priority)
+            started = time.time()
+            acc.perform_actions([(self.window, 'AXRaise')])
+            self.finished.append((priority, time.time() - started))
+        thread = threading.Thread(target=run)
+        thread.start()
+        self.threads.append(thread)
+
+    def wait(self, in_flight, background):
+        # Until the application has in_flight requests out and background waiting
+        deadline = time.time() + 5 * LATENCY
+        while time.time() < deadline:
+            application = acc.scheduler_info()['applications'].get(SLOW['pid'])
+            if application is not None and (application['in_flight'], application['queued']['background']) == (in_flight, background):
+                return
+            time.sleep(0.005)
+        self.fail('The requests were never scheduled as expected')
+
+    def test_interactive_passes_background(self):
+        acc.configure_scheduler(max_in_flight=1)
+        self.start('normal')
+        self.wait(1, 0)
+        for _ in range(3):
+            self.start('background')
+        self.wait(1, 3)
+        self.start('interactive')
+        for thread in self.threads:
+            thread.join()
+        self.assertEqual([priority for priority, _ in self.finished],
+                         ['normal', 'interactive', 'background', 'background', 'background'])
+
+    def test_background_in_flight(self):
+        acc.configure_scheduler(max_in_flight=4, background_in_flight=1)
+        for _ in range(3):
+            self.start('background')
+        # One goes out while the others wait, though there is room for more
+        self.wait(1, 2)
+        self.start('normal')
+        for thread in self.threads:
+            thread.join()
+        normal = [seconds for priority, seconds in self.finished if priority == 'normal'][0]
+        self.assertLess(normal, 1.5 * LATENCY)
+        self.assertGreater(max(seconds for _, seconds in self.finished), 2.5 * LATENCY)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,85 @@
+"""test_snapshot.py
+
+Checks snapshot, Snapshot and the shared snapshot classes against the
+simulated backend, so it needs a platform other than OS X. Build the module
+in place and run it from the top of the source tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import os
+import unittest
+
+import accessibility as acc
+
+TREE = {'pid': 101, 'name': 'Tree', 'windows': 2, 'nodes': 60, 'fanout': 4, 'text_length': 16}
+COMPARED = ['AXRole', 'AXTitle', 'AXValue']
+
+
+class SnapshotTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 2, 'applications': [TREE]})
+        self.app = acc.create_application_ref(TREE['pid'])
+        self.data = acc.snapshot(self.app)
+
+    def live(self):
+        # Depth-first, as snapshots number their nodes
+        elements = []
+        pending = [self.app]
+        while pending:
+            element = pending.pop()
+            elements.append(element)
+            pending.extend(reversed(element.get('AXChildren') or []))
+        return elements
+
+    def test_round_trip(self):
+        tree = acc.Snapshot(self.data)
+        self.assertEqual(tree.pid, TREE['pid'])
+        elements = self.live()
+        self.assertEqual(len(tree.column('AXRole')), len(elements))
+        for node, element in enumerate(elements):
+            for name in COMPARED:
+                try:
+                    value = element.get(name)
+                except KeyError:
+                    value = None
+                self.assertEqual(tree.get(node, name), value, (node, name))
+
+    def test_queries(self):
+        tree = acc.Snapshot(self.data)
+        roles = tree.column('AXRole')
+        self.assertEqual(tree.find('AXRole', 'AXWindow'), [node for node, role in enumerate(roles) if role == 'AXWindow'])
+        self.assertEqual(len(tree.find('AXRole', 'AXWindow')), TREE['windows'])
+        self.assertIsNone(tree.parent(0))
+        for node in range(len(roles)):
+            for child in tree.children(node):
+                self.assertEqual(tree.parent(child), node)
+        self.assertRaises(KeyError, tree.get, 0, 'AXNothing')
+
+    def test_rejects_bad_data(self):
+        version = bytearray(self.data)
+        version[8] += 1
+        self.assertRaises(ValueError, acc.Snapshot, version)
+        self.assertRaises(ValueError, acc.Snapshot, bytearray(self.data[:len(self.data) // 2]))
+        self.assertRaises(ValueError, acc.Snapshot, bytearray(b'not a snapshot'))
+
+    def test_publish_subscribe(self):
+        name = '/accessibility-test-%d' % os.getpid()
+        publisher = acc.SnapshotPublisher(name)
+        subscriber = acc.SnapshotSubscriber(name)
+        try:
+            self.assertEqual(subscriber.read(), (0, None))
+            generation = publisher.publish(self.data)
+            read, tree = subscriber.read()
+            self.assertEqual(read, generation)
+            self.assertEqual(tree.column('AXRole'), acc.Snapshot(self.data).column('AXRole'))
+            self.assertEqual(subscriber.read(raw=True), (generation, self.data))
+        finally:
+            subscriber.close()
+            publisher.close()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,42 @@
+"""test_text_reader.py
+
+Checks TextReader against the simulated backend, so it needs a platform other
+than OS X. Build the module in place and run it from the top of the source
+tree::
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python -m unittest discover tests
+"""
+
+import unittest
+
+import accessibility as acc
+
+# Characters outside the BMP take two UTF-16 units, so small chunks cut some
+SAMPLE = u'ab\U0001F600cd\U0001F601e\U0001F602'
+TEXT = {'pid': 101, 'name': 'Text', 'windows': 1, 'nodes': 50, 'text_length': 50, 'text': SAMPLE}
+
+
+class TextReaderTest(unittest.TestCase):
+
+    def setUp(self):
+        acc.set_backend('simulated', {'seed': 1, 'applications': [TEXT]})
+        pending = [acc.create_application_ref(TEXT['pid'])]
+        while pending:
+            element = pending.pop()
+            if element.get('AXRole') == 'AXTextArea':
+                self.element = element
+                return
+            pending.extend(element.get('AXChildren') or [])
+        self.fail('No text area')
+
+    def test_surrogate_pairs(self):
+        text = self.element.get('AXValue')
+        for chunk_size in range(1, 8):
+            reader = acc.TextReader(self.element, chunk_size=chunk_size)
+            self.assertEqual(''.join(reader), text, chunk_size)
+            self.assertEqual(reader.read(), text, chunk_size)
+
+
+if __name__ == '__main__':
+    unittest.main()